@@ -0,0 +1,134 @@
+// summing a synthetic country sized world over a grid, scalar against avx2
+// kernels and one thread against many. build with RELEASE=1 for meaningful
+// numbers
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "error.h"
+#include "world.h"
+#include "aggregate.h"
+#include "simd.h"
+#include "pool.h"
+#include "alloc.h"
+#include "timing.h"
+
+#define ROAD_POINTS (24)
+#define RING_POINTS (12)
+#define ROUNDS (3)
+
+static uint64_t next(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// streets wandering in steps of ~50m and small polygons, over ten degrees
+// square like a mid sized country
+static void generate(struct world *w, int roads, int land_uses) {
+	uint64_t seed = 88172645463325252ULL;
+	init_world(w);
+
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	for (int i = 0; i < roads; i++) {
+		struct road r = { .id = i + 1, .type = i % ROAD_TYPE_COUNT };
+		point p = {45 + (next(&seed) % 10000000) / 1e6, (next(&seed) % 10000000) / 1e6};
+		for (int j = 0; j < ROAD_POINTS; j++) {
+			vec_push(&r.segments, p);
+			p.lat += ((int) (next(&seed) % 1000) - 500) / 1e6;
+			p.lon += ((int) (next(&seed) % 1000) - 500) / 1e6;
+		}
+		vec_push(&w->roads, r);
+	}
+
+	for (int i = 0; i < land_uses; i++) {
+		struct land_use l = { .id = i + 1, .type = i % LANDUSE_TYPE_COUNT };
+		point c = {45 + (next(&seed) % 10000000) / 1e6, (next(&seed) % 10000000) / 1e6};
+		for (int j = 0; j < RING_POINTS; j++) {
+			double r = (200 + next(&seed) % 800) / 1e6, t = j * 2 * M_PI / RING_POINTS;
+			vec_push(&l.points, ((point) {c.lat + r * sin(t), c.lon + r * cos(t)}));
+		}
+		vec_push(&w->land_uses, l);
+	}
+}
+
+static double run(const struct world *w, const struct agg_grid *grid, int threads, uint32_t *cells) {
+	double best = 1e9;
+	for (int r = 0; r < ROUNDS; r++) {
+		struct aggregate agg;
+		double start = monotonic_now();
+		int ret = aggregate_world(w, grid, threads, &agg);
+		double t = monotonic_now() - start;
+		if (ret != CRACKING) {
+			fprintf(stderr, "error: %s\n", error_get_message(ret));
+			exit(1);
+		}
+		*cells = agg.n_cells;
+		aggregate_free(&agg);
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-j N] [-n N] [-g G]\n"
+			"  -j, --jobs N    threads, <= 0 for one a cpu\n"
+			"  -n, --roads N   roads in the world, a quarter as many land uses\n"
+			"  -g, --grid G    \"zZ\" or a cell size in degrees\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	int threads = 0, roads = 2000000;
+	const char *grid_spec = "z12";
+
+	static const struct option long_opts[] = {
+		{"jobs", required_argument, NULL, 'j'},
+		{"roads", required_argument, NULL, 'n'},
+		{"grid", required_argument, NULL, 'g'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "j:n:g:h", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'j': threads = atoi(optarg); break;
+			case 'n': roads = atoi(optarg); break;
+			case 'g': grid_spec = optarg; break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	struct agg_grid grid;
+	if (!agg_grid_from_string(grid_spec, &grid)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (threads <= 0)
+		threads = pool_default_threads();
+
+	struct world world;
+	generate(&world, roads, roads / 4);
+	double points = (double) roads * ROAD_POINTS + (double) (roads / 4) * RING_POINTS;
+
+	bool simd = simd_set(false);
+	for (int k = 0; k < (simd ? 2 : 1); k++) {
+		simd_set(k == 1);
+		uint32_t cells;
+		double one = run(&world, &grid, 1, &cells);
+		double many = run(&world, &grid, threads, &cells);
+		printf("%-6s %u cells: %7.1f M points/s on one thread, %7.1f M points/s on %d (%.2fx)\n",
+				k == 1 ? "avx2" : "scalar", cells, points / one / 1e6, points / many / 1e6,
+				threads, one / many);
+	}
+	simd_set(simd);
+
+	free_world(&world);
+	return 0;
+}
@@ -0,0 +1,137 @@
+// hashing and diffing a synthetic world, then applying deltas of growing
+// size to it. build with RELEASE=1 for meaningful numbers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "world.h"
+#include "diff.h"
+#include "alloc.h"
+#include "timing.h"
+
+#define POINTS (20)
+
+static uint64_t next(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void add_road(struct world *w, id road_id, uint64_t seed, bool moved) {
+	struct road r = { .id = road_id, .type = road_id % ROAD_TYPE_COUNT };
+	char name[32];
+	sprintf(name, "Street %lld", (long long) road_id);
+	r.name = alloc_strdup(ALLOC_TAGS, name);
+
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	for (int i = 0; i < POINTS; i++) {
+		point pt = {51 + (next(&seed) % 1000000) / 1e6, -1 + (next(&seed) % 1000000) / 1e6};
+		vec_push(&r.segments, pt);
+	}
+	if (moved)
+		r.segments.data[0].lat += 1e-5;
+	vec_push(&w->roads, r);
+}
+
+// n roads, of which each one in every `every` is touched: a third each
+// removed, moved, or replaced by a road with a new id
+static void generate(struct world *w, int n, int every) {
+	init_world(w);
+	for (int i = 1; i <= n; i++) {
+		uint64_t seed = 0x9e3779b97f4a7c15ULL * i;
+		int touched = every > 0 && i % every == 0 ? i / every % 3 + 1 : 0;
+		if (touched == 1)
+			continue;
+		add_road(w, touched == 3 ? n + i : i, seed, touched == 2);
+	}
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-j N] [-n N]\n"
+			"  -j, --jobs N    hashing threads, <= 0 for one a cpu\n"
+			"  -n, --roads N   roads in the world\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	int threads = 0, n = 500000;
+
+	static const struct option long_opts[] = {
+		{"jobs", required_argument, NULL, 'j'},
+		{"roads", required_argument, NULL, 'n'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "j:n:h", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'j': threads = atoi(optarg); break;
+			case 'n': n = atoi(optarg); break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	struct world base;
+	generate(&base, n, 0);
+
+	uint64_t *hashes = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+	if (hashes == NULL)
+		return 1;
+	double start = monotonic_now();
+	diff_hash_world(&base, 1, hashes);
+	double serial = monotonic_now() - start;
+	start = monotonic_now();
+	diff_hash_world(&base, threads, hashes);
+	double parallel = monotonic_now() - start;
+	free(hashes);
+	printf("hash %d roads: %.1f ms on one thread, %.1f ms on %d (%.2fx)\n", n, serial * 1e3, parallel * 1e3,
+			threads > 0 ? threads : (int) sysconf(_SC_NPROCESSORS_ONLN), serial / parallel);
+
+	char path[] = "/tmp/osm_bench_diff_XXXXXX";
+	close(mkstemp(path));
+
+	printf("%8s %10s %10s %10s %10s\n", "every", "delta", "bytes", "diff ms", "apply ms");
+	const int everies[] = {10000, 1000, 100, 10};
+	for (size_t e = 0; e < sizeof(everies) / sizeof(*everies); e++) {
+		struct world old, new;
+		generate(&old, n, 0);
+		generate(&new, n, everies[e]);
+
+		struct diff_counts counts;
+		start = monotonic_now();
+		int ret = diff_write(&old, &new, path, threads, &counts);
+		double diff = monotonic_now() - start;
+
+		// the index is built once per world, not per delta
+		struct diff_index idx;
+		double apply = 0;
+		if (ret == CRACKING && (ret = diff_index_build(&idx, &old, threads)) == CRACKING) {
+			start = monotonic_now();
+			ret = diff_apply(&old, &idx, path, NULL);
+			apply = monotonic_now() - start;
+			diff_index_free(&idx);
+		}
+
+		struct stat st;
+		if (ret != CRACKING || stat(path, &st) != 0) {
+			fprintf(stderr, "error: %s\n", error_get_message(ret));
+			return 1;
+		}
+		printf("%8d %10u %10lld %10.2f %10.3f\n", everies[e], counts.removed + counts.changed + counts.added,
+				(long long) st.st_size, diff * 1e3, apply * 1e3);
+
+		free_world(&old);
+		free_world(&new);
+	}
+
+	remove(path);
+	free_world(&base);
+	return 0;
+}
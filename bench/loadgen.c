@@ -0,0 +1,264 @@
+// query load against a running `osm --daemon`, one thread per connection
+// each with one request in flight. reports throughput and p50/p99 latency
+// per query type
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "error.h"
+#include "timing.h"
+
+#define OPS (3)
+
+static const char *op_names[OPS] = {"bbox", "feature", "nearest"};
+
+struct client {
+	const char *socket_path;
+	long requests;
+	double bbox_size; // fraction of the world's extent
+	const struct reply_info *info;
+	const int64_t *ids;
+	uint32_t n_ids;
+	uint64_t seed;
+
+	double *latencies[OPS];
+	long counts[OPS];
+	long errors;
+};
+
+static uint64_t next(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static double uniform(uint64_t *rng, double min, double max) {
+	return min + (next(rng) % 1000000) / 1e6 * (max - min);
+}
+
+// one op per request, in turn
+static void *run_client(void *arg) {
+	struct client *c = arg;
+	const struct reply_info *info = c->info;
+	uint64_t rng = c->seed | 1;
+	void *body = NULL;
+	size_t cap = 0;
+
+	int fd;
+	if (daemon_connect(c->socket_path, &fd) != CRACKING) {
+		c->errors = c->requests;
+		return NULL;
+	}
+
+	for (long i = 0; i < c->requests; i++) {
+		int op = (int) (i % OPS);
+		double lat = uniform(&rng, info->min_lat, info->max_lat);
+		double lon = uniform(&rng, info->min_lon, info->max_lon);
+
+		union {
+			struct query_bbox bbox;
+			struct query_feature feature;
+			struct query_nearest nearest;
+		} q;
+		memset(&q, 0, sizeof(q));
+		enum query_op query;
+		uint32_t len;
+
+		if (op == 0) {
+			double h = (info->max_lat - info->min_lat) * c->bbox_size / 2;
+			double w = (info->max_lon - info->min_lon) * c->bbox_size / 2;
+			q.bbox = (struct query_bbox) {lat - h, lon - w, lat + h, lon + w, 0, 0};
+			query = QUERY_BBOX;
+			len = sizeof(q.bbox);
+		} else if (op == 1) {
+			q.feature.id = c->n_ids > 0 ? c->ids[next(&rng) % c->n_ids] : 1;
+			query = QUERY_FEATURE;
+			len = sizeof(q.feature);
+		} else {
+			q.nearest = (struct query_nearest) {lat, lon};
+			query = QUERY_NEAREST;
+			len = sizeof(q.nearest);
+		}
+
+		struct frame_header reply;
+		double start = monotonic_now();
+		if (daemon_send(fd, query, (uint32_t) i, &q, len) != CRACKING
+				|| daemon_receive(fd, &reply, &body, &cap) != CRACKING) {
+			c->errors += c->requests - i;
+			break;
+		}
+
+		c->latencies[op][c->counts[op]++] = monotonic_now() - start;
+		if (reply.op != REPLY_OK && reply.op != REPLY_NOT_FOUND)
+			c->errors++;
+	}
+
+	close(fd);
+	free(body);
+	return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, long n, double p) {
+	if (n == 0)
+		return 0;
+	long i = (long) (p * (n - 1) + 0.5);
+	return sorted[i];
+}
+
+// the world's extent and a sample of ids to look up
+static int survey(const char *socket_path, struct reply_info *info, int64_t **ids, uint32_t *n_ids) {
+	int fd;
+	int ret = daemon_connect(socket_path, &fd);
+	if (ret != CRACKING)
+		return ret;
+
+	struct frame_header h;
+	void *body = NULL;
+	size_t cap = 0;
+	ret = daemon_send(fd, QUERY_INFO, 0, NULL, 0);
+	if (ret == CRACKING)
+		ret = daemon_receive(fd, &h, &body, &cap);
+	if (ret == CRACKING && (h.op != REPLY_OK || h.length != sizeof(*info)))
+		ret = ERR_IO;
+	if (ret == CRACKING)
+		memcpy(info, body, sizeof(*info));
+
+	struct query_bbox all = {info->min_lat, info->min_lon, info->max_lat, info->max_lon, 10000, 0};
+	if (ret == CRACKING)
+		ret = daemon_send(fd, QUERY_BBOX, 1, &all, sizeof(all));
+	if (ret == CRACKING)
+		ret = daemon_receive(fd, &h, &body, &cap);
+
+	if (ret == CRACKING && h.op == REPLY_OK) {
+		uint32_t count;
+		memcpy(&count, body, sizeof(count));
+		*ids = malloc((count + 1) * sizeof(int64_t));
+		*n_ids = count;
+
+		const char *refs = (const char *) body + sizeof(count);
+		for (uint32_t i = 0; i < count; i++) {
+			struct reply_feature_ref ref;
+			memcpy(&ref, refs + i * sizeof(ref), sizeof(ref));
+			(*ids)[i] = ref.id;
+		}
+	}
+
+	free(body);
+	close(fd);
+	return ret;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [options] socket\n"
+			"  -c, --connections N  concurrent clients (4)\n"
+			"  -n, --requests N     requests per client (20000)\n"
+			"  -b, --bbox F         bbox queries span F of the world on each axis (0.01)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	int connections = 4;
+	long requests = 20000;
+	double bbox_size = 0.01;
+
+	static const struct option long_opts[] = {
+		{"connections", required_argument, NULL, 'c'},
+		{"requests", required_argument, NULL, 'n'},
+		{"bbox", required_argument, NULL, 'b'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "c:n:b:h", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'c': connections = atoi(optarg); break;
+			case 'n': requests = atol(optarg); break;
+			case 'b': bbox_size = atof(optarg); break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1 || connections < 1 || requests < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const char *socket_path = argv[optind];
+	struct reply_info info;
+	int64_t *ids = NULL;
+	uint32_t n_ids = 0;
+	int ret = survey(socket_path, &info, &ids, &n_ids);
+	if (ret != CRACKING) {
+		fprintf(stderr, "%s: %s\n", socket_path, error_get_message(ret));
+		return 1;
+	}
+
+	struct client *clients = calloc(connections, sizeof(struct client));
+	pthread_t *threads = calloc(connections, sizeof(pthread_t));
+	for (int i = 0; i < connections; i++) {
+		clients[i] = (struct client) {
+			.socket_path = socket_path,
+			.requests = requests,
+			.bbox_size = bbox_size,
+			.info = &info,
+			.ids = ids,
+			.n_ids = n_ids,
+			.seed = 0x9e3779b97f4a7c15ULL * (i + 1)
+		};
+		for (int op = 0; op < OPS; op++)
+			clients[i].latencies[op] = malloc((requests / OPS + 1) * sizeof(double));
+	}
+
+	double start = monotonic_now();
+	for (int i = 0; i < connections; i++)
+		pthread_create(&threads[i], NULL, run_client, &clients[i]);
+	for (int i = 0; i < connections; i++)
+		pthread_join(threads[i], NULL);
+	double elapsed = monotonic_now() - start;
+
+	long total = 0, errors = 0;
+	printf("world %" PRIu64 ": %u roads, %u land uses\n", info.generation, info.roads, info.land_uses);
+	for (int op = 0; op < OPS; op++) {
+		long n = 0;
+		for (int i = 0; i < connections; i++)
+			n += clients[i].counts[op];
+
+		double *all = malloc((n + 1) * sizeof(double));
+		long at = 0;
+		for (int i = 0; i < connections; i++) {
+			memcpy(all + at, clients[i].latencies[op], clients[i].counts[op] * sizeof(double));
+			at += clients[i].counts[op];
+		}
+		qsort(all, n, sizeof(double), compare_doubles);
+
+		printf("%-8s %8ld  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", op_names[op], n,
+				percentile(all, n, 0.5) * 1e6, percentile(all, n, 0.99) * 1e6, n > 0 ? all[n - 1] * 1e6 : 0);
+		total += n;
+		free(all);
+	}
+
+	for (int i = 0; i < connections; i++) {
+		errors += clients[i].errors;
+		for (int op = 0; op < OPS; op++)
+			free(clients[i].latencies[op]);
+	}
+	printf("%ld requests in %.3f s, %.0f/s, %ld errors\n", total, elapsed, total / elapsed, errors);
+
+	free(threads);
+	free(clients);
+	free(ids);
+	return errors > 0;
+}
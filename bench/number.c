@@ -0,0 +1,107 @@
+// attribute parsing of node lines: the old strcmp + strtol/strtold path
+// against the number kernel. build with RELEASE=1 for meaningful numbers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "osm/number.h"
+
+#define NODES  (2000000)
+#define ROUNDS (5)
+
+struct attr {
+	const char *key;
+	const char *val;
+	size_t len;
+};
+
+struct bench_node {
+	int64_t id;
+	double lat, lon;
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void parse_libc(const struct attr *attrs, struct bench_node *out) {
+	for (int i = 0; i < 3; i++) {
+		if (strcmp(attrs[i].key, "id") == 0)
+			out->id = strtol(attrs[i].val, NULL, 10);
+		else if (strcmp(attrs[i].key, "lat") == 0)
+			out->lat = strtold(attrs[i].val, NULL);
+		else if (strcmp(attrs[i].key, "lon") == 0)
+			out->lon = strtold(attrs[i].val, NULL);
+	}
+}
+
+static void parse_kernel(const struct attr *attrs, struct bench_node *out) {
+	for (int i = 0; i < 3; i++) {
+		const char *k = attrs[i].key;
+		if (k[0] == 'i')
+			parse_int64(attrs[i].val, attrs[i].len, &out->id);
+		else if (k[1] == 'a')
+			out->lat = parse_coord(attrs[i].val, attrs[i].len);
+		else
+			out->lon = parse_coord(attrs[i].val, attrs[i].len);
+	}
+}
+
+static double run(void (*fn)(const struct attr *, struct bench_node *), struct attr *attrs, struct bench_node *out) {
+	double best = 1e9;
+	for (int r = 0; r < ROUNDS; r++) {
+		double start = now();
+		for (int i = 0; i < NODES; i++)
+			fn(attrs + i * 3, out + i);
+		double t = now() - start;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+int main(void) {
+	struct attr *attrs = malloc(sizeof(struct attr) * NODES * 3);
+	struct bench_node *out = malloc(sizeof(struct bench_node) * NODES);
+	char *text = malloc((size_t) NODES * 48);
+	if (attrs == NULL || out == NULL || text == NULL)
+		return 1;
+
+	char *p = text;
+	unsigned long long seed = 88172645463325252ULL;
+	for (int i = 0; i < NODES; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+
+		struct attr *a = attrs + i * 3;
+		a[0].key = "id";
+		a[0].val = p;
+		a[0].len = sprintf(p, "%llu", 1000000000ULL + (seed % 9000000000ULL));
+		p += a[0].len + 1;
+
+		a[1].key = "lat";
+		a[1].val = p;
+		a[1].len = sprintf(p, "%s%llu.%07llu", seed & 1 ? "-" : "", (seed >> 8) % 90, (seed >> 16) % 10000000);
+		p += a[1].len + 1;
+
+		a[2].key = "lon";
+		a[2].val = p;
+		a[2].len = sprintf(p, "%llu.%07llu", (seed >> 24) % 180, (seed >> 32) % 10000000);
+		p += a[2].len + 1;
+	}
+
+	double libc = run(parse_libc, attrs, out);
+	double kernel = run(parse_kernel, attrs, out);
+
+	printf("libc:   %6.1f M nodes/s\n", NODES / libc / 1e6);
+	printf("kernel: %6.1f M nodes/s (%.1fx)\n", NODES / kernel / 1e6, libc / kernel);
+
+	free(text);
+	free(out);
+	free(attrs);
+	return 0;
+}
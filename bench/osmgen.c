@@ -0,0 +1,245 @@
+// deterministic synthetic osm xml, the same options and seed always give
+// the same bytes. nodes are laid out on a jittered grid and ways walk
+// between neighbouring nodes, so refs have the locality of real extracts
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+enum layout {
+	// just the attributes the parser reads
+	LAYOUT_MINIMAL,
+
+	// osmosis/osmium style, with the metadata attributes of a planet dump
+	LAYOUT_FULL
+};
+
+struct gen_options {
+	long nodes;
+	long ways;
+	int way_tags;       // extra tags per way on top of the classifying one
+	int node_tag_pct;   // percentage of nodes with tags
+	int refs;           // max refs per way
+	int id_gap;         // mean gap between consecutive ids, 1 for dense
+	enum layout layout;
+	uint64_t seed;
+};
+
+static uint64_t next(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static const char *highways[] = {
+	"motorway", "primary", "secondary", "tertiary", "unclassified",
+	"residential", "residential", "residential", "service", "footway", "path", "cycleway"
+};
+
+static const char *land_uses[] = {
+	"residential", "farmland", "forest", "grass", "industrial", "retail", "meadow"
+};
+
+static const char *buildings[] = {
+	"yes", "yes", "yes", "house", "apartments", "commercial", "school"
+};
+
+static const char *extra_keys[] = {
+	"source", "surface", "maxspeed", "lit", "oneway", "ref", "layer", "note"
+};
+
+#define COUNT(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+static void write_meta(FILE *out, const struct gen_options *o, int64_t id, uint64_t *rng) {
+	if (o->layout != LAYOUT_FULL)
+		return;
+
+	fprintf(out, " version=\"%d\" timestamp=\"2019-%02d-%02dT%02d:%02d:%02dZ\" uid=\"%d\" user=\"mapper%d\" changeset=\"%" PRId64 "\"",
+			(int) (1 + next(rng) % 9), (int) (1 + next(rng) % 12), (int) (1 + next(rng) % 28),
+			(int) (next(rng) % 24), (int) (next(rng) % 60), (int) (next(rng) % 60),
+			(int) (next(rng) % 100000), (int) (next(rng) % 1000), id / 40 + 1000);
+}
+
+static int64_t next_id(int64_t id, const struct gen_options *o, uint64_t *rng) {
+	return id + (o->id_gap <= 1 ? 1 : 1 + (int64_t) (next(rng) % (2 * o->id_gap - 1)));
+}
+
+static void write_tag(FILE *out, const char *indent, const char *k, const char *v) {
+	fprintf(out, "%s<tag k=\"%s\" v=\"%s\"/>\n", indent, k, v);
+}
+
+static void generate(FILE *out, const struct gen_options *o) {
+	uint64_t rng = o->seed | 1;
+	const char *indent = o->layout == LAYOUT_FULL ? "  " : "";
+	const char *child = o->layout == LAYOUT_FULL ? "    " : "";
+
+	fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\" generator=\"osmgen\">\n");
+	if (o->layout == LAYOUT_FULL)
+		fprintf(out, "%s<bounds minlat=\"51.0\" minlon=\"-1.0\" maxlat=\"52.0\" maxlon=\"0.0\"/>\n", indent);
+
+	// ids of the nodes, kept for the ways to reference
+	int64_t *ids = malloc(o->nodes * sizeof(int64_t));
+	if (ids == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	long side = 1;
+	while (side * side < o->nodes)
+		side++;
+
+	int64_t id = 0;
+	for (long i = 0; i < o->nodes; i++) {
+		id = next_id(id, o, &rng);
+		ids[i] = id;
+
+		double lat = 51.0 + (i / side) / (double) side + (next(&rng) % 1000) / 1e7;
+		double lon = -1.0 + (i % side) / (double) side + (next(&rng) % 1000) / 1e7;
+		bool tagged = (long) (next(&rng) % 100) < o->node_tag_pct;
+
+		fprintf(out, "%s<node id=\"%" PRId64 "\"", indent, id);
+		write_meta(out, o, id, &rng);
+		fprintf(out, " lat=\"%.7f\" lon=\"%.7f\"%s>\n", lat, lon, tagged ? "" : "/");
+
+		if (tagged) {
+			write_tag(out, child, "amenity", "bench");
+			fprintf(out, "%s</node>\n", indent);
+		}
+	}
+
+	id = 0;
+	for (long w = 0; w < o->ways; w++) {
+		id = next_id(id, o, &rng);
+		fprintf(out, "%s<way id=\"%" PRId64 "\"", indent, id);
+		write_meta(out, o, id, &rng);
+		fprintf(out, ">\n");
+
+		// a walk over the grid from a random node
+		long at = (long) (next(&rng) % o->nodes);
+		int refs = 2 + (int) (next(&rng) % (o->refs - 1));
+		for (int r = 0; r < refs; r++) {
+			fprintf(out, "%s<nd ref=\"%" PRId64 "\"/>\n", child, ids[at]);
+
+			long step = next(&rng) & 1 ? 1 : side;
+			if (next(&rng) & 1)
+				step = -step;
+			if (at + step >= 0 && at + step < o->nodes)
+				at += step;
+		}
+
+		uint64_t kind = next(&rng) % 10;
+		if (kind < 4) {
+			write_tag(out, child, "highway", highways[next(&rng) % COUNT(highways)]);
+
+			char name[48];
+			sprintf(name, "Bench Street %ld", w);
+			write_tag(out, child, "name", name);
+		} else if (kind < 6) {
+			write_tag(out, child, "landuse", land_uses[next(&rng) % COUNT(land_uses)]);
+		} else if (kind < 9) {
+			write_tag(out, child, "building", buildings[next(&rng) % COUNT(buildings)]);
+		}
+
+		for (int t = 0; t < o->way_tags; t++)
+			write_tag(out, child, extra_keys[t % COUNT(extra_keys)], "bench");
+
+		fprintf(out, "%s</way>\n", indent);
+	}
+
+	fprintf(out, "</osm>\n");
+	free(ids);
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [options]\n"
+			"  -n, --nodes N       nodes (1000000)\n"
+			"  -w, --ways N        ways (100000)\n"
+			"  -t, --way-tags N    extra tags per way (2)\n"
+			"  -T, --node-tags P   percentage of nodes with a tag (5)\n"
+			"  -r, --refs N        max node refs per way (12)\n"
+			"  -g, --id-gap N      mean gap between ids, 1 for dense (1)\n"
+			"  -l, --layout L      minimal or full (full)\n"
+			"  -s, --seed N        rng seed (1)\n"
+			"  -o, --output PATH   output file (stdout)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	struct gen_options o = {
+		.nodes = 1000000,
+		.ways = 100000,
+		.way_tags = 2,
+		.node_tag_pct = 5,
+		.refs = 12,
+		.id_gap = 1,
+		.layout = LAYOUT_FULL,
+		.seed = 1
+	};
+	const char *output = NULL;
+
+	static const struct option long_opts[] = {
+		{"nodes", required_argument, NULL, 'n'},
+		{"ways", required_argument, NULL, 'w'},
+		{"way-tags", required_argument, NULL, 't'},
+		{"node-tags", required_argument, NULL, 'T'},
+		{"refs", required_argument, NULL, 'r'},
+		{"id-gap", required_argument, NULL, 'g'},
+		{"layout", required_argument, NULL, 'l'},
+		{"seed", required_argument, NULL, 's'},
+		{"output", required_argument, NULL, 'o'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "n:w:t:T:r:g:l:s:o:h", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'n': o.nodes = atol(optarg); break;
+			case 'w': o.ways = atol(optarg); break;
+			case 't': o.way_tags = atoi(optarg); break;
+			case 'T': o.node_tag_pct = atoi(optarg); break;
+			case 'r': o.refs = atoi(optarg); break;
+			case 'g': o.id_gap = atoi(optarg); break;
+			case 's': o.seed = strtoull(optarg, NULL, 10); break;
+			case 'o': output = optarg; break;
+			case 'l':
+				if (strcmp(optarg, "minimal") == 0)
+					o.layout = LAYOUT_MINIMAL;
+				else if (strcmp(optarg, "full") == 0)
+					o.layout = LAYOUT_FULL;
+				else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (o.nodes < 1 || o.ways < 0 || o.refs < 2 || o.way_tags < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	FILE *out = output != NULL ? fopen(output, "w") : stdout;
+	if (out == NULL) {
+		perror("fopen");
+		return 1;
+	}
+
+	static char buf[1 << 16];
+	setvbuf(out, buf, _IOFBF, sizeof(buf));
+	generate(out, &o);
+
+	if (fclose(out) != 0) {
+		perror("fclose");
+		return 1;
+	}
+	return 0;
+}
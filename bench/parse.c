@@ -0,0 +1,186 @@
+// end to end throughput of parse_osm_from_file and dump_to_file, with a
+// json report so runs can be compared. build with RELEASE=1 for meaningful
+// numbers, `make bench` generates an input with bench_osmgen first
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "error.h"
+#include "world.h"
+#include "timing.h"
+#include "osm/parser.h"
+#include "osm/stats.h"
+#include "alloc.h"
+
+struct round {
+	struct parse_stats parse;
+	double encode; // < 0 if protobuf is not built in
+	int roads, land_uses;
+};
+
+static int run(const char *path, struct parse_options *opts, const char *encode_path, int encode_threads,
+		struct round *out) {
+	struct world world;
+	memset(out, 0, sizeof(*out));
+	opts->stats = &out->parse;
+
+	int ret = parse_osm_from_file_opts(path, opts, &world);
+	if (ret != CRACKING)
+		return ret;
+
+	out->roads = world.roads.length;
+	out->land_uses = world.land_uses.length;
+
+#ifndef NO_PROTOBUF
+	double start = monotonic_now();
+	if (!dump_to_file_threads(&world, (char *) encode_path, encode_threads))
+		ret = ERR_IO;
+	out->encode = monotonic_now() - start;
+#else
+	(void) encode_path;
+	(void) encode_threads;
+	out->encode = -1;
+#endif
+
+	free_world(&world);
+	return ret;
+}
+
+static void print_json(FILE *f, const char *path, off_t bytes, const struct parse_options *opts,
+		int rounds, int encode_threads, const struct round *best, long peak_rss_kb) {
+	const struct parse_timings *t = &best->parse.timings;
+	uint64_t nodes = best->parse.elements[TAG_NODE];
+	uint64_t ways = best->parse.elements[TAG_WAY];
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"input\": \"%s\",\n", path);
+	fprintf(f, "  \"bytes\": %lld,\n", (long long) bytes);
+	fprintf(f, "  \"nodes\": %" PRIu64 ",\n", nodes);
+	fprintf(f, "  \"ways\": %" PRIu64 ",\n", ways);
+	fprintf(f, "  \"resolution\": \"%s\",\n", opts->resolution == RESOLVE_DEFERRED ? "deferred" : "immediate");
+	fprintf(f, "  \"rounds\": %d,\n", rounds);
+	fprintf(f, "  \"encode_threads\": %d,\n", encode_threads);
+	fprintf(f, "  \"roads\": %d,\n", best->roads);
+	fprintf(f, "  \"land_uses\": %d,\n", best->land_uses);
+	fprintf(f, "  \"mb_per_s\": %.3f,\n", bytes / t->total / 1e6);
+	fprintf(f, "  \"nodes_per_s\": %.0f,\n", nodes / t->total);
+	fprintf(f, "  \"ways_per_s\": %.0f,\n", ways / t->total);
+	fprintf(f, "  \"seconds\": {\n");
+	fprintf(f, "    \"parse\": %.6f,\n", t->total);
+	fprintf(f, "    \"tokenize\": %.6f,\n", t->tokenize);
+	fprintf(f, "    \"node_store\": %.6f,\n", t->node_store);
+	fprintf(f, "    \"way_resolve\": %.6f,\n", t->way_resolve);
+	if (best->encode < 0)
+		fprintf(f, "    \"encode\": null\n");
+	else
+		fprintf(f, "    \"encode\": %.6f\n", best->encode);
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"peak_rss_kb\": %ld,\n", peak_rss_kb);
+	fprintf(f, "  \"stats\": ");
+	print_parse_stats(f, &best->parse);
+
+	// peaks over every round, by subsystem
+	struct alloc_stats memory[ALLOC_TAG_COUNT];
+	alloc_get_stats(memory);
+	fprintf(f, ",\n  \"memory\": ");
+	print_alloc_stats(f, memory);
+	fprintf(f, "}\n");
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [options] file.osm\n"
+			"  -d, --deferred     resolve node references in one sorted pass\n"
+			"  -r, --rounds N     runs, the fastest is reported (3)\n"
+			"  -o, --json PATH    write the report as json\n"
+			"  -e, --encode PATH  where to dump the world (/dev/null)\n"
+			"  -j, --jobs N       threads encoding the world, 0 for one a cpu (1)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	struct parse_options opts = {0};
+	int rounds = 3;
+	const char *json_path = NULL;
+	const char *encode_path = "/dev/null";
+	int encode_threads = 1;
+
+	static const struct option long_opts[] = {
+		{"deferred", no_argument, NULL, 'd'},
+		{"rounds", required_argument, NULL, 'r'},
+		{"json", required_argument, NULL, 'o'},
+		{"encode", required_argument, NULL, 'e'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "dr:o:e:j:h", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'd': opts.resolution = RESOLVE_DEFERRED; break;
+			case 'r': rounds = atoi(optarg); break;
+			case 'o': json_path = optarg; break;
+			case 'e': encode_path = optarg; break;
+			case 'j': encode_threads = atoi(optarg); break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1 || rounds < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const char *path = argv[optind];
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		perror(path);
+		return 1;
+	}
+
+	struct round best = {0};
+	for (int r = 0; r < rounds; r++) {
+		struct round round;
+		int ret = run(path, &opts, encode_path, encode_threads, &round);
+		if (ret != CRACKING) {
+			fprintf(stderr, "error: %s\n", error_get_message(ret));
+			return 1;
+		}
+
+		if (r == 0 || round.parse.timings.total + round.encode < best.parse.timings.total + best.encode)
+			best = round;
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	const struct parse_timings *t = &best.parse.timings;
+	double nodes = best.parse.elements[TAG_NODE];
+	double ways = best.parse.elements[TAG_WAY];
+	printf("%s: %.1f MB, %.0f nodes, %.0f ways\n", path, st.st_size / 1e6, nodes, ways);
+	printf("parse:       %8.3f s  %7.1f MB/s  %5.2f M nodes/s  %5.2f M ways/s\n",
+			t->total, st.st_size / t->total / 1e6, nodes / t->total / 1e6, ways / t->total / 1e6);
+	printf("  tokenize:  %8.3f s\n", t->tokenize);
+	printf("  nodes:     %8.3f s\n", t->node_store);
+	printf("  ways:      %8.3f s\n", t->way_resolve);
+	if (best.encode >= 0)
+		printf("encode:      %8.3f s  %d threads\n", best.encode, encode_threads);
+	printf("peak rss:    %8.1f MB\n", usage.ru_maxrss / 1024.0);
+
+	if (json_path != NULL) {
+		FILE *f = fopen(json_path, "w");
+		if (f == NULL) {
+			perror(json_path);
+			return 1;
+		}
+		print_json(f, path, st.st_size, &opts, rounds, encode_threads, &best, usage.ru_maxrss);
+		fclose(f);
+	}
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+// projection and fixed point kernels, scalar against avx2 where the cpu
+// has it. build with RELEASE=1 for meaningful numbers
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "project.h"
+#include "simd.h"
+#include "timing.h"
+
+#define POINTS (4000000)
+#define ROUNDS (5)
+
+static double run(const struct projector *p, const point *in, point *out, fixed_point *fixed) {
+	double best = 1e9;
+	for (int r = 0; r < ROUNDS; r++) {
+		double start = monotonic_now();
+		if (p != NULL)
+			project_points(p, in, out, POINTS);
+		else
+			quantize_points(in, fixed, POINTS, 100);
+		double t = monotonic_now() - start;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+int main(void) {
+	point *in = malloc(sizeof(point) * POINTS);
+	point *out = malloc(sizeof(point) * POINTS);
+	fixed_point *fixed = malloc(sizeof(fixed_point) * POINTS);
+	if (in == NULL || out == NULL || fixed == NULL)
+		return 1;
+
+	unsigned long long seed = 88172645463325252ULL;
+	for (int i = 0; i < POINTS; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		in[i].lat = 51 + (seed % 1000000) / 1e6;
+		in[i].lon = -1 + ((seed >> 20) % 1000000) / 1e6;
+	}
+
+	struct projector local, mercator;
+	projector_init(&local, PROJECT_LOCAL, (point) {51.5, -0.5});
+	projector_init(&mercator, PROJECT_MERCATOR, (point) {0, 0});
+
+	const char *names[] = {"local", "mercator", "fixed"};
+	const struct projector *kinds[] = {&local, &mercator, NULL};
+	bool simd = simd_set(false);
+
+	for (int k = 0; k < 3; k++) {
+		simd_set(false);
+		double scalar = run(kinds[k], in, out, fixed);
+		printf("%-9s scalar: %7.1f M points/s\n", names[k], POINTS / scalar / 1e6);
+
+		if (simd) {
+			simd_set(true);
+			double vector = run(kinds[k], in, out, fixed);
+			printf("%-9s avx2:   %7.1f M points/s (%.1fx)\n", names[k], POINTS / vector / 1e6, scalar / vector);
+		}
+	}
+
+	free(fixed);
+	free(out);
+	free(in);
+	return 0;
+}
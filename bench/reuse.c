@@ -0,0 +1,160 @@
+// per parse latency of small buffers, a fresh parse each time against one
+// osm_parser kept across them. build with RELEASE=1 for meaningful numbers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "error.h"
+#include "world.h"
+#include "timing.h"
+#include "osm/parser.h"
+
+#define MIN_PARSES (200)
+#define MIN_SECONDS (0.5)
+
+static uint64_t next(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// a few streets and land uses over n_nodes nodes, like a small diff
+static char *generate(int n_nodes, uint64_t seed, size_t *len) {
+	static const char *highways[] = {"residential", "primary", "footway", "service"};
+	char *buf = NULL;
+	FILE *f = open_memstream(&buf, len);
+	if (f == NULL)
+		return NULL;
+
+	fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n");
+	for (int i = 1; i <= n_nodes; i++) {
+		uint64_t r = next(&seed);
+		fprintf(f, " <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n", i,
+				51.5 + (r % 100000) / 1e7, -0.1 + ((r >> 20) % 100000) / 1e7);
+	}
+
+	for (int w = 1; w <= n_nodes / 4 + 1; w++) {
+		fprintf(f, " <way id=\"%d\">\n", w);
+		int refs = 2 + next(&seed) % 5;
+		for (int i = 0; i < refs; i++)
+			fprintf(f, "  <nd ref=\"%d\"/>\n", (int) (next(&seed) % n_nodes) + 1);
+		if (w % 5 == 0)
+			fprintf(f, "  <tag k=\"landuse\" v=\"grass\"/>\n");
+		else
+			fprintf(f, "  <tag k=\"highway\" v=\"%s\"/>\n  <tag k=\"name\" v=\"Street %d\"/>\n", highways[w % 4], w);
+		fprintf(f, " </way>\n");
+	}
+	fprintf(f, "</osm>\n");
+	fclose(f);
+	return buf;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+struct latency {
+	int parses;
+	double mean, p50, p99;
+};
+
+// parser NULL parses with parse_osm_from_buffer_opts
+static int measure(struct osm_parser *parser, const struct parse_options *opts, char *osm, size_t len,
+		struct latency *out) {
+	size_t cap = 1024, n = 0;
+	double *times = malloc(cap * sizeof(double));
+	double total = 0;
+	int ret = times == NULL ? ERR_MEM : CRACKING;
+
+	while (ret == CRACKING && (n < MIN_PARSES || total < MIN_SECONDS)) {
+		struct world world;
+		double start = monotonic_now();
+		ret = parser != NULL
+			? osm_parser_parse_buffer(parser, osm, len, &world)
+			: parse_osm_from_buffer_opts(osm, len, opts, &world);
+		double t = monotonic_now() - start;
+		free_world(&world);
+
+		if (n == cap) {
+			double *grown = realloc(times, (cap *= 2) * sizeof(double));
+			if (grown == NULL) {
+				ret = ERR_MEM;
+				break;
+			}
+			times = grown;
+		}
+		times[n++] = t;
+		total += t;
+	}
+
+	if (ret == CRACKING) {
+		qsort(times, n, sizeof(double), compare_doubles);
+		out->parses = (int) n;
+		out->mean = total / n;
+		out->p50 = times[n / 2];
+		out->p99 = times[n * 99 / 100];
+	}
+	free(times);
+	return ret;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-d]\n"
+			"  -d, --deferred  resolve node references in one sorted pass\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	struct parse_options opts = {0};
+
+	static const struct option long_opts[] = {
+		{"deferred", no_argument, NULL, 'd'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "dh", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'd': opts.resolution = RESOLVE_DEFERRED; break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	struct osm_parser *parser;
+	int ret = osm_parser_new(&opts, &parser);
+	if (ret != CRACKING) {
+		fprintf(stderr, "error: %s\n", error_get_message(ret));
+		return 1;
+	}
+
+	printf("%8s %8s  %-7s %9s %9s %9s\n", "nodes", "bytes", "parser", "mean us", "p50 us", "p99 us");
+	const int sizes[] = {16, 128, 1024, 8192};
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+		size_t len;
+		char *osm = generate(sizes[s], 2463534242ULL + s, &len);
+		if (osm == NULL)
+			return 1;
+
+		struct latency fresh, reused;
+		if ((ret = measure(NULL, &opts, osm, len, &fresh)) == CRACKING)
+			ret = measure(parser, &opts, osm, len, &reused);
+		free(osm);
+		if (ret != CRACKING) {
+			fprintf(stderr, "error: %s\n", error_get_message(ret));
+			return 1;
+		}
+
+		printf("%8d %8zu  %-7s %9.2f %9.2f %9.2f\n", sizes[s], len, "fresh",
+				fresh.mean * 1e6, fresh.p50 * 1e6, fresh.p99 * 1e6);
+		printf("%8s %8s  %-7s %9.2f %9.2f %9.2f  %.2fx\n", "", "", "reused",
+				reused.mean * 1e6, reused.p50 * 1e6, reused.p99 * 1e6, fresh.mean / reused.mean);
+	}
+
+	osm_parser_free(parser);
+	return 0;
+}
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "aggregate.h"
+#include "geodesic.h"
+#include "render.h"
+#include "world.h"
+#include "pool.h"
+#include "alloc.h"
+#include "error.h"
+
+// features before summing goes to the pool
+#define PARALLEL_MIN (1 << 10)
+
+// finer cells than this would number more than a uint32 across
+#define MIN_CELL (1e-6)
+
+struct cell {
+	uint32_t x, y;
+	bool used;
+	double sums[AGG_COLUMNS];
+};
+
+// open addressed on x and y
+struct cell_table {
+	struct cell *slots;
+	size_t mask, used;
+};
+
+// the cell the last point fell in, most of the next ones fall there too
+struct locator {
+	const struct agg_grid *grid;
+	bool valid;
+	uint32_t x, y;
+	double west, east, south, north;
+};
+
+// the cells of one chunk of features, only ever touched by the thread
+// summing it
+struct agg_chunk {
+	const struct world *world;
+	const struct agg_grid *grid;
+	struct cell_table cells;
+
+	double *lengths;
+	point *scratch;
+	size_t scratch_cap;
+	int ret;
+};
+
+bool agg_grid_from_string(const char *s, struct agg_grid *out) {
+	char *end;
+	memset(out, 0, sizeof(*out));
+
+	if (*s == 'z') {
+		long zoom = strtol(s + 1, &end, 10);
+		out->kind = GRID_TILES;
+		out->zoom = (int) zoom;
+		return end != s + 1 && *end == '\0' && zoom >= 0 && zoom <= RENDER_MAX_ZOOM;
+	}
+
+	out->kind = GRID_DEGREES;
+	out->cell = strtod(s, &end);
+	return end != s && *end == '\0' && out->cell >= MIN_CELL && out->cell <= 180;
+}
+
+static uint32_t clamp_cell(double v, uint32_t n) {
+	return !(v > 0) ? 0 : v >= n - 1 ? n - 1 : (uint32_t) v;
+}
+
+// into [-180, 180)
+static double normalise_lon(double lon) {
+	return lon - 360 * floor((lon + 180) / 360);
+}
+
+static void locate(struct locator *l, point p) {
+	if (l->valid && p.lon >= l->west && p.lon < l->east && p.lat >= l->south && p.lat < l->north)
+		return;
+
+	const struct agg_grid *g = l->grid;
+	if (g->kind == GRID_TILES) {
+		l->x = lon_tile(p.lon, g->zoom);
+		l->y = lat_tile(p.lat, g->zoom);
+		l->west = tile_lon(l->x, g->zoom);
+		l->east = tile_lon(l->x + 1, g->zoom);
+		l->north = tile_lat(l->y, g->zoom);
+		l->south = tile_lat(l->y + 1, g->zoom);
+	} else {
+		l->x = clamp_cell(floor((p.lon + 180) / g->cell), (uint32_t) ceil(360 / g->cell));
+		l->y = clamp_cell(floor((p.lat + 90) / g->cell), (uint32_t) ceil(180 / g->cell));
+		l->west = l->x * g->cell - 180;
+		l->east = l->west + g->cell;
+		l->south = l->y * g->cell - 90;
+		l->north = l->south + g->cell;
+	}
+	l->valid = true;
+}
+
+static size_t cell_slot(uint32_t x, uint32_t y) {
+	return (size_t) (((((uint64_t) y << 32) | x) * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+// room for n cells at most half full
+static int cells_init(struct cell_table *t, size_t n) {
+	size_t cap = 64;
+	while (cap < n * 2)
+		cap *= 2;
+
+	t->slots = alloc_calloc(ALLOC_OTHER, cap, sizeof(struct cell));
+	if (t->slots == NULL)
+		return ERR_MEM;
+	t->mask = cap - 1;
+	t->used = 0;
+	return CRACKING;
+}
+
+static struct cell *cells_find(struct cell_table *t, uint32_t x, uint32_t y) {
+	size_t s = cell_slot(x, y) & t->mask;
+	while (t->slots[s].used && (t->slots[s].x != x || t->slots[s].y != y))
+		s = (s + 1) & t->mask;
+	return &t->slots[s];
+}
+
+// the sums of a cell, added if it's new. NULL if out of memory
+static double *cell_sums(struct cell_table *t, uint32_t x, uint32_t y) {
+	struct cell *c = cells_find(t, x, y);
+	if (c->used)
+		return c->sums;
+
+	if ((t->used + 1) * 2 > t->mask + 1) {
+		struct cell_table grown;
+		if (cells_init(&grown, t->used + 1) != CRACKING)
+			return NULL;
+		for (size_t i = 0; i <= t->mask; i++) {
+			if (t->slots[i].used)
+				*cells_find(&grown, t->slots[i].x, t->slots[i].y) = t->slots[i];
+		}
+		grown.used = t->used;
+		alloc_free(ALLOC_OTHER, t->slots);
+		*t = grown;
+		c = cells_find(t, x, y);
+	}
+
+	c->x = x;
+	c->y = y;
+	c->used = true;
+	t->used++;
+	return c->sums;
+}
+
+static bool reserve_scratch(struct agg_chunk *c, size_t n) {
+	if (n <= c->scratch_cap)
+		return true;
+
+	size_t cap = c->scratch_cap ? c->scratch_cap : 256;
+	while (cap < n)
+		cap *= 2;
+	double *lengths = alloc_realloc(ALLOC_OTHER, c->lengths, cap * sizeof(double));
+	if (lengths != NULL)
+		c->lengths = lengths;
+	point *scratch = alloc_realloc(ALLOC_OTHER, c->scratch, cap * sizeof(point));
+	if (scratch != NULL)
+		c->scratch = scratch;
+	if (lengths == NULL || scratch == NULL)
+		return false;
+	c->scratch_cap = cap;
+	return true;
+}
+
+static int add_road(struct agg_chunk *c, struct locator *l, const struct road *r) {
+	const point *p = r->segments.data;
+	int n = r->segments.length;
+	if (n < 2)
+		return CRACKING;
+	if (!reserve_scratch(c, n))
+		return ERR_MEM;
+
+	geodesic_segments(p, n, c->lengths);
+
+	// only looked up again when a segment crosses into another cell
+	double *sums = NULL;
+	uint32_t x = 0, y = 0;
+	for (int i = 0; i + 1 < n; i++) {
+		// the way it was measured, across the antimeridian if shorter
+		double lon = normalise_lon(p[i].lon + geodesic_wrap_lon(p[i + 1].lon - p[i].lon) / 2);
+		locate(l, (point) {(p[i].lat + p[i + 1].lat) / 2, lon});
+		if (sums == NULL || l->x != x || l->y != y) {
+			x = l->x;
+			y = l->y;
+			if ((sums = cell_sums(&c->cells, x, y)) == NULL)
+				return ERR_MEM;
+		}
+		sums[r->type] += c->lengths[i];
+	}
+	return CRACKING;
+}
+
+static int add_land_use(struct agg_chunk *c, struct locator *l, const struct land_use *lu) {
+	const point *p = lu->points.data;
+	int n = lu->points.length;
+	if (n < 3)
+		return CRACKING;
+	if (!reserve_scratch(c, n))
+		return ERR_MEM;
+
+	// lons from the first vertex, so a ring over the antimeridian doesn't
+	// average out on the other side of the world
+	point mean = {0, 0};
+	for (int i = 0; i < n; i++) {
+		mean.lat += p[i].lat;
+		mean.lon += geodesic_wrap_lon(p[i].lon - p[0].lon);
+	}
+	locate(l, (point) {mean.lat / n, normalise_lon(p[0].lon + mean.lon / n)});
+
+	double *sums = cell_sums(&c->cells, l->x, l->y);
+	if (sums == NULL)
+		return ERR_MEM;
+	sums[ROAD_TYPE_COUNT + lu->type] += geodesic_area(p, n, c->scratch);
+	return CRACKING;
+}
+
+// roads first then land uses
+static void agg_chunk(void *ctx, int chunk, size_t from, size_t to) {
+	struct agg_chunk *c = (struct agg_chunk *) ctx + chunk;
+	const struct world *w = c->world;
+	struct locator l = {.grid = c->grid};
+
+	for (int i = (int) from; c->ret == CRACKING && i < (int) to; i++) {
+		c->ret = i < w->roads.length
+			? add_road(c, &l, &w->roads.data[i])
+			: add_land_use(c, &l, &w->land_uses.data[i - w->roads.length]);
+	}
+
+	alloc_free(ALLOC_OTHER, c->lengths);
+	alloc_free(ALLOC_OTHER, c->scratch);
+	c->lengths = NULL;
+	c->scratch = NULL;
+}
+
+static int compare_cells(const void *a, const void *b) {
+	const struct cell *x = a, *y = b;
+	if (x->y != y->y)
+		return x->y < y->y ? -1 : 1;
+	return (x->x > y->x) - (x->x < y->x);
+}
+
+// the merged cells, in order, as columns
+static int build_columns(struct cell_table *t, struct aggregate *out) {
+	size_t n = 0;
+	for (size_t i = 0; i <= t->mask; i++) {
+		if (t->slots[i].used)
+			t->slots[n++] = t->slots[i];
+	}
+	qsort(t->slots, n, sizeof(struct cell), compare_cells);
+
+	size_t alloc = n > 0 ? n : 1;
+	out->n_cells = (uint32_t) n;
+	out->x = alloc_malloc(ALLOC_OTHER, alloc * sizeof(uint32_t));
+	out->y = alloc_malloc(ALLOC_OTHER, alloc * sizeof(uint32_t));
+	bool ok = out->x != NULL && out->y != NULL;
+	for (int k = 0; k < AGG_COLUMNS; k++)
+		ok = (out->columns[k] = alloc_malloc(ALLOC_OTHER, alloc * sizeof(double))) != NULL && ok;
+	if (!ok)
+		return ERR_MEM;
+
+	for (size_t i = 0; i < n; i++) {
+		out->x[i] = t->slots[i].x;
+		out->y[i] = t->slots[i].y;
+		for (int k = 0; k < AGG_COLUMNS; k++)
+			out->columns[k][i] = t->slots[i].sums[k];
+	}
+	return CRACKING;
+}
+
+int aggregate_world(const struct world *world, const struct agg_grid *grid, int threads, struct aggregate *out) {
+	memset(out, 0, sizeof(*out));
+	out->grid = *grid;
+	if (world->projection != PROJECT_NONE)
+		return ERR_UNSUPPORTED;
+
+	int n = world->roads.length + world->land_uses.length;
+	int n_chunks = pool_chunk_count(n, PARALLEL_MIN, threads);
+	struct agg_chunk *chunks = alloc_calloc(ALLOC_OTHER, n_chunks, sizeof(struct agg_chunk));
+	if (chunks == NULL)
+		return ERR_MEM;
+
+	int ret = CRACKING;
+	for (int i = 0; i < n_chunks; i++) {
+		struct agg_chunk *c = &chunks[i];
+		c->world = world;
+		c->grid = &out->grid;
+		if ((c->ret = cells_init(&c->cells, 0)) != CRACKING)
+			ret = c->ret;
+	}
+
+	if (ret == CRACKING)
+		pool_for_chunks(n, PARALLEL_MIN, threads, agg_chunk, chunks);
+
+	// merged in chunk order, so sums only depend on the number of threads
+	struct cell_table *all = &chunks[0].cells;
+	for (int i = 0; i < n_chunks; i++) {
+		if (ret == CRACKING)
+			ret = chunks[i].ret;
+		for (size_t s = 0; ret == CRACKING && i > 0 && s <= chunks[i].cells.mask; s++) {
+			const struct cell *c = &chunks[i].cells.slots[s];
+			if (!c->used)
+				continue;
+			double *sums = cell_sums(all, c->x, c->y);
+			if (sums == NULL) {
+				ret = ERR_MEM;
+				break;
+			}
+			for (int k = 0; k < AGG_COLUMNS; k++)
+				sums[k] += c->sums[k];
+		}
+		if (i > 0)
+			alloc_free(ALLOC_OTHER, chunks[i].cells.slots);
+	}
+
+	if (ret == CRACKING)
+		ret = build_columns(all, out);
+	alloc_free(ALLOC_OTHER, all->slots);
+	alloc_free(ALLOC_OTHER, chunks);
+
+	if (ret != CRACKING)
+		aggregate_free(out);
+	return ret;
+}
+
+void aggregate_free(struct aggregate *a) {
+	alloc_free(ALLOC_OTHER, a->x);
+	alloc_free(ALLOC_OTHER, a->y);
+	for (int k = 0; k < AGG_COLUMNS; k++)
+		alloc_free(ALLOC_OTHER, a->columns[k]);
+	a->x = a->y = NULL;
+	memset(a->columns, 0, sizeof(a->columns));
+	a->n_cells = 0;
+}
+
+int aggregate_write(const struct aggregate *a, const char *path) {
+	struct agg_header h = {
+		.magic = AGG_MAGIC,
+		.version = AGG_VERSION,
+		.grid = (uint8_t) a->grid.kind,
+		.zoom = (uint8_t) a->grid.zoom,
+		.cell = a->grid.cell,
+		.n_cells = a->n_cells
+	};
+
+	// columns of nothing but zeros are left out
+	for (int k = 0; k < AGG_COLUMNS; k++) {
+		for (uint32_t i = 0; i < a->n_cells; i++) {
+			if (a->columns[k][i] != 0) {
+				h.columns |= 1u << k;
+				break;
+			}
+		}
+	}
+
+	float *column = alloc_malloc(ALLOC_OTHER, (a->n_cells > 0 ? a->n_cells : 1) * sizeof(float));
+	if (column == NULL)
+		return ERR_MEM;
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		alloc_free(ALLOC_OTHER, column);
+		return ERR_IO;
+	}
+
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+		&& fwrite(a->x, sizeof(uint32_t), a->n_cells, f) == a->n_cells
+		&& fwrite(a->y, sizeof(uint32_t), a->n_cells, f) == a->n_cells;
+	for (int k = 0; ok && k < AGG_COLUMNS; k++) {
+		if (!(h.columns & (1u << k)))
+			continue;
+		for (uint32_t i = 0; i < a->n_cells; i++)
+			column[i] = (float) a->columns[k][i];
+		ok = fwrite(column, sizeof(float), a->n_cells, f) == a->n_cells;
+	}
+
+	alloc_free(ALLOC_OTHER, column);
+	if (fclose(f) != 0 || !ok)
+		return ERR_IO;
+	return CRACKING;
+}
@@ -0,0 +1,63 @@
+#ifndef OSM_AGGREGATE
+#define OSM_AGGREGATE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osm/osm.h"
+
+struct world;
+
+// road length per road_type then land use area per land_use_type
+#define AGG_COLUMNS (ROAD_TYPE_COUNT + LANDUSE_TYPE_COUNT)
+
+enum grid_kind {
+	GRID_TILES = 0, // web mercator tiles at a zoom, x east and y south
+	GRID_DEGREES    // square cells of lat/lon from -180,-90, x east and y north
+};
+
+struct agg_grid {
+	enum grid_kind kind;
+	int zoom;
+	double cell; // degrees
+};
+
+// "zZ" for the tiles at zoom Z, or a cell size in degrees
+bool agg_grid_from_string(const char *s, struct agg_grid *out);
+
+// the cells with anything in them, sorted by y then x, as columns. a
+// segment counts whole in the cell of its midpoint and a polygon in that
+// of its vertex mean
+struct aggregate {
+	struct agg_grid grid;
+	uint32_t n_cells;
+	uint32_t *x, *y;
+	double *columns[AGG_COLUMNS]; // metres then square metres, n_cells each
+};
+
+// sums the world over the grid, in chunks on threads workers (<= 0 for
+// one a cpu) each with cells of their own that are merged once all are
+// done. ERR_UNSUPPORTED for a projected world
+int aggregate_world(const struct world *world, const struct agg_grid *grid, int threads, struct aggregate *out);
+
+void aggregate_free(struct aggregate *a);
+
+// the file is in host byte order: an agg_header, the x then y column of
+// uint32s and each column in the mask as floats
+#define AGG_MAGIC (0x41474741) // "AGGA"
+#define AGG_VERSION (1)
+
+struct agg_header {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t grid;   // grid_kind
+	uint8_t zoom;
+	double cell;
+	uint32_t n_cells;
+	uint32_t columns; // bit per column with anything in it
+};
+
+int aggregate_write(const struct aggregate *a, const char *path);
+
+#endif
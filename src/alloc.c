@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include <inttypes.h>
+
+#include "alloc.h"
+
+struct counters {
+	_Atomic int64_t live;
+	_Atomic int64_t peak;
+	_Atomic uint64_t allocs;
+	_Atomic uint64_t frees;
+};
+
+static struct counters counters[ALLOC_TAG_COUNT];
+
+static const char *tag_names[ALLOC_TAG_COUNT] = {
+	"nodes", "ways", "tags", "geometry", "encoder", "other"
+};
+
+static _Thread_local enum alloc_tag vec_tag = ALLOC_OTHER;
+
+static void *libc_realloc(void *ctx, void *ptr, size_t size) {
+	(void) ctx;
+	return realloc(ptr, size);
+}
+
+static void libc_free(void *ctx, void *ptr) {
+	(void) ctx;
+	free(ptr);
+}
+
+static size_t libc_size(void *ctx, void *ptr) {
+	(void) ctx;
+	return malloc_usable_size(ptr);
+}
+
+static const struct allocator libc_backend = {
+	.realloc = libc_realloc,
+	.free = libc_free,
+	.size = libc_size
+};
+
+static struct allocator backend = {
+	.realloc = libc_realloc,
+	.free = libc_free,
+	.size = libc_size
+};
+
+void alloc_set_backend(const struct allocator *b) {
+	backend = b != NULL ? *b : libc_backend;
+}
+
+static void account(enum alloc_tag tag, int64_t delta) {
+	struct counters *c = &counters[tag];
+	int64_t live = atomic_fetch_add_explicit(&c->live, delta, memory_order_relaxed) + delta;
+
+	int64_t peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&c->peak, &peak, live,
+				memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size) {
+	if (ptr != NULL && size == 0) {
+		alloc_free(tag, ptr);
+		return NULL;
+	}
+
+	size_t old = ptr != NULL ? backend.size(backend.ctx, ptr) : 0;
+
+	// on failure ptr is untouched and still accounted
+	void *out = backend.realloc(backend.ctx, ptr, size);
+	if (out == NULL)
+		return NULL;
+
+	if (ptr == NULL)
+		atomic_fetch_add_explicit(&counters[tag].allocs, 1, memory_order_relaxed);
+	account(tag, (int64_t) backend.size(backend.ctx, out) - (int64_t) old);
+	return out;
+}
+
+void *alloc_malloc(enum alloc_tag tag, size_t size) {
+	return alloc_realloc(tag, NULL, size);
+}
+
+void *alloc_calloc(enum alloc_tag tag, size_t n, size_t size) {
+	if (size != 0 && n > SIZE_MAX / size)
+		return NULL;
+
+	void *out = alloc_realloc(tag, NULL, n * size);
+	if (out != NULL)
+		memset(out, 0, n * size);
+	return out;
+}
+
+void alloc_free(enum alloc_tag tag, void *ptr) {
+	if (ptr == NULL)
+		return;
+
+	atomic_fetch_add_explicit(&counters[tag].frees, 1, memory_order_relaxed);
+	account(tag, -(int64_t) backend.size(backend.ctx, ptr));
+	backend.free(backend.ctx, ptr);
+}
+
+char *alloc_strndup(enum alloc_tag tag, const char *s, size_t n) {
+	size_t len = strnlen(s, n);
+	char *out = alloc_malloc(tag, len + 1);
+	if (out == NULL)
+		return NULL;
+
+	memcpy(out, s, len);
+	out[len] = '\0';
+	return out;
+}
+
+char *alloc_strdup(enum alloc_tag tag, const char *s) {
+	return alloc_strndup(tag, s, SIZE_MAX);
+}
+
+enum alloc_tag alloc_set_vec_tag(enum alloc_tag tag) {
+	enum alloc_tag prev = vec_tag;
+	vec_tag = tag;
+	return prev;
+}
+
+void *alloc_vec_realloc(void *ptr, size_t size) {
+	return alloc_realloc(vec_tag, ptr, size);
+}
+
+void alloc_vec_free(void *ptr) {
+	alloc_free(vec_tag, ptr);
+}
+
+void alloc_get_stats(struct alloc_stats out[ALLOC_TAG_COUNT]) {
+	for (int i = 0; i < ALLOC_TAG_COUNT; i++) {
+		out[i].live = atomic_load_explicit(&counters[i].live, memory_order_relaxed);
+		out[i].peak = atomic_load_explicit(&counters[i].peak, memory_order_relaxed);
+		out[i].allocs = atomic_load_explicit(&counters[i].allocs, memory_order_relaxed);
+		out[i].frees = atomic_load_explicit(&counters[i].frees, memory_order_relaxed);
+	}
+}
+
+void alloc_reset_peaks(void) {
+	for (int i = 0; i < ALLOC_TAG_COUNT; i++)
+		atomic_store_explicit(&counters[i].peak,
+				atomic_load_explicit(&counters[i].live, memory_order_relaxed), memory_order_relaxed);
+}
+
+void print_alloc_stats(FILE *f, const struct alloc_stats stats[ALLOC_TAG_COUNT]) {
+	fprintf(f, "{\n");
+	for (int i = 0; i < ALLOC_TAG_COUNT; i++) {
+		fprintf(f, "  \"%s\": {\"live\": %" PRId64 ", \"peak\": %" PRId64 ", \"allocs\": %" PRIu64 ", \"frees\": %" PRIu64 "}%s\n",
+				tag_names[i], stats[i].live, stats[i].peak, stats[i].allocs, stats[i].frees,
+				i + 1 < ALLOC_TAG_COUNT ? "," : "");
+	}
+	fprintf(f, "}\n");
+}
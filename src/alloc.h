@@ -0,0 +1,70 @@
+#ifndef OSM_ALLOC
+#define OSM_ALLOC
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// what an allocation is for, so memory can be accounted per subsystem
+enum alloc_tag {
+	ALLOC_NODES = 0,  // node map, deferred node list
+	ALLOC_WAYS,       // way map, way node refs, deferred refs
+	ALLOC_TAGS,       // tag values kept past the line, names, filters
+	ALLOC_GEOMETRY,   // world features and their points
+	ALLOC_ENCODER,    // output buffers
+	ALLOC_OTHER,
+	ALLOC_TAG_COUNT
+};
+
+struct alloc_stats {
+	int64_t live;     // bytes, can go negative for a tag if memory moved between tags
+	int64_t peak;
+	uint64_t allocs;
+	uint64_t frees;
+};
+
+// where memory comes from. size reports the usable size of a live block,
+// which is what gets accounted. every function gets ctx
+struct allocator {
+	void *(*realloc)(void *ctx, void *ptr, size_t size);
+	void (*free)(void *ctx, void *ptr);
+	size_t (*size)(void *ctx, void *ptr);
+	void *ctx;
+};
+
+// replaces the libc backend. only safe before anything has been allocated
+// through here, or after all of it has been freed. NULL restores libc
+void alloc_set_backend(const struct allocator *backend);
+
+void *alloc_malloc(enum alloc_tag tag, size_t size);
+void *alloc_calloc(enum alloc_tag tag, size_t n, size_t size);
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size);
+void alloc_free(enum alloc_tag tag, void *ptr);
+char *alloc_strdup(enum alloc_tag tag, const char *s);
+char *alloc_strndup(enum alloc_tag tag, const char *s, size_t n);
+
+// defines name_realloc and name_free for the hashmap hooks
+#define DEFINE_ALLOC_HOOKS(name, tag) \
+	static void *name##_realloc(void *ptr, size_t size) { return alloc_realloc(tag, ptr, size); } \
+	static void name##_free(void *ptr) { alloc_free(tag, ptr); }
+
+// vec has no allocator parameter, so vec.c is built with realloc and free
+// pointing here and its growth is charged to the calling thread's vec tag.
+// returns the previous tag
+enum alloc_tag alloc_set_vec_tag(enum alloc_tag tag);
+
+void *alloc_vec_realloc(void *ptr, size_t size);
+void alloc_vec_free(void *ptr);
+
+// vec_deinit frees with libc, this goes through the backend
+#define alloc_vec_deinit(tag, v) \
+	(alloc_free(tag, (v)->data), vec_init(v))
+
+void alloc_get_stats(struct alloc_stats out[ALLOC_TAG_COUNT]);
+
+// peaks restart from the current live bytes
+void alloc_reset_peaks(void);
+
+void print_alloc_stats(FILE *f, const struct alloc_stats stats[ALLOC_TAG_COUNT]);
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "building.h"
+#include "pool.h"
+#include "alloc.h"
+#include "error.h"
+
+// buildings before measuring goes to the pool
+#define PARALLEL_MIN (1 << 11)
+
+// polygons smaller than this, in square metres, are lines or points
+#define MIN_AREA (1e-6)
+
+void buildings_init(struct buildings *b) {
+	memset(b, 0, sizeof(*b));
+}
+
+void buildings_free(struct buildings *b) {
+	alloc_free(ALLOC_GEOMETRY, b->ids);
+	alloc_free(ALLOC_GEOMETRY, b->types);
+	alloc_free(ALLOC_GEOMETRY, b->offsets);
+	alloc_free(ALLOC_GEOMETRY, b->points);
+	alloc_free(ALLOC_GEOMETRY, b->areas);
+	alloc_free(ALLOC_GEOMETRY, b->centroids);
+	buildings_init(b);
+}
+
+static int grow(void **p, size_t size) {
+	void *grown = alloc_realloc(ALLOC_GEOMETRY, *p, size);
+	if (grown == NULL)
+		return ERR_MEM;
+	*p = grown;
+	return CRACKING;
+}
+
+static int reserve(struct buildings *b, uint32_t n_points) {
+	if (b->length == b->capacity) {
+		int cap = b->capacity ? b->capacity * 2 : 64;
+		if (grow((void **) &b->ids, cap * sizeof(id)) != CRACKING
+				|| grow((void **) &b->types, cap * sizeof(uint8_t)) != CRACKING
+				|| grow((void **) &b->offsets, (cap + 1) * sizeof(uint32_t)) != CRACKING)
+			return ERR_MEM;
+		if (b->capacity == 0)
+			b->offsets[0] = 0;
+		b->capacity = cap;
+	}
+
+	if ((uint64_t) b->n_points + n_points > UINT32_MAX)
+		return ERR_RANGE;
+	if (b->n_points + n_points > b->points_capacity) {
+		uint64_t cap = b->points_capacity ? b->points_capacity : 1024;
+		while (cap < b->n_points + n_points)
+			cap *= 2;
+		if (cap > UINT32_MAX)
+			cap = UINT32_MAX;
+		if (grow((void **) &b->points, cap * sizeof(fixed_point)) != CRACKING)
+			return ERR_MEM;
+		b->points_capacity = (uint32_t) cap;
+	}
+	return CRACKING;
+}
+
+int buildings_add(struct buildings *b, id id, enum building_type type, const point *points, uint32_t n) {
+	int ret = reserve(b, n);
+	if (ret != CRACKING)
+		return ret;
+
+	fixed_point *ring = b->points + b->n_points;
+	if (points != NULL)
+		quantize_points(points, ring, n, BUILDING_SCALE);
+	else
+		memset(ring, 0, n * sizeof(fixed_point));
+
+	b->ids[b->length] = id;
+	b->types[b->length] = (uint8_t) type;
+	b->n_points += n;
+	b->offsets[++b->length] = b->n_points;
+	b->measured = false;
+	return CRACKING;
+}
+
+void buildings_place(struct buildings *b, uint32_t building, uint32_t index, point pos) {
+	quantize_points(&pos, &b->points[b->offsets[building] + index], 1, BUILDING_SCALE);
+}
+
+void buildings_pop(struct buildings *b) {
+	b->length--;
+	b->n_points = b->offsets[b->length];
+}
+
+int buildings_copy(struct buildings *dst, const struct buildings *src, int i) {
+	uint32_t n = building_ring_length(src, i);
+	int ret = reserve(dst, n);
+	if (ret != CRACKING)
+		return ret;
+
+	memcpy(dst->points + dst->n_points, src->points + src->offsets[i], n * sizeof(fixed_point));
+	dst->ids[dst->length] = src->ids[i];
+	dst->types[dst->length] = src->types[i];
+	dst->n_points += n;
+	dst->offsets[++dst->length] = dst->n_points;
+	dst->measured = false;
+	return CRACKING;
+}
+
+void buildings_drop(struct buildings *b, const bool *drop) {
+	int kept = 0;
+	uint32_t points = 0;
+	for (int i = 0; i < b->length; i++) {
+		if (drop[i])
+			continue;
+
+		uint32_t from = b->offsets[i], n = b->offsets[i + 1] - from;
+		memmove(b->points + points, b->points + from, n * sizeof(fixed_point));
+		b->ids[kept] = b->ids[i];
+		b->types[kept] = b->types[i];
+		if (b->measured) {
+			b->areas[kept] = b->areas[i];
+			b->centroids[kept] = b->centroids[i];
+		}
+
+		// kept <= i, so this only writes offsets already read
+		points += n;
+		b->offsets[++kept] = points;
+	}
+
+	b->length = kept;
+	b->n_points = points;
+}
+
+// shoelace sums on the plane about the ring's first point, in ints
+// relative to it so big coordinates don't swamp small rings
+static void measure_ring(fixed_point *ring, uint32_t n, float *area, fixed_point *centroid) {
+	fixed_point o = ring[0];
+	struct projector p;
+	point origin = {o.lat / BUILDING_SCALE, o.lon / BUILDING_SCALE};
+	projector_init(&p, PROJECT_LOCAL, origin);
+	double sy = p.scale_lat / BUILDING_SCALE, sx = p.scale_lon / BUILDING_SCALE;
+
+	double twice = 0, cx = 0, cy = 0, mx = 0, my = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t j = i + 1 < n ? i + 1 : 0;
+		double x0 = (double) ((int64_t) ring[i].lon - o.lon) * sx;
+		double y0 = (double) ((int64_t) ring[i].lat - o.lat) * sy;
+		double x1 = (double) ((int64_t) ring[j].lon - o.lon) * sx;
+		double y1 = (double) ((int64_t) ring[j].lat - o.lat) * sy;
+
+		double cross = x0 * y1 - x1 * y0;
+		twice += cross;
+		cx += (x0 + x1) * cross;
+		cy += (y0 + y1) * cross;
+		mx += x0;
+		my += y0;
+	}
+
+	// degenerate rings get the mean of their points
+	if (fabs(twice) / 2 < MIN_AREA) {
+		cx = mx / n;
+		cy = my / n;
+		twice = 0;
+	} else {
+		cx /= 3 * twice;
+		cy /= 3 * twice;
+	}
+
+	// turned around its first point, which stays first
+	if (twice < 0) {
+		for (uint32_t i = 1, j = n - 1; i < j; i++, j--) {
+			fixed_point t = ring[i];
+			ring[i] = ring[j];
+			ring[j] = t;
+		}
+	}
+
+	*area = (float) (fabs(twice) / 2);
+	centroid->lat = (int32_t) lround(o.lat + cy / sy);
+	centroid->lon = (int32_t) lround(o.lon + cx / sx);
+}
+
+static void measure_chunk(void *ctx, int chunk, size_t from, size_t to) {
+	(void) chunk;
+	struct buildings *b = ctx;
+	for (size_t i = from; i < to; i++) {
+		uint32_t n = building_ring_length(b, (int) i);
+		if (n == 0) {
+			b->areas[i] = 0;
+			b->centroids[i] = (fixed_point) {0, 0};
+			continue;
+		}
+		measure_ring(b->points + b->offsets[i], n, &b->areas[i], &b->centroids[i]);
+	}
+}
+
+int buildings_measure(struct buildings *b, int threads) {
+	if (b->length == 0) {
+		b->measured = true;
+		return CRACKING;
+	}
+
+	if (grow((void **) &b->areas, b->length * sizeof(float)) != CRACKING
+			|| grow((void **) &b->centroids, b->length * sizeof(fixed_point)) != CRACKING)
+		return ERR_MEM;
+
+	pool_for_chunks(b->length, PARALLEL_MIN, threads, measure_chunk, b);
+	b->measured = true;
+	return CRACKING;
+}
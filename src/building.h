@@ -0,0 +1,61 @@
+#ifndef OSM_BUILDING
+#define OSM_BUILDING
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osm/osm.h"
+#include "project.h"
+
+// outline points in whole 1e-7 degrees, the precision osm itself keeps, so
+// nothing is lost as int32s. they stay so whatever the world's projection
+#define BUILDING_SCALE (1e7)
+
+// building outlines, far more of them than any other feature so they are
+// columns rather than a struct and vec each. every ring is in one buffer,
+// without the point that closes it, and counter clockwise once measured
+struct buildings {
+	int length, capacity;
+	id *ids;
+	uint8_t *types; // enum building_type
+	uint32_t *offsets; // length + 1, into points
+
+	fixed_point *points;
+	uint32_t n_points, points_capacity;
+
+	// set by buildings_measure
+	float *areas; // square metres
+	fixed_point *centroids;
+	bool measured;
+};
+
+void buildings_init(struct buildings *b);
+
+void buildings_free(struct buildings *b);
+
+// appends a ring of n points, the closing one already left out. points
+// NULL leaves them zeroed for buildings_place to fill in
+int buildings_add(struct buildings *b, id id, enum building_type type, const point *points, uint32_t n);
+
+void buildings_place(struct buildings *b, uint32_t building, uint32_t index, point pos);
+
+// undoes the last buildings_add
+void buildings_pop(struct buildings *b);
+
+// appends building i of src
+int buildings_copy(struct buildings *dst, const struct buildings *src, int i);
+
+// drops the buildings marked in drop, the rest keep their order
+void buildings_drop(struct buildings *b, const bool *drop);
+
+static inline uint32_t building_ring_length(const struct buildings *b, int i) {
+	return b->offsets[i + 1] - b->offsets[i];
+}
+
+// area and centroid of every ring on the local tangent plane, turning
+// clockwise rings around. split over threads workers (<= 0 for one a
+// cpu), small inputs stay on the caller
+int buildings_measure(struct buildings *b, int threads);
+
+#endif
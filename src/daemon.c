@@ -0,0 +1,790 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "daemon.h"
+#include "index.h"
+#include "world.h"
+#include "pool.h"
+#include "alloc.h"
+#include "error.h"
+#include "osm/osm.h"
+
+// requests a connection can have in flight before it stops being read
+#define MAX_PENDING (64)
+
+#define READ_CHUNK (4096)
+
+// a world and its index, freed when the last query using it is done
+struct snapshot {
+	struct world world;
+	struct spatial_index index;
+	uint64_t generation;
+	atomic_int refs;
+};
+
+struct buffer {
+	char *data;
+	size_t len, cap;
+};
+
+struct conn {
+	int fd;
+	struct buffer in;
+	struct buffer out;
+	size_t out_sent;
+
+	int pending; // jobs in flight, only touched by the loop
+	bool closed;
+	uint32_t events;
+
+	// open connections, so they can be shut at the end
+	struct conn *prev, *next;
+};
+
+struct daemon;
+
+struct job {
+	struct daemon *d;
+	struct conn *conn;
+	struct snapshot *snap;
+
+	struct frame_header header;
+	char body[PROTOCOL_MAX_REQUEST];
+
+	struct buffer reply;
+	struct job *next;
+};
+
+struct daemon {
+	const struct daemon_config *cfg;
+	int epoll_fd, listen_fd, event_fd, signal_fd;
+	struct pool pool;
+	struct snapshot *current;
+	struct conn *conns;
+	struct conn *dead; // closed, freed once their jobs are back
+	bool stopping;
+
+	// finished jobs and loads, handed back to the loop through event_fd
+	pthread_mutex_t lock;
+	struct job *done;
+	bool load_done;
+	int load_ret;
+	struct snapshot *loaded;
+
+	bool loading;
+	pthread_t loader;
+};
+
+static bool reserve(struct buffer *b, size_t extra) {
+	if (b->len + extra <= b->cap)
+		return true;
+
+	size_t cap = b->cap > 0 ? b->cap : 256;
+	while (cap < b->len + extra)
+		cap *= 2;
+
+	char *data = alloc_realloc(ALLOC_OTHER, b->data, cap);
+	if (data == NULL)
+		return false;
+	b->data = data;
+	b->cap = cap;
+	return true;
+}
+
+static bool append(struct buffer *b, const void *data, size_t len) {
+	if (!reserve(b, len))
+		return false;
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return true;
+}
+
+static void release(struct snapshot *snap) {
+	if (atomic_fetch_sub(&snap->refs, 1) != 1)
+		return;
+
+	index_free(&snap->index);
+	free_world(&snap->world);
+	alloc_free(ALLOC_OTHER, snap);
+}
+
+static int load_snapshot(const struct daemon_config *cfg, uint64_t generation, struct snapshot **out) {
+	struct snapshot *snap = alloc_calloc(ALLOC_OTHER, 1, sizeof(struct snapshot));
+	if (snap == NULL)
+		return ERR_MEM;
+
+	int ret = cfg->load(cfg->load_ctx, &snap->world);
+	if (ret != CRACKING) {
+		alloc_free(ALLOC_OTHER, snap);
+		return ret;
+	}
+
+	if ((ret = index_build(&snap->index, &snap->world, cfg->threads)) != CRACKING) {
+		free_world(&snap->world);
+		alloc_free(ALLOC_OTHER, snap);
+		return ret;
+	}
+
+	snap->generation = generation;
+	atomic_init(&snap->refs, 1);
+	*out = snap;
+	return CRACKING;
+}
+
+// answering, on the workers
+
+static void feature_info(const struct world *world, uint32_t n_roads, uint32_t f,
+		int64_t *id, uint8_t *kind, uint8_t *type, const vec_point_t **points) {
+	if (f < n_roads) {
+		const struct road *r = &world->roads.data[f];
+		*id = r->id;
+		*kind = FEATURE_ROAD;
+		*type = (uint8_t) r->type;
+		*points = &r->segments;
+	} else {
+		const struct land_use *l = &world->land_uses.data[f - n_roads];
+		*id = l->id;
+		*kind = FEATURE_LAND_USE;
+		*type = (uint8_t) l->type;
+		*points = &l->points;
+	}
+}
+
+struct bbox_visit {
+	const struct snapshot *snap;
+	struct buffer *reply;
+	uint32_t count, limit;
+	bool failed;
+};
+
+static bool visit_bbox(uint32_t feature, void *arg) {
+	struct bbox_visit *v = arg;
+	struct reply_feature_ref ref = {0};
+	const vec_point_t *points;
+	feature_info(&v->snap->world, v->snap->index.n_roads, feature, &ref.id, &ref.kind, &ref.type, &points);
+	ref.points = (uint32_t) points->length;
+
+	if (!append(v->reply, &ref, sizeof(ref))) {
+		v->failed = true;
+		return false;
+	}
+	return ++v->count != v->limit;
+}
+
+static enum reply_status answer_bbox(const struct snapshot *snap, const struct query_bbox *q, struct buffer *reply) {
+	size_t count_at = reply->len;
+	uint32_t count = 0;
+	if (!append(reply, &count, sizeof(count)))
+		return REPLY_ERROR;
+
+	struct bbox_visit v = {snap, reply, 0, q->limit, false};
+	struct bbox box = {{q->min_lat, q->min_lon}, {q->max_lat, q->max_lon}};
+	index_query_bbox(&snap->index, box, visit_bbox, &v);
+	if (v.failed)
+		return REPLY_ERROR;
+
+	memcpy(reply->data + count_at, &v.count, sizeof(v.count));
+	return REPLY_OK;
+}
+
+static enum reply_status answer_feature(const struct snapshot *snap, const struct query_feature *q, struct buffer *reply) {
+	uint32_t f;
+	if (!index_find_id(&snap->index, q->id, &f))
+		return REPLY_NOT_FOUND;
+
+	struct reply_feature out = {0};
+	const vec_point_t *points;
+	feature_info(&snap->world, snap->index.n_roads, f, &out.id, &out.kind, &out.type, &points);
+	out.points = (uint32_t) points->length;
+
+	const char *name = out.kind == FEATURE_ROAD ? snap->world.roads.data[f].name : NULL;
+	size_t name_len = name != NULL ? strlen(name) : 0;
+	out.name_len = (uint16_t) (name_len > UINT16_MAX ? UINT16_MAX : name_len);
+
+	// point is two doubles, the same as on the wire
+	bool ok = append(reply, &out, sizeof(out))
+		&& append(reply, name, out.name_len)
+		&& append(reply, points->data, points->length * sizeof(point));
+	return ok ? REPLY_OK : REPLY_ERROR;
+}
+
+static enum reply_status answer_nearest(const struct snapshot *snap, const struct query_nearest *q, struct buffer *reply) {
+	uint32_t road;
+	struct reply_nearest out = {0};
+	point closest;
+	if (!index_nearest_road(&snap->index, (point) {q->lat, q->lon}, &road, &out.distance, &closest))
+		return REPLY_NOT_FOUND;
+
+	out.id = snap->world.roads.data[road].id;
+	out.lat = closest.lat;
+	out.lon = closest.lon;
+	return append(reply, &out, sizeof(out)) ? REPLY_OK : REPLY_ERROR;
+}
+
+static enum reply_status answer_info(const struct snapshot *snap, struct buffer *reply) {
+	const struct bbox *e = &snap->index.extent;
+	struct reply_info out = {
+		.generation = snap->generation,
+		.roads = (uint32_t) snap->world.roads.length,
+		.land_uses = (uint32_t) snap->world.land_uses.length,
+		.min_lat = e->min.lat, .min_lon = e->min.lon,
+		.max_lat = e->max.lat, .max_lon = e->max.lon
+	};
+	return append(reply, &out, sizeof(out)) ? REPLY_OK : REPLY_ERROR;
+}
+
+static enum reply_status answer(const struct snapshot *snap, const struct frame_header *h, const char *body, struct buffer *reply) {
+	switch (h->op) {
+		case QUERY_INFO:
+			return answer_info(snap, reply);
+
+		case QUERY_BBOX: {
+			struct query_bbox q;
+			if (h->length != sizeof(q))
+				return REPLY_BAD_REQUEST;
+			memcpy(&q, body, sizeof(q));
+			return answer_bbox(snap, &q, reply);
+		}
+
+		case QUERY_FEATURE: {
+			struct query_feature q;
+			if (h->length != sizeof(q))
+				return REPLY_BAD_REQUEST;
+			memcpy(&q, body, sizeof(q));
+			return answer_feature(snap, &q, reply);
+		}
+
+		case QUERY_NEAREST: {
+			struct query_nearest q;
+			if (h->length != sizeof(q))
+				return REPLY_BAD_REQUEST;
+			memcpy(&q, body, sizeof(q));
+			return answer_nearest(snap, &q, reply);
+		}
+
+		default:
+			return REPLY_BAD_REQUEST;
+	}
+}
+
+static void hand_back(struct daemon *d, struct job *job) {
+	pthread_mutex_lock(&d->lock);
+	if (job != NULL) {
+		job->next = d->done;
+		d->done = job;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	uint64_t one = 1;
+	if (write(d->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		perror("eventfd");
+}
+
+static void run_job(void *arg) {
+	struct job *job = arg;
+	struct frame_header reply = {0};
+	reply.tag = job->header.tag;
+
+	// the header goes first, its length is known at the end
+	job->reply.len = 0;
+	enum reply_status status = REPLY_ERROR;
+	if (append(&job->reply, &reply, sizeof(reply))) {
+		status = answer(job->snap, &job->header, job->body, &job->reply);
+		if (status != REPLY_OK)
+			job->reply.len = sizeof(reply);
+
+		reply.op = (uint8_t) status;
+		reply.length = (uint32_t) (job->reply.len - sizeof(reply));
+		memcpy(job->reply.data, &reply, sizeof(reply));
+	}
+
+	release(job->snap);
+	job->snap = NULL;
+	hand_back(job->d, job);
+}
+
+static void *run_loader(void *arg) {
+	struct daemon *d = arg;
+	struct snapshot *snap = NULL;
+	int ret = load_snapshot(d->cfg, d->current->generation + 1, &snap);
+
+	pthread_mutex_lock(&d->lock);
+	d->load_done = true;
+	d->load_ret = ret;
+	d->loaded = snap;
+	pthread_mutex_unlock(&d->lock);
+
+	hand_back(d, NULL);
+	return NULL;
+}
+
+// the event loop
+
+static void watch(struct daemon *d, struct conn *c) {
+	uint32_t events = 0;
+	if (c->pending < MAX_PENDING)
+		events |= EPOLLIN;
+	if (c->out_sent < c->out.len)
+		events |= EPOLLOUT;
+
+	if (events == c->events)
+		return;
+
+	struct epoll_event ev = {.events = events, .data.ptr = c};
+	epoll_ctl(d->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->events = events;
+}
+
+static void free_conn(struct conn *c) {
+	alloc_free(ALLOC_OTHER, c->in.data);
+	alloc_free(ALLOC_OTHER, c->out.data);
+	alloc_free(ALLOC_OTHER, c);
+}
+
+// the connection lives on until its jobs are back
+static void close_conn(struct daemon *d, struct conn *c) {
+	if (c->closed)
+		return;
+
+	epoll_ctl(d->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->closed = true;
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		d->conns = c->next;
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+
+	c->next = d->dead;
+	d->dead = c;
+}
+
+// after a batch of events, so none of them can point at a freed conn
+static void sweep_dead(struct daemon *d) {
+	struct conn **link = &d->dead;
+	while (*link != NULL) {
+		struct conn *c = *link;
+		if (c->pending > 0) {
+			link = &c->next;
+			continue;
+		}
+
+		*link = c->next;
+		free_conn(c);
+	}
+}
+
+static void flush_conn(struct daemon *d, struct conn *c) {
+	while (c->out_sent < c->out.len) {
+		ssize_t n = send(c->fd, c->out.data + c->out_sent, c->out.len - c->out_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				close_conn(d, c);
+			break;
+		}
+		c->out_sent += n;
+	}
+
+	if (!c->closed && c->out_sent == c->out.len)
+		c->out.len = c->out_sent = 0;
+}
+
+// queues every complete frame, as far as the pending limit allows. false
+// if the connection broke the protocol
+static bool dispatch_frames(struct daemon *d, struct conn *c) {
+	size_t off = 0;
+	bool ok = true;
+
+	while (!d->stopping && c->pending < MAX_PENDING && c->in.len - off >= sizeof(struct frame_header)) {
+		struct frame_header h;
+		memcpy(&h, c->in.data + off, sizeof(h));
+		if (h.length > PROTOCOL_MAX_REQUEST) {
+			ok = false;
+			break;
+		}
+		if (c->in.len - off < sizeof(h) + h.length)
+			break;
+
+		struct job *job = alloc_calloc(ALLOC_OTHER, 1, sizeof(struct job));
+		if (job == NULL)
+			break;
+
+		job->d = d;
+		job->conn = c;
+		job->header = h;
+		memcpy(job->body, c->in.data + off + sizeof(h), h.length);
+		job->snap = d->current;
+		atomic_fetch_add(&job->snap->refs, 1);
+		off += sizeof(h) + h.length;
+
+		c->pending++;
+		if (pool_submit(&d->pool, run_job, job) != CRACKING)
+			run_job(job);
+	}
+
+	memmove(c->in.data, c->in.data + off, c->in.len - off);
+	c->in.len -= off;
+	return ok;
+}
+
+static void read_conn(struct daemon *d, struct conn *c) {
+	while (true) {
+		if (!reserve(&c->in, READ_CHUNK)) {
+			close_conn(d, c);
+			return;
+		}
+
+		ssize_t n = recv(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len, 0);
+		if (n > 0) {
+			c->in.len += n;
+
+			// a client far ahead of its replies waits in the socket
+			if (c->in.len >= MAX_PENDING * (sizeof(struct frame_header) + PROTOCOL_MAX_REQUEST))
+				break;
+			continue;
+		}
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			close_conn(d, c);
+			return;
+		}
+		break;
+	}
+
+	if (!dispatch_frames(d, c)) {
+		close_conn(d, c);
+		return;
+	}
+	watch(d, c);
+}
+
+static void accept_conns(struct daemon *d) {
+	while (true) {
+		int fd = accept4(d->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		struct conn *c = alloc_calloc(ALLOC_OTHER, 1, sizeof(struct conn));
+		if (c == NULL) {
+			close(fd);
+			continue;
+		}
+
+		c->fd = fd;
+		c->events = EPOLLIN;
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+		if (epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			close(fd);
+			free_conn(c);
+			continue;
+		}
+
+		c->next = d->conns;
+		if (d->conns != NULL)
+			d->conns->prev = c;
+		d->conns = c;
+	}
+}
+
+static void swap_in(struct daemon *d, struct snapshot *snap) {
+	struct snapshot *old = d->current;
+	d->current = snap;
+	release(old);
+
+	fprintf(stderr, "serving world %lu: %d roads, %d land uses\n", (unsigned long) snap->generation,
+			snap->world.roads.length, snap->world.land_uses.length);
+}
+
+static void collect_done(struct daemon *d) {
+	uint64_t count;
+	if (read(d->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		perror("eventfd");
+
+	pthread_mutex_lock(&d->lock);
+	struct job *job = d->done;
+	d->done = NULL;
+	bool load_done = d->load_done;
+	d->load_done = false;
+	pthread_mutex_unlock(&d->lock);
+
+	while (job != NULL) {
+		struct job *next = job->next;
+		struct conn *c = job->conn;
+		c->pending--;
+
+		if (!c->closed) {
+			if (!append(&c->out, job->reply.data, job->reply.len))
+				close_conn(d, c);
+			else
+				flush_conn(d, c);
+
+			// frames held back by the pending limit
+			if (!c->closed && !dispatch_frames(d, c))
+				close_conn(d, c);
+			if (!c->closed)
+				watch(d, c);
+		}
+
+		alloc_free(ALLOC_OTHER, job->reply.data);
+		alloc_free(ALLOC_OTHER, job);
+		job = next;
+	}
+
+	if (load_done) {
+		pthread_join(d->loader, NULL);
+		d->loading = false;
+		if (d->load_ret == CRACKING)
+			swap_in(d, d->loaded);
+		else
+			fprintf(stderr, "reload failed, still serving world %lu: %s\n",
+					(unsigned long) d->current->generation, error_get_message(d->load_ret));
+		d->loaded = NULL;
+	}
+}
+
+static void handle_signal(struct daemon *d) {
+	struct signalfd_siginfo info;
+	while (read(d->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo != SIGHUP) {
+			d->stopping = true;
+			continue;
+		}
+
+		if (d->loading)
+			continue;
+		if (pthread_create(&d->loader, NULL, run_loader, d) == 0)
+			d->loading = true;
+	}
+}
+
+static int listen_on(const char *path, int *out) {
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return ERR_UNSUPPORTED;
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return ERR_IO;
+
+	// a stale socket from a daemon that didn't get to clean up
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+		close(fd);
+		return ERR_IO;
+	}
+
+	*out = fd;
+	return CRACKING;
+}
+
+static int add_fd(struct daemon *d, int fd) {
+	struct epoll_event ev = {.events = EPOLLIN, .data.u64 = (uint64_t) fd};
+	return epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0 ? CRACKING : ERR_IO;
+}
+
+static void serve(struct daemon *d) {
+	struct epoll_event events[64];
+
+	while (!d->stopping) {
+		int n = epoll_wait(d->epoll_fd, events, 64, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return;
+		}
+
+		for (int i = 0; i < n; i++) {
+			// fds of the daemon itself are registered by number, clients by
+			// conn pointer, which is never that small
+			uint64_t key = events[i].data.u64;
+			if (key == (uint64_t) d->listen_fd)
+				accept_conns(d);
+			else if (key == (uint64_t) d->event_fd)
+				collect_done(d);
+			else if (key == (uint64_t) d->signal_fd)
+				handle_signal(d);
+		}
+
+		for (int i = 0; i < n; i++) {
+			uint64_t key = events[i].data.u64;
+			if (key == (uint64_t) d->listen_fd || key == (uint64_t) d->event_fd || key == (uint64_t) d->signal_fd)
+				continue;
+
+			struct conn *c = events[i].data.ptr;
+			if (c->closed)
+				continue;
+			if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+				close_conn(d, c);
+				continue;
+			}
+			if (events[i].events & EPOLLOUT) {
+				flush_conn(d, c);
+				if (!c->closed)
+					watch(d, c);
+			}
+			if (!c->closed && events[i].events & EPOLLIN)
+				read_conn(d, c);
+		}
+
+		sweep_dead(d);
+	}
+}
+
+int daemon_run(const struct daemon_config *cfg) {
+	struct daemon d = {.cfg = cfg, .epoll_fd = -1, .listen_fd = -1, .event_fd = -1, .signal_fd = -1};
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	int ret = load_snapshot(cfg, 1, &d.current);
+	if (ret != CRACKING)
+		return ret;
+	fprintf(stderr, "serving world 1: %d roads, %d land uses\n",
+			d.current->world.roads.length, d.current->world.land_uses.length);
+
+	pthread_mutex_init(&d.lock, NULL);
+	d.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	d.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	d.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (d.epoll_fd < 0 || d.event_fd < 0 || d.signal_fd < 0)
+		ret = ERR_IO;
+
+	if (ret == CRACKING)
+		ret = listen_on(cfg->socket_path, &d.listen_fd);
+	if (ret == CRACKING)
+		ret = pool_init(&d.pool, cfg->threads);
+
+	if (ret == CRACKING && (add_fd(&d, d.listen_fd) != CRACKING || add_fd(&d, d.event_fd) != CRACKING
+				|| add_fd(&d, d.signal_fd) != CRACKING))
+		ret = ERR_IO;
+
+	if (ret == CRACKING) {
+		serve(&d);
+
+		// queries in flight get their answers sent, then everyone is let go
+		pool_free(&d.pool);
+		if (d.loading) {
+			pthread_join(d.loader, NULL);
+			d.loading = d.load_done = false;
+			if (d.loaded != NULL)
+				release(d.loaded);
+		}
+		collect_done(&d);
+		while (d.conns != NULL)
+			close_conn(&d, d.conns);
+		sweep_dead(&d);
+		unlink(cfg->socket_path);
+	} else if (d.pool.threads != NULL) {
+		pool_free(&d.pool);
+	}
+
+	if (d.listen_fd >= 0)
+		close(d.listen_fd);
+	if (d.signal_fd >= 0)
+		close(d.signal_fd);
+	if (d.event_fd >= 0)
+		close(d.event_fd);
+	if (d.epoll_fd >= 0)
+		close(d.epoll_fd);
+	pthread_mutex_destroy(&d.lock);
+	release(d.current);
+	return ret;
+}
+
+// client side
+
+static int send_all(int fd, const void *data, size_t len) {
+	const char *p = data;
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return ERR_IO;
+		p += n;
+		len -= n;
+	}
+	return CRACKING;
+}
+
+static int recv_all(int fd, void *data, size_t len) {
+	char *p = data;
+	while (len > 0) {
+		ssize_t n = recv(fd, p, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return ERR_IO;
+		p += n;
+		len -= n;
+	}
+	return CRACKING;
+}
+
+int daemon_connect(const char *socket_path, int *fd) {
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+		return ERR_UNSUPPORTED;
+	strcpy(addr.sun_path, socket_path);
+
+	int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s < 0)
+		return ERR_IO;
+	if (connect(s, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		close(s);
+		return ERR_FILE_NOT_FOUND;
+	}
+
+	*fd = s;
+	return CRACKING;
+}
+
+int daemon_send(int fd, enum query_op op, uint32_t tag, const void *body, uint32_t len) {
+	char frame[sizeof(struct frame_header) + PROTOCOL_MAX_REQUEST];
+	struct frame_header h = {.length = len, .tag = tag, .op = (uint8_t) op};
+	if (len > PROTOCOL_MAX_REQUEST)
+		return ERR_UNSUPPORTED;
+
+	memcpy(frame, &h, sizeof(h));
+	if (len > 0)
+		memcpy(frame + sizeof(h), body, len);
+	return send_all(fd, frame, sizeof(h) + len);
+}
+
+int daemon_receive(int fd, struct frame_header *header, void **body, size_t *cap) {
+	int ret = recv_all(fd, header, sizeof(*header));
+	if (ret != CRACKING)
+		return ret;
+
+	if (header->length > *cap) {
+		void *grown = realloc(*body, header->length);
+		if (grown == NULL)
+			return ERR_MEM;
+		*body = grown;
+		*cap = header->length;
+	}
+	return recv_all(fd, *body, header->length);
+}
@@ -0,0 +1,36 @@
+#ifndef OSM_DAEMON
+#define OSM_DAEMON
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+struct world;
+
+// builds the world to serve, at start and again on each SIGHUP
+typedef int world_loader(void *ctx, struct world *out);
+
+struct daemon_config {
+	const char *socket_path;
+	int threads; // query workers, <= 0 for one per cpu
+	world_loader *load;
+	void *load_ctx;
+};
+
+// loads the world then answers queries on a unix socket until SIGINT or
+// SIGTERM. SIGHUP loads a new world on a thread of its own and swaps it in
+// when it is ready, queries already running finish on the old one. the
+// signals are blocked in the calling thread, other threads must have them
+// blocked too
+int daemon_run(const struct daemon_config *cfg);
+
+// client side, blocking
+int daemon_connect(const char *socket_path, int *fd);
+
+int daemon_send(int fd, enum query_op op, uint32_t tag, const void *body, uint32_t len);
+
+// body is grown as needed, cap is its size
+int daemon_receive(int fd, struct frame_header *header, void **body, size_t *cap);
+
+#endif
@@ -0,0 +1,642 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "diff.h"
+#include "world.h"
+#include "pool.h"
+#include "alloc.h"
+#include "error.h"
+
+// features before hashing goes to the pool
+#define PARALLEL_MIN (1 << 10)
+
+#define EMPTY (UINT32_MAX)
+
+// unchanged, for a feature of the new world in diff_write
+#define DIFF_SAME (0xff)
+
+// open addressed on kind and id
+struct diff_slot {
+	int64_t id;
+	uint64_t hash;
+	uint32_t index; // into its kind's vec, EMPTY for a free slot
+	uint8_t kind;
+};
+
+// a record of a delta being applied, pointing into the file
+struct record {
+	const struct diff_record *rec;
+	const struct diff_body *body;
+	const point *points;
+	const id *way_ids;
+	const char *name;
+	uint64_t hash;
+
+	bool built;
+	union {
+		struct road road;
+		struct land_use land_use;
+	} feature;
+};
+
+double diff_scale(const struct world *world) {
+	if (world->projection == PROJECT_NONE)
+		return 1e7;
+	return world->fixed_scale > 0 ? world->fixed_scale : 1e3;
+}
+
+// only ever arithmetic on values rather than their bytes, so the hash is
+// the same whatever the byte order
+static uint64_t mix(uint64_t h, uint64_t v) {
+	h ^= v * 0x9e3779b97f4a7c15ULL;
+	return (h << 31 | h >> 33) * 0xc2b2ae3d27d4eb4fULL;
+}
+
+static uint64_t finish(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	return h ^ (h >> 33);
+}
+
+static uint64_t hash_feature(enum feature_kind kind, id id, int type, const char *name, size_t name_len,
+		const point *points, uint32_t n, double scale) {
+	uint64_t h = mix(0x6f736d2064696666ULL, kind);
+	h = mix(h, (uint64_t) id);
+	h = mix(h, (uint64_t) type);
+
+	// no name and an empty one differ
+	h = mix(h, name == NULL ? UINT64_MAX : name_len);
+	for (size_t i = 0; name != NULL && i < name_len; i += 8) {
+		uint64_t word = 0;
+		for (size_t j = 0; j < 8 && i + j < name_len; j++)
+			word |= (uint64_t) (unsigned char) name[i + j] << (j * 8);
+		h = mix(h, word);
+	}
+
+	h = mix(h, n);
+	for (uint32_t i = 0; i < n; i++) {
+		h = mix(h, (uint64_t) llround(points[i].lat * scale));
+		h = mix(h, (uint64_t) llround(points[i].lon * scale));
+	}
+	return finish(h);
+}
+
+uint64_t diff_hash_road(const struct road *r, double scale) {
+	return hash_feature(FEATURE_ROAD, r->id, r->type, r->name, r->name != NULL ? strlen(r->name) : 0,
+			r->segments.data, (uint32_t) r->segments.length, scale);
+}
+
+uint64_t diff_hash_land_use(const struct land_use *l, double scale) {
+	return hash_feature(FEATURE_LAND_USE, l->id, l->type, NULL, 0, l->points.data, (uint32_t) l->points.length, scale);
+}
+
+struct hash_job {
+	const struct world *world;
+	double scale;
+	uint64_t *out;
+};
+
+// roads first then land uses
+static void hash_chunk(void *ctx, int chunk, size_t from, size_t to) {
+	(void) chunk;
+	struct hash_job *job = ctx;
+	const struct world *w = job->world;
+	for (int i = (int) from; i < (int) to; i++) {
+		job->out[i] = i < w->roads.length
+			? diff_hash_road(&w->roads.data[i], job->scale)
+			: diff_hash_land_use(&w->land_uses.data[i - w->roads.length], job->scale);
+	}
+}
+
+int diff_hash_world(const struct world *world, int threads, uint64_t *out) {
+	struct hash_job job = {world, diff_scale(world), out};
+	pool_for_chunks(world->roads.length + world->land_uses.length, PARALLEL_MIN, threads, hash_chunk, &job);
+	return CRACKING;
+}
+
+static size_t key_slot(uint8_t kind, id id) {
+	return (size_t) ((((uint64_t) id * 2 + kind) * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+// room for n keys at most half full
+static int table_init(struct diff_index *idx, size_t n) {
+	size_t cap = 16;
+	while (cap < n * 2)
+		cap *= 2;
+
+	idx->slots = alloc_malloc(ALLOC_OTHER, cap * sizeof(struct diff_slot));
+	if (idx->slots == NULL)
+		return ERR_MEM;
+	idx->mask = cap - 1;
+	idx->used = 0;
+	for (size_t i = 0; i < cap; i++)
+		idx->slots[i].index = EMPTY;
+	return CRACKING;
+}
+
+static struct diff_slot *table_find(const struct diff_index *idx, uint8_t kind, id id) {
+	for (size_t s = key_slot(kind, id) & idx->mask; idx->slots[s].index != EMPTY; s = (s + 1) & idx->mask) {
+		struct diff_slot *slot = &idx->slots[s];
+		if (slot->id == id && slot->kind == kind)
+			return slot;
+	}
+	return NULL;
+}
+
+// false if the key is there already
+static bool table_insert(struct diff_index *idx, uint8_t kind, id id, uint32_t index, uint64_t hash) {
+	size_t s = key_slot(kind, id) & idx->mask;
+	for (; idx->slots[s].index != EMPTY; s = (s + 1) & idx->mask) {
+		if (idx->slots[s].id == id && idx->slots[s].kind == kind)
+			return false;
+	}
+	idx->slots[s] = (struct diff_slot) {id, hash, index, kind};
+	idx->used++;
+	return true;
+}
+
+// shifts the rest of the run back over the hole, so there are no
+// tombstones to build up over many deltas
+static void table_remove(struct diff_index *idx, struct diff_slot *slot) {
+	size_t hole = slot - idx->slots;
+	for (size_t s = (hole + 1) & idx->mask; idx->slots[s].index != EMPTY; s = (s + 1) & idx->mask) {
+		size_t home = key_slot(idx->slots[s].kind, idx->slots[s].id) & idx->mask;
+		// only if the hole is between its home and where it is now
+		if (((s - home) & idx->mask) >= ((s - hole) & idx->mask)) {
+			idx->slots[hole] = idx->slots[s];
+			hole = s;
+		}
+	}
+	idx->slots[hole].index = EMPTY;
+	idx->used--;
+}
+
+static int table_reserve(struct diff_index *idx, size_t extra) {
+	if ((idx->used + extra) * 2 <= idx->mask + 1)
+		return CRACKING;
+
+	struct diff_index grown = *idx;
+	int ret = table_init(&grown, idx->used + extra);
+	if (ret != CRACKING)
+		return ret;
+
+	for (size_t i = 0; i <= idx->mask; i++) {
+		const struct diff_slot *s = &idx->slots[i];
+		if (s->index != EMPTY)
+			table_insert(&grown, s->kind, s->id, s->index, s->hash);
+	}
+	alloc_free(ALLOC_OTHER, idx->slots);
+	*idx = grown;
+	return CRACKING;
+}
+
+int diff_index_build(struct diff_index *idx, const struct world *world, int threads) {
+	memset(idx, 0, sizeof(*idx));
+	idx->scale = diff_scale(world);
+
+	int n = world->roads.length + world->land_uses.length;
+	uint64_t *hashes = alloc_malloc(ALLOC_OTHER, (n > 0 ? n : 1) * sizeof(uint64_t));
+	if (hashes == NULL)
+		return ERR_MEM;
+
+	int ret = table_init(idx, n);
+	if (ret == CRACKING)
+		ret = diff_hash_world(world, threads, hashes);
+
+	for (int i = 0; ret == CRACKING && i < n; i++) {
+		bool road = i < world->roads.length;
+		uint8_t kind = road ? FEATURE_ROAD : FEATURE_LAND_USE;
+		id id = road ? world->roads.data[i].id : world->land_uses.data[i - world->roads.length].id;
+		uint32_t index = road ? i : i - world->roads.length;
+
+		// a feature could not be told apart from another
+		if (!table_insert(idx, kind, id, index, hashes[i]))
+			ret = ERR_OSM;
+		idx->digest ^= hashes[i];
+	}
+
+	alloc_free(ALLOC_OTHER, hashes);
+	if (ret != CRACKING)
+		diff_index_free(idx);
+	return ret;
+}
+
+void diff_index_free(struct diff_index *idx) {
+	alloc_free(ALLOC_OTHER, idx->slots);
+	memset(idx, 0, sizeof(*idx));
+}
+
+static bool write_zeros(FILE *f, size_t n) {
+	static const char zeros[8];
+	return n == 0 || fwrite(zeros, n, 1, f) == 1;
+}
+
+// feature i of the world, roads first then land uses
+static bool write_feature(FILE *f, enum diff_op op, const struct world *w, int i) {
+	struct diff_record rec = {.op = op};
+	struct diff_body body = {0};
+	const point *points;
+	const id *way_ids = NULL;
+	const char *name = NULL;
+
+	if (i < w->roads.length) {
+		const struct road *r = &w->roads.data[i];
+		rec.id = r->id;
+		rec.kind = FEATURE_ROAD;
+		rec.type = (uint8_t) r->type;
+		rec.named = r->name != NULL;
+		rec.points = (uint32_t) r->segments.length;
+		points = r->segments.data;
+
+		body.first_node = r->first_node;
+		body.last_node = r->last_node;
+		body.way_ids = (uint32_t) r->way_ids.length;
+		way_ids = r->way_ids.data;
+		name = r->name;
+		body.name_len = name != NULL ? (uint32_t) strlen(name) : 0;
+	} else {
+		const struct land_use *l = &w->land_uses.data[i - w->roads.length];
+		rec.id = l->id;
+		rec.kind = FEATURE_LAND_USE;
+		rec.type = (uint8_t) l->type;
+		rec.points = (uint32_t) l->points.length;
+		points = l->points.data;
+	}
+
+	if (op == DIFF_REMOVE) {
+		rec.type = rec.named = 0;
+		rec.points = 0;
+		return fwrite(&rec, sizeof(rec), 1, f) == 1;
+	}
+
+	return fwrite(&rec, sizeof(rec), 1, f) == 1
+		&& fwrite(&body, sizeof(body), 1, f) == 1
+		&& (rec.points == 0 || fwrite(points, sizeof(point), rec.points, f) == rec.points)
+		&& (body.way_ids == 0 || fwrite(way_ids, sizeof(id), body.way_ids, f) == body.way_ids)
+		&& (body.name_len == 0 || fwrite(name, body.name_len, 1, f) == 1)
+		&& write_zeros(f, -body.name_len & 7);
+}
+
+int diff_write(const struct world *old, const struct world *new, const char *path, int threads,
+		struct diff_counts *counts) {
+	if (old->projection != new->projection || diff_scale(old) != diff_scale(new))
+		return ERR_UNSUPPORTED;
+
+	struct diff_index idx;
+	int ret = diff_index_build(&idx, old, threads);
+	if (ret != CRACKING)
+		return ret;
+
+	int n_old = old->roads.length + old->land_uses.length;
+	int n_new = new->roads.length + new->land_uses.length;
+	uint64_t *hashes = alloc_malloc(ALLOC_OTHER, (n_new > 0 ? n_new : 1) * sizeof(uint64_t));
+	uint8_t *ops = alloc_malloc(ALLOC_OTHER, n_new > 0 ? n_new : 1);
+	bool *kept = alloc_calloc(ALLOC_OTHER, n_old > 0 ? n_old : 1, sizeof(bool));
+	FILE *f = NULL;
+	if (hashes == NULL || ops == NULL || kept == NULL) {
+		ret = ERR_MEM;
+		goto out;
+	}
+	diff_hash_world(new, threads, hashes);
+
+	// the join, probing the old world's table with every new feature
+	struct diff_header h = {
+		.magic = DIFF_MAGIC,
+		.version = DIFF_VERSION,
+		.projection = (uint8_t) new->projection,
+		.fixed_scale = new->fixed_scale,
+		.base_digest = idx.digest
+	};
+	uint32_t n_kept = 0;
+	for (int i = 0; i < n_new; i++) {
+		bool road = i < new->roads.length;
+		id id = road ? new->roads.data[i].id : new->land_uses.data[i - new->roads.length].id;
+		const struct diff_slot *slot = table_find(&idx, road ? FEATURE_ROAD : FEATURE_LAND_USE, id);
+		h.digest ^= hashes[i];
+
+		if (slot == NULL) {
+			ops[i] = DIFF_ADD;
+			h.added++;
+			continue;
+		}
+
+		int was = slot->kind == FEATURE_ROAD ? (int) slot->index : old->roads.length + (int) slot->index;
+		n_kept += !kept[was];
+		kept[was] = true;
+		ops[i] = slot->hash == hashes[i] ? DIFF_SAME : DIFF_CHANGE;
+		h.changed += ops[i] == DIFF_CHANGE;
+	}
+	h.removed = (uint32_t) n_old - n_kept;
+
+	if ((f = fopen(path, "wb")) == NULL) {
+		ret = ERR_IO;
+		goto out;
+	}
+
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	for (int i = 0; ok && i < n_old; i++) {
+		if (!kept[i])
+			ok = write_feature(f, DIFF_REMOVE, old, i);
+	}
+	for (int i = 0; ok && i < n_new; i++) {
+		if (ops[i] == DIFF_CHANGE)
+			ok = write_feature(f, DIFF_CHANGE, new, i);
+	}
+	for (int i = 0; ok && i < n_new; i++) {
+		if (ops[i] == DIFF_ADD)
+			ok = write_feature(f, DIFF_ADD, new, i);
+	}
+	if (fclose(f) != 0 || !ok)
+		ret = ERR_IO;
+
+	if (ret == CRACKING && counts != NULL)
+		*counts = (struct diff_counts) {h.removed, h.changed, h.added};
+
+out:
+	alloc_free(ALLOC_OTHER, hashes);
+	alloc_free(ALLOC_OTHER, ops);
+	alloc_free(ALLOC_OTHER, kept);
+	diff_index_free(&idx);
+	return ret;
+}
+
+static int read_delta(const char *path, char **out, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return ERR_FILE_NOT_FOUND;
+
+	long size;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		return ERR_IO;
+	}
+
+	// malloc's alignment keeps every record aligned too
+	char *buf = alloc_malloc(ALLOC_OTHER, size > 0 ? (size_t) size : 1);
+	if (buf == NULL) {
+		fclose(f);
+		return ERR_MEM;
+	}
+	if (fread(buf, 1, size, f) != (size_t) size) {
+		alloc_free(ALLOC_OTHER, buf);
+		fclose(f);
+		return ERR_IO;
+	}
+
+	fclose(f);
+	*out = buf;
+	*len = (size_t) size;
+	return CRACKING;
+}
+
+// checks every record fits and makes sense, and hashes what they carry
+static int parse_records(const char *buf, size_t len, const struct diff_header *h, double scale,
+		struct record *records, size_t n) {
+	size_t off = sizeof(struct diff_header);
+	for (size_t i = 0; i < n; i++) {
+		struct record *r = &records[i];
+		enum diff_op op = i < h->removed ? DIFF_REMOVE
+			: i < (size_t) h->removed + h->changed ? DIFF_CHANGE : DIFF_ADD;
+
+		if (len - off < sizeof(struct diff_record))
+			return ERR_DIFF;
+		const struct diff_record *rec = r->rec = (const struct diff_record *) (buf + off);
+		off += sizeof(struct diff_record);
+
+		bool road = rec->kind == FEATURE_ROAD;
+		if (rec->op != op || rec->kind > FEATURE_LAND_USE
+				|| rec->type >= (road ? ROAD_TYPE_COUNT : LANDUSE_TYPE_COUNT))
+			return ERR_DIFF;
+		if (op == DIFF_REMOVE)
+			continue;
+
+		if (len - off < sizeof(struct diff_body))
+			return ERR_DIFF;
+		const struct diff_body *body = r->body = (const struct diff_body *) (buf + off);
+		off += sizeof(struct diff_body);
+
+		size_t name_size = ((size_t) body->name_len + 7) & ~(size_t) 7;
+		size_t size = (size_t) rec->points * sizeof(point) + (size_t) body->way_ids * sizeof(id) + name_size;
+		if (len - off < size || (!road && (rec->named || body->way_ids > 0 || body->name_len > 0)))
+			return ERR_DIFF;
+
+		r->points = (const point *) (buf + off);
+		r->way_ids = (const id *) (buf + off + (size_t) rec->points * sizeof(point));
+		r->name = buf + off + size - name_size;
+		off += size;
+
+		// names are strings in the world
+		if (memchr(r->name, '\0', body->name_len) != NULL)
+			return ERR_DIFF;
+
+		r->hash = hash_feature(rec->kind, rec->id, rec->type, rec->named ? r->name : NULL, body->name_len,
+				r->points, rec->points, scale);
+	}
+	return off == len ? CRACKING : ERR_DIFF;
+}
+
+static void release_road(struct road *r) {
+	if (r->name != NULL)
+		alloc_free(ALLOC_TAGS, r->name);
+	if (r->segments.data != NULL)
+		alloc_vec_deinit(ALLOC_GEOMETRY, &r->segments);
+	if (r->way_ids.data != NULL)
+		alloc_vec_deinit(ALLOC_WAYS, &r->way_ids);
+}
+
+static void release_land_use(struct land_use *l) {
+	if (l->points.data != NULL)
+		alloc_vec_deinit(ALLOC_GEOMETRY, &l->points);
+}
+
+// the feature a change or addition carries, as it goes in the world
+static int build_feature(struct record *r) {
+	const struct diff_record *rec = r->rec;
+	vec_point_t *points;
+
+	memset(&r->feature, 0, sizeof(r->feature));
+	r->built = true;
+	if (rec->kind == FEATURE_ROAD) {
+		struct road *road = &r->feature.road;
+		road->id = rec->id;
+		road->type = rec->type;
+		road->first_node = r->body->first_node;
+		road->last_node = r->body->last_node;
+		points = &road->segments;
+
+		if (rec->named && (road->name = alloc_strndup(ALLOC_TAGS, r->name, r->body->name_len)) == NULL)
+			return ERR_MEM;
+
+		alloc_set_vec_tag(ALLOC_WAYS);
+		if (vec_reserve(&road->way_ids, (int) r->body->way_ids) != 0)
+			return ERR_MEM;
+		if (r->body->way_ids > 0)
+			memcpy(road->way_ids.data, r->way_ids, r->body->way_ids * sizeof(id));
+		road->way_ids.length = (int) r->body->way_ids;
+	} else {
+		struct land_use *l = &r->feature.land_use;
+		l->id = rec->id;
+		l->type = rec->type;
+		points = &l->points;
+	}
+
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	if (vec_reserve(points, (int) rec->points) != 0)
+		return ERR_MEM;
+	if (rec->points > 0)
+		memcpy(points->data, r->points, rec->points * sizeof(point));
+	points->length = (int) rec->points;
+	return CRACKING;
+}
+
+// the last feature of its kind takes the gap
+static void remove_feature(struct world *world, struct diff_index *idx, struct diff_slot *slot) {
+	uint32_t at = slot->index;
+	uint8_t kind = slot->kind;
+	table_remove(idx, slot);
+
+	id moved;
+	if (kind == FEATURE_ROAD) {
+		release_road(&world->roads.data[at]);
+		world->roads.data[at] = vec_pop(&world->roads);
+		if (at == (uint32_t) world->roads.length)
+			return;
+		moved = world->roads.data[at].id;
+	} else {
+		release_land_use(&world->land_uses.data[at]);
+		world->land_uses.data[at] = vec_pop(&world->land_uses);
+		if (at == (uint32_t) world->land_uses.length)
+			return;
+		moved = world->land_uses.data[at].id;
+	}
+	table_find(idx, kind, moved)->index = at;
+}
+
+int diff_apply(struct world *world, struct diff_index *idx, const char *path, struct diff_counts *counts) {
+	char *buf;
+	size_t len;
+	int ret = read_delta(path, &buf, &len);
+	if (ret != CRACKING)
+		return ret;
+
+	struct diff_header h;
+	if (len < sizeof(h)) {
+		alloc_free(ALLOC_OTHER, buf);
+		return ERR_UNSUPPORTED;
+	}
+	memcpy(&h, buf, sizeof(h));
+	if (h.magic != DIFF_MAGIC || h.version != DIFF_VERSION) {
+		alloc_free(ALLOC_OTHER, buf);
+		return ERR_UNSUPPORTED;
+	}
+	if (h.projection != world->projection || h.fixed_scale != world->fixed_scale || h.base_digest != idx->digest) {
+		alloc_free(ALLOC_OTHER, buf);
+		return ERR_DIFF;
+	}
+
+	// a count the file is too short for is turned away before it sizes
+	// anything, every record being at least a diff_record and a body
+	uint64_t least = (uint64_t) h.removed * sizeof(struct diff_record)
+		+ ((uint64_t) h.changed + h.added) * (sizeof(struct diff_record) + sizeof(struct diff_body));
+	if (least > len - sizeof(h)) {
+		alloc_free(ALLOC_OTHER, buf);
+		return ERR_DIFF;
+	}
+
+	size_t n = (size_t) h.removed + h.changed + h.added;
+	struct record *records = alloc_calloc(ALLOC_OTHER, n > 0 ? n : 1, sizeof(struct record));
+	struct diff_index seen = {0};
+	if (records == NULL || (ret = table_init(&seen, n)) != CRACKING) {
+		ret = ERR_MEM;
+		goto out;
+	}
+	if ((ret = parse_records(buf, len, &h, idx->scale, records, n)) != CRACKING)
+		goto out;
+
+	// every key once, removals and changes of features the world has and
+	// additions of ones it doesn't, leaving it with the digest promised
+	uint64_t digest = idx->digest;
+	int add_roads = 0, add_land_uses = 0;
+	for (size_t i = 0; i < n; i++) {
+		const struct diff_record *rec = records[i].rec;
+		const struct diff_slot *slot = table_find(idx, rec->kind, rec->id);
+		if (!table_insert(&seen, rec->kind, rec->id, 0, 0) || (slot != NULL) != (rec->op != DIFF_ADD)) {
+			ret = ERR_DIFF;
+			goto out;
+		}
+
+		if (slot != NULL)
+			digest ^= slot->hash;
+		if (rec->op != DIFF_REMOVE)
+			digest ^= records[i].hash;
+		if (rec->op == DIFF_ADD) {
+			add_roads += rec->kind == FEATURE_ROAD;
+			add_land_uses += rec->kind == FEATURE_LAND_USE;
+		}
+	}
+	if (digest != h.digest) {
+		ret = ERR_DIFF;
+		goto out;
+	}
+
+	// everything that can fail happens before the world is touched
+	for (size_t i = h.removed; i < n; i++) {
+		if ((ret = build_feature(&records[i])) != CRACKING)
+			goto out;
+	}
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	if (vec_reserve(&world->roads, world->roads.length + add_roads) != 0
+			|| vec_reserve(&world->land_uses, world->land_uses.length + add_land_uses) != 0
+			|| table_reserve(idx, h.added) != CRACKING) {
+		ret = ERR_MEM;
+		goto out;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		struct record *r = &records[i];
+		uint8_t kind = r->rec->kind;
+		struct diff_slot *slot = table_find(idx, kind, r->rec->id);
+		r->built = false;
+
+		if (r->rec->op == DIFF_REMOVE) {
+			remove_feature(world, idx, slot);
+		} else if (r->rec->op == DIFF_CHANGE) {
+			if (kind == FEATURE_ROAD) {
+				release_road(&world->roads.data[slot->index]);
+				world->roads.data[slot->index] = r->feature.road;
+			} else {
+				release_land_use(&world->land_uses.data[slot->index]);
+				world->land_uses.data[slot->index] = r->feature.land_use;
+			}
+			slot->hash = r->hash;
+		} else if (kind == FEATURE_ROAD) {
+			world->roads.data[world->roads.length++] = r->feature.road;
+			table_insert(idx, kind, r->rec->id, (uint32_t) world->roads.length - 1, r->hash);
+		} else {
+			world->land_uses.data[world->land_uses.length++] = r->feature.land_use;
+			table_insert(idx, kind, r->rec->id, (uint32_t) world->land_uses.length - 1, r->hash);
+		}
+	}
+	idx->digest = digest;
+
+	if (counts != NULL)
+		*counts = (struct diff_counts) {h.removed, h.changed, h.added};
+
+out:
+	for (size_t i = 0; records != NULL && i < n; i++) {
+		if (!records[i].built)
+			continue;
+		if (records[i].rec->kind == FEATURE_ROAD)
+			release_road(&records[i].feature.road);
+		else
+			release_land_use(&records[i].feature.land_use);
+	}
+	alloc_free(ALLOC_OTHER, records);
+	alloc_free(ALLOC_OTHER, seen.slots);
+	alloc_free(ALLOC_OTHER, buf);
+	return ret;
+}
@@ -0,0 +1,102 @@
+#ifndef OSM_DIFF
+#define OSM_DIFF
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osm/osm.h"
+#include "protocol.h"
+
+struct world;
+
+// deltas between two worlds of roads and land uses, matched by kind and id.
+// buildings are not diffed. the file is in host byte order: a diff_header,
+// then a diff_record per feature, removals then changes then additions, each
+// in the order of its world
+#define DIFF_MAGIC (0x4644534f) // "OSDF"
+#define DIFF_VERSION (1)
+
+enum diff_op {
+	DIFF_REMOVE = 0,
+	DIFF_CHANGE,
+	DIFF_ADD
+};
+
+struct diff_header {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t projection; // both worlds have the same one
+	uint8_t pad;
+	uint32_t fixed_scale;
+	uint32_t removed, changed, added;
+
+	// xor of the hash of every feature, in the world the delta applies to
+	// and in the one it makes
+	uint64_t base_digest, digest;
+};
+
+struct diff_record {
+	int64_t id;
+	uint8_t op;    // diff_op
+	uint8_t kind;  // feature_kind
+	uint8_t type;  // road_type or land_use_type
+	uint8_t named; // roads only, the name may still be empty
+	uint32_t points;
+};
+
+// after the record of a change or addition, followed by points lat/lon
+// doubles, way_ids ids and name_len bytes of name padded to 8
+struct diff_body {
+	int64_t first_node, last_node;
+	uint32_t way_ids;
+	uint32_t name_len;
+};
+
+struct diff_counts {
+	uint32_t removed, changed, added;
+};
+
+// grid the geometry is hashed on: 1e-7 degrees, or 1/fixed_scale (else a
+// millimetre) once projected
+double diff_scale(const struct world *world);
+
+// a content hash of id, type, name and quantized geometry, the same on any
+// machine for the same feature
+uint64_t diff_hash_road(const struct road *r, double scale);
+
+uint64_t diff_hash_land_use(const struct land_use *l, double scale);
+
+// every road's hash then every land use's, into out of roads + land uses.
+// split over threads workers (<= 0 for one a cpu), small worlds stay on
+// the caller
+int diff_hash_world(const struct world *world, int threads, uint64_t *out);
+
+struct diff_slot;
+
+// the features of a world by kind and id with their hashes, for applying
+// deltas to it. built once, then kept up to date by every diff_apply so
+// each costs only the size of its delta
+struct diff_index {
+	struct diff_slot *slots;
+	size_t mask, used;
+	double scale;
+	uint64_t digest;
+};
+
+int diff_index_build(struct diff_index *idx, const struct world *world, int threads);
+
+void diff_index_free(struct diff_index *idx);
+
+// writes to path what turns old into new, ERR_UNSUPPORTED if they are
+// projected differently. counts may be NULL
+int diff_write(const struct world *old, const struct world *new, const char *path, int threads,
+		struct diff_counts *counts);
+
+// applies a delta to the world idx was built from. a removal moves the
+// last feature of its kind into the gap and additions go on the end.
+// ERR_DIFF, and nothing changes, if the delta was made against another
+// world. counts may be NULL
+int diff_apply(struct world *world, struct diff_index *idx, const char *path, struct diff_counts *counts);
+
+#endif
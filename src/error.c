@@ -1,5 +1,9 @@
+#include <stdio.h>
+
 #include "error.h"
 
+FILE *err_stream = NULL;
+
 const char *error_get_message(int err)
 {
 	switch(err)
@@ -14,6 +18,14 @@ const char *error_get_message(int err)
 			return "Memory error";
 		case ERR_OSM:
 			return "OSM format error";
+		case ERR_UNSUPPORTED:
+			return "Unsupported input format";
+		case ERR_FILTER:
+			return "Invalid tag filter";
+		case ERR_RANGE:
+			return "Value out of range";
+		case ERR_DIFF:
+			return "Delta does not apply to this world";
 		default:
 			return "Unknown error code";
 	}
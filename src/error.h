@@ -7,6 +7,10 @@
 #define ERR_IO             (0x1001)
 #define ERR_MEM            (0x1002)
 #define ERR_OSM            (0x1003)
+#define ERR_UNSUPPORTED    (0x1004)
+#define ERR_FILTER         (0x1005)
+#define ERR_RANGE          (0x1006)
+#define ERR_DIFF           (0x1007)
 
 const char *error_get_message(int err);
 
@@ -0,0 +1,175 @@
+#include <math.h>
+
+#include "geodesic.h"
+#include "simd.h"
+
+#define WGS84_A (6378137.0)
+#define WGS84_E2 (0.00669437999014) // first eccentricity squared
+#define DEG_TO_RAD (M_PI / 180.0)
+
+// metres per degree of longitude times cos(lat) / w, and of latitude
+// times 1 / w^3, w being sqrt(1 - e^2 sin^2 lat)
+#define K_LON (WGS84_A * DEG_TO_RAD)
+#define K_LAT (WGS84_A * (1 - WGS84_E2) * DEG_TO_RAD)
+
+// taylor series of cos in x^2, under 1e-12 off anywhere in +-pi/2. avx2
+// has no cos, this is the same sums in both paths so they agree exactly
+static const double cos_terms[] = {
+	1.0 / 20922789888000.0,
+	-1.0 / 87178291200.0,
+	1.0 / 479001600.0,
+	-1.0 / 3628800.0,
+	1.0 / 40320.0,
+	-1.0 / 720.0,
+	1.0 / 24.0,
+	-1.0 / 2.0,
+	1.0
+};
+#define COS_TERMS (sizeof(cos_terms) / sizeof(*cos_terms))
+
+static double cos_poly(double x) {
+	double x2 = x * x, r = cos_terms[0];
+	for (size_t i = 1; i < COS_TERMS; i++)
+		r = r * x2 + cos_terms[i];
+	return r;
+}
+
+static void segments_scalar(const point *p, size_t n, double *out) {
+	for (size_t i = 0; i + 1 < n; i++) {
+		double c = cos_poly((p[i].lat + p[i + 1].lat) * (DEG_TO_RAD / 2));
+		double w2 = 1 - WGS84_E2 * (1 - c * c), w = sqrt(w2);
+		double dx = geodesic_wrap_lon(p[i + 1].lon - p[i].lon) * c / w * K_LON;
+		double dy = (p[i + 1].lat - p[i].lat) / (w2 * w) * K_LAT;
+		out[i] = sqrt(dx * dx + dy * dy);
+	}
+}
+
+// northing into lat and easting into lon from o, the northing being the
+// meridian arc from o by the midpoint rule
+static void sinusoidal_scalar(const point *p, size_t n, point o, point *out) {
+	for (size_t i = 0; i < n; i++) {
+		double c = cos_poly(p[i].lat * DEG_TO_RAD);
+		double w = sqrt(1 - WGS84_E2 * (1 - c * c));
+		double cm = cos_poly((p[i].lat + o.lat) * (DEG_TO_RAD / 2));
+		double wm2 = 1 - WGS84_E2 * (1 - cm * cm), wm = sqrt(wm2);
+		double x = geodesic_wrap_lon(p[i].lon - o.lon) * c / w * K_LON;
+		out[i].lat = (p[i].lat - o.lat) / (wm2 * wm) * K_LAT;
+		out[i].lon = x;
+	}
+}
+
+#ifdef HAVE_AVX2
+// four points into a register of lats and one of lons
+__attribute__((target("avx2"), always_inline))
+static inline void load_points(const point *p, __m256d *lat, __m256d *lon) {
+	const double *src = (const double *) p;
+	__m256d a = _mm256_loadu_pd(src), b = _mm256_loadu_pd(src + 4);
+	// unpacking gives 0 2 1 3
+	*lat = _mm256_permute4x64_pd(_mm256_unpacklo_pd(a, b), 0xd8);
+	*lon = _mm256_permute4x64_pd(_mm256_unpackhi_pd(a, b), 0xd8);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256d cos_poly_avx2(__m256d x) {
+	__m256d x2 = _mm256_mul_pd(x, x), r = _mm256_set1_pd(cos_terms[0]);
+	for (size_t i = 1; i < COS_TERMS; i++)
+		r = _mm256_add_pd(_mm256_mul_pd(r, x2), _mm256_set1_pd(cos_terms[i]));
+	return r;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256d wrap_lon_avx2(__m256d d) {
+	__m256d turns = _mm256_round_pd(_mm256_div_pd(d, _mm256_set1_pd(360)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	return _mm256_sub_pd(d, _mm256_mul_pd(_mm256_set1_pd(360), turns));
+}
+
+// w^2 = 1 - e^2 (1 - c^2)
+__attribute__((target("avx2"), always_inline))
+static inline __m256d w2_avx2(__m256d c) {
+	__m256d one = _mm256_set1_pd(1);
+	return _mm256_sub_pd(one, _mm256_mul_pd(_mm256_set1_pd(WGS84_E2), _mm256_sub_pd(one, _mm256_mul_pd(c, c))));
+}
+
+__attribute__((target("avx2")))
+static void segments_avx2(const point *p, size_t n, double *out) {
+	__m256d half = _mm256_set1_pd(DEG_TO_RAD / 2);
+	__m256d k_lon = _mm256_set1_pd(K_LON), k_lat = _mm256_set1_pd(K_LAT);
+
+	size_t i = 0;
+	for (; i + 5 <= n; i += 4) {
+		__m256d lat0, lon0, lat1, lon1;
+		load_points(p + i, &lat0, &lon0);
+		load_points(p + i + 1, &lat1, &lon1);
+
+		__m256d c = cos_poly_avx2(_mm256_mul_pd(_mm256_add_pd(lat0, lat1), half));
+		__m256d w2 = w2_avx2(c), w = _mm256_sqrt_pd(w2);
+		__m256d dx = _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(wrap_lon_avx2(_mm256_sub_pd(lon1, lon0)), c), w), k_lon);
+		__m256d dy = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(lat1, lat0), _mm256_mul_pd(w2, w)), k_lat);
+		_mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy))));
+	}
+
+	// the tail and whatever the caller does next are sse, which stalls on
+	// dirty upper halves and the compiler doesn't always clear them
+	_mm256_zeroupper();
+	segments_scalar(p + i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void sinusoidal_avx2(const point *p, size_t n, point o, point *out) {
+	__m256d rad = _mm256_set1_pd(DEG_TO_RAD), half = _mm256_set1_pd(DEG_TO_RAD / 2);
+	__m256d k_lon = _mm256_set1_pd(K_LON), k_lat = _mm256_set1_pd(K_LAT);
+	__m256d o_lat = _mm256_set1_pd(o.lat), o_lon = _mm256_set1_pd(o.lon);
+	double *dst = (double *) out;
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d lat, lon;
+		load_points(p + i, &lat, &lon);
+
+		__m256d c = cos_poly_avx2(_mm256_mul_pd(lat, rad));
+		__m256d w = _mm256_sqrt_pd(w2_avx2(c));
+		__m256d cm = cos_poly_avx2(_mm256_mul_pd(_mm256_add_pd(lat, o_lat), half));
+		__m256d wm2 = w2_avx2(cm), wm = _mm256_sqrt_pd(wm2);
+		__m256d x = _mm256_mul_pd(_mm256_div_pd(_mm256_mul_pd(wrap_lon_avx2(_mm256_sub_pd(lon, o_lon)), c), w), k_lon);
+		__m256d y = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(lat, o_lat), _mm256_mul_pd(wm2, wm)), k_lat);
+
+		// back to y x pairs
+		__m256d lo = _mm256_unpacklo_pd(y, x), hi = _mm256_unpackhi_pd(y, x);
+		_mm256_storeu_pd(dst + i * 2, _mm256_permute2f128_pd(lo, hi, 0x20));
+		_mm256_storeu_pd(dst + i * 2 + 4, _mm256_permute2f128_pd(lo, hi, 0x31));
+	}
+
+	_mm256_zeroupper();
+	sinusoidal_scalar(p + i, n - i, o, out + i);
+}
+#endif
+
+void geodesic_segments(const point *points, size_t n, double *out) {
+#ifdef HAVE_AVX2
+	if (simd_avx2()) {
+		segments_avx2(points, n, out);
+		return;
+	}
+#endif
+	segments_scalar(points, n, out);
+}
+
+double geodesic_area(const point *points, size_t n, point *scratch) {
+	if (n < 3)
+		return 0;
+
+#ifdef HAVE_AVX2
+	if (simd_avx2())
+		sinusoidal_avx2(points, n, points[0], scratch);
+	else
+#endif
+		sinusoidal_scalar(points, n, points[0], scratch);
+
+	// a closing point adds nothing
+	double twice = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t j = i + 1 < n ? i + 1 : 0;
+		twice += scratch[i].lon * scratch[j].lat - scratch[j].lon * scratch[i].lat;
+	}
+	return fabs(twice) / 2;
+}
@@ -0,0 +1,27 @@
+#ifndef OSM_GEODESIC
+#define OSM_GEODESIC
+
+#include <stddef.h>
+#include <math.h>
+
+#include "osm/parser.h"
+
+// lengths and areas on the wgs84 ellipsoid from lat/lon degrees. segments
+// are measured on the plane tangent at their middle, good to a few parts
+// per million up to ten kilometres, and rings on the ellipsoidal
+// sinusoidal projection about their first point, which keeps area
+
+// a difference of longitudes the short way round, so across the
+// antimeridian too
+static inline double geodesic_wrap_lon(double d) {
+	return d - 360 * nearbyint(d / 360);
+}
+
+// metres along each of the n - 1 segments of a polyline, into out
+void geodesic_segments(const point *points, size_t n, double *out);
+
+// square metres inside a ring, with or without its closing point.
+// scratch holds n points
+double geodesic_area(const point *points, size_t n, point *scratch);
+
+#endif
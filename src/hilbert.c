@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "hilbert.h"
+#include "sort.h"
+#include "world.h"
+#include "osm/osm.h"
+#include "alloc.h"
+#include "error.h"
+
+uint32_t hilbert_key(uint32_t x, uint32_t y) {
+	uint32_t d = 0;
+	for (uint32_t s = HILBERT_SIDE / 2; s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+
+		// rotate the quadrant so the sub curve joins up
+		if (ry == 0) {
+			if (rx == 1) {
+				x = HILBERT_SIDE - 1 - x;
+				y = HILBERT_SIDE - 1 - y;
+			}
+			uint32_t t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return d;
+}
+
+struct extent {
+	ll_t min_lat, min_lon;
+	ll_t max_lat, max_lon;
+};
+
+// false for a feature without any points
+static bool centre_of(const vec_point_t *points, point *out) {
+	if (points->length == 0)
+		return false;
+
+	struct extent e = {points->data[0].lat, points->data[0].lon, points->data[0].lat, points->data[0].lon};
+	for (int i = 1; i < points->length; i++) {
+		point p = points->data[i];
+		e.min_lat = fmin(e.min_lat, p.lat);
+		e.max_lat = fmax(e.max_lat, p.lat);
+		e.min_lon = fmin(e.min_lon, p.lon);
+		e.max_lon = fmax(e.max_lon, p.lon);
+	}
+
+	out->lat = (e.min_lat + e.max_lat) / 2;
+	out->lon = (e.min_lon + e.max_lon) / 2;
+	return true;
+}
+
+static uint32_t to_cell(ll_t v, ll_t min, ll_t max) {
+	if (max <= min)
+		return 0;
+
+	double cell = (v - min) / (max - min) * (HILBERT_SIDE - 1);
+	return cell <= 0 ? 0 : cell >= HILBERT_SIDE - 1 ? HILBERT_SIDE - 1 : (uint32_t) (cell + 0.5);
+}
+
+static void grow(struct extent *e, point p) {
+	e->min_lat = fmin(e->min_lat, p.lat);
+	e->max_lat = fmax(e->max_lat, p.lat);
+	e->min_lon = fmin(e->min_lon, p.lon);
+	e->max_lon = fmax(e->max_lon, p.lon);
+}
+
+// keys of features without points stay 0, putting them first
+static void assign_keys(struct sort_item *items, const point *centres, const bool *has_centre,
+		int n, const struct extent *e) {
+	for (int i = 0; i < n; i++) {
+		items[i].index = i;
+		items[i].key = !has_centre[i] ? 0 : hilbert_key(
+				to_cell(centres[i].lon, e->min_lon, e->max_lon),
+				to_cell(centres[i].lat, e->min_lat, e->max_lat));
+	}
+}
+
+// moves elements of size bytes into the order given by items
+static int permute(void *data, const struct sort_item *items, int n, size_t size) {
+	if (n < 2)
+		return CRACKING;
+
+	char *tmp = alloc_malloc(ALLOC_GEOMETRY, n * size);
+	if (tmp == NULL)
+		return ERR_MEM;
+
+	for (int i = 0; i < n; i++)
+		memcpy(tmp + i * size, (char *) data + items[i].index * size, size);
+	memcpy(data, tmp, n * size);
+
+	alloc_free(ALLOC_GEOMETRY, tmp);
+	return CRACKING;
+}
+
+int sort_world_hilbert(struct world *world, int threads) {
+	int n_roads = world->roads.length;
+	int n = n_roads + world->land_uses.length;
+	if (n < 2)
+		return CRACKING;
+
+	// roads first then land uses, sharing one extent
+	point *centres = alloc_malloc(ALLOC_OTHER, n * sizeof(point));
+	bool *has_centre = alloc_malloc(ALLOC_OTHER, n * sizeof(bool));
+	struct sort_item *items = alloc_malloc(ALLOC_OTHER, n * sizeof(struct sort_item));
+	int ret = centres == NULL || has_centre == NULL || items == NULL ? ERR_MEM : CRACKING;
+
+	struct extent e = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+	for (int i = 0; ret == CRACKING && i < n; i++) {
+		const vec_point_t *points = i < n_roads
+			? &world->roads.data[i].segments
+			: &world->land_uses.data[i - n_roads].points;
+
+		has_centre[i] = centre_of(points, &centres[i]);
+		if (has_centre[i])
+			grow(&e, centres[i]);
+	}
+
+	if (ret == CRACKING) {
+		assign_keys(items, centres, has_centre, n, &e);
+		ret = radix_sort_items(items, n_roads, 2 * HILBERT_ORDER, threads);
+	}
+	if (ret == CRACKING)
+		ret = permute(world->roads.data, items, n_roads, sizeof(struct road));
+
+	if (ret == CRACKING) {
+		int n_land_uses = n - n_roads;
+		assign_keys(items, centres + n_roads, has_centre + n_roads, n_land_uses, &e);
+		ret = radix_sort_items(items, n_land_uses, 2 * HILBERT_ORDER, threads);
+		if (ret == CRACKING)
+			ret = permute(world->land_uses.data, items, n_land_uses, sizeof(struct land_use));
+	}
+
+	alloc_free(ALLOC_OTHER, centres);
+	alloc_free(ALLOC_OTHER, has_centre);
+	alloc_free(ALLOC_OTHER, items);
+	return ret;
+}
@@ -0,0 +1,20 @@
+#ifndef OSM_HILBERT
+#define OSM_HILBERT
+
+#include <stdint.h>
+
+struct world;
+
+// cells per side of the grid keys are taken on
+#define HILBERT_ORDER 16
+#define HILBERT_SIDE (1u << HILBERT_ORDER)
+
+// distance along the curve of cell x,y, both < HILBERT_SIDE
+uint32_t hilbert_key(uint32_t x, uint32_t y);
+
+// reorders roads and land uses by the curve key of their bbox centre, over
+// the extent of the whole world, so features close on the map are close in
+// memory and in the dump. ties keep parse order whatever the thread count
+int sort_world_hilbert(struct world *world, int threads);
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "alloc.h"
+#include "error.h"
+
+#ifndef NO_COMPRESSION
+#include <zlib.h>
+#endif
+
+static int write_ppm(FILE *f, const uint8_t *rgb, int width, int height) {
+	fprintf(f, "P6\n%d %d\n255\n", width, height);
+	size_t n = (size_t) width * height * 3;
+	return fwrite(rgb, 1, n, f) == n ? CRACKING : ERR_IO;
+}
+
+#ifndef NO_COMPRESSION
+static void put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static int write_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len) {
+	uint8_t head[8];
+	put_u32(head, len);
+	memcpy(head + 4, type, 4);
+
+	uint32_t crc = crc32(0, head + 4, 4);
+	if (len > 0)
+		crc = crc32(crc, data, len);
+	uint8_t tail[4];
+	put_u32(tail, crc);
+
+	bool ok = fwrite(head, 1, 8, f) == 8
+		&& (len == 0 || fwrite(data, 1, len, f) == len)
+		&& fwrite(tail, 1, 4, f) == 4;
+	return ok ? CRACKING : ERR_IO;
+}
+
+// 8 bit truecolour, every row with the sub filter. flat fills compress
+// well at the fastest level already
+static int write_png(FILE *f, const uint8_t *rgb, int width, int height) {
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	size_t stride = (size_t) width * 3;
+	size_t raw_len = (stride + 1) * height;
+	uLongf packed_len = compressBound(raw_len);
+
+	uint8_t *raw = alloc_malloc(ALLOC_ENCODER, raw_len);
+	uint8_t *packed = alloc_malloc(ALLOC_ENCODER, packed_len);
+	int ret = raw == NULL || packed == NULL ? ERR_MEM : CRACKING;
+
+	if (ret == CRACKING) {
+		for (int y = 0; y < height; y++) {
+			const uint8_t *row = rgb + y * stride;
+			uint8_t *out = raw + y * (stride + 1);
+			out[0] = 1;
+			for (size_t i = 0; i < stride; i++)
+				out[1 + i] = row[i] - (i >= 3 ? row[i - 3] : 0);
+		}
+
+		if (compress2(packed, &packed_len, raw, raw_len, Z_BEST_SPEED) != Z_OK)
+			ret = ERR_MEM;
+	}
+
+	if (ret == CRACKING) {
+		uint8_t ihdr[13] = {0};
+		put_u32(ihdr, width);
+		put_u32(ihdr + 4, height);
+		ihdr[8] = 8; // bits per channel
+		ihdr[9] = 2; // truecolour
+
+		if (fwrite(signature, 1, 8, f) != 8)
+			ret = ERR_IO;
+		if (ret == CRACKING)
+			ret = write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+		if (ret == CRACKING)
+			ret = write_chunk(f, "IDAT", packed, (uint32_t) packed_len);
+		if (ret == CRACKING)
+			ret = write_chunk(f, "IEND", NULL, 0);
+	}
+
+	alloc_free(ALLOC_ENCODER, raw);
+	alloc_free(ALLOC_ENCODER, packed);
+	return ret;
+}
+#endif
+
+int write_image(const char *path, enum image_format format, const uint8_t *rgb, int width, int height) {
+#ifdef NO_COMPRESSION
+	if (format == IMAGE_PNG)
+		return ERR_UNSUPPORTED;
+#endif
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return ERR_IO;
+
+	int ret;
+	if (format == IMAGE_PPM)
+		ret = write_ppm(f, rgb, width, height);
+#ifndef NO_COMPRESSION
+	else
+		ret = write_png(f, rgb, width, height);
+#else
+	else
+		ret = ERR_UNSUPPORTED;
+#endif
+
+	if (fclose(f) != 0 && ret == CRACKING)
+		ret = ERR_IO;
+	return ret;
+}
+
+const char *image_extension(enum image_format format) {
+	return format == IMAGE_PPM ? "ppm" : "png";
+}
@@ -0,0 +1,17 @@
+#ifndef OSM_IMAGE
+#define OSM_IMAGE
+
+#include <stdint.h>
+
+enum image_format {
+	IMAGE_PNG = 0,
+	IMAGE_PPM
+};
+
+// rgb is 3 bytes a pixel, rows top to bottom
+int write_image(const char *path, enum image_format format, const uint8_t *rgb, int width, int height);
+
+// "png" or "ppm"
+const char *image_extension(enum image_format format);
+
+#endif
@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "index.h"
+#include "sort.h"
+#include "world.h"
+#include "osm/osm.h"
+#include "alloc.h"
+#include "error.h"
+
+// metres per degree of latitude on the sphere project.c uses
+#define METRES_PER_DEGREE (6378137.0 * M_PI / 180.0)
+
+// cells on the longer side are capped, a few features per cell otherwise
+#define MAX_SIDE (2048)
+
+// a feature covering more cells than this goes on the large list
+#define MAX_FEATURE_CELLS (64)
+
+static const vec_point_t *feature_points(const struct spatial_index *idx, uint32_t feature) {
+	return feature < idx->n_roads
+		? &idx->world->roads.data[feature].segments
+		: &idx->world->land_uses.data[feature - idx->n_roads].points;
+}
+
+static int64_t feature_id(const struct spatial_index *idx, uint32_t feature) {
+	return feature < idx->n_roads
+		? idx->world->roads.data[feature].id
+		: idx->world->land_uses.data[feature - idx->n_roads].id;
+}
+
+// ids are signed, flipping the top bit sorts them as unsigned
+static uint64_t id_key(int64_t way_id) {
+	return (uint64_t) way_id ^ (1ULL << 63);
+}
+
+static struct bbox points_bbox(const vec_point_t *points) {
+	struct bbox b = {{INFINITY, INFINITY}, {-INFINITY, -INFINITY}};
+	for (int i = 0; i < points->length; i++) {
+		point p = points->data[i];
+		b.min.lat = fmin(b.min.lat, p.lat);
+		b.min.lon = fmin(b.min.lon, p.lon);
+		b.max.lat = fmax(b.max.lat, p.lat);
+		b.max.lon = fmax(b.max.lon, p.lon);
+	}
+	return b;
+}
+
+static bool is_empty(const struct bbox *b) {
+	return b->min.lat > b->max.lat;
+}
+
+static uint32_t cell_col(const struct spatial_index *idx, double lon) {
+	double c = floor((lon - idx->extent.min.lon) / idx->cell_lon);
+	return c <= 0 ? 0 : c >= idx->cols - 1 ? idx->cols - 1 : (uint32_t) c;
+}
+
+static uint32_t cell_row(const struct spatial_index *idx, double lat) {
+	double r = floor((lat - idx->extent.min.lat) / idx->cell_lat);
+	return r <= 0 ? 0 : r >= idx->rows - 1 ? idx->rows - 1 : (uint32_t) r;
+}
+
+static void size_grid(struct spatial_index *idx) {
+	double height = idx->extent.max.lat - idx->extent.min.lat;
+	double width = idx->extent.max.lon - idx->extent.min.lon;
+	double side = ceil(sqrt(idx->n_features / 2.0 + 1));
+	if (side > MAX_SIDE)
+		side = MAX_SIDE;
+
+	// square-ish cells, the longer axis of the world gets more of them
+	if (width >= height) {
+		idx->cols = (uint32_t) side;
+		idx->rows = (uint32_t) fmax(1, ceil(side * height / (width > 0 ? width : 1)));
+	} else {
+		idx->rows = (uint32_t) side;
+		idx->cols = (uint32_t) fmax(1, ceil(side * width / height));
+	}
+
+	idx->cell_lat = height > 0 ? height / idx->rows : 1;
+	idx->cell_lon = width > 0 ? width / idx->cols : 1;
+}
+
+// counts or fills the cells of every feature, depending on fill
+static void place_features(struct spatial_index *idx, uint32_t *fill) {
+	for (uint32_t f = 0; f < idx->n_features; f++) {
+		const struct bbox *b = &idx->boxes[f];
+		if (is_empty(b))
+			continue;
+
+		uint32_t c0 = cell_col(idx, b->min.lon), c1 = cell_col(idx, b->max.lon);
+		uint32_t r0 = cell_row(idx, b->min.lat), r1 = cell_row(idx, b->max.lat);
+		if ((uint64_t) (c1 - c0 + 1) * (r1 - r0 + 1) > MAX_FEATURE_CELLS) {
+			if (fill != NULL)
+				idx->large[idx->n_large++] = f;
+			continue;
+		}
+
+		for (uint32_t r = r0; r <= r1; r++) {
+			for (uint32_t c = c0; c <= c1; c++) {
+				uint32_t cell = r * idx->cols + c;
+				if (fill == NULL)
+					idx->cell_start[cell + 1]++;
+				else
+					idx->cell_items[fill[cell]++] = f;
+			}
+		}
+	}
+}
+
+int index_build(struct spatial_index *idx, const struct world *world, int threads) {
+	memset(idx, 0, sizeof(*idx));
+	idx->world = world;
+	idx->n_roads = world->roads.length;
+	idx->n_features = world->roads.length + world->land_uses.length;
+
+	if (world->projection != PROJECT_NONE)
+		idx->metres_lat = idx->metres_lon = 1;
+
+	size_t n = idx->n_features > 0 ? idx->n_features : 1;
+	idx->boxes = alloc_malloc(ALLOC_OTHER, n * sizeof(struct bbox));
+	idx->ids = alloc_malloc(ALLOC_OTHER, n * sizeof(struct sort_item));
+	if (idx->boxes == NULL || idx->ids == NULL) {
+		index_free(idx);
+		return ERR_MEM;
+	}
+
+	idx->extent = (struct bbox) {{INFINITY, INFINITY}, {-INFINITY, -INFINITY}};
+	for (uint32_t f = 0; f < idx->n_features; f++) {
+		struct bbox *b = &idx->boxes[f];
+		*b = points_bbox(feature_points(idx, f));
+		if (!is_empty(b)) {
+			idx->extent.min.lat = fmin(idx->extent.min.lat, b->min.lat);
+			idx->extent.min.lon = fmin(idx->extent.min.lon, b->min.lon);
+			idx->extent.max.lat = fmax(idx->extent.max.lat, b->max.lat);
+			idx->extent.max.lon = fmax(idx->extent.max.lon, b->max.lon);
+		}
+
+		idx->ids[f].key = id_key(feature_id(idx, f));
+		idx->ids[f].index = f;
+	}
+
+	if (is_empty(&idx->extent))
+		idx->extent = (struct bbox) {{0, 0}, {0, 0}};
+
+	int ret = radix_sort_items(idx->ids, idx->n_features, 64, threads);
+	if (ret != CRACKING) {
+		index_free(idx);
+		return ret;
+	}
+
+	size_grid(idx);
+	size_t cells = (size_t) idx->rows * idx->cols;
+	idx->cell_start = alloc_calloc(ALLOC_OTHER, cells + 1, sizeof(uint32_t));
+	uint32_t *fill = alloc_malloc(ALLOC_OTHER, cells * sizeof(uint32_t));
+	if (idx->cell_start == NULL || fill == NULL) {
+		alloc_free(ALLOC_OTHER, fill);
+		index_free(idx);
+		return ERR_MEM;
+	}
+
+	place_features(idx, NULL);
+	for (size_t c = 0; c < cells; c++) {
+		idx->cell_start[c + 1] += idx->cell_start[c];
+		fill[c] = idx->cell_start[c];
+	}
+
+	idx->cell_items = alloc_malloc(ALLOC_OTHER, ((size_t) idx->cell_start[cells] + 1) * sizeof(uint32_t));
+	idx->large = alloc_malloc(ALLOC_OTHER, n * sizeof(uint32_t));
+	if (idx->cell_items == NULL || idx->large == NULL) {
+		alloc_free(ALLOC_OTHER, fill);
+		index_free(idx);
+		return ERR_MEM;
+	}
+
+	place_features(idx, fill);
+	alloc_free(ALLOC_OTHER, fill);
+	return CRACKING;
+}
+
+void index_free(struct spatial_index *idx) {
+	alloc_free(ALLOC_OTHER, idx->boxes);
+	alloc_free(ALLOC_OTHER, idx->ids);
+	alloc_free(ALLOC_OTHER, idx->cell_start);
+	alloc_free(ALLOC_OTHER, idx->cell_items);
+	alloc_free(ALLOC_OTHER, idx->large);
+	memset(idx, 0, sizeof(*idx));
+}
+
+static bool overlaps(const struct bbox *a, const struct bbox *b) {
+	return a->min.lat <= b->max.lat && b->min.lat <= a->max.lat
+		&& a->min.lon <= b->max.lon && b->min.lon <= a->max.lon;
+}
+
+void index_query_bbox(const struct spatial_index *idx, struct bbox box, index_visitor *fn, void *arg) {
+	if (idx->n_features == 0 || !overlaps(&box, &idx->extent))
+		return;
+
+	for (uint32_t i = 0; i < idx->n_large; i++)
+		if (overlaps(&idx->boxes[idx->large[i]], &box) && !fn(idx->large[i], arg))
+			return;
+
+	uint32_t c0 = cell_col(idx, box.min.lon), c1 = cell_col(idx, box.max.lon);
+	uint32_t r0 = cell_row(idx, box.min.lat), r1 = cell_row(idx, box.max.lat);
+
+	for (uint32_t r = r0; r <= r1; r++) {
+		for (uint32_t c = c0; c <= c1; c++) {
+			uint32_t cell = r * idx->cols + c;
+			for (uint32_t i = idx->cell_start[cell]; i < idx->cell_start[cell + 1]; i++) {
+				uint32_t f = idx->cell_items[i];
+				const struct bbox *b = &idx->boxes[f];
+				if (!overlaps(b, &box))
+					continue;
+
+				// only reported from the first cell of the query it is in
+				if (cell_col(idx, fmax(b->min.lon, box.min.lon)) != c || cell_row(idx, fmax(b->min.lat, box.min.lat)) != r)
+					continue;
+
+				if (!fn(f, arg))
+					return;
+			}
+		}
+	}
+}
+
+bool index_find_id(const struct spatial_index *idx, int64_t way_id, uint32_t *feature) {
+	uint64_t key = id_key(way_id);
+	size_t lo = 0, hi = idx->n_features;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (idx->ids[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == idx->n_features || idx->ids[lo].key != key)
+		return false;
+	*feature = idx->ids[lo].index;
+	return true;
+}
+
+struct nearest {
+	point at;
+	double scale_lat, scale_lon;
+
+	uint32_t road;
+	double distance; // squared until the end
+	point closest;
+	bool found;
+};
+
+static void nearest_on_road(struct nearest *n, const struct spatial_index *idx, uint32_t road) {
+	const vec_point_t *points = feature_points(idx, road);
+
+	// in metres around the query point, where the segment maths is planar
+	for (int i = 0; i < points->length; i++) {
+		point a = points->data[i];
+		point b = points->data[i + 1 < points->length ? i + 1 : i];
+		double ax = (a.lon - n->at.lon) * n->scale_lon, ay = (a.lat - n->at.lat) * n->scale_lat;
+		double bx = (b.lon - n->at.lon) * n->scale_lon, by = (b.lat - n->at.lat) * n->scale_lat;
+
+		double dx = bx - ax, dy = by - ay;
+		double len = dx * dx + dy * dy;
+		double t = len > 0 ? -(ax * dx + ay * dy) / len : 0;
+		t = t < 0 ? 0 : t > 1 ? 1 : t;
+
+		double x = ax + t * dx, y = ay + t * dy;
+		double d = x * x + y * y;
+		if (!n->found || d < n->distance) {
+			n->found = true;
+			n->distance = d;
+			n->road = road;
+			n->closest = (point) {a.lat + t * (b.lat - a.lat), a.lon + t * (b.lon - a.lon)};
+		}
+	}
+}
+
+static void nearest_in_cell(struct nearest *n, const struct spatial_index *idx, uint32_t cell) {
+	for (uint32_t i = idx->cell_start[cell]; i < idx->cell_start[cell + 1]; i++)
+		if (idx->cell_items[i] < idx->n_roads)
+			nearest_on_road(n, idx, idx->cell_items[i]);
+}
+
+bool index_nearest_road(const struct spatial_index *idx, point p, uint32_t *road, double *distance, point *closest) {
+	if (idx->n_roads == 0)
+		return false;
+
+	struct nearest n = {.at = p};
+	n.scale_lat = idx->metres_lat > 0 ? idx->metres_lat : METRES_PER_DEGREE;
+	n.scale_lon = idx->metres_lon > 0 ? idx->metres_lon : METRES_PER_DEGREE * cos(p.lat * M_PI / 180);
+
+	int64_t col = cell_col(idx, p.lon), row = cell_row(idx, p.lat);
+	double step = fmin(idx->cell_lat * n.scale_lat, idx->cell_lon * n.scale_lon);
+	int64_t max_ring = idx->cols > idx->rows ? idx->cols : idx->rows;
+
+	for (uint32_t i = 0; i < idx->n_large; i++)
+		if (idx->large[i] < idx->n_roads)
+			nearest_on_road(&n, idx, idx->large[i]);
+
+	// rings of cells outwards, anything past ring r is at least r cells away
+	for (int64_t ring = 0; ring <= max_ring; ring++) {
+		for (int64_t r = row - ring; r <= row + ring; r++) {
+			if (r < 0 || r >= idx->rows)
+				continue;
+
+			// the whole top and bottom rows, just the two sides between
+			bool edge = r == row - ring || r == row + ring;
+			int64_t c_step = edge || ring == 0 ? 1 : 2 * ring;
+			for (int64_t c = col - ring; c <= col + ring; c += c_step) {
+				if (c >= 0 && c < idx->cols)
+					nearest_in_cell(&n, idx, (uint32_t) (r * idx->cols + c));
+			}
+		}
+
+		if (n.found && sqrt(n.distance) <= ring * step)
+			break;
+	}
+
+	if (!n.found)
+		return false;
+
+	*road = n.road;
+	*distance = sqrt(n.distance);
+	*closest = n.closest;
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef OSM_INDEX
+#define OSM_INDEX
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osm/parser.h"
+
+struct world;
+struct sort_item;
+
+struct bbox {
+	point min, max;
+};
+
+// uniform grid over a world, a feature is listed in every cell its bbox
+// touches. features are numbered roads first then land uses
+struct spatial_index {
+	const struct world *world;
+	uint32_t n_roads, n_features;
+
+	struct bbox extent;
+	struct bbox *boxes;
+
+	uint32_t cols, rows;
+	double cell_lat, cell_lon;
+	uint32_t *cell_start; // rows * cols + 1, into cell_items
+	uint32_t *cell_items;
+
+	// features spanning too many cells, checked by every query instead
+	uint32_t *large;
+	uint32_t n_large;
+
+	// feature numbers by way id
+	struct sort_item *ids;
+
+	// metres per unit on each axis, 0 to take them at the query's latitude
+	double metres_lat, metres_lon;
+};
+
+// the world must outlive the index and not change under it
+int index_build(struct spatial_index *idx, const struct world *world, int threads);
+
+void index_free(struct spatial_index *idx);
+
+// false stops the query
+typedef bool index_visitor(uint32_t feature, void *arg);
+
+// each feature whose bbox meets box, once, in no particular order
+void index_query_bbox(const struct spatial_index *idx, struct bbox box, index_visitor *fn, void *arg);
+
+bool index_find_id(const struct spatial_index *idx, int64_t way_id, uint32_t *feature);
+
+// the road passing closest to p, and how far in metres (world units once
+// projected). false if there are no roads
+bool index_nearest_road(const struct spatial_index *idx, point p, uint32_t *road, double *distance, point *closest);
+
+#endif
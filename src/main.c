@@ -1,23 +1,382 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
 
 #include "error.h"
 #include "osm/parser.h"
+#include "osm/filter.h"
+#include "osm/stats.h"
+#include "alloc.h"
 #include "world.h"
+#include "hilbert.h"
+#include "stitch.h"
+#include "daemon.h"
+#include "render.h"
+#include "diff.h"
+#include "aggregate.h"
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [options] [file.osm[.gz|.bz2]...]\n"
+			"  -j, --jobs N    threads for parsing several files at once and for\n"
+			"                  encoding the world\n"
+			"  -d, --deferred  resolve node references in one sorted pass\n"
+			"  -f, --filter S  ways to keep, e.g. \"highway=primary,trunk;building\"\n"
+			"                  or @file with a rule per line\n"
+			"  -M, --max-memory N\n"
+			"                  keep node and way stores under N bytes (k, m, g\n"
+			"                  suffixes) by spilling sorted runs to $TMPDIR, one\n"
+			"                  file only\n"
+			"  -s, --stats F   write parse counters, timings and memory use as json,\n"
+			"                  - for stdout, which then gets nothing else as the\n"
+			"                  log goes to stderr\n"
+			"  -S, --stitch    join roads of one street that meet end to end\n"
+			"  -p, --project P reproject to metres, \"mercator\" or \"local\"\n"
+			"  -F, --fixed N   with -p, write points as integers of 1/N metres\n"
+			"  -H, --hilbert   write features in hilbert curve order, sorted\n"
+			"                  with the --jobs threads\n"
+			"  -D, --daemon S  keep the world loaded and answer queries on unix\n"
+			"                  socket S, SIGHUP reloads the files\n"
+			"  -T, --tiles T   render map tiles instead of dumping the world, T is\n"
+			"                  Z for every tile of the world at zoom Z, Z/X/Y or\n"
+			"                  Z/X0-X1/Y0-Y1, drawn with the --jobs threads\n"
+			"  -o, --tile-dir D\n"
+			"                  where tiles go, as D/Z/X/Y.png (tiles)\n"
+			"  -P, --ppm       write tiles as ppm rather than png\n"
+			"  -a, --aggregate G\n"
+			"                  sum road length and land use area by type over grid\n"
+			"                  G, \"zZ\" for the tiles at zoom Z or a cell size in\n"
+			"                  degrees, into world.agg instead of dumping\n"
+			"  -X, --diff F    write world.diff, what turns the world built the same\n"
+			"                  way from F into this one, instead of dumping it\n"
+			"  -A, --apply D   apply the delta D from --diff before dumping\n"
+			"  -v, --verbose   log malformed elements and dangling refs to stderr\n"
+			"several files are merged into one world\n", prog);
+}
+
+// a byte count with an optional k, m or g suffix
+static bool parse_size(const char *s, size_t *out) {
+	char *end;
+	unsigned long long n = strtoull(s, &end, 10);
+	if (end == s)
+		return false;
+
+	switch (*end) {
+		case 'g': case 'G': n <<= 10; // fall through
+		case 'm': case 'M': n <<= 10; // fall through
+		case 'k': case 'K': n <<= 10; end++; break;
+		case '\0': break;
+		default: return false;
+	}
+	*out = (size_t) n;
+	return *end == '\0' && n > 0;
+}
+
+// totals over every cell, in km and square km
+static void print_aggregate(const struct aggregate *agg) {
+	printf("world.agg: %u cells\n", agg->n_cells);
+	for (int k = 0; k < AGG_COLUMNS; k++) {
+		double total = 0;
+		for (uint32_t i = 0; i < agg->n_cells; i++)
+			total += agg->columns[k][i];
+
+		if (k == 0)
+			printf("roads:\n");
+		else if (k == ROAD_TYPE_COUNT)
+			printf("land uses:\n");
+		if (k < ROAD_TYPE_COUNT)
+			printf("  %-12s %12.3f km\n", road_type_to_string(k), total / 1e3);
+		else
+			printf("  %-12s %12.3f km2\n", land_use_type_to_string(k - ROAD_TYPE_COUNT), total / 1e6);
+	}
+}
+
+// everything between the files and a finished world
+struct pipeline {
+	const char *const *files;
+	int n_files;
+	struct parse_options opts;
+	bool stitch;
+	enum projection projection;
+	uint32_t fixed_scale;
+	bool hilbert;
+};
+
+static int build_world(void *ctx, struct world *world) {
+	const struct pipeline *p = ctx;
+	int ret = p->n_files == 1
+		? parse_osm_from_file_opts(p->files[0], &p->opts, world)
+		: parse_osm_from_files(p->files, p->n_files, &p->opts, world);
+	if (ret != CRACKING)
+		return ret;
+
+	if (p->stitch)
+		ret = stitch_roads(world, NULL);
+	if (ret == CRACKING && p->projection != PROJECT_NONE)
+		ret = project_world(world, p->projection, p->fixed_scale);
+	if (ret == CRACKING && p->hilbert)
+		ret = sort_world_hilbert(world, p->opts.threads);
+
+	if (ret != CRACKING)
+		free_world(world);
+	return ret;
+}
 
 int main(int argc, char *argv[]) {
 
-	char *file = argc >= 2 ? argv[1] : "../xmls/place.xml";
+	struct pipeline pipeline = {0};
+	struct parse_options *opts = &pipeline.opts;
+	const char *filter_spec = NULL;
+	const char *stats_path = NULL;
+	const char *socket_path = NULL;
+	const char *tile_spec = NULL;
+	const char *tile_dir = "tiles";
+	const char *diff_from = NULL;
+	const char *grid_spec = NULL;
+	struct agg_grid grid;
+	const char *delta_path = NULL;
+	enum image_format tile_format = IMAGE_PNG;
+	struct tile_range tiles;
+	struct parse_stats stats = {0};
+
+	static const struct option long_opts[] = {
+		{"jobs", required_argument, NULL, 'j'},
+		{"deferred", no_argument, NULL, 'd'},
+		{"filter", required_argument, NULL, 'f'},
+		{"stats", required_argument, NULL, 's'},
+		{"max-memory", required_argument, NULL, 'M'},
+		{"stitch", no_argument, NULL, 'S'},
+		{"project", required_argument, NULL, 'p'},
+		{"fixed", required_argument, NULL, 'F'},
+		{"hilbert", no_argument, NULL, 'H'},
+		{"daemon", required_argument, NULL, 'D'},
+		{"tiles", required_argument, NULL, 'T'},
+		{"tile-dir", required_argument, NULL, 'o'},
+		{"ppm", no_argument, NULL, 'P'},
+		{"aggregate", required_argument, NULL, 'a'},
+		{"diff", required_argument, NULL, 'X'},
+		{"apply", required_argument, NULL, 'A'},
+		{"verbose", no_argument, NULL, 'v'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "j:df:s:M:Sp:F:HD:T:o:Pa:X:A:vh", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'j':
+				opts->threads = atoi(optarg);
+				break;
+			case 'd':
+				opts->resolution = RESOLVE_DEFERRED;
+				break;
+			case 'f':
+				filter_spec = optarg;
+				break;
+			case 's':
+				stats_path = optarg;
+				opts->stats = &stats;
+				break;
+			case 'M':
+				if (!parse_size(optarg, &opts->max_memory)) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'S':
+				pipeline.stitch = true;
+				break;
+			case 'p':
+				if ((pipeline.projection = projection_from_string(optarg)) == PROJECT_NONE) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'F':
+				pipeline.fixed_scale = (uint32_t) strtoul(optarg, NULL, 10);
+				break;
+			case 'H':
+				pipeline.hilbert = true;
+				break;
+			case 'D':
+				socket_path = optarg;
+				break;
+			case 'T':
+				tile_spec = optarg;
+				break;
+			case 'o':
+				tile_dir = optarg;
+				break;
+			case 'P':
+				tile_format = IMAGE_PPM;
+				break;
+			case 'a':
+				grid_spec = optarg;
+				break;
+			case 'X':
+				diff_from = optarg;
+				break;
+			case 'A':
+				delta_path = optarg;
+				break;
+			case 'v':
+				err_stream = stderr;
+				break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	// a fixed grid is in metres, which only a projection gives
+	if (pipeline.fixed_scale > 0 && pipeline.projection == PROJECT_NONE) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// tiles are cut from lat/lon, before any reprojection
+	if (tile_spec != NULL && (!tile_range_from_string(tile_spec, &tiles) || pipeline.projection != PROJECT_NONE)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (grid_spec != NULL && (!agg_grid_from_string(grid_spec, &grid) || pipeline.projection != PROJECT_NONE)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// the json keeps stdout to itself, everything else printed goes to stderr
+	FILE *stats_out = NULL;
+	if (stats_path != NULL && strcmp(stats_path, "-") == 0) {
+		int fd = dup(STDOUT_FILENO);
+		if (fd < 0 || (stats_out = fdopen(fd, "w")) == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			perror("stdout");
+			return 1;
+		}
+	}
+
+	char *default_file = "../xmls/place.xml";
+	pipeline.files = (const char *const *) argv + optind;
+	pipeline.n_files = argc - optind;
+	if (pipeline.n_files == 0) {
+		pipeline.files = (const char *const *) &default_file;
+		pipeline.n_files = 1;
+	}
+
+	struct tag_filter filter;
+	int ret;
+	if (filter_spec != NULL) {
+		if ((ret = tag_filter_compile(filter_spec, &filter)) != CRACKING) {
+			printf("error: %s\n", error_get_message(ret));
+			return 1;
+		}
+		opts->filter = &filter;
+	}
+
+	if (socket_path != NULL) {
+		// counters would only add up over every reload
+		opts->stats = NULL;
+
+		struct daemon_config cfg = {
+			.socket_path = socket_path,
+			.threads = opts->threads,
+			.load = build_world,
+			.load_ctx = &pipeline
+		};
+		ret = daemon_run(&cfg);
+		if (opts->filter != NULL)
+			tag_filter_free(&filter);
+
+		if (ret != CRACKING) {
+			printf("error: %s\n", error_get_message(ret));
+			return 1;
+		}
+		return 0;
+	}
 
 	struct world world;
-	int ret = parse_osm_from_file(file, &world);
+	ret = build_world(&pipeline, &world);
+
+	// built just like the new one, only its counters are left out
+	struct world old;
+	if (ret == CRACKING && diff_from != NULL) {
+		struct pipeline from = pipeline;
+		from.files = &diff_from;
+		from.n_files = 1;
+		from.opts.stats = NULL;
+		if ((ret = build_world(&from, &old)) != CRACKING)
+			free_world(&world);
+	}
+
+	if (opts->filter != NULL)
+		tag_filter_free(&filter);
 
 	if (ret != CRACKING) {
 		printf("error: %s\n", error_get_message(ret));
 		return 1;
 	}
 
-	debug_print(&world);
-	if (!dump_to_file(&world, "world.bin"))
+	if (delta_path != NULL) {
+		struct diff_index idx;
+		struct diff_counts counts;
+		if ((ret = diff_index_build(&idx, &world, opts->threads)) == CRACKING) {
+			ret = diff_apply(&world, &idx, delta_path, &counts);
+			diff_index_free(&idx);
+		}
+
+		if (ret != CRACKING) {
+			printf("error: %s: %s\n", delta_path, error_get_message(ret));
+			if (diff_from != NULL)
+				free_world(&old);
+			free_world(&world);
+			return 1;
+		}
+		printf("applied %s: %u removed, %u changed, %u added\n", delta_path,
+				counts.removed, counts.changed, counts.added);
+	}
+
+	if (diff_from != NULL) {
+		struct diff_counts counts;
+		if ((ret = diff_write(&old, &world, "world.diff", opts->threads, &counts)) != CRACKING)
+			printf("error: %s\n", error_get_message(ret));
+		else
+			printf("world.diff: %u removed, %u changed, %u added\n", counts.removed, counts.changed, counts.added);
+		free_world(&old);
+	} else if (grid_spec != NULL) {
+		struct aggregate agg;
+		if ((ret = aggregate_world(&world, &grid, opts->threads, &agg)) == CRACKING)
+			ret = aggregate_write(&agg, "world.agg");
+		if (ret != CRACKING)
+			printf("error: %s\n", error_get_message(ret));
+		else
+			print_aggregate(&agg);
+		aggregate_free(&agg);
+	} else if (tile_spec != NULL) {
+		if ((ret = render_tiles(&world, &tiles, tile_dir, tile_format, opts->threads)) != CRACKING)
+			printf("error: %s\n", error_get_message(ret));
+	} else {
+		debug_print(&world);
+	}
+
+	if (stats_path != NULL) {
+		FILE *f = stats_out != NULL ? stats_out : fopen(stats_path, "w");
+		if (f == NULL) {
+			perror(stats_path);
+		} else {
+			struct alloc_stats memory[ALLOC_TAG_COUNT];
+			alloc_get_stats(memory);
+
+			fprintf(f, "{\n\"parse\": ");
+			print_parse_stats(f, &stats);
+			fprintf(f, ",\n\"memory\": ");
+			print_alloc_stats(f, memory);
+			fprintf(f, "}\n");
+			fclose(f);
+		}
+	}
+
+	if (tile_spec == NULL && diff_from == NULL && grid_spec == NULL && !dump_to_file_threads(&world, "world.bin", opts->threads))
 		fprintf(stderr, "failed to dump world to file\n");
 	free_world(&world);
+	return ret == CRACKING ? 0 : 1;
 }
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "filter.h"
+#include "osm.h"
+#include "error.h"
+#include "alloc.h"
+
+struct known_value {
+	const char *value;
+	int type;
+};
+
+static const struct known_value road_values[] = {
+	{"motorway", ROAD_MOTORWAY},
+	{"motorway_link", ROAD_MOTORWAY},
+	{"primary_link", ROAD_PRIMARY},
+	{"primary", ROAD_PRIMARY},
+	{"trunk", ROAD_PRIMARY},
+	{"trunk_link", ROAD_PRIMARY},
+
+	{"secondary_link", ROAD_SECONDARY},
+	{"secondary", ROAD_SECONDARY},
+	{"tertiary", ROAD_SECONDARY},
+	{"tertiary_link", ROAD_SECONDARY},
+
+	{"unclassified", ROAD_MINOR},
+	{"minor", ROAD_MINOR},
+
+	{"residential", ROAD_RESIDENTIAL},
+	{"living_street", ROAD_RESIDENTIAL},
+
+	{"pedestrian", ROAD_PEDESTRIAN},
+	{"footway", ROAD_PEDESTRIAN},
+	{"steps", ROAD_PEDESTRIAN},
+	{"path", ROAD_PEDESTRIAN},
+	{"cycleway", ROAD_PEDESTRIAN},
+	{"bridleway", ROAD_PEDESTRIAN},
+	{NULL, 0}
+};
+
+static const struct known_value land_use_values[] = {
+	{"residential", LANDUSE_RESIDENTIAL},
+
+	{"commercial", LANDUSE_COMMERCIAL},
+	{"retail", LANDUSE_COMMERCIAL},
+
+	{"conservation", LANDUSE_AGRICULTURE},
+	{"plant_nursery", LANDUSE_AGRICULTURE},
+	{"aquaculture", LANDUSE_AGRICULTURE},
+	{"farmland", LANDUSE_AGRICULTURE},
+	{"farmyard", LANDUSE_AGRICULTURE},
+	{"orchard", LANDUSE_AGRICULTURE},
+	{"vineyard", LANDUSE_AGRICULTURE},
+	{"greenhouse_horticulture", LANDUSE_AGRICULTURE},
+	{"logging", LANDUSE_AGRICULTURE},
+	{"farm", LANDUSE_AGRICULTURE},
+	{"allotments", LANDUSE_AGRICULTURE},
+
+	{"industrial", LANDUSE_INDUSTRIAL},
+	{"quarry", LANDUSE_INDUSTRIAL},
+	{"construction", LANDUSE_INDUSTRIAL},
+
+	{"cemetery", LANDUSE_GREEN},
+	{"forest", LANDUSE_GREEN},
+	{"grass", LANDUSE_GREEN},
+	{"meadow", LANDUSE_GREEN},
+	{"village_green", LANDUSE_GREEN},
+	{"recreation_ground", LANDUSE_GREEN},
+	{"greenfield", LANDUSE_GREEN},
+	{"field", LANDUSE_GREEN},
+
+	{"reservoir", LANDUSE_WATER},
+	{"basin", LANDUSE_WATER},
+	{NULL, 0}
+};
+
+static const struct known_value building_values[] = {
+	{"yes", BUILDING_UNKNOWN},
+
+	{"house", BUILDING_ACCOMODATION},
+	{"detached", BUILDING_ACCOMODATION},
+	{"semidetached_house", BUILDING_ACCOMODATION},
+	{"terrace", BUILDING_ACCOMODATION},
+	{"residential", BUILDING_ACCOMODATION},
+	{"apartments", BUILDING_ACCOMODATION},
+	{"bungalow", BUILDING_ACCOMODATION},
+	{"dormitory", BUILDING_ACCOMODATION},
+	{"hotel", BUILDING_ACCOMODATION},
+
+	{"commercial", BUILDING_COMMERCIAL},
+	{"retail", BUILDING_COMMERCIAL},
+	{"office", BUILDING_COMMERCIAL},
+	{"supermarket", BUILDING_COMMERCIAL},
+	{"kiosk", BUILDING_COMMERCIAL},
+	{"industrial", BUILDING_COMMERCIAL},
+	{"warehouse", BUILDING_COMMERCIAL},
+
+	{"civic", BUILDING_CIVIC},
+	{"public", BUILDING_CIVIC},
+	{"government", BUILDING_CIVIC},
+	{"school", BUILDING_CIVIC},
+	{"university", BUILDING_CIVIC},
+	{"hospital", BUILDING_CIVIC},
+	{"church", BUILDING_CIVIC},
+	{"train_station", BUILDING_CIVIC},
+	{NULL, 0}
+};
+
+static const struct {
+	const char *key;
+	const struct known_value *values;
+	int unknown; // type of values not in the list
+} filter_keys[FILTER_KEY_COUNT] = {
+	[FILTER_LANDUSE] = {"landuse", land_use_values, LANDUSE_UNKNOWN},
+	[FILTER_HIGHWAY] = {"highway", road_values, ROAD_UNKNOWN},
+	[FILTER_BUILDING] = {"building", building_values, BUILDING_OTHER},
+};
+
+// fnv-1a
+static uint32_t hash_value(const char *s, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char) s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct filter_entry *find_entry(const struct filter_rule *rule, const char *val, size_t len) {
+	if (rule->table == NULL)
+		return NULL;
+
+	for (uint32_t i = hash_value(val, len) & rule->mask; ; i = (i + 1) & rule->mask) {
+		struct filter_entry *e = &rule->table[i];
+		if (e->value == NULL)
+			return NULL;
+		if (e->len == len && memcmp(e->value, val, len) == 0)
+			return e;
+	}
+}
+
+// finds or inserts, there is always room as the table is sized up front
+static struct filter_entry *add_entry(struct filter_rule *rule, const char *val, size_t len, int type) {
+	uint32_t i = hash_value(val, len) & rule->mask;
+	while (rule->table[i].value != NULL) {
+		struct filter_entry *e = &rule->table[i];
+		if (e->len == len && memcmp(e->value, val, len) == 0)
+			return e;
+		i = (i + 1) & rule->mask;
+	}
+
+	struct filter_entry *e = &rule->table[i];
+	if ((e->value = alloc_strndup(ALLOC_TAGS, val, len)) == NULL)
+		return NULL;
+	e->len = len;
+	e->type = type;
+	e->keep = false;
+	return e;
+}
+
+static void free_rule(struct filter_rule *rule) {
+	if (rule->table == NULL)
+		return;
+
+	for (uint32_t i = 0; i <= rule->mask; i++)
+		alloc_free(ALLOC_TAGS, rule->table[i].value);
+	alloc_free(ALLOC_TAGS, rule->table);
+	memset(rule, 0, sizeof(*rule));
+}
+
+// leaves rule empty if it fails
+static int init_rule(struct filter_rule *rule, enum filter_key key, size_t extra) {
+	size_t n = extra;
+	for (const struct known_value *v = filter_keys[key].values; v->value != NULL; v++)
+		n++;
+
+	uint32_t size = 16;
+	while (size < n * 2)
+		size *= 2;
+
+	if ((rule->table = alloc_calloc(ALLOC_TAGS, size, sizeof(struct filter_entry))) == NULL)
+		return ERR_MEM;
+	rule->mask = size - 1;
+	rule->enabled = true;
+
+	for (const struct known_value *v = filter_keys[key].values; v->value != NULL; v++) {
+		if (add_entry(rule, v->value, strlen(v->value), v->type) == NULL) {
+			free_rule(rule);
+			return ERR_MEM;
+		}
+	}
+
+	return CRACKING;
+}
+
+static int compile_default(struct tag_filter *out) {
+	int ret;
+	if ((ret = init_rule(&out->rules[FILTER_HIGHWAY], FILTER_HIGHWAY, 0)) != CRACKING)
+		return ret;
+	out->rules[FILTER_HIGHWAY].any = true;
+
+	if ((ret = init_rule(&out->rules[FILTER_LANDUSE], FILTER_LANDUSE, 0)) != CRACKING)
+		return ret;
+
+	struct filter_rule *lu = &out->rules[FILTER_LANDUSE];
+	for (uint32_t i = 0; i <= lu->mask; i++)
+		lu->table[i].keep = lu->table[i].value != NULL && lu->table[i].type != LANDUSE_UNKNOWN;
+
+	return CRACKING;
+}
+
+static char *trim(char *s) {
+	while (isspace((unsigned char) *s))
+		s++;
+
+	char *end = s + strlen(s);
+	while (end > s && isspace((unsigned char) end[-1]))
+		*--end = '\0';
+	return s;
+}
+
+static int compile_rule(struct tag_filter *out, char *rule_str) {
+	char *hash = strchr(rule_str, '#');
+	if (hash != NULL)
+		*hash = '\0';
+
+	rule_str = trim(rule_str);
+	if (*rule_str == '\0')
+		return CRACKING;
+
+	char *values = strchr(rule_str, '=');
+	if (values != NULL)
+		*values++ = '\0';
+
+	char *key_str = trim(rule_str);
+	int key = tag_filter_key(key_str, strlen(key_str));
+	if (key < 0)
+		return ERR_FILTER;
+
+	struct filter_rule *rule = &out->rules[key];
+	if (values == NULL || strcmp(trim(values), "*") == 0) {
+		if (!rule->enabled && init_rule(rule, key, 0) != CRACKING)
+			return ERR_MEM;
+		rule->any = true;
+		return CRACKING;
+	}
+
+	// rules for the same key accumulate, so rebuild with room for both
+	size_t extra = 1;
+	for (char *c = values; *c; c++)
+		extra += *c == ',';
+
+	struct filter_rule grown = {0};
+	if (init_rule(&grown, key, extra + (rule->mask + 1)) != CRACKING)
+		return ERR_MEM;
+
+	// the old rule is only let go once everything is copied, so running
+	// out of memory leaves it as it was
+	if (rule->table != NULL) {
+		grown.any = rule->any;
+		for (uint32_t i = 0; i <= rule->mask; i++) {
+			struct filter_entry *e = &rule->table[i];
+			if (e->value == NULL)
+				continue;
+			struct filter_entry *added = add_entry(&grown, e->value, e->len, e->type);
+			if (added == NULL) {
+				free_rule(&grown);
+				return ERR_MEM;
+			}
+			added->keep = e->keep;
+		}
+		free_rule(rule);
+	}
+	*rule = grown;
+
+	char *v;
+	while ((v = strsep(&values, ",")) != NULL) {
+		v = trim(v);
+		if (*v == '\0')
+			return ERR_FILTER;
+
+		struct filter_entry *e = add_entry(rule, v, strlen(v), filter_keys[key].unknown);
+		if (e == NULL)
+			return ERR_MEM;
+		e->keep = true;
+	}
+
+	return CRACKING;
+}
+
+static char *read_spec_file(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return NULL;
+
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *mem = open_memstream(&buf, &len);
+	if (mem == NULL) {
+		fclose(f);
+		return NULL;
+	}
+
+	int c;
+	bool comment = false;
+	while ((c = fgetc(f)) != EOF) {
+		if (c == '#')
+			comment = true;
+		if (c == '\n') {
+			comment = false;
+			c = ';';
+		}
+		if (!comment)
+			fputc(c, mem);
+	}
+
+	fclose(f);
+	fclose(mem);
+	return buf;
+}
+
+int tag_filter_compile(const char *spec, struct tag_filter *out) {
+	memset(out, 0, sizeof(*out));
+	if (spec == NULL)
+		return compile_default(out);
+
+	char *buf = spec[0] == '@' ? read_spec_file(spec + 1) : strdup(spec);
+	if (buf == NULL)
+		return spec[0] == '@' ? ERR_FILE_NOT_FOUND : ERR_MEM;
+
+	int ret = CRACKING;
+	char *save = NULL;
+	for (char *rule = strtok_r(buf, ";", &save); rule != NULL && ret == CRACKING; rule = strtok_r(NULL, ";", &save))
+		ret = compile_rule(out, rule);
+
+	free(buf);
+	if (ret != CRACKING)
+		tag_filter_free(out);
+	return ret;
+}
+
+void tag_filter_free(struct tag_filter *filter) {
+	for (int k = 0; k < FILTER_KEY_COUNT; k++)
+		free_rule(&filter->rules[k]);
+	memset(filter, 0, sizeof(*filter));
+}
+
+int tag_filter_key(const char *key, size_t len) {
+	switch (len) {
+		case 7:
+			if (memcmp(key, "highway", 7) == 0)
+				return FILTER_HIGHWAY;
+			if (memcmp(key, "landuse", 7) == 0)
+				return FILTER_LANDUSE;
+			break;
+		case 8:
+			if (memcmp(key, "building", 8) == 0)
+				return FILTER_BUILDING;
+			break;
+	}
+	return -1;
+}
+
+bool tag_filter_match(const struct tag_filter *filter, enum filter_key key, const char *val, size_t len, int *type) {
+	const struct filter_rule *rule = &filter->rules[key];
+	if (!rule->enabled)
+		return false;
+
+	const struct filter_entry *e = find_entry(rule, val, len);
+	if (e != NULL) {
+		*type = e->type;
+		return e->keep || rule->any;
+	}
+
+	*type = filter_keys[key].unknown;
+	return rule->any;
+}
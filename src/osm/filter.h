@@ -0,0 +1,50 @@
+#ifndef OSM_FILTER
+#define OSM_FILTER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the tag keys that can turn a way into a world feature, in the order
+// they are tried when classifying
+enum filter_key {
+	FILTER_LANDUSE = 0,
+	FILTER_HIGHWAY,
+	FILTER_BUILDING,
+	FILTER_KEY_COUNT
+};
+
+struct filter_entry {
+	char *value;
+	size_t len;
+	int type;  // road_type/land_use_type/building_type for the key
+	bool keep;
+};
+
+struct filter_rule {
+	bool enabled;
+	bool any; // values not listed are kept too, with an unknown type
+
+	// open addressed, every known value of the key plus those listed
+	struct filter_entry *table;
+	uint32_t mask;
+};
+
+struct tag_filter {
+	struct filter_rule rules[FILTER_KEY_COUNT];
+};
+
+// spec is a ';' separated list of rules, "key", "key=*" or "key=v1,v2".
+// "@path" reads the rules from a file, one per line, '#' starts a comment.
+// NULL compiles the default: any highway and the known land uses
+int tag_filter_compile(const char *spec, struct tag_filter *out);
+
+void tag_filter_free(struct tag_filter *filter);
+
+// interned key, -1 for keys no rule can use
+int tag_filter_key(const char *key, size_t len);
+
+// whether a way with this tag passes, and the feature type it implies
+bool tag_filter_match(const struct tag_filter *filter, enum filter_key key, const char *val, size_t len, int *type);
+
+#endif
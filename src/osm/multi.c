@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "osm.h"
+#include "resolve.h"
+#include "world.h"
+#include "error.h"
+#include "pool.h"
+#include "stats.h"
+#include "alloc.h"
+#include "timing.h"
+
+DEFINE_HASHMAP(id_set, id)
+
+#define ID_CMP(left, right) *(left) != *(right)
+#define ID_HASH(entry) *(entry)
+DEFINE_ALLOC_HOOKS(id_set, ALLOC_WAYS)
+DECLARE_HASHMAP(id_set, ID_CMP, ID_HASH, id_set_free, id_set_realloc)
+
+struct file_job {
+	const char *path;
+	struct parse_options opts;
+	struct parse_stats stats;
+
+	struct world world;
+	struct deferred_refs refs;
+	int ret;
+};
+
+static void parse_file_job(void *arg) {
+	struct file_job *job = arg;
+	job->ret = parse_osm_partial(job->path, &job->opts, &job->world, &job->refs);
+}
+
+// duplicate is set if an earlier file already took the way id
+static int claim_way(id_set *seen, id way_id, bool *duplicate) {
+	id key = way_id;
+	id *pkey = &key;
+
+	*duplicate = id_setFind(seen, &pkey);
+	if (*duplicate)
+		return CRACKING;
+
+	pkey = &key;
+	return id_setPut(seen, &pkey, HMDR_FAIL) == HMPR_FAILED ? ERR_MEM : CRACKING;
+}
+
+// moves one file's features into the merged world, renumbering the
+// feature index of its references to match
+static int merge_file(struct file_job *job, id_set *seen, struct world *out, struct deferred_refs *refs) {
+	int n_roads = job->world.roads.length;
+	int n_land_uses = job->world.land_uses.length;
+	struct buildings *buildings = &job->world.buildings;
+	int ret = CRACKING;
+
+	int64_t *remap = alloc_malloc(ALLOC_OTHER, (n_roads + n_land_uses + buildings->length + 1) * sizeof(int64_t));
+	if (remap == NULL)
+		return ERR_MEM;
+
+	for (int i = 0; i < n_roads; i++) {
+		struct road *r = &job->world.roads.data[i];
+		bool duplicate = false;
+
+		if (ret == CRACKING)
+			ret = claim_way(seen, r->id, &duplicate);
+
+		if (ret != CRACKING || duplicate) {
+			alloc_free(ALLOC_TAGS, r->name);
+			alloc_vec_deinit(ALLOC_GEOMETRY, &r->segments);
+			remap[i] = -1;
+			continue;
+		}
+
+		remap[i] = out->roads.length;
+		alloc_set_vec_tag(ALLOC_GEOMETRY);
+		if (vec_push(&out->roads, *r) != 0)
+			ret = ERR_MEM;
+	}
+
+	for (int i = 0; i < n_land_uses; i++) {
+		struct land_use *l = &job->world.land_uses.data[i];
+		bool duplicate = false;
+
+		if (ret == CRACKING)
+			ret = claim_way(seen, l->id, &duplicate);
+
+		if (ret != CRACKING || duplicate) {
+			alloc_vec_deinit(ALLOC_GEOMETRY, &l->points);
+			remap[n_roads + i] = -1;
+			continue;
+		}
+
+		remap[n_roads + i] = out->land_uses.length | REF_LAND_USE;
+		alloc_set_vec_tag(ALLOC_GEOMETRY);
+		if (vec_push(&out->land_uses, *l) != 0)
+			ret = ERR_MEM;
+	}
+
+	// rings are copied, the file's store goes in one free
+	int64_t *remap_buildings = remap + n_roads + n_land_uses;
+	for (int i = 0; i < buildings->length; i++) {
+		bool duplicate = false;
+
+		if (ret == CRACKING)
+			ret = claim_way(seen, buildings->ids[i], &duplicate);
+
+		if (ret != CRACKING || duplicate) {
+			remap_buildings[i] = -1;
+			continue;
+		}
+
+		remap_buildings[i] = out->buildings.length | REF_BUILDING;
+		ret = buildings_copy(&out->buildings, buildings, i);
+	}
+
+	alloc_set_vec_tag(ALLOC_WAYS);
+	if (ret == CRACKING && vec_reserve(&refs->refs, refs->refs.length + job->refs.refs.length) != 0)
+		ret = ERR_MEM;
+
+	if (ret == CRACKING) {
+		for (int i = 0; i < job->refs.refs.length; i++) {
+			struct node_ref ref = job->refs.refs.data[i];
+			uint32_t feature = REF_FEATURE(ref.feature);
+			if (ref.feature & REF_LAND_USE)
+				feature += n_roads;
+			else if (ref.feature & REF_BUILDING)
+				feature += n_roads + n_land_uses;
+
+			int64_t to = remap[feature];
+			if (to < 0)
+				continue;
+
+			ref.feature = (uint32_t) to;
+			refs->refs.data[refs->refs.length++] = ref;
+		}
+	}
+
+	// file order is kept, so the first file wins on duplicate node ids
+	alloc_set_vec_tag(ALLOC_NODES);
+	if (ret == CRACKING && vec_reserve(&refs->nodes, refs->nodes.length + job->refs.nodes.length) != 0)
+		ret = ERR_MEM;
+
+	if (ret == CRACKING && job->refs.nodes.length > 0) {
+		memcpy(refs->nodes.data + refs->nodes.length, job->refs.nodes.data, job->refs.nodes.length * sizeof(struct node));
+		refs->nodes.length += job->refs.nodes.length;
+	}
+
+	alloc_free(ALLOC_OTHER, remap);
+	alloc_vec_deinit(ALLOC_GEOMETRY, &job->world.roads);
+	alloc_vec_deinit(ALLOC_GEOMETRY, &job->world.land_uses);
+	buildings_free(buildings);
+	free_deferred(&job->refs);
+	return ret;
+}
+
+int parse_osm_from_files(const char *const *paths, int n, const struct parse_options *opts, struct world *out) {
+	init_world(out);
+
+	// the files' references are joined in memory
+	if (opts != NULL && opts->max_memory > 0)
+		return ERR_UNSUPPORTED;
+	double start = monotonic_now();
+
+	struct file_job *jobs = alloc_calloc(ALLOC_OTHER, n > 0 ? n : 1, sizeof(struct file_job));
+	if (jobs == NULL)
+		return ERR_MEM;
+
+	struct pool pool;
+	int threads = opts != NULL ? opts->threads : 0;
+	if (threads <= 0 || threads > n)
+		threads = n < pool_default_threads() ? n : pool_default_threads();
+
+	int ret = pool_init(&pool, threads);
+	if (ret == CRACKING) {
+		for (int i = 0; i < n; i++) {
+			jobs[i].path = paths[i];
+			if (opts != NULL)
+				jobs[i].opts = *opts;
+
+			// each job counts for itself, summed once they're done
+			if (opts != NULL && opts->stats != NULL)
+				jobs[i].opts.stats = &jobs[i].stats;
+			if (pool_submit(&pool, parse_file_job, &jobs[i]) != CRACKING)
+				parse_file_job(&jobs[i]);
+		}
+		pool_free(&pool);
+	}
+
+	// merged strictly in path order, whichever file finished first
+	id_set seen;
+	id_setNew(&seen);
+	struct deferred_refs refs;
+	memset(&refs, 0, sizeof(refs));
+
+	for (int i = 0; i < n; i++) {
+		if (ret == CRACKING && jobs[i].ret != CRACKING)
+			ret = jobs[i].ret;
+
+		if (opts != NULL && opts->stats != NULL) {
+			jobs[i].stats.timings.total = 0;
+			add_parse_stats(opts->stats, &jobs[i].stats);
+		}
+
+		int merged = merge_file(&jobs[i], &seen, out, &refs);
+		if (merged != CRACKING)
+			ret = merged;
+	}
+
+	double resolve_start = monotonic_now();
+	int resolved = resolve_deferred(&refs, out, opts != NULL ? opts->stats : NULL);
+	if (resolved == CRACKING)
+		resolved = buildings_measure(&out->buildings, opts != NULL ? opts->threads : 0);
+	if (resolved != CRACKING)
+		ret = resolved;
+
+	if (opts != NULL && opts->stats != NULL) {
+		opts->stats->timings.way_resolve += monotonic_now() - resolve_start;
+		opts->stats->timings.total += monotonic_now() - start;
+	}
+
+	free_deferred(&refs);
+	id_setDestroy(&seen);
+	alloc_free(ALLOC_OTHER, jobs);
+	return ret;
+}
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+
+static const uint32_t pow10_table[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SWAR (1)
+
+static inline uint64_t load8(const char *s) {
+	uint64_t v;
+	memcpy(&v, s, sizeof(v));
+	return v;
+}
+
+// all 8 bytes in '0'..'9'
+static inline bool is_eight_digits(uint64_t v) {
+	return ((v & 0xf0f0f0f0f0f0f0f0ULL) |
+			(((v + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+// combines digit pairs, then quads, then the two halves in three multiplies
+static inline uint32_t eight_digits_value(uint64_t v) {
+	const uint64_t mask = 0x000000ff000000ffULL;
+	const uint64_t mul1 = 100 + (1000000ULL << 32);
+	const uint64_t mul2 = 1 + (10000ULL << 32);
+
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+	return (uint32_t) v;
+}
+#endif
+
+// up to 19 digits, which cannot overflow a uint64_t
+static inline bool parse_digits(const char *s, size_t n, uint64_t *out) {
+	uint64_t acc = 0;
+
+#ifdef HAVE_SWAR
+	while (n >= 8) {
+		uint64_t v = load8(s);
+		if (!is_eight_digits(v))
+			return false;
+		acc = acc * 100000000ULL + eight_digits_value(v);
+		s += 8;
+		n -= 8;
+	}
+#endif
+
+	for (; n > 0; s++, n--) {
+		unsigned d = (unsigned char) *s - '0';
+		if (d > 9)
+			return false;
+		acc = acc * 10 + d;
+	}
+
+	*out = acc;
+	return true;
+}
+
+bool parse_int64(const char *s, size_t len, int64_t *out) {
+	bool neg = false;
+	if (len > 0 && (*s == '-' || *s == '+')) {
+		neg = *s == '-';
+		s++;
+		len--;
+	}
+
+	if (len == 0 || len > 19)
+		return false;
+
+	uint64_t mag;
+	if (!parse_digits(s, len, &mag))
+		return false;
+
+	if (mag > (uint64_t) INT64_MAX + neg)
+		return false;
+
+	*out = neg ? (int64_t) (0 - mag) : (int64_t) mag;
+	return true;
+}
+
+static bool parse_coord_magnitude(const char *s, size_t len, uint64_t *out) {
+	const char *dot = memchr(s, '.', len);
+	size_t int_len = dot == NULL ? len : (size_t) (dot - s);
+	size_t frac_len = dot == NULL ? 0 : len - int_len - 1;
+
+	if (int_len > 3 || frac_len > COORD_DECIMAL || int_len + frac_len == 0)
+		return false;
+
+	uint64_t whole = 0;
+	if (!parse_digits(s, int_len, &whole))
+		return false;
+
+	uint64_t frac = 0;
+#ifdef HAVE_SWAR
+	if (frac_len == COORD_DECIMAL) {
+		// the dot and its 7 digits are 8 bytes, swap the dot for a leading zero
+		uint64_t v = (load8(dot) & ~0xffULL) | '0';
+		if (!is_eight_digits(v))
+			return false;
+		frac = eight_digits_value(v);
+	} else
+#endif
+	{
+		if (dot != NULL && !parse_digits(dot + 1, frac_len, &frac))
+			return false;
+		frac *= pow10_table[COORD_DECIMAL - frac_len];
+	}
+
+	*out = whole * COORD_SCALE + frac;
+	return true;
+}
+
+bool parse_coord_fixed(const char *s, size_t len, int32_t *out) {
+	bool neg = false;
+	if (len > 0 && (*s == '-' || *s == '+')) {
+		neg = *s == '-';
+		s++;
+		len--;
+	}
+
+	uint64_t mag;
+	if (!parse_coord_magnitude(s, len, &mag) || mag > INT32_MAX)
+		return false;
+
+	*out = neg ? -(int32_t) mag : (int32_t) mag;
+	return true;
+}
+
+double parse_coord(const char *s, size_t len) {
+	const char *digits = s;
+	size_t digits_len = len;
+	bool neg = false;
+	if (digits_len > 0 && (*digits == '-' || *digits == '+')) {
+		neg = *digits == '-';
+		digits++;
+		digits_len--;
+	}
+
+	// both operands are exact, so the ieee division rounds the exact decimal
+	// value correctly, and magnitude first keeps the sign of -0
+	uint64_t mag;
+	if (parse_coord_magnitude(digits, digits_len, &mag)) {
+		double d = (double) mag / COORD_SCALE;
+		return neg ? -d : d;
+	}
+
+	// more precision or exponent notation
+	char buf[64];
+	if (len >= sizeof(buf))
+		return strtod(s, NULL);
+
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+	return strtod(buf, NULL);
+}
@@ -0,0 +1,22 @@
+#ifndef OSM_NUMBER
+#define OSM_NUMBER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// osm coordinates are stored with 7 decimal places
+#define COORD_SCALE   (10000000)
+#define COORD_DECIMAL (7)
+
+// whole of s[0..len) must be an optionally signed decimal integer
+bool parse_int64(const char *s, size_t len, int64_t *out);
+
+// degrees scaled by COORD_SCALE. false for anything but plain decimal
+// notation with at most COORD_DECIMAL places
+bool parse_coord_fixed(const char *s, size_t len, int32_t *out);
+
+// correctly rounded, identical to strtod on the same input
+double parse_coord(const char *s, size_t len);
+
+#endif
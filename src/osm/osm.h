@@ -18,6 +18,17 @@ DEFINE_HASHMAP(tag_map, struct tag)
 typedef int64_t id;
 typedef vec_t(id) vec_id_t;
 
+// xml elements the parser recognises, in the order of tag_lookup
+enum tag_type {
+	TAG_NODE,
+	TAG_TAG,
+	TAG_WAY,
+	TAG_NODE_REF,
+	TAG_RELATION,
+	TAG_UNKNOWN
+};
+#define TAG_TYPE_COUNT (TAG_UNKNOWN + 1)
+
 struct node {
 	id id;
 	point pos;
@@ -29,6 +40,7 @@ enum way_type {
 	WAY_BUILDING,
 	WAY_LANDUSE
 };
+#define WAY_TYPE_COUNT (WAY_LANDUSE + 1)
 
 enum road_type {
 	ROAD_UNKNOWN = 0,
@@ -39,6 +51,7 @@ enum road_type {
 	ROAD_RESIDENTIAL,
 	ROAD_PEDESTRIAN
 };
+#define ROAD_TYPE_COUNT (ROAD_PEDESTRIAN + 1)
 
 enum building_type {
 	BUILDING_UNKNOWN = 0,
@@ -47,6 +60,7 @@ enum building_type {
 	BUILDING_CIVIC,
 	BUILDING_OTHER
 };
+#define BUILDING_TYPE_COUNT (BUILDING_OTHER + 1)
 
 enum land_use_type {
 	LANDUSE_UNKNOWN = 0,
@@ -57,14 +71,24 @@ enum land_use_type {
 	LANDUSE_GREEN,
 	LANDUSE_WATER
 };
+#define LANDUSE_TYPE_COUNT (LANDUSE_WATER + 1)
 
 const char *road_type_to_string(enum road_type rt);
 
+const char *land_use_type_to_string(enum land_use_type lt);
+
 struct road {
 	id id;
 	enum road_type type;
 	vec_point_t segments;
 	char *name;
+
+	// node ids at either end of segments, for joining roads up
+	id first_node, last_node;
+
+	// the ways a stitched road was made from, in segment order. empty for
+	// a road that is a single way
+	vec_id_t way_ids;
 };
 
 struct land_use {
@@ -81,6 +105,7 @@ struct way {
 	union {
 		struct road road;
 		struct land_use land_use;
+		enum building_type building; // the ring goes straight to the world
 	} que;
 };
 
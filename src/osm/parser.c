@@ -7,24 +7,25 @@
 #include <error.h>
 #include <math.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "osm.h"
 #include "world.h"
 #include "parser.h"
+#include "stream.h"
+#include "number.h"
+#include "resolve.h"
+#include "filter.h"
+#include "stats.h"
+#include "timing.h"
+#include "alloc.h"
 
 #define NODE_CMP(left, right) left->id != right->id
 #define NODE_HASH(entry) entry->id
-DECLARE_HASHMAP(node_map, NODE_CMP, NODE_HASH, free, realloc)
-DECLARE_HASHMAP(way_map, NODE_CMP, NODE_HASH, free, realloc)
-
-enum tag_type {
-	TAG_NODE,
-	TAG_TAG,
-	TAG_WAY,
-	TAG_NODE_REF,
-	TAG_RELATION,
-	TAG_UNKNOWN
-};
+DEFINE_ALLOC_HOOKS(node_map, ALLOC_NODES)
+DEFINE_ALLOC_HOOKS(way_map, ALLOC_WAYS)
+DECLARE_HASHMAP(node_map, NODE_CMP, NODE_HASH, node_map_free, node_map_realloc)
+DECLARE_HASHMAP(way_map, NODE_CMP, NODE_HASH, way_map_free, way_map_realloc)
 
 struct parse_ctx {
 	FILE *f;
@@ -39,7 +40,18 @@ struct parse_ctx {
 		struct node node;
 		struct way way;
 	} que;
-	tag_map current_tags;
+
+	// per filter key, the feature type of the current way's tag if the
+	// filter keeps it, otherwise -1
+	int tag_types[FILTER_KEY_COUNT];
+
+	// a building's points before they are quantized into the store
+	vec_point_t ring;
+
+	// only copied out of the line if the way turns out to be a road
+	char *name;
+	size_t name_cap;
+	bool has_name;
 
 	double lat_range[2];
 	double lon_range[2];
@@ -47,6 +59,15 @@ struct parse_ctx {
 	node_map nodes;
 	way_map ways;
 
+	const struct parse_options *opts;
+	const struct tag_filter *filter;
+	struct deferred_refs deferred;
+	bool defer; // RESOLVE_DEFERRED, or a memory budget
+
+	// always counted, timings only taken if the caller wants stats
+	struct parse_stats stats;
+	bool timed;
+
 	struct world out;
 };
 
@@ -64,6 +85,10 @@ const char *tag_lookup[] = {
 	"relation",
 };
 
+static const char *tag_name(enum tag_type type) {
+	return type < TAG_UNKNOWN ? tag_lookup[type] : "none";
+}
+
 struct xml_tag parse_tag(char *tag_in) {
 	struct xml_tag out = {
 		.type = TAG_UNKNOWN
@@ -138,16 +163,16 @@ int read_line(struct parse_ctx *ctx) {
 	while (true) {
 		int read = getline(&ctx->full_line, &ctx->n, ctx->f);
 
-		// possibly at the end too
+		// possibly at the end too. the line buffer is kept for the next parse
 		if (read == -1) {
-			free(ctx->full_line);
-			ctx->full_line = NULL;
 			ctx->line_end = NULL;
 			ctx->tag_start = NULL;
 			ctx->attr_start = NULL;
 			return ERR_IO;
 		}
 
+		ctx->stats.lines++;
+		ctx->stats.bytes += read;
 		ctx->line_end = ctx->full_line + strlen(ctx->full_line);
 
 		if (find_tag(ctx->full_line, &ctx->tag_start) == CRACKING) {
@@ -159,22 +184,23 @@ int read_line(struct parse_ctx *ctx) {
 	return ERR_IO; // never gonna get here
 }
 
-// current_tags must have been init'd already
 void clear_current(struct parse_ctx *ctx) {
 	ctx->current_tag = TAG_UNKNOWN;
 	memset(&ctx->que, 0, sizeof(ctx->que));
 
-	struct tag *tag = NULL;
-	HASHMAP_FOR_EACH(tag_map, tag, ctx->current_tags) {
-		free(tag->key);
-		free(tag->val);
-	} HASHMAP_FOR_EACH_END
-	tag_mapDestroy(&ctx->current_tags);
-	tag_mapNew(&ctx->current_tags);
+	for (int i = 0; i < FILTER_KEY_COUNT; i++)
+		ctx->tag_types[i] = -1;
+	ctx->has_name = false;
 }
 
-typedef void attr_visitor(char *key, char *val, void *data);
-#define ATTR_VISITOR(name) void name(char *key, char *val, void *data)
+typedef void attr_visitor(char *key, char *val, size_t val_len, void *data);
+#define ATTR_VISITOR(name) void name(char *key, char *val, size_t val_len, void *data)
+
+// attribute keys are compared often enough that strcmp shows up
+#define KEY_IS_ID(k)  ((k)[0] == 'i' && (k)[1] == 'd' && (k)[2] == '\0')
+#define KEY_IS_LAT(k) ((k)[0] == 'l' && (k)[1] == 'a' && (k)[2] == 't' && (k)[3] == '\0')
+#define KEY_IS_LON(k) ((k)[0] == 'l' && (k)[1] == 'o' && (k)[2] == 'n' && (k)[3] == '\0')
+#define KEY_IS_REF(k) ((k)[0] == 'r' && (k)[1] == 'e' && (k)[2] == 'f' && (k)[3] == '\0')
 
 void visit_attributes(char *line, attr_visitor *visitor, void *data) {
 	while (true) {
@@ -196,7 +222,7 @@ void visit_attributes(char *line, attr_visitor *visitor, void *data) {
 		*val_end = '\0';
 
 		// wahey!
-		visitor(key_start, val_start, data);
+		visitor(key_start, val_start, (size_t) (val_end - val_start), data);
 		// TODO allow early termination
 
 		// move on
@@ -208,8 +234,19 @@ void visit_attributes(char *line, attr_visitor *visitor, void *data) {
 
 int add_node_to_context(struct parse_ctx *ctx) {
 	struct node *node = &ctx->que.node;
+	double start = ctx->timed ? monotonic_now() : 0;
 
-	int ret = node_mapPut(&ctx->nodes, &node, HMDR_FAIL) == HMPR_FAILED ? ERR_MEM : CRACKING;
+	int ret;
+	if (ctx->defer) {
+		ret = defer_node(&ctx->deferred, node);
+	} else {
+		ret = node_mapPut(&ctx->nodes, &node, HMDR_FAIL) == HMPR_FAILED ? ERR_MEM : CRACKING;
+		ctx->stats.node_map_probes++;
+		ctx->stats.node_map_size += ret == CRACKING;
+	}
+
+	if (ctx->timed)
+		ctx->stats.timings.node_store += monotonic_now() - start;
 
 	// unset current
 	clear_current(ctx);
@@ -217,30 +254,21 @@ int add_node_to_context(struct parse_ctx *ctx) {
 	return ret;
 }
 
-bool id_to_long(char *s, long *out) {
-	char *str_end;
-	long long_id = strtol(s, &str_end, 10);
-	if (*str_end != '\0')
-		return false;
-	*out = long_id;
-	return true;
-}
-
 ATTR_VISITOR(node_visitor) {
 
-	if (strcmp(key, "id") == 0) {
-		if (!id_to_long(val, &((struct node *)data)->id)) {
-			// fprintf(err_stream, "bad node id '%s'\n", val);
+	if (KEY_IS_ID(key)) {
+		if (!parse_int64(val, val_len, &((struct node *)data)->id)) {
+			LOG_ERROR("bad node id '%s'\n", val);
 			return;
 		}
 	}
 
-	else if (strcmp(key, "lat") == 0) {
-		((struct node *)data)->pos.lat = strtold(val, NULL);
+	else if (KEY_IS_LAT(key)) {
+		((struct node *)data)->pos.lat = parse_coord(val, val_len);
 	}
 
-	else if (strcmp(key, "lon") == 0) {
-		((struct node *)data)->pos.lon = strtold(val, NULL);
+	else if (KEY_IS_LON(key)) {
+		((struct node *)data)->pos.lon = parse_coord(val, val_len);
 	}
 }
 
@@ -266,21 +294,30 @@ int parse_node_tag(struct parse_ctx *ctx, bool opening) {
 	return CRACKING;
 }
 
+// points into the current line, valid until the next is read
+struct raw_tag {
+	char *key, *val;
+	size_t key_len, val_len;
+};
+
 ATTR_VISITOR(tag_visitor) {
+	struct raw_tag *tag = data;
 	switch(key[0]) {
 		case 'k':
-			((struct tag *)data)->key = strdup(val);
+			tag->key = val;
+			tag->key_len = val_len;
 			break;
 		case 'v':
-			((struct tag *)data)->val = strdup(val);
+			tag->val = val;
+			tag->val_len = val_len;
 			break;
 	}
 }
 
 ATTR_VISITOR(node_ref_visitor) {
-	if (strcmp(key, "ref") == 0) {
-		if (!id_to_long(val, (id *)data)) {
-			// fprintf(err_stream, "bad node ref id '%s'\n", val);
+	if (KEY_IS_REF(key)) {
+		if (!parse_int64(val, val_len, (id *)data)) {
+			LOG_ERROR("bad node ref id '%s'\n", val);
 			return;
 		}
 
@@ -288,7 +325,7 @@ ATTR_VISITOR(node_ref_visitor) {
 }
 int parse_node_ref_tag(struct parse_ctx *ctx) {
 	if (ctx->current_tag != TAG_WAY) {
-		// fprintf(err_stream, "nd tag found inside non-way tag '%s'\n", tag_lookup[ctx->current_tag]);
+		LOG_ERROR("nd tag found inside non-way tag '%s'\n", tag_name(ctx->current_tag));
 		return ERR_OSM;
 	}
 
@@ -300,120 +337,38 @@ int parse_node_ref_tag(struct parse_ctx *ctx) {
 
 
 	struct way *way = &ctx->que.way;
+	alloc_set_vec_tag(ALLOC_WAYS);
 	return vec_push(&way->nodes, id) == 0 ? CRACKING : ERR_MEM;
 }
 
-static enum road_type parse_road_type(const char *s) {
-	if (strcmp(s, "motorway") == 0) return ROAD_MOTORWAY;
-	else if (strcmp(s, "motorway_link") == 0) return ROAD_MOTORWAY;
-	else if (strcmp(s, "primary_link") == 0) return ROAD_PRIMARY;
-	else if (strcmp(s, "primary") == 0) return ROAD_PRIMARY;
-	else if (strcmp(s, "trunk") == 0) return ROAD_PRIMARY;
-	else if (strcmp(s, "trunk_link") == 0) return ROAD_PRIMARY;
-
-	else if (strcmp(s, "secondary_link") == 0) return ROAD_SECONDARY;
-	else if (strcmp(s, "secondary") == 0) return ROAD_SECONDARY;
-	else if (strcmp(s, "tertiary") == 0) return ROAD_SECONDARY;
-	else if (strcmp(s, "tertiary_link") == 0) return ROAD_SECONDARY;
-
-	else if (strcmp(s, "unclassified") == 0) return ROAD_MINOR;
-	else if (strcmp(s, "minor") == 0) return ROAD_MINOR;
-
-
-	else if (strcmp(s, "residential") == 0) return ROAD_RESIDENTIAL;
-	else if (strcmp(s, "living_street") == 0) return ROAD_RESIDENTIAL;
-
-	else if (strcmp(s, "pedestrian") == 0) return ROAD_PEDESTRIAN;
-	else if (strcmp(s, "footway") == 0) return ROAD_PEDESTRIAN;
-	else if (strcmp(s, "steps") == 0) return ROAD_PEDESTRIAN;
-	else if (strcmp(s, "path") == 0) return ROAD_PEDESTRIAN;
-	else if (strcmp(s, "cycleway") == 0) return ROAD_PEDESTRIAN;
-	else if (strcmp(s, "bridleway") == 0) return ROAD_PEDESTRIAN;
-
-	else return ROAD_UNKNOWN;
-}
-
-static enum land_use_type parse_landuse(const char *s) {
-
-	if (strcmp(s, "residential") == 0) return LANDUSE_RESIDENTIAL;
-
-	else if (strcmp(s, "commercial") == 0) return LANDUSE_COMMERCIAL;
-	else if (strcmp(s, "retail") == 0) return LANDUSE_COMMERCIAL;
-
-	else if (strcmp(s, "conservation") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "plant_nursery") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "aquaculture") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "farmland") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "farmyard") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "orchard") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "vineyard") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "greenhouse_horticulture") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "logging") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "farm") == 0) return LANDUSE_AGRICULTURE;
-	else if (strcmp(s, "allotments") == 0) return LANDUSE_AGRICULTURE;
-
-	else if (strcmp(s, "industrial") == 0) return LANDUSE_INDUSTRIAL;
-	else if (strcmp(s, "quarry") == 0) return LANDUSE_INDUSTRIAL;
-	else if (strcmp(s, "construction") == 0) return LANDUSE_INDUSTRIAL;
-
-	else if (strcmp(s, "cemetery") == 0) return LANDUSE_GREEN;
-	else if (strcmp(s, "forest") == 0) return LANDUSE_GREEN;
-	else if (strcmp(s, "grass") == 0) return LANDUSE_GREEN;
-	else if (strcmp(s, "meadow") == 0) return LANDUSE_GREEN;
-	else if (strcmp(s, "village_green") == 0) return LANDUSE_GREEN;
-	else if (strcmp(s, "recreation_ground") == 0) return LANDUSE_GREEN;
-	else if (strcmp(s, "greenfield") == 0) return LANDUSE_GREEN;
-	else if (strcmp(s, "field") == 0) return LANDUSE_GREEN;
-
-	else if (strcmp(s, "reservoir") == 0) return LANDUSE_WATER;
-	else if (strcmp(s, "basin") == 0) return LANDUSE_WATER;
-
-	else return LANDUSE_UNKNOWN;
-}
-
 ATTR_VISITOR(way_visitor) {
 
-	if (strcmp(key, "id") == 0) {
-		if (!id_to_long(val, &((struct way *)data)->id)) {
-			// fprintf(err_stream, "bad way id '%s'\n", val);
+	if (KEY_IS_ID(key)) {
+		if (!parse_int64(val, val_len, &((struct way *)data)->id)) {
+			LOG_ERROR("bad way id '%s'\n", val);
 			return;
 		}
 	}
 }
 
 static enum way_type classify_way(struct parse_ctx *ctx, struct way *way) {
-	struct tag tag = {0};
-	struct tag *ptag = &tag;
-
-	tag.key = "landuse";
-	if (tag_mapFind(&ctx->current_tags, &ptag)) {
-		enum land_use_type lu = parse_landuse(ptag->val);
-		if (lu != LANDUSE_UNKNOWN) {
-			way->way_type = WAY_LANDUSE;
-			way->que.land_use.type = lu;
-			return WAY_LANDUSE;
-		}
+	if (ctx->tag_types[FILTER_LANDUSE] >= 0) {
+		way->way_type = WAY_LANDUSE;
+		way->que.land_use.type = (enum land_use_type) ctx->tag_types[FILTER_LANDUSE];
+		return WAY_LANDUSE;
 	}
 
-
-
-	tag.key = "highway";
-	if (tag_mapFind(&ctx->current_tags, &ptag)) {
-		enum road_type rt = parse_road_type(ptag->val);
+	if (ctx->tag_types[FILTER_HIGHWAY] >= 0) {
 		way->way_type = WAY_ROAD;
-		way->que.road.type = rt;
+		way->que.road.type = (enum road_type) ctx->tag_types[FILTER_HIGHWAY];
 		return WAY_ROAD;
 	}
 
-/*
-	tag.key = "building";
-	if (tag_mapFind(&ctx->current_tags, &ptag)) {
-		enum building_type bt = parse_building_type(ptag->val);
+	if (ctx->tag_types[FILTER_BUILDING] >= 0) {
 		way->way_type = WAY_BUILDING;
-		way->que.building.type = bt;
+		way->que.building = (enum building_type) ctx->tag_types[FILTER_BUILDING];
 		return WAY_BUILDING;
 	}
-*/
 
 	return way->way_type = WAY_UNKNOWN;
 }
@@ -423,70 +378,157 @@ static int add_node_points(struct parse_ctx *ctx, struct way *way, vec_point_t *
 	id nid = 0;
 	struct node node = {0};
 	struct node *pnode = NULL;
+	int missing = 0;
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
 	vec_foreach(&way->nodes, nid, i) {
 		node.id = nid;
 		pnode = &node;
+		ctx->stats.node_map_probes++;
 		if (!node_mapFind(&ctx->nodes, &pnode)) {
-			// fprintf(err_stream, "nonexistent node ref %ld\n", nid);
-			return ERR_OSM;
+			LOG_ERROR("nonexistent node ref %ld\n", nid);
+			missing++;
+			continue;
 		}
 
-		if (vec_push(out, pnode->pos) != 0)
+		if (missing == 0 && vec_push(out, pnode->pos) != 0)
 			return ERR_MEM;
 	}
 
+	if (missing > 0) {
+		ctx->stats.unresolved_refs += missing;
+		ctx->stats.dropped_features++;
+		return ERR_OSM;
+	}
+
 	return CRACKING;
 }
 
+static int way_points(struct parse_ctx *ctx, struct way *way, uint32_t feature, vec_point_t *out) {
+	double start = ctx->timed ? monotonic_now() : 0;
+
+	int ret;
+	if (ctx->defer)
+		ret = defer_way_refs(&ctx->deferred, &way->nodes, feature, out);
+	else
+		ret = add_node_points(ctx, way, out);
+
+	if (ctx->timed)
+		ctx->stats.timings.way_resolve += monotonic_now() - start;
+	return ret;
+}
+
+// the first n of the way's nodes as a ring in the building store
+static int building_ring(struct parse_ctx *ctx, struct way *way, uint32_t n) {
+	double start = ctx->timed ? monotonic_now() : 0;
+	struct buildings *b = &ctx->out.buildings;
+
+	int ret;
+	if (ctx->defer) {
+		ret = buildings_add(b, way->id, way->que.building, NULL, n);
+		if (ret == CRACKING && (ret = defer_ring_refs(&ctx->deferred, way->nodes.data, n, (b->length - 1) | REF_BUILDING)) != CRACKING)
+			buildings_pop(b);
+	} else {
+		vec_clear(&ctx->ring);
+		ret = add_node_points(ctx, way, &ctx->ring);
+		if (ret == CRACKING)
+			ret = buildings_add(b, way->id, way->que.building, ctx->ring.data, n);
+	}
+
+	if (ctx->timed)
+		ctx->stats.timings.way_resolve += monotonic_now() - start;
+	return ret;
+}
+
 int add_way_to_context(struct parse_ctx *ctx) {
 	struct way *way = &ctx->que.way;
-	struct tag tag = {0};
-	struct tag *ptag = &tag;
 
-	// add all ways in case they're used in relations
-	if (way_mapPut(&ctx->ways, &way, HMDR_FAIL) == HMPR_FAILED)
-		return ERR_MEM;
+	// add all ways in case they're used in relations. under a memory budget
+	// only the id is kept, repeats are dropped when resolving instead
+	bool budget = ctx->deferred.spill != NULL;
+	if (!budget) {
+		ctx->stats.way_map_probes++;
+		if (way_mapPut(&ctx->ways, &way, HMDR_FAIL) == HMPR_FAILED) {
+			alloc_vec_deinit(ALLOC_WAYS, &way->nodes);
+			clear_current(ctx);
+			return ERR_MEM;
+		}
+		ctx->stats.way_map_size++;
+	}
 
 	int ret = CRACKING;
 	enum way_type type = classify_way(ctx, way);
 
+	ctx->stats.ways[type]++;
+	if (type == WAY_ROAD)
+		ctx->stats.roads[way->que.road.type]++;
+	else if (type == WAY_LANDUSE)
+		ctx->stats.land_uses[way->que.land_use.type]++;
+	else if (type == WAY_BUILDING)
+		ctx->stats.buildings[way->que.building]++;
+
 	// road name and segments
 	if (type == WAY_ROAD) {
-		tag.key = "name";
-		ptag = &tag;
-		if (tag_mapFind(&ctx->current_tags, &ptag)) {
-			if ((way->que.road.name = strdup(ptag->val)) == NULL)
-				return ERR_MEM;
-		}
+		if (ctx->has_name && (way->que.road.name = alloc_strdup(ALLOC_TAGS, ctx->name)) == NULL)
+			ret = ERR_MEM;
 
 		// add road segments
-		if ((ret = add_node_points(ctx, way, &way->que.road.segments)) != CRACKING)
-			return ret;
+		if (ret == CRACKING)
+			ret = way_points(ctx, way, ctx->out.roads.length, &way->que.road.segments);
 
 		way->que.road.id = way->id;
+		if (way->nodes.length > 0) {
+			way->que.road.first_node = way->nodes.data[0];
+			way->que.road.last_node = way->nodes.data[way->nodes.length - 1];
+		}
+
+		alloc_set_vec_tag(ALLOC_GEOMETRY);
+		if (ret == CRACKING)
+			ret = vec_push(&ctx->out.roads, way->que.road) == 0 ? CRACKING : ERR_MEM;
 
-		ret = vec_push(&ctx->out.roads, way->que.road) == 0 ? CRACKING : ERR_MEM;
+		if (ret != CRACKING) {
+			alloc_free(ALLOC_TAGS, way->que.road.name);
+			alloc_vec_deinit(ALLOC_GEOMETRY, &way->que.road.segments);
+		}
 	}
 
 	// land use
 	else if (type == WAY_LANDUSE) {
-		if ((ret = add_node_points(ctx, way, &way->que.land_use.points)) != CRACKING)
-			return ret;
+		ret = way_points(ctx, way, ctx->out.land_uses.length | REF_LAND_USE, &way->que.land_use.points);
 
 		way->que.land_use.id = way->id;
-		ret = vec_push(&ctx->out.land_uses, way->que.land_use) == 0 ? CRACKING : ERR_MEM;
+
+		alloc_set_vec_tag(ALLOC_GEOMETRY);
+		if (ret == CRACKING)
+			ret = vec_push(&ctx->out.land_uses, way->que.land_use) == 0 ? CRACKING : ERR_MEM;
+
+		if (ret != CRACKING)
+			alloc_vec_deinit(ALLOC_GEOMETRY, &way->que.land_use.points);
 	}
 
-	// building
-/*
+	// building, without the node that closes its ring
 	else if (type == WAY_BUILDING) {
-		if ((ret = add_node_points(ctx, way, &way->que.building.points)) != CRACKING)
-			return ret;
-		ret = vec_push(&ctx->out.buildings, way->que.building) == 0 ? CRACKING : ERR_MEM;
+		int n = way->nodes.length;
+		if (n > 1 && way->nodes.data[0] == way->nodes.data[n - 1])
+			n--;
+		ret = building_ring(ctx, way, (uint32_t) n);
 	}
-*/
 
-	// unset current
+	if (budget) {
+		uint32_t feature = WAY_NO_FEATURE;
+		if (ret == CRACKING && type == WAY_ROAD)
+			feature = ctx->out.roads.length - 1;
+		else if (ret == CRACKING && type == WAY_LANDUSE)
+			feature = (ctx->out.land_uses.length - 1) | REF_LAND_USE;
+		else if (ret == CRACKING && type == WAY_BUILDING)
+			feature = (ctx->out.buildings.length - 1) | REF_BUILDING;
+
+		int err = defer_way_id(&ctx->deferred, way->id, feature);
+		if (ret == CRACKING)
+			ret = err;
+		alloc_vec_deinit(ALLOC_WAYS, &way->nodes);
+	}
+
+	// unset current, also on failure so tags don't leak into the next element
 	clear_current(ctx);
 
 	return ret;
@@ -516,35 +558,92 @@ int parse_way_tag(struct parse_ctx *ctx, bool opening) {
 	return CRACKING;
 }
 
+static int set_name(struct parse_ctx *ctx, const char *val, size_t len) {
+	if (len + 1 > ctx->name_cap) {
+		size_t cap = ctx->name_cap ? ctx->name_cap : 64;
+		while (cap < len + 1)
+			cap *= 2;
+
+		char *name = alloc_realloc(ALLOC_TAGS, ctx->name, cap);
+		if (name == NULL)
+			return ERR_MEM;
+		ctx->name = name;
+		ctx->name_cap = cap;
+	}
+
+	memcpy(ctx->name, val, len + 1);
+	ctx->has_name = true;
+	return CRACKING;
+}
+
 int parse_tag_tag(struct parse_ctx *ctx) {
 	if (ctx->current_tag != TAG_NODE && ctx->current_tag != TAG_WAY) {
-		// fprintf(err_stream, "tag tag found inside non-node or way tag '%s'\n", tag_lookup[ctx->current_tag]);
+		LOG_ERROR("tag tag found inside non-node or way tag '%s'\n", tag_name(ctx->current_tag));
 		return ERR_OSM;
 	}
 
-	struct tag tag = {0};
+	// nothing reads node tags
+	if (ctx->current_tag == TAG_NODE)
+		return CRACKING;
+
+	struct raw_tag tag = {0};
 	visit_attributes(ctx->attr_start, tag_visitor, &tag);
 	if (tag.key == NULL || tag.val == NULL) {
-		// fprintf(err_stream, "bad tag or memory error\n");
+		LOG_ERROR("bad tag\n");
 		return ERR_OSM;
 	}
 
-	struct tag *ptag = &tag;
-	if (tag_mapPut(&ctx->current_tags, &ptag, HMDR_REPLACE) == HMPR_FAILED)
-		return ERR_MEM;
+	if (tag.key_len == 4 && memcmp(tag.key, "name", 4) == 0)
+		return set_name(ctx, tag.val, tag.val_len);
+
+	int key = tag_filter_key(tag.key, tag.key_len);
+	if (key < 0)
+		return CRACKING;
 
+	int type;
+	ctx->tag_types[key] = tag_filter_match(ctx->filter, (enum filter_key) key, tag.val, tag.val_len, &type) ? type : -1;
 	return CRACKING;
 }
 
-void free_context(struct parse_ctx *ctx) {
-	node_mapDestroy(&ctx->nodes);
-
+static void free_way_nodes(struct parse_ctx *ctx) {
 	struct way *way = NULL;
 	HASHMAP_FOR_EACH(way_map, way, ctx->ways) {
-		vec_deinit(&way->nodes);
+		alloc_vec_deinit(ALLOC_WAYS, &way->nodes);
 	} HASHMAP_FOR_EACH_END
+}
 
+void free_context(struct parse_ctx *ctx) {
+	node_mapDestroy(&ctx->nodes);
+	free_way_nodes(ctx);
 	way_mapDestroy(&ctx->ways);
+	free_deferred(&ctx->deferred);
+	alloc_free(ALLOC_TAGS, ctx->name);
+	alloc_vec_deinit(ALLOC_GEOMETRY, &ctx->ring);
+	free(ctx->full_line); // from getline
+	ctx->name = NULL;
+	ctx->name_cap = 0;
+	ctx->full_line = NULL;
+	ctx->n = 0;
+}
+
+// drops the entries but keeps the bucket arrays at their size, there is
+// no clear in the hashmap api
+#define EMPTY_HASHMAP(map, free_entry) do { \
+		for (size_t i = 0; i < (map).size; i++) { \
+			if ((map).buckets[i].entry != NULL) { \
+				free_entry((map).buckets[i].entry); \
+				(map).buckets[i].entry = NULL; \
+			} \
+		} \
+		(map).count = 0; \
+	} while (0)
+
+// forgets everything parsed, keeping what was allocated for it
+static void empty_context(struct parse_ctx *ctx) {
+	EMPTY_HASHMAP(ctx->nodes, node_map_free);
+	free_way_nodes(ctx);
+	EMPTY_HASHMAP(ctx->ways, way_map_free);
+	clear_deferred(&ctx->deferred);
 }
 
 struct osm_source {
@@ -559,79 +658,231 @@ struct osm_source {
 	} u;
 };
 
-static int parse_osm(struct osm_source *src, struct world *out) {
-	struct parse_ctx ctx = {0};
-	ctx.current_tag = TAG_UNKNOWN;
-	init_world(&ctx.out);
+static const struct parse_options default_options = {
+	.resolution = RESOLVE_IMMEDIATE
+};
 
-	int ret;
-	if (src->is_file) {
-		ret = (ctx.f = fopen(src->u.file_path, "r")) == NULL ? ERR_FILE_NOT_FOUND : CRACKING;
-	} else {
-        ret = (ctx.f = fmemopen(src->u.buf, src->u.n, "r")) == NULL ? ERR_IO : CRACKING;
+static struct tag_filter default_filter;
+static int default_filter_ret;
+static pthread_once_t default_filter_once = PTHREAD_ONCE_INIT;
+
+static void compile_default_filter(void) {
+	default_filter_ret = tag_filter_compile(NULL, &default_filter);
+}
+
+static int init_context(struct parse_ctx *ctx, const struct parse_options *opts) {
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->opts = opts != NULL ? opts : &default_options;
+	ctx->defer = ctx->opts->resolution == RESOLVE_DEFERRED || ctx->opts->max_memory > 0;
+	if (ctx->opts->filter != NULL) {
+		ctx->filter = ctx->opts->filter;
+		return CRACKING;
 	}
 
-	if (ret == CRACKING) {
-		while (true) {
-			if (read_line(&ctx) != CRACKING) break;
+	pthread_once(&default_filter_once, compile_default_filter);
+	ctx->filter = &default_filter;
+	return default_filter_ret;
+}
 
-			struct xml_tag tag = parse_tag(ctx.tag_start);
+// reads f to the end into out. keep, if given, receives the unresolved
+// references instead of them being resolved here. requires RESOLVE_DEFERRED
+static int parse_stream(struct parse_ctx *ctx, FILE *f, struct deferred_refs *keep, struct world *out) {
+	ctx->f = f;
+	init_world(&ctx->out);
+	clear_current(ctx);
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
 
-			switch(tag.type) {
-				case TAG_NODE:
-					if ((ret = parse_node_tag(&ctx, tag.opening)) != CRACKING)
-					{}
-						// fprintf(err_stream, "error processing node: %s\n", error_get_message(ret));
-					break;
+	ctx->timed = ctx->opts->stats != NULL;
+	double start = ctx->timed ? monotonic_now() : 0;
 
-				case TAG_WAY:
-					if ((ret = parse_way_tag(&ctx, tag.opening)) != CRACKING)
-					{}
-						// fprintf(err_stream, "error processing way: %s\n", error_get_message(ret));
-					break;
+	int ret = CRACKING;
+	if (ctx->opts->max_memory > 0 && (ret = defer_with_budget(&ctx->deferred, ctx->opts->max_memory, ctx->opts->spill_dir)) != CRACKING) {
+		fclose(ctx->f);
+		ctx->f = NULL;
+		*out = ctx->out;
+		return ret;
+	}
 
-				case TAG_NODE_REF:
-					if ((ret = parse_node_ref_tag(&ctx)) != CRACKING)
-					{}
-						// fprintf(err_stream, "error processing node ref: %s\n", error_get_message(ret));
-					break;
+	while (true) {
+		if (read_line(ctx) != CRACKING) break;
+
+		struct xml_tag tag = parse_tag(ctx->tag_start);
+		ctx->stats.elements[tag.type] += tag.opening;
+
+		int err;
+		switch(tag.type) {
+			case TAG_NODE:
+				err = ret = parse_node_tag(ctx, tag.opening);
+				break;
+
+			case TAG_WAY:
+				err = ret = parse_way_tag(ctx, tag.opening);
+				break;
+
+			case TAG_NODE_REF:
+				err = ret = parse_node_ref_tag(ctx);
+				break;
 
-				case TAG_TAG:
-					parse_tag_tag(&ctx);
-					break;
+			case TAG_TAG:
+				err = parse_tag_tag(ctx);
+				break;
 
-				default:
-					continue;
+			default:
+				continue;
 
-			}
+		}
 
+		if (err != CRACKING) {
+			ctx->stats.errors++;
+			LOG_ERROR("error processing %s: %s\n", tag_name(tag.type), error_get_message(err));
 		}
+	}
+
+	// a failed read or decompression looks like eof to getline
+	if (ferror(ctx->f))
+		ret = ERR_IO;
+
+	fclose(ctx->f);
+	ctx->f = NULL;
+
+	ctx->stats.deferred_nodes = ctx->deferred.nodes.length;
+	ctx->stats.deferred_refs = ctx->deferred.refs.length;
+	if (ctx->deferred.spill != NULL) {
+		ctx->stats.deferred_nodes += spill_records(&ctx->deferred.spill->nodes);
+		ctx->stats.deferred_refs += spill_records(&ctx->deferred.spill->refs);
+	}
+
+	if (keep != NULL) {
+		*keep = ctx->deferred;
+		memset(&ctx->deferred, 0, sizeof(ctx->deferred));
+	} else if (ctx->defer) {
+		double resolve_start = ctx->timed ? monotonic_now() : 0;
+		int res = resolve_deferred(&ctx->deferred, &ctx->out, &ctx->stats);
+		if (res != CRACKING)
+			ret = res;
+		if (ctx->timed)
+			ctx->stats.timings.way_resolve += monotonic_now() - resolve_start;
+	}
+
+	// partial worlds are measured once merged and resolved
+	if (keep == NULL) {
+		int res = buildings_measure(&ctx->out.buildings, ctx->opts->threads);
+		if (res != CRACKING)
+			ret = res;
+	}
+
+	*out = ctx->out;
+	memset(&ctx->out, 0, sizeof(ctx->out));
+	empty_context(ctx);
+
+	if (ctx->timed) {
+		struct parse_timings *t = &ctx->stats.timings;
+		t->total = monotonic_now() - start;
+		t->tokenize = t->total - t->node_store - t->way_resolve;
+		add_parse_stats(ctx->opts->stats, &ctx->stats);
+	}
+	return ret;
+}
+
+static int parse_osm(struct osm_source *src, const struct parse_options *opts, struct deferred_refs *keep, struct world *out) {
+	struct parse_ctx ctx;
+	FILE *f = NULL;
+	int ret = init_context(&ctx, opts);
 
-		fclose(ctx.f);
-		ctx.f = NULL;
+	if (ret != CRACKING) {
+		// default filter failed to compile
+	} else if (src->is_file) {
+		ret = open_osm_stream(src->u.file_path, &f);
+	} else {
+		ret = (f = fmemopen(src->u.buf, src->u.n, "r")) == NULL ? ERR_IO : CRACKING;
 	}
 
-	*out = ctx.out;
+	if (ret == CRACKING)
+		ret = parse_stream(&ctx, f, keep, out);
+	else
+		init_world(out);
+
 	free_context(&ctx);
 	return ret;
 }
 
+struct osm_parser {
+	struct parse_ctx ctx;
+	struct parse_options opts;
+};
+
+int osm_parser_new(const struct parse_options *opts, struct osm_parser **out) {
+	struct osm_parser *p = alloc_malloc(ALLOC_OTHER, sizeof(struct osm_parser));
+	if (p == NULL)
+		return ERR_MEM;
+
+	p->opts = opts != NULL ? *opts : default_options;
+	int ret = init_context(&p->ctx, &p->opts);
+	if (ret != CRACKING) {
+		alloc_free(ALLOC_OTHER, p);
+		return ret;
+	}
+
+	*out = p;
+	return CRACKING;
+}
+
+int osm_parser_parse_buffer(struct osm_parser *p, void *buffer, size_t len, struct world *out) {
+	FILE *f = fmemopen(buffer, len, "r");
+	if (f == NULL) {
+		init_world(out);
+		return ERR_IO;
+	}
+	return parse_stream(&p->ctx, f, NULL, out);
+}
+
+void osm_parser_reset(struct osm_parser *p) {
+	free_context(&p->ctx);
+	init_context(&p->ctx, &p->opts);
+}
+
+void osm_parser_free(struct osm_parser *p) {
+	if (p == NULL)
+		return;
+	free_context(&p->ctx);
+	alloc_free(ALLOC_OTHER, p);
+}
+
 int parse_osm_from_file(const char *path, struct world *out) {
-    struct osm_source src = {
-            .is_file = 1,
+	return parse_osm_from_file_opts(path, NULL, out);
+}
+
+int parse_osm_from_buffer(void *buffer, size_t len, struct world *out) {
+	return parse_osm_from_buffer_opts(buffer, len, NULL, out);
+}
+
+int parse_osm_from_file_opts(const char *path, const struct parse_options *opts, struct world *out) {
+	struct osm_source src = {
+			.is_file = 1,
 			.u.file_path = path
 	};
-	return parse_osm(&src, out);
+	return parse_osm(&src, opts, NULL, out);
 }
 
-int parse_osm_from_buffer(void *buffer, size_t len, struct world *out) {
+int parse_osm_partial(const char *path, const struct parse_options *opts, struct world *out, struct deferred_refs *refs) {
+	struct parse_options deferred = opts != NULL ? *opts : default_options;
+	deferred.resolution = RESOLVE_DEFERRED;
+
+	struct osm_source src = {
+			.is_file = 1,
+			.u.file_path = path
+	};
+	return parse_osm(&src, &deferred, refs, out);
+}
+
+int parse_osm_from_buffer_opts(void *buffer, size_t len, const struct parse_options *opts, struct world *out) {
 	struct osm_source src = {
 			.is_file = 0,
 			.u.buf = buffer,
 			.u.n = len
 	};
 
-	return parse_osm(&src, out);
+	return parse_osm(&src, opts, NULL, out);
 }
 
 const char *road_type_lookup[] = {
@@ -640,9 +891,24 @@ const char *road_type_lookup[] = {
 	"primary",
 	"secondary",
 	"minor",
+	"residential",
 	"pedestrian"
 };
 
 const char *road_type_to_string(enum road_type rt) {
 	return road_type_lookup[rt];
 }
+
+const char *land_use_type_lookup[] = {
+	"unknown",
+	"residential",
+	"commercial",
+	"agriculture",
+	"industrial",
+	"green",
+	"water"
+};
+
+const char *land_use_type_to_string(enum land_use_type lt) {
+	return land_use_type_lookup[lt];
+}
@@ -6,9 +6,17 @@
 #include <stdio.h>
 #include "vec.h"
 
+// per element problems are logged here if set, the parser is quiet by default
 extern FILE *err_stream;
 
+#define LOG_ERROR(...) do { \
+		if (err_stream != NULL) \
+			fprintf(err_stream, __VA_ARGS__); \
+	} while (0)
+
 struct world;
+struct tag_filter;
+struct parse_stats;
 
 typedef double ll_t;
 
@@ -18,7 +26,67 @@ typedef struct {
 
 typedef vec_t(point) vec_point_t;
 
+// how way node references are turned into positions
+enum ref_resolution {
+	// look each node up in a hashmap as its way closes
+	RESOLVE_IMMEDIATE = 0,
+
+	// collect every reference, then sort them by node id and merge join
+	// against the sorted nodes once the input is read. sequential instead
+	// of a random probe per reference, and nodes may follow their ways
+	RESOLVE_DEFERRED
+};
+
+struct parse_options {
+	enum ref_resolution resolution;
+
+	// worker threads for multi file ingest, <= 0 for one per cpu
+	int threads;
+
+	// which tagged ways become features, NULL for any highway and the
+	// known land uses. see filter.h
+	const struct tag_filter *filter;
+
+	// counters and phase timings are added to this if not NULL. see stats.h
+	struct parse_stats *stats;
+
+	// bytes the node and way stores may hold, 0 for no limit. past it they
+	// are sorted and spilled to files in spill_dir ($TMPDIR or /tmp if
+	// NULL) and merged back to resolve, with the same result. implies
+	// RESOLVE_DEFERRED, the world being built is not counted. single file
+	// parses only
+	size_t max_memory;
+	const char *spill_dir;
+};
+
 int parse_osm_from_file(const char *path, struct world *out);
 int parse_osm_from_buffer(void *buffer, size_t len, struct world *out);
+
+// opts may be NULL for the defaults
+int parse_osm_from_file_opts(const char *path, const struct parse_options *opts, struct world *out);
+int parse_osm_from_buffer_opts(void *buffer, size_t len, const struct parse_options *opts, struct world *out);
+
+// a parser kept around for many small inputs, holding on to its hashmap
+// buckets, node lists and line buffer between parses instead of building
+// them up again each time. one thread at a time
+struct osm_parser;
+
+// opts is copied, whatever it points to must outlive the parser
+int osm_parser_new(const struct parse_options *opts, struct osm_parser **out);
+
+// like parse_osm_from_buffer_opts, nothing of one parse is seen by the next
+int osm_parser_parse_buffer(struct osm_parser *p, void *buffer, size_t len, struct world *out);
+
+// gives back the memory kept for reuse, after an unusually large input
+void osm_parser_reset(struct osm_parser *p);
+
+void osm_parser_free(struct osm_parser *p);
+
+// parses adjacent extracts concurrently into one world. ways present in
+// several files are kept once, from the first file listing them, and node
+// references resolve across files. the result only depends on the order
+// of paths, never on scheduling. returns the first error in path order.
+// ERR_UNSUPPORTED with a max_memory
+int parse_osm_from_files(const char *const *paths, int n, const struct parse_options *opts, struct world *out);
 #endif
 
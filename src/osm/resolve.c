@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "resolve.h"
+#include "world.h"
+#include "error.h"
+#include "stats.h"
+#include "alloc.h"
+
+// stable lsd radix sort on an id field, a byte per pass. flipping the sign
+// bit makes the unsigned digit order match signed ids. passes where every
+// key has the same digit are skipped, which for real ids is most of them
+#define DEFINE_RADIX_SORT(name, type, key_field, tag) \
+	static int name(type *data, size_t n) { \
+		if (n < 2) \
+			return CRACKING; \
+		type *tmp = alloc_malloc(tag, n * sizeof(type)); \
+		if (tmp == NULL) \
+			return ERR_MEM; \
+		size_t counts[8][256] = {{0}}; \
+		for (size_t i = 0; i < n; i++) { \
+			uint64_t k = (uint64_t) data[i].key_field ^ (1ULL << 63); \
+			for (int d = 0; d < 8; d++) \
+				counts[d][(k >> (d * 8)) & 0xff]++; \
+		} \
+		type *src = data; \
+		type *dst = tmp; \
+		for (int d = 0; d < 8; d++) { \
+			size_t *c = counts[d]; \
+			uint64_t first = (uint64_t) src[0].key_field ^ (1ULL << 63); \
+			if (c[(first >> (d * 8)) & 0xff] == n) \
+				continue; \
+			size_t sum = 0; \
+			for (int b = 0; b < 256; b++) { \
+				size_t t = c[b]; \
+				c[b] = sum; \
+				sum += t; \
+			} \
+			for (size_t i = 0; i < n; i++) { \
+				uint64_t k = (uint64_t) src[i].key_field ^ (1ULL << 63); \
+				dst[c[(k >> (d * 8)) & 0xff]++] = src[i]; \
+			} \
+			type *t = src; \
+			src = dst; \
+			dst = t; \
+		} \
+		if (src != data) \
+			memcpy(data, src, n * sizeof(type)); \
+		alloc_free(tag, tmp); \
+		return CRACKING; \
+	}
+
+DEFINE_RADIX_SORT(sort_nodes, struct node, id, ALLOC_NODES)
+DEFINE_RADIX_SORT(sort_refs, struct node_ref, node, ALLOC_WAYS)
+DEFINE_RADIX_SORT(sort_ways_seen, struct way_seen, id, ALLOC_WAYS)
+
+// first growth of a list under a budget, in elements
+#define MIN_LIST (1024)
+
+int defer_with_budget(struct deferred_refs *d, size_t budget, const char *dir) {
+	struct spill_store *s = alloc_calloc(ALLOC_OTHER, 1, sizeof(struct spill_store));
+	if (s == NULL)
+		return ERR_MEM;
+
+	s->budget = budget;
+	spill_init(&s->nodes, dir, sizeof(struct node));
+	spill_init(&s->refs, dir, sizeof(struct node_ref));
+	spill_init(&s->way_ids, dir, sizeof(struct way_seen));
+	d->spill = s;
+	return CRACKING;
+}
+
+static bool nodes_sorted(struct deferred_refs *d) {
+	for (int i = 1; i < d->nodes.length; i++)
+		if (d->nodes.data[i - 1].id > d->nodes.data[i].id)
+			return false;
+	return true;
+}
+
+// the lists as sorted runs, then empty and unallocated so they can grow
+// back in whatever proportion the rest of the input needs
+static int spill_lists(struct deferred_refs *d) {
+	struct spill_store *s = d->spill;
+	int ret = CRACKING;
+
+	if (!nodes_sorted(d))
+		ret = sort_nodes(d->nodes.data, d->nodes.length);
+	if (ret == CRACKING)
+		ret = spill_write_run(&s->nodes, d->nodes.data, d->nodes.length);
+
+	if (ret == CRACKING)
+		ret = sort_refs(d->refs.data, d->refs.length);
+	if (ret == CRACKING)
+		ret = spill_write_run(&s->refs, d->refs.data, d->refs.length);
+
+	if (ret == CRACKING)
+		ret = sort_ways_seen(s->ways.data, s->ways.length);
+	if (ret == CRACKING)
+		ret = spill_write_run(&s->way_ids, s->ways.data, s->ways.length);
+
+	if (ret == CRACKING) {
+		alloc_vec_deinit(ALLOC_NODES, &d->nodes);
+		alloc_vec_deinit(ALLOC_WAYS, &d->refs);
+		alloc_vec_deinit(ALLOC_WAYS, &s->ways);
+	}
+	return ret;
+}
+
+// capacity a list grows to for extra more, doubling as vec would
+static size_t grown(int length, int capacity, size_t extra) {
+	size_t want = (size_t) length + extra;
+	if (want <= (size_t) capacity)
+		return capacity;
+
+	size_t cap = capacity > 0 ? (size_t) capacity * 2 : MIN_LIST;
+	while (cap < want)
+		cap *= 2;
+	return cap;
+}
+
+// grows the lists for what is about to be queued, spilling them first if
+// they would pass the budget. a single way bigger than that is let through
+static int make_room(struct deferred_refs *d, size_t nodes, size_t refs, size_t ways) {
+	struct spill_store *s = d->spill;
+	size_t bytes = grown(d->nodes.length, d->nodes.capacity, nodes) * sizeof(struct node)
+		+ grown(d->refs.length, d->refs.capacity, refs) * sizeof(struct node_ref)
+		+ grown(s->ways.length, s->ways.capacity, ways) * sizeof(struct way_seen);
+
+	int ret;
+	bool queued = d->nodes.length > 0 || d->refs.length > 0 || s->ways.length > 0;
+	if (bytes > s->budget / 2 && queued && (ret = spill_lists(d)) != CRACKING)
+		return ret;
+
+	alloc_set_vec_tag(ALLOC_NODES);
+	if (vec_reserve(&d->nodes, grown(d->nodes.length, d->nodes.capacity, nodes)) != 0)
+		return ERR_MEM;
+	alloc_set_vec_tag(ALLOC_WAYS);
+	if (vec_reserve(&d->refs, grown(d->refs.length, d->refs.capacity, refs)) != 0)
+		return ERR_MEM;
+	if (vec_reserve(&s->ways, grown(s->ways.length, s->ways.capacity, ways)) != 0)
+		return ERR_MEM;
+	return CRACKING;
+}
+
+int defer_node(struct deferred_refs *d, const struct node *node) {
+	int ret;
+	if (d->spill != NULL && (ret = make_room(d, 1, 0, 0)) != CRACKING)
+		return ret;
+
+	alloc_set_vec_tag(ALLOC_NODES);
+	return vec_push(&d->nodes, *node) == 0 ? CRACKING : ERR_MEM;
+}
+
+int defer_way_id(struct deferred_refs *d, id way_id, uint32_t feature) {
+	int ret;
+	if ((ret = make_room(d, 0, 0, 1)) != CRACKING)
+		return ret;
+
+	struct way_seen seen = {.id = way_id, .feature = feature};
+	alloc_set_vec_tag(ALLOC_WAYS);
+	return vec_push(&d->spill->ways, seen) == 0 ? CRACKING : ERR_MEM;
+}
+
+static int queue_refs(struct deferred_refs *d, const id *nodes, int n, uint32_t feature) {
+	alloc_set_vec_tag(ALLOC_WAYS);
+	if (vec_reserve(&d->refs, d->refs.length + n) != 0)
+		return ERR_MEM;
+
+	for (int i = 0; i < n; i++) {
+		struct node_ref ref = {
+			.node = nodes[i],
+			.feature = feature,
+			.index = (uint32_t) i
+		};
+		d->refs.data[d->refs.length++] = ref;
+	}
+
+	return CRACKING;
+}
+
+int defer_way_refs(struct deferred_refs *d, vec_id_t *nodes, uint32_t feature, vec_point_t *points) {
+	if (nodes->length == 0)
+		return CRACKING;
+
+	int ret;
+	if (d->spill != NULL && (ret = make_room(d, 0, nodes->length, 0)) != CRACKING)
+		return ret;
+
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	if (vec_reserve(points, nodes->length) != 0)
+		return ERR_MEM;
+	memset(points->data, 0, nodes->length * sizeof(point));
+	points->length = nodes->length;
+
+	return queue_refs(d, nodes->data, nodes->length, feature);
+}
+
+int defer_ring_refs(struct deferred_refs *d, const id *nodes, int n, uint32_t feature) {
+	if (n == 0)
+		return CRACKING;
+
+	int ret;
+	if (d->spill != NULL && (ret = make_room(d, 0, n, 0)) != CRACKING)
+		return ret;
+
+	return queue_refs(d, nodes, n, feature);
+}
+
+// a feature's place in the dangling flags, roads then land uses then
+// buildings
+static size_t flag_index(const struct world *world, uint32_t feature) {
+	uint32_t f = REF_FEATURE(feature);
+	if (feature & REF_LAND_USE)
+		return world->roads.length + f;
+	if (feature & REF_BUILDING)
+		return world->roads.length + world->land_uses.length + f;
+	return f;
+}
+
+static size_t feature_count(const struct world *world) {
+	return world->roads.length + world->land_uses.length + world->buildings.length;
+}
+
+static void drop_dangling(struct world *world, const bool *dangling) {
+	int kept = 0;
+	for (int i = 0; i < world->roads.length; i++) {
+		struct road *r = &world->roads.data[i];
+		if (dangling[i]) {
+			alloc_free(ALLOC_TAGS, r->name);
+			alloc_vec_deinit(ALLOC_GEOMETRY, &r->segments);
+			continue;
+		}
+		world->roads.data[kept++] = *r;
+	}
+
+	dangling += world->roads.length;
+	world->roads.length = kept;
+
+	kept = 0;
+	for (int i = 0; i < world->land_uses.length; i++) {
+		struct land_use *l = &world->land_uses.data[i];
+		if (dangling[i]) {
+			alloc_vec_deinit(ALLOC_GEOMETRY, &l->points);
+			continue;
+		}
+		world->land_uses.data[kept++] = *l;
+	}
+
+	dangling += world->land_uses.length;
+	world->land_uses.length = kept;
+
+	buildings_drop(&world->buildings, dangling);
+}
+
+// a reference given its node, or NULL if there is none
+static void place_ref(struct world *world, const struct node_ref *ref, const struct node *node,
+		bool *dangling, uint64_t *unresolved) {
+	uint32_t feature = REF_FEATURE(ref->feature);
+
+	if (node == NULL) {
+		LOG_ERROR("nonexistent node ref %ld\n", ref->node);
+		dangling[flag_index(world, ref->feature)] = true;
+		(*unresolved)++;
+		return;
+	}
+
+	if (ref->feature & REF_BUILDING) {
+		buildings_place(&world->buildings, feature, ref->index, node->pos);
+		return;
+	}
+
+	vec_point_t *points = (ref->feature & REF_LAND_USE)
+		? &world->land_uses.data[feature].points
+		: &world->roads.data[feature].segments;
+	points->data[ref->index] = node->pos;
+}
+
+static void join_in_memory(struct deferred_refs *d, struct world *world, bool *dangling, uint64_t *unresolved) {
+	const struct node *nodes = d->nodes.data;
+	size_t n_nodes = d->nodes.length;
+	size_t n = 0;
+
+	for (int i = 0; i < d->refs.length; i++) {
+		const struct node_ref *ref = &d->refs.data[i];
+
+		// both sides ascending, first node wins on duplicate ids
+		while (n < n_nodes && nodes[n].id < ref->node)
+			n++;
+
+		bool found = n < n_nodes && nodes[n].id == ref->node;
+		place_ref(world, ref, found ? &nodes[n] : NULL, dangling, unresolved);
+	}
+}
+
+// the same join over the runs on disk, what is left in memory merged in
+// as the last run
+static int join_spilled(struct deferred_refs *d, struct world *world, bool *dangling, uint64_t *unresolved) {
+	struct spill_store *s = d->spill;
+	struct spill_merge nodes, refs;
+
+	int ret = spill_merge_init(&nodes, &s->nodes, d->nodes.data, d->nodes.length, s->budget / 4);
+	if (ret != CRACKING)
+		return ret;
+	if ((ret = spill_merge_init(&refs, &s->refs, d->refs.data, d->refs.length, s->budget / 4)) != CRACKING) {
+		spill_merge_free(&nodes);
+		return ret;
+	}
+
+	const struct node *node = spill_merge_next(&nodes);
+	const struct node_ref *ref;
+	while ((ref = spill_merge_next(&refs)) != NULL) {
+		while (node != NULL && node->id < ref->node)
+			node = spill_merge_next(&nodes);
+
+		place_ref(world, ref, node != NULL && node->id == ref->node ? node : NULL, dangling, unresolved);
+	}
+
+	ret = nodes.error != CRACKING ? nodes.error : refs.error;
+	spill_merge_free(&nodes);
+	spill_merge_free(&refs);
+	return ret;
+}
+
+// every way after the first with its id, as the way map refuses them
+static int mark_repeated_ways(struct deferred_refs *d, struct world *world, bool *dangling, uint64_t *repeated) {
+	struct spill_store *s = d->spill;
+	struct spill_merge ways;
+
+	int ret = sort_ways_seen(s->ways.data, s->ways.length);
+	if (ret == CRACKING)
+		ret = spill_merge_init(&ways, &s->way_ids, s->ways.data, s->ways.length, s->budget / 4);
+	if (ret != CRACKING)
+		return ret;
+
+	const struct way_seen *w;
+	bool first = true;
+	id last = 0;
+	while ((w = spill_merge_next(&ways)) != NULL) {
+		if (!first && w->id == last && w->feature != WAY_NO_FEATURE) {
+			dangling[flag_index(world, w->feature)] = true;
+			(*repeated)++;
+		}
+		first = false;
+		last = w->id;
+	}
+
+	ret = ways.error;
+	spill_merge_free(&ways);
+	return ret;
+}
+
+int resolve_deferred(struct deferred_refs *d, struct world *world, struct parse_stats *stats) {
+	int ret;
+
+	// osm files are normally written in id order already
+	if (!nodes_sorted(d) && (ret = sort_nodes(d->nodes.data, d->nodes.length)) != CRACKING)
+		return ret;
+
+	if ((ret = sort_refs(d->refs.data, d->refs.length)) != CRACKING)
+		return ret;
+
+	bool *dangling = alloc_calloc(ALLOC_OTHER, feature_count(world) + 1, sizeof(bool));
+	if (dangling == NULL)
+		return ERR_MEM;
+
+	uint64_t unresolved = 0, repeated = 0;
+	if (d->spill == NULL) {
+		join_in_memory(d, world, dangling, &unresolved);
+	} else {
+		ret = join_spilled(d, world, dangling, &unresolved);
+		if (ret == CRACKING)
+			ret = mark_repeated_ways(d, world, dangling, &repeated);
+
+		if (stats != NULL) {
+			struct spill_store *s = d->spill;
+			stats->spilled_runs += s->nodes.n_runs + s->refs.n_runs + s->way_ids.n_runs;
+			stats->spilled_bytes += spill_records(&s->nodes) * sizeof(struct node)
+				+ spill_records(&s->refs) * sizeof(struct node_ref)
+				+ spill_records(&s->way_ids) * sizeof(struct way_seen);
+		}
+	}
+
+	if (ret == CRACKING && unresolved + repeated > 0) {
+		size_t before = feature_count(world);
+		drop_dangling(world, dangling);
+
+		if (stats != NULL) {
+			stats->unresolved_refs += unresolved;
+			stats->dropped_features += before - feature_count(world);
+		}
+	}
+
+	alloc_free(ALLOC_OTHER, dangling);
+	return ret;
+}
+
+static void end_budget(struct deferred_refs *d) {
+	struct spill_store *s = d->spill;
+	if (s == NULL)
+		return;
+
+	spill_close(&s->nodes);
+	spill_close(&s->refs);
+	spill_close(&s->way_ids);
+	alloc_vec_deinit(ALLOC_WAYS, &s->ways);
+	alloc_free(ALLOC_OTHER, s);
+	d->spill = NULL;
+}
+
+void clear_deferred(struct deferred_refs *d) {
+	vec_clear(&d->nodes);
+	vec_clear(&d->refs);
+	end_budget(d);
+}
+
+void free_deferred(struct deferred_refs *d) {
+	alloc_vec_deinit(ALLOC_NODES, &d->nodes);
+	alloc_vec_deinit(ALLOC_WAYS, &d->refs);
+	end_budget(d);
+}
@@ -0,0 +1,84 @@
+#ifndef OSM_RESOLVE
+#define OSM_RESOLVE
+
+#include "osm.h"
+#include "spill.h"
+
+struct world;
+struct parse_stats;
+
+// feature index with the top bits telling roads, land uses and buildings
+// apart
+#define REF_LAND_USE  (1u << 31)
+#define REF_BUILDING  (1u << 30)
+#define REF_FEATURE(f) ((f) & ~(REF_LAND_USE | REF_BUILDING))
+
+// one point of one feature waiting for its node's position
+struct node_ref {
+	id node;
+	uint32_t feature;
+	uint32_t index;
+};
+
+// a way by id and the feature it became, if any. kept instead of the way
+// map under a memory budget, so repeated way ids are still dropped
+struct way_seen {
+	id id;
+	uint32_t feature;
+};
+#define WAY_NO_FEATURE (UINT32_MAX)
+
+typedef vec_t(struct node) vec_node_t;
+typedef vec_t(struct node_ref) vec_node_ref_t;
+typedef vec_t(struct way_seen) vec_way_seen_t;
+
+// the lists below held to a memory budget, anything past it is sorted and
+// written out as a run, and the runs are merged back when resolving
+struct spill_store {
+	size_t budget;
+	vec_way_seen_t ways;
+	struct spill_file nodes, refs, way_ids;
+};
+
+// node positions and way references collected during the parse, resolved
+// in one sorted sweep instead of a hash probe per reference
+struct deferred_refs {
+	vec_node_t nodes;
+	vec_node_ref_t refs;
+
+	// NULL unless there is a memory budget
+	struct spill_store *spill;
+};
+
+// bounds the lists to half of budget bytes, the other half is scratch for
+// sorting them. dir as for spill_init
+int defer_with_budget(struct deferred_refs *d, size_t budget, const char *dir);
+
+int defer_node(struct deferred_refs *d, const struct node *node);
+
+// only with a budget
+int defer_way_id(struct deferred_refs *d, id way_id, uint32_t feature);
+
+// sizes points to match nodes and queues a reference for each of them
+int defer_way_refs(struct deferred_refs *d, vec_id_t *nodes, uint32_t feature, vec_point_t *points);
+
+// queues references for the first n nodes of a building, whose ring is
+// already in the world's store
+int defer_ring_refs(struct deferred_refs *d, const id *nodes, int n, uint32_t feature);
+
+// sorts nodes and references by id, merge joins them and scatters the
+// positions into the world. features with dangling references are dropped,
+// as the immediate path does. stats, if not NULL, counts them. with a
+// budget, spilled runs are merged in and repeated way ids dropped too
+int resolve_deferred(struct deferred_refs *d, struct world *world, struct parse_stats *stats);
+
+// empties the lists, keeping their capacity. ends any budget
+void clear_deferred(struct deferred_refs *d);
+
+void free_deferred(struct deferred_refs *d);
+
+// parses a file without resolving its references, so they can be joined
+// against the nodes of other files. positions in out are unset until then
+int parse_osm_partial(const char *path, const struct parse_options *opts, struct world *out, struct deferred_refs *refs);
+
+#endif
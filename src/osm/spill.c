@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "spill.h"
+#include "error.h"
+#include "alloc.h"
+
+#define MIN_BUFFER (4096)
+
+struct spill_cursor {
+	int fd; // -1 for the tail
+	uint64_t next, end; // byte offsets still to read
+
+	const char *buf;
+	size_t at, len;
+	char *owned; // read buffer, NULL for the tail
+	size_t cap;
+};
+
+void spill_init(struct spill_file *s, const char *dir, size_t record_size) {
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+	s->dir = dir;
+	s->record_size = record_size;
+}
+
+static int spill_create(struct spill_file *s) {
+	const char *dir = s->dir != NULL ? s->dir : getenv("TMPDIR");
+	if (dir == NULL || *dir == '\0')
+		dir = "/tmp";
+
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/osm_spill_XXXXXX", dir) >= (int) sizeof(path))
+		return ERR_IO;
+
+	if ((s->fd = mkstemp(path)) == -1)
+		return ERR_IO;
+
+	// gone from the directory already, the space comes back on close
+	unlink(path);
+	return CRACKING;
+}
+
+static bool write_all(int fd, const char *p, size_t n) {
+	while (n > 0) {
+		ssize_t wrote = write(fd, p, n);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0)
+			return false;
+		p += wrote;
+		n -= wrote;
+	}
+	return true;
+}
+
+int spill_write_run(struct spill_file *s, const void *records, size_t n) {
+	if (n == 0)
+		return CRACKING;
+
+	int ret;
+	if (s->fd == -1 && (ret = spill_create(s)) != CRACKING)
+		return ret;
+
+	if (s->n_runs + 2 > s->starts_cap) {
+		size_t cap = s->starts_cap ? s->starts_cap * 2 : 16;
+		uint64_t *starts = alloc_realloc(ALLOC_OTHER, s->starts, cap * sizeof(uint64_t));
+		if (starts == NULL)
+			return ERR_MEM;
+		if (s->starts_cap == 0)
+			starts[0] = 0;
+		s->starts = starts;
+		s->starts_cap = cap;
+	}
+
+	if (!write_all(s->fd, records, n * s->record_size))
+		return ERR_IO;
+
+	s->starts[s->n_runs + 1] = s->starts[s->n_runs] + n;
+	s->n_runs++;
+	return CRACKING;
+}
+
+uint64_t spill_records(const struct spill_file *s) {
+	return s->n_runs > 0 ? s->starts[s->n_runs] : 0;
+}
+
+void spill_close(struct spill_file *s) {
+	if (s->fd != -1)
+		close(s->fd);
+	alloc_free(ALLOC_OTHER, s->starts);
+	spill_init(s, s->dir, s->record_size);
+}
+
+static int64_t cursor_key(const struct spill_cursor *c) {
+	int64_t key;
+	memcpy(&key, c->buf + c->at, sizeof(key));
+	return key;
+}
+
+// ties go to the earlier run
+static bool before(const struct spill_merge *m, uint32_t a, uint32_t b) {
+	int64_t ka = cursor_key(&m->cursors[a]), kb = cursor_key(&m->cursors[b]);
+	return ka < kb || (ka == kb && a < b);
+}
+
+static void sift_down(struct spill_merge *m, size_t i) {
+	while (true) {
+		size_t least = i, l = i * 2 + 1, r = l + 1;
+		if (l < m->heap_len && before(m, m->heap[l], m->heap[least]))
+			least = l;
+		if (r < m->heap_len && before(m, m->heap[r], m->heap[least]))
+			least = r;
+		if (least == i)
+			return;
+		uint32_t t = m->heap[i];
+		m->heap[i] = m->heap[least];
+		m->heap[least] = t;
+		i = least;
+	}
+}
+
+// false once the cursor is exhausted, or the read failed
+static bool refill(struct spill_merge *m, struct spill_cursor *c) {
+	if (c->owned == NULL || c->next == c->end)
+		return false;
+
+	size_t want = c->end - c->next < c->cap ? (size_t) (c->end - c->next) : c->cap;
+	size_t got = 0;
+	while (got < want) {
+		ssize_t n = pread(c->fd, c->owned + got, want - got, (off_t) (c->next + got));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			m->error = ERR_IO;
+			return false;
+		}
+		got += n;
+	}
+
+	c->next += got;
+	c->buf = c->owned;
+	c->at = 0;
+	c->len = got;
+	return true;
+}
+
+int spill_merge_init(struct spill_merge *m, const struct spill_file *s, const void *tail, size_t tail_n,
+		size_t buffer_bytes) {
+	memset(m, 0, sizeof(*m));
+	m->record_size = s->record_size;
+	m->n_cursors = s->n_runs + 1;
+	m->cursors = alloc_calloc(ALLOC_OTHER, m->n_cursors, sizeof(struct spill_cursor));
+	m->heap = alloc_malloc(ALLOC_OTHER, m->n_cursors * sizeof(uint32_t));
+	m->current = alloc_malloc(ALLOC_OTHER, m->record_size);
+	if (m->cursors == NULL || m->heap == NULL || m->current == NULL) {
+		spill_merge_free(m);
+		return ERR_MEM;
+	}
+
+	// whole records per buffer
+	size_t per_run = s->n_runs > 0 ? buffer_bytes / s->n_runs : 0;
+	if (per_run < MIN_BUFFER)
+		per_run = MIN_BUFFER;
+	per_run -= per_run % m->record_size;
+	if (per_run == 0)
+		per_run = m->record_size;
+
+	for (size_t i = 0; i < s->n_runs; i++) {
+		struct spill_cursor *c = &m->cursors[i];
+		c->fd = s->fd;
+		c->next = s->starts[i] * m->record_size;
+		c->end = s->starts[i + 1] * m->record_size;
+		c->cap = per_run;
+		if ((c->owned = alloc_malloc(ALLOC_OTHER, per_run)) == NULL) {
+			spill_merge_free(m);
+			return ERR_MEM;
+		}
+		if (refill(m, c))
+			m->heap[m->heap_len++] = (uint32_t) i;
+		else if (m->error != CRACKING) {
+			int ret = m->error;
+			spill_merge_free(m);
+			return ret;
+		}
+	}
+
+	struct spill_cursor *t = &m->cursors[s->n_runs];
+	t->fd = -1;
+	t->buf = tail;
+	t->len = tail_n * m->record_size;
+	if (tail_n > 0)
+		m->heap[m->heap_len++] = (uint32_t) s->n_runs;
+
+	for (size_t i = m->heap_len / 2; i-- > 0;)
+		sift_down(m, i);
+	return CRACKING;
+}
+
+const void *spill_merge_next(struct spill_merge *m) {
+	if (m->heap_len == 0)
+		return NULL;
+
+	struct spill_cursor *c = &m->cursors[m->heap[0]];
+	memcpy(m->current, c->buf + c->at, m->record_size);
+
+	c->at += m->record_size;
+	if (c->at == c->len && !refill(m, c)) {
+		if (m->error != CRACKING) {
+			m->heap_len = 0;
+			return NULL;
+		}
+		m->heap[0] = m->heap[--m->heap_len];
+	}
+	sift_down(m, 0);
+	return m->current;
+}
+
+void spill_merge_free(struct spill_merge *m) {
+	for (size_t i = 0; m->cursors != NULL && i < m->n_cursors; i++)
+		alloc_free(ALLOC_OTHER, m->cursors[i].owned);
+	alloc_free(ALLOC_OTHER, m->cursors);
+	alloc_free(ALLOC_OTHER, m->heap);
+	alloc_free(ALLOC_OTHER, m->current);
+	memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,54 @@
+#ifndef OSM_SPILL
+#define OSM_SPILL
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// sorted runs of fixed size records, each keyed by the int64 it starts
+// with, appended to one temporary file that is unlinked as soon as it is
+// made. fd is -1 until the first run is written
+struct spill_file {
+	int fd;
+	const char *dir;
+	size_t record_size;
+
+	// n_runs + 1 record offsets, run i is [starts[i], starts[i + 1])
+	uint64_t *starts;
+	size_t n_runs, starts_cap;
+};
+
+// dir NULL uses $TMPDIR, or /tmp. nothing is created yet
+void spill_init(struct spill_file *s, const char *dir, size_t record_size);
+
+// records must already be sorted
+int spill_write_run(struct spill_file *s, const void *records, size_t n);
+
+uint64_t spill_records(const struct spill_file *s);
+
+void spill_close(struct spill_file *s);
+
+struct spill_cursor;
+
+// k way merge of every run then, as the last one, a sorted tail still in
+// memory. equal keys come out in run order, so the first written wins
+struct spill_merge {
+	size_t record_size;
+	struct spill_cursor *cursors;
+	uint32_t *heap;
+	size_t n_cursors, heap_len;
+	void *current;
+	int error;
+};
+
+// buffer_bytes is shared between the runs' read buffers
+int spill_merge_init(struct spill_merge *m, const struct spill_file *s, const void *tail, size_t tail_n,
+		size_t buffer_bytes);
+
+// the next record, valid until the next call. NULL at the end, or with
+// m->error set if reading failed
+const void *spill_merge_next(struct spill_merge *m);
+
+void spill_merge_free(struct spill_merge *m);
+
+#endif
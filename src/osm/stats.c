@@ -0,0 +1,82 @@
+#include <inttypes.h>
+
+#include "stats.h"
+
+static const char *element_names[TAG_TYPE_COUNT] = {
+	"node", "tag", "way", "nd", "relation", "other"
+};
+
+static const char *way_names[WAY_TYPE_COUNT] = {
+	"unknown", "road", "building", "land_use"
+};
+
+static const char *road_names[ROAD_TYPE_COUNT] = {
+	"unknown", "motorway", "primary", "secondary", "minor", "residential", "pedestrian"
+};
+
+static const char *land_use_names[LANDUSE_TYPE_COUNT] = {
+	"unknown", "residential", "commercial", "agriculture", "industrial", "green", "water"
+};
+
+static const char *building_names[BUILDING_TYPE_COUNT] = {
+	"unknown", "accomodation", "commercial", "civic", "other"
+};
+
+#define ADD(field) to->field += from->field
+#define ADD_ALL(field) \
+	for (size_t i = 0; i < sizeof(to->field) / sizeof(to->field[0]); i++) \
+		to->field[i] += from->field[i]
+
+void add_parse_stats(struct parse_stats *to, const struct parse_stats *from) {
+	ADD(lines);
+	ADD(bytes);
+	ADD_ALL(elements);
+	ADD(errors);
+	ADD(node_map_size);
+	ADD(node_map_probes);
+	ADD(way_map_size);
+	ADD(way_map_probes);
+	ADD(deferred_nodes);
+	ADD(deferred_refs);
+	ADD(spilled_runs);
+	ADD(spilled_bytes);
+	ADD(unresolved_refs);
+	ADD(dropped_features);
+	ADD_ALL(ways);
+	ADD_ALL(roads);
+	ADD_ALL(land_uses);
+	ADD_ALL(buildings);
+
+	ADD(timings.total);
+	ADD(timings.tokenize);
+	ADD(timings.node_store);
+	ADD(timings.way_resolve);
+}
+
+static void print_histogram(FILE *f, const char *name, const char **names, const uint64_t *counts, int n) {
+	fprintf(f, "  \"%s\": {", name);
+	for (int i = 0; i < n; i++)
+		fprintf(f, "%s\"%s\": %" PRIu64, i ? ", " : "", names[i], counts[i]);
+	fprintf(f, "},\n");
+}
+
+void print_parse_stats(FILE *f, const struct parse_stats *s) {
+	fprintf(f, "{\n");
+	fprintf(f, "  \"lines\": %" PRIu64 ",\n", s->lines);
+	fprintf(f, "  \"bytes\": %" PRIu64 ",\n", s->bytes);
+	print_histogram(f, "elements", element_names, s->elements, TAG_TYPE_COUNT);
+	fprintf(f, "  \"errors\": %" PRIu64 ",\n", s->errors);
+	fprintf(f, "  \"node_map\": {\"size\": %" PRIu64 ", \"probes\": %" PRIu64 "},\n", s->node_map_size, s->node_map_probes);
+	fprintf(f, "  \"way_map\": {\"size\": %" PRIu64 ", \"probes\": %" PRIu64 "},\n", s->way_map_size, s->way_map_probes);
+	fprintf(f, "  \"deferred\": {\"nodes\": %" PRIu64 ", \"refs\": %" PRIu64 "},\n", s->deferred_nodes, s->deferred_refs);
+	fprintf(f, "  \"spilled\": {\"runs\": %" PRIu64 ", \"bytes\": %" PRIu64 "},\n", s->spilled_runs, s->spilled_bytes);
+	fprintf(f, "  \"unresolved_refs\": %" PRIu64 ",\n", s->unresolved_refs);
+	fprintf(f, "  \"dropped_features\": %" PRIu64 ",\n", s->dropped_features);
+	print_histogram(f, "ways", way_names, s->ways, WAY_TYPE_COUNT);
+	print_histogram(f, "roads", road_names, s->roads, ROAD_TYPE_COUNT);
+	print_histogram(f, "land_uses", land_use_names, s->land_uses, LANDUSE_TYPE_COUNT);
+	print_histogram(f, "buildings", building_names, s->buildings, BUILDING_TYPE_COUNT);
+	fprintf(f, "  \"seconds\": {\"total\": %.6f, \"tokenize\": %.6f, \"node_store\": %.6f, \"way_resolve\": %.6f}\n",
+			s->timings.total, s->timings.tokenize, s->timings.node_store, s->timings.way_resolve);
+	fprintf(f, "}\n");
+}
@@ -0,0 +1,66 @@
+#ifndef OSM_STATS
+#define OSM_STATS
+
+#include <stdio.h>
+#include <stdint.h>
+#include "osm.h"
+
+// wall clock seconds spent in each phase, only measured when stats are
+// requested. with several files the phases are summed over threads and
+// can exceed total
+struct parse_timings {
+	double total;
+
+	// reading, decompressing and splitting lines, the rest of total
+	double tokenize;
+
+	// adding nodes to the node map, or the deferred node list
+	double node_store;
+
+	// turning way node refs into positions, including the deferred sort
+	double way_resolve;
+};
+
+// counters for one parse, or several added together
+struct parse_stats {
+	uint64_t lines;
+	uint64_t bytes;
+
+	// opening tags, by tag_type
+	uint64_t elements[TAG_TYPE_COUNT];
+
+	// elements that failed to parse, also logged to err_stream if set
+	uint64_t errors;
+
+	// entries, and finds plus inserts. unused with deferred resolution
+	uint64_t node_map_size;
+	uint64_t node_map_probes;
+	uint64_t way_map_size;
+	uint64_t way_map_probes;
+
+	// queued by deferred resolution instead
+	uint64_t deferred_nodes;
+	uint64_t deferred_refs;
+
+	// sorted runs written under a memory budget, and their size
+	uint64_t spilled_runs;
+	uint64_t spilled_bytes;
+
+	// refs to nodes not in the input, and the features dropped for them
+	uint64_t unresolved_refs;
+	uint64_t dropped_features;
+
+	// classification of every way, before any are dropped
+	uint64_t ways[WAY_TYPE_COUNT];
+	uint64_t roads[ROAD_TYPE_COUNT];
+	uint64_t land_uses[LANDUSE_TYPE_COUNT];
+	uint64_t buildings[BUILDING_TYPE_COUNT];
+
+	struct parse_timings timings;
+};
+
+void add_parse_stats(struct parse_stats *to, const struct parse_stats *from);
+
+void print_parse_stats(FILE *f, const struct parse_stats *stats);
+
+#endif
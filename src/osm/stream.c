@@ -0,0 +1,807 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifndef NO_COMPRESSION
+#include <zlib.h>
+#include <bzlib.h>
+#endif
+
+#include "stream.h"
+#include "error.h"
+#include "pool.h"
+
+#define CHUNK_SIZE (1 << 20)
+#define RAW_SLOTS  (4)
+#define OUT_SLOTS  (8)
+
+struct chunk {
+	char *data;
+	size_t len;
+};
+
+// bounded single producer/single consumer queue of preallocated chunks
+struct ring {
+	struct chunk *slots;
+	size_t n_slots;
+	size_t head;
+	size_t count;
+
+	bool closed;    // producer is done, err says how it went
+	bool cancelled; // consumer has gone away
+	int err;
+
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+struct stream {
+	FILE *file;
+	enum osm_compression compression;
+
+	struct ring raw; // reader -> decoder
+	struct ring out; // decoder -> parser, unused for plain input
+
+	pthread_t reader;
+	pthread_t decoder;
+	bool has_reader;
+	bool has_decoder;
+
+	// parser side
+	struct chunk *current;
+	size_t pos;
+};
+
+static int ring_init(struct ring *r, size_t slots) {
+	memset(r, 0, sizeof(*r));
+	if ((r->slots = calloc(slots, sizeof(struct chunk))) == NULL)
+		return ERR_MEM;
+
+	r->n_slots = slots;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->not_empty, NULL);
+	pthread_cond_init(&r->not_full, NULL);
+
+	for (size_t i = 0; i < slots; i++) {
+		if ((r->slots[i].data = malloc(CHUNK_SIZE)) == NULL)
+			return ERR_MEM;
+	}
+	return CRACKING;
+}
+
+static void ring_free(struct ring *r) {
+	if (r->slots == NULL)
+		return;
+
+	for (size_t i = 0; i < r->n_slots; i++)
+		free(r->slots[i].data);
+	free(r->slots);
+	r->slots = NULL;
+
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->not_empty);
+	pthread_cond_destroy(&r->not_full);
+}
+
+// next empty chunk for the producer to fill, NULL if the consumer cancelled
+static struct chunk *ring_begin_write(struct ring *r) {
+	pthread_mutex_lock(&r->lock);
+	while (r->count == r->n_slots && !r->cancelled)
+		pthread_cond_wait(&r->not_full, &r->lock);
+
+	struct chunk *c = NULL;
+	if (!r->cancelled) {
+		c = &r->slots[(r->head + r->count) % r->n_slots];
+		c->len = 0;
+	}
+	pthread_mutex_unlock(&r->lock);
+	return c;
+}
+
+static void ring_end_write(struct ring *r) {
+	pthread_mutex_lock(&r->lock);
+	r->count++;
+	pthread_cond_signal(&r->not_empty);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void ring_close(struct ring *r, int err) {
+	pthread_mutex_lock(&r->lock);
+	r->closed = true;
+	r->err = err;
+	pthread_cond_broadcast(&r->not_empty);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void ring_cancel(struct ring *r) {
+	if (r->slots == NULL)
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	r->cancelled = true;
+	pthread_cond_broadcast(&r->not_full);
+	pthread_mutex_unlock(&r->lock);
+}
+
+// oldest filled chunk, NULL once the producer has closed and the ring is drained
+static struct chunk *ring_begin_read(struct ring *r) {
+	pthread_mutex_lock(&r->lock);
+	while (r->count == 0 && !r->closed)
+		pthread_cond_wait(&r->not_empty, &r->lock);
+
+	struct chunk *c = r->count > 0 ? &r->slots[r->head] : NULL;
+	pthread_mutex_unlock(&r->lock);
+	return c;
+}
+
+static void ring_end_read(struct ring *r) {
+	pthread_mutex_lock(&r->lock);
+	r->head = (r->head + 1) % r->n_slots;
+	r->count--;
+	pthread_cond_signal(&r->not_full);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void *reader_main(void *data) {
+	struct stream *s = data;
+	int err = CRACKING;
+
+	while (true) {
+		struct chunk *c = ring_begin_write(&s->raw);
+		if (c == NULL)
+			break;
+
+		c->len = fread(c->data, 1, CHUNK_SIZE, s->file);
+		if (c->len == 0) {
+			if (ferror(s->file))
+				err = ERR_IO;
+			break;
+		}
+
+		ring_end_write(&s->raw);
+	}
+
+	ring_close(&s->raw, err);
+	return NULL;
+}
+
+#ifndef NO_COMPRESSION
+
+// copies into the ring, committing chunks as they fill up. *cur is the
+// partially filled chunk carried between calls
+static bool ring_write_all(struct ring *r, struct chunk **cur, const char *buf, size_t n) {
+	while (n > 0) {
+		if (*cur == NULL && (*cur = ring_begin_write(r)) == NULL)
+			return false;
+
+		size_t space = CHUNK_SIZE - (*cur)->len;
+		size_t len = n < space ? n : space;
+		memcpy((*cur)->data + (*cur)->len, buf, len);
+		(*cur)->len += len;
+		buf += len;
+		n -= len;
+
+		if ((*cur)->len == CHUNK_SIZE) {
+			ring_end_write(r);
+			*cur = NULL;
+		}
+	}
+
+	return true;
+}
+
+static void ring_flush(struct ring *r, struct chunk **cur) {
+	if (*cur != NULL && (*cur)->len > 0)
+		ring_end_write(r);
+	*cur = NULL;
+}
+
+// gzip cannot be split without an index, so it gets a single decoder thread.
+// concatenated members (as produced by pigz/bgzip) are decoded back to back
+static void *gzip_main(void *data) {
+	struct stream *s = data;
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+
+	// 15 + 32: max window, detect gzip/zlib header
+	int err = inflateInit2(&z, 15 + 32) == Z_OK ? CRACKING : ERR_MEM;
+	bool member_end = false;
+	struct chunk *in = NULL;
+	struct chunk *out = NULL;
+
+	while (err == CRACKING) {
+		if (z.avail_in == 0) {
+			if (in != NULL)
+				ring_end_read(&s->raw);
+
+			if ((in = ring_begin_read(&s->raw)) == NULL) {
+				err = s->raw.err;
+				if (err == CRACKING && !member_end)
+					err = ERR_IO; // truncated
+				break;
+			}
+
+			z.next_in = (Bytef *) in->data;
+			z.avail_in = in->len;
+		}
+
+		if (out == NULL) {
+			if ((out = ring_begin_write(&s->out)) == NULL)
+				break;
+			z.next_out = (Bytef *) out->data;
+			z.avail_out = CHUNK_SIZE;
+		}
+
+		int ret = inflate(&z, Z_NO_FLUSH);
+		out->len = CHUNK_SIZE - z.avail_out;
+
+		if (ret == Z_STREAM_END) {
+			member_end = true;
+			inflateReset(&z);
+		} else if (ret == Z_OK) {
+			member_end = false;
+		} else {
+			err = ERR_IO;
+		}
+
+		if (z.avail_out == 0) {
+			ring_end_write(&s->out);
+			out = NULL;
+		}
+	}
+
+	if (in != NULL)
+		ring_end_read(&s->raw);
+	ring_flush(&s->out, &out);
+
+	inflateEnd(&z);
+	ring_close(&s->out, err);
+	ring_cancel(&s->raw);
+	return NULL;
+}
+
+// bzip2 compresses independent blocks, each starting with a 48 bit magic
+// at an arbitrary bit offset. blocks are cut out of the input, rewrapped as
+// standalone single block streams and decompressed on a worker pool, then
+// emitted in input order
+#define BZ_BLOCK_MAGIC (0x314159265359ULL)
+#define BZ_EOS_MAGIC   (0x177245385090ULL)
+#define BZ_MAGIC_MASK  (0xffffffffffffULL)
+#define BZ_MAGIC_BITS  (48)
+
+struct bz_splitter;
+
+struct bz_block {
+	struct bz_splitter *owner;
+
+	// everything from this block's magic up to the next block magic, which
+	// includes any stream trailer and header in between
+	unsigned char *bits;
+	size_t bit_offset;
+	size_t span_len;
+	size_t decode_len; // up to the end of stream marker, if any
+
+	char *out;
+	size_t out_len;
+	int err;
+	bool done;
+};
+
+struct bz_splitter {
+	struct stream *stream;
+	struct pool pool;
+
+	pthread_mutex_t lock;
+	pthread_cond_t block_done;
+
+	struct bz_block **queue;
+	size_t queue_len;
+	size_t max_inflight;
+	struct chunk *out; // partially filled output chunk
+
+	// bytes of the block currently being scanned
+	unsigned char *cur;
+	size_t cur_len;
+	size_t cur_cap;
+	uint64_t cur_base; // input byte offset of cur[0]
+
+	bool in_block;
+	uint64_t block_start; // input bit offsets
+	uint64_t eos_at;
+	bool eos_seen;
+};
+
+static uint32_t read_bits(const unsigned char *src, size_t pos, int n) {
+	uint32_t v = 0;
+	for (int i = 0; i < n; i++, pos++)
+		v = (v << 1) | ((src[pos >> 3] >> (7 - (pos & 7))) & 1);
+	return v;
+}
+
+static void put_bits(unsigned char *dst, size_t *pos, uint64_t v, int n) {
+	for (int i = n - 1; i >= 0; i--, (*pos)++) {
+		unsigned char bit = (v >> i) & 1;
+		if (bit)
+			dst[*pos >> 3] |= 0x80 >> (*pos & 7);
+	}
+}
+
+// dst must be zeroed and src readable one byte past the last bit
+static void copy_bits(unsigned char *dst, size_t *dst_pos, const unsigned char *src, size_t src_pos, size_t n) {
+	if ((*dst_pos & 7) == 0) {
+		unsigned char *d = dst + (*dst_pos >> 3);
+		const unsigned char *sb = src + (src_pos >> 3);
+		int shift = src_pos & 7;
+		size_t bytes = (n + 7) >> 3;
+		for (size_t i = 0; i < bytes; i++)
+			d[i] = shift ? (unsigned char) ((sb[i] << shift) | (sb[i + 1] >> (8 - shift))) : sb[i];
+
+		// clear bits past the end
+		if (n & 7)
+			d[bytes - 1] &= (unsigned char) (0xff << (8 - (n & 7)));
+		*dst_pos += n;
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		size_t p = src_pos + i;
+		put_bits(dst, dst_pos, (src[p >> 3] >> (7 - (p & 7))) & 1, 1);
+	}
+}
+
+static void decode_block(struct bz_block *b) {
+	b->err = ERR_IO;
+	b->out_len = 0;
+
+	if (b->decode_len < BZ_MAGIC_BITS + 32)
+		return;
+
+	// "BZh9" + block + end of stream magic + stream crc, which for a single
+	// block is the block crc stored right after its magic
+	uint32_t crc = read_bits(b->bits, b->bit_offset + BZ_MAGIC_BITS, 32);
+	size_t synth_bits = 32 + b->decode_len + BZ_MAGIC_BITS + 32;
+	size_t synth_len = (synth_bits + 7) / 8;
+	unsigned char *synth = calloc(synth_len + 1, 1);
+	if (synth == NULL) {
+		b->err = ERR_MEM;
+		return;
+	}
+
+	size_t pos = 0;
+	memcpy(synth, "BZh9", 4);
+	pos = 32;
+	copy_bits(synth, &pos, b->bits, b->bit_offset, b->decode_len);
+	put_bits(synth, &pos, BZ_EOS_MAGIC, BZ_MAGIC_BITS);
+	put_bits(synth, &pos, crc, 32);
+
+	bz_stream bz;
+	memset(&bz, 0, sizeof(bz));
+	if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK) {
+		free(synth);
+		b->err = ERR_MEM;
+		return;
+	}
+
+	bz.next_in = (char *) synth;
+	bz.avail_in = synth_len;
+
+	size_t cap = 0;
+	while (true) {
+		if (b->out_len == cap) {
+			size_t new_cap = cap == 0 ? CHUNK_SIZE : cap * 2;
+			char *out = realloc(b->out, new_cap);
+			if (out == NULL) {
+				b->err = ERR_MEM;
+				break;
+			}
+			b->out = out;
+			cap = new_cap;
+		}
+
+		bz.next_out = b->out + b->out_len;
+		bz.avail_out = cap - b->out_len;
+		int ret = BZ2_bzDecompress(&bz);
+		b->out_len = cap - bz.avail_out;
+
+		if (ret == BZ_STREAM_END) {
+			b->err = CRACKING;
+			break;
+		}
+
+		// out of input without finishing the stream
+		if (ret != BZ_OK || (bz.avail_in == 0 && bz.avail_out > 0))
+			break;
+	}
+
+	BZ2_bzDecompressEnd(&bz);
+	free(synth);
+}
+
+static void decode_block_job(void *arg) {
+	struct bz_block *b = arg;
+	decode_block(b);
+
+	pthread_mutex_lock(&b->owner->lock);
+	b->done = true;
+	pthread_cond_broadcast(&b->owner->block_done);
+	pthread_mutex_unlock(&b->owner->lock);
+}
+
+static void free_block(struct bz_block *b) {
+	free(b->bits);
+	free(b->out);
+	free(b);
+}
+
+static void wait_block(struct bz_splitter *sp, struct bz_block *b) {
+	pthread_mutex_lock(&sp->lock);
+	while (!b->done)
+		pthread_cond_wait(&sp->block_done, &sp->lock);
+	pthread_mutex_unlock(&sp->lock);
+}
+
+static bool block_done(struct bz_splitter *sp, struct bz_block *b) {
+	pthread_mutex_lock(&sp->lock);
+	bool done = b->done;
+	pthread_mutex_unlock(&sp->lock);
+	return done;
+}
+
+static void queue_pop(struct bz_splitter *sp, size_t i) {
+	memmove(sp->queue + i, sp->queue + i + 1, (sp->queue_len - i - 1) * sizeof(struct bz_block *));
+	sp->queue_len--;
+}
+
+// a magic sequence occurring by chance inside compressed data splits a
+// block in two and both halves fail to decode. glue the next span back on
+// and decode again on this thread
+static int merge_with_next(struct bz_splitter *sp) {
+	struct bz_block *a = sp->queue[0];
+	struct bz_block *b = sp->queue[1];
+	wait_block(sp, b);
+
+	size_t bits = a->span_len + b->span_len;
+	unsigned char *merged = calloc((bits + 7) / 8 + 1, 1);
+	if (merged == NULL)
+		return ERR_MEM;
+
+	size_t pos = 0;
+	copy_bits(merged, &pos, a->bits, a->bit_offset, a->span_len);
+	copy_bits(merged, &pos, b->bits, b->bit_offset, b->span_len);
+
+	free(a->bits);
+	a->bits = merged;
+	a->bit_offset = 0;
+	a->decode_len = a->span_len + b->decode_len;
+	a->span_len = bits;
+
+	queue_pop(sp, 1);
+	free_block(b);
+
+	decode_block(a);
+	return CRACKING;
+}
+
+// emits finished blocks in order. only blocks when the queue is full, or
+// when final is set and everything must be flushed
+static int drain_blocks(struct bz_splitter *sp, bool final) {
+	while (sp->queue_len > 0) {
+		struct bz_block *b = sp->queue[0];
+
+		if (!final && sp->queue_len < sp->max_inflight && !block_done(sp, b))
+			break;
+		wait_block(sp, b);
+
+		while (b->err != CRACKING) {
+			if (sp->queue_len == 1) {
+				if (!final)
+					return CRACKING; // retry once more input has arrived
+				return b->err;
+			}
+
+			int ret = merge_with_next(sp);
+			if (ret != CRACKING)
+				return ret;
+		}
+
+		if (!ring_write_all(&sp->stream->out, &sp->out, b->out, b->out_len))
+			return ERR_IO;
+
+		queue_pop(sp, 0);
+		free_block(b);
+	}
+
+	return CRACKING;
+}
+
+static int submit_block(struct bz_splitter *sp, uint64_t end) {
+	if (sp->queue_len >= sp->max_inflight) {
+		int ret = drain_blocks(sp, false);
+		if (ret != CRACKING)
+			return ret;
+	}
+
+	struct bz_block *b = calloc(1, sizeof(struct bz_block));
+	if (b == NULL)
+		return ERR_MEM;
+
+	size_t first = sp->block_start / 8 - sp->cur_base;
+	size_t last = (end + 7) / 8 - sp->cur_base;
+
+	b->owner = sp;
+	b->bit_offset = sp->block_start & 7;
+	b->span_len = end - sp->block_start;
+	b->decode_len = (sp->eos_seen ? sp->eos_at : end) - sp->block_start;
+	if ((b->bits = calloc(last - first + 1, 1)) == NULL) {
+		free(b);
+		return ERR_MEM;
+	}
+	memcpy(b->bits, sp->cur + first, last - first);
+
+	sp->queue[sp->queue_len++] = b;
+	if (pool_submit(&sp->pool, decode_block_job, b) != CRACKING) {
+		decode_block_job(b);
+	}
+
+	return CRACKING;
+}
+
+// found a magic starting at input bit offset pos
+static int on_magic(struct bz_splitter *sp, uint64_t pos, bool is_block) {
+	if (!is_block) {
+		if (sp->in_block && !sp->eos_seen) {
+			sp->eos_seen = true;
+			sp->eos_at = pos;
+		}
+		return CRACKING;
+	}
+
+	if (sp->in_block) {
+		int ret = submit_block(sp, pos);
+		if (ret != CRACKING)
+			return ret;
+	}
+
+	// keep only the bytes of the new block
+	size_t keep_from = pos / 8 - sp->cur_base;
+	memmove(sp->cur, sp->cur + keep_from, sp->cur_len - keep_from);
+	sp->cur_len -= keep_from;
+	sp->cur_base += keep_from;
+
+	sp->in_block = true;
+	sp->block_start = pos;
+	sp->eos_seen = false;
+	return CRACKING;
+}
+
+static int scan_chunk(struct bz_splitter *sp, struct chunk *in, uint64_t *window, uint64_t *offset) {
+	if (sp->cur_len + in->len > sp->cur_cap) {
+		size_t cap = sp->cur_cap == 0 ? CHUNK_SIZE : sp->cur_cap;
+		while (cap < sp->cur_len + in->len)
+			cap *= 2;
+		unsigned char *cur = realloc(sp->cur, cap);
+		if (cur == NULL)
+			return ERR_MEM;
+		sp->cur = cur;
+		sp->cur_cap = cap;
+	}
+
+	const unsigned char *bytes = (const unsigned char *) in->data;
+	for (size_t i = 0; i < in->len; i++) {
+		sp->cur[sp->cur_len++] = bytes[i];
+		*window = (*window << 8) | bytes[i];
+		uint64_t end = (*offset + i + 1) * 8;
+
+		// every bit alignment ending in this byte, earliest first
+		for (int shift = 7; shift >= 0; shift--) {
+			uint64_t v = (*window >> shift) & BZ_MAGIC_MASK;
+			if ((v != BZ_BLOCK_MAGIC && v != BZ_EOS_MAGIC) || end - shift < BZ_MAGIC_BITS)
+				continue;
+
+			int ret = on_magic(sp, end - shift - BZ_MAGIC_BITS, v == BZ_BLOCK_MAGIC);
+			if (ret != CRACKING)
+				return ret;
+		}
+	}
+	*offset += in->len;
+
+	// between blocks only the tail that could hold a partial magic matters
+	if (!sp->in_block && sp->cur_len > 8) {
+		size_t drop = sp->cur_len - 8;
+		memmove(sp->cur, sp->cur + drop, 8);
+		sp->cur_len = 8;
+		sp->cur_base += drop;
+	}
+
+	if (sp->queue_len > 0)
+		return drain_blocks(sp, false);
+	return CRACKING;
+}
+
+static void *bzip2_main(void *data) {
+	struct stream *s = data;
+	struct bz_splitter sp;
+	memset(&sp, 0, sizeof(sp));
+	sp.stream = s;
+
+	int err = pool_init(&sp.pool, 0);
+	if (err == CRACKING) {
+		sp.max_inflight = sp.pool.n_threads * 2 + 1;
+		if ((sp.queue = calloc(sp.max_inflight + 1, sizeof(struct bz_block *))) == NULL)
+			err = ERR_MEM;
+	}
+	pthread_mutex_init(&sp.lock, NULL);
+	pthread_cond_init(&sp.block_done, NULL);
+
+	uint64_t window = 0;
+	uint64_t offset = 0;
+	struct chunk *in = NULL;
+
+	while (err == CRACKING) {
+		if ((in = ring_begin_read(&s->raw)) == NULL) {
+			err = s->raw.err;
+			break;
+		}
+
+		err = scan_chunk(&sp, in, &window, &offset);
+		ring_end_read(&s->raw);
+	}
+
+	if (err == CRACKING) {
+		// last block runs to the end of the input
+		if (sp.in_block)
+			err = submit_block(&sp, offset * 8);
+		if (err == CRACKING)
+			err = drain_blocks(&sp, true);
+		ring_flush(&s->out, &sp.out);
+	}
+
+	pool_free(&sp.pool);
+	for (size_t i = 0; i < sp.queue_len; i++)
+		free_block(sp.queue[i]);
+	free(sp.queue);
+	free(sp.cur);
+	pthread_mutex_destroy(&sp.lock);
+	pthread_cond_destroy(&sp.block_done);
+
+	ring_close(&s->out, err);
+	ring_cancel(&s->raw);
+	return NULL;
+}
+
+#endif
+
+enum osm_compression detect_compression(const unsigned char *magic, size_t len) {
+	if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		return COMPRESSION_GZIP;
+	if (len >= 3 && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h')
+		return COMPRESSION_BZIP2;
+	return COMPRESSION_NONE;
+}
+
+static ssize_t stream_read(void *cookie, char *buf, size_t size) {
+	struct stream *s = cookie;
+	struct ring *r = s->compression == COMPRESSION_NONE ? &s->raw : &s->out;
+
+	size_t done = 0;
+	while (done < size) {
+		if (s->current == NULL) {
+			if ((s->current = ring_begin_read(r)) == NULL) {
+				if (r->err != CRACKING && done == 0) {
+					errno = EIO;
+					return -1;
+				}
+				break;
+			}
+			s->pos = 0;
+		}
+
+		size_t avail = s->current->len - s->pos;
+		size_t n = size - done < avail ? size - done : avail;
+		memcpy(buf + done, s->current->data + s->pos, n);
+		s->pos += n;
+		done += n;
+
+		if (s->pos == s->current->len) {
+			ring_end_read(r);
+			s->current = NULL;
+		}
+	}
+
+	return done;
+}
+
+static void free_stream(struct stream *s) {
+	ring_cancel(&s->out);
+	ring_cancel(&s->raw);
+
+	if (s->has_decoder)
+		pthread_join(s->decoder, NULL);
+	if (s->has_reader)
+		pthread_join(s->reader, NULL);
+
+	ring_free(&s->raw);
+	ring_free(&s->out);
+	fclose(s->file);
+	free(s);
+}
+
+static int stream_close(void *cookie) {
+	free_stream(cookie);
+	return 0;
+}
+
+int open_osm_stream(const char *path, FILE **out) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return ERR_FILE_NOT_FOUND;
+
+	unsigned char magic[3];
+	size_t magic_len = fread(magic, 1, sizeof(magic), f);
+	rewind(f);
+
+	struct stream *s = calloc(1, sizeof(struct stream));
+	if (s == NULL) {
+		fclose(f);
+		return ERR_MEM;
+	}
+	s->file = f;
+	s->compression = detect_compression(magic, magic_len);
+
+	void *(*decoder)(void *) = NULL;
+	switch (s->compression) {
+#ifndef NO_COMPRESSION
+		case COMPRESSION_GZIP:
+			decoder = gzip_main;
+			break;
+		case COMPRESSION_BZIP2:
+			decoder = bzip2_main;
+			break;
+#else
+		case COMPRESSION_GZIP:
+		case COMPRESSION_BZIP2:
+			free_stream(s);
+			return ERR_UNSUPPORTED;
+#endif
+		case COMPRESSION_NONE:
+		default:
+			break;
+	}
+
+	int ret = ring_init(&s->raw, RAW_SLOTS);
+	if (ret == CRACKING && decoder != NULL)
+		ret = ring_init(&s->out, OUT_SLOTS);
+
+	if (ret == CRACKING && pthread_create(&s->reader, NULL, reader_main, s) == 0)
+		s->has_reader = true;
+	else if (ret == CRACKING)
+		ret = ERR_MEM;
+
+	if (ret == CRACKING && decoder != NULL) {
+		if (pthread_create(&s->decoder, NULL, decoder, s) == 0)
+			s->has_decoder = true;
+		else
+			ret = ERR_MEM;
+	}
+
+	cookie_io_functions_t funcs = {
+		.read = stream_read,
+		.write = NULL,
+		.seek = NULL,
+		.close = stream_close
+	};
+
+	if (ret != CRACKING || (*out = fopencookie(s, "r", funcs)) == NULL) {
+		free_stream(s);
+		return ret != CRACKING ? ret : ERR_MEM;
+	}
+
+	// parser reads by line, keep the copies out of the ring coarse
+	setvbuf(*out, NULL, _IOFBF, 1 << 16);
+	return CRACKING;
+}
@@ -0,0 +1,21 @@
+#ifndef OSM_STREAM
+#define OSM_STREAM
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum osm_compression {
+	COMPRESSION_NONE = 0,
+	COMPRESSION_GZIP,
+	COMPRESSION_BZIP2
+};
+
+enum osm_compression detect_compression(const unsigned char *magic, size_t len);
+
+// opens an osm file for reading. gzip and bzip2 input is detected from the
+// magic bytes and decompressed on background threads, reading/decompression
+// run ahead of the caller through bounded rings of large buffers.
+// the returned FILE must be closed with fclose
+int open_osm_stream(const char *path, FILE **out);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 
 #include "osm.h"
+#include "alloc.h"
 
 // http://www.cse.yorku.ca/~oz/hash.html
 static uint64_t djb2(char *s) {
@@ -13,4 +14,5 @@ static uint64_t djb2(char *s) {
 
 #define TAG_CMP(left, right) strcmp(left->key, right->key)
 #define TAG_HASH(entry) djb2(entry->key)
-DECLARE_HASHMAP(tag_map, TAG_CMP, TAG_HASH, free, realloc)
+DEFINE_ALLOC_HOOKS(tag_map, ALLOC_TAGS)
+DECLARE_HASHMAP(tag_map, TAG_CMP, TAG_HASH, tag_map_free, tag_map_realloc)
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "error.h"
+
+#define CHUNKS_PER_THREAD (4)
+
+struct pool_task {
+	pool_job *fn;
+	void *arg;
+	struct pool_task *next;
+};
+
+struct chunk_task {
+	pool_chunk_job *fn;
+	void *ctx;
+	int chunk;
+	size_t from, to;
+};
+
+static void *worker_main(void *data) {
+	struct pool *pool = data;
+
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (pool->head == NULL && !pool->stopping)
+			pthread_cond_wait(&pool->has_work, &pool->lock);
+
+		if (pool->head == NULL)
+			break;
+
+		struct pool_task *task = pool->head;
+		pool->head = task->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+
+		pthread_mutex_unlock(&pool->lock);
+		task->fn(task->arg);
+		free(task);
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+int pool_default_threads(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (int) n;
+}
+
+int pool_init(struct pool *pool, int threads) {
+	if (threads <= 0)
+		threads = pool_default_threads();
+
+	pool->head = pool->tail = NULL;
+	pool->pending = 0;
+	pool->stopping = false;
+	pool->n_threads = 0;
+
+	if ((pool->threads = calloc(threads, sizeof(pthread_t))) == NULL)
+		return ERR_MEM;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->has_work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+			pool_free(pool);
+			return ERR_MEM;
+		}
+		pool->n_threads++;
+	}
+
+	return CRACKING;
+}
+
+int pool_submit(struct pool *pool, pool_job *fn, void *arg) {
+	struct pool_task *task = malloc(sizeof(struct pool_task));
+	if (task == NULL)
+		return ERR_MEM;
+
+	task->fn = fn;
+	task->arg = arg;
+	task->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail == NULL)
+		pool->head = task;
+	else
+		pool->tail->next = task;
+	pool->tail = task;
+	pool->pending++;
+	pthread_cond_signal(&pool->has_work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return CRACKING;
+}
+
+void pool_wait(struct pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(struct pool *pool) {
+	if (pool->threads == NULL)
+		return;
+
+	pool_wait(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->has_work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->has_work);
+	pthread_cond_destroy(&pool->idle);
+
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->n_threads = 0;
+}
+
+static void run_chunk(void *arg) {
+	struct chunk_task *t = arg;
+	t->fn(t->ctx, t->chunk, t->from, t->to);
+}
+
+int pool_chunk_count(size_t n, size_t min, int threads) {
+	if (threads <= 0)
+		threads = pool_default_threads();
+	return threads == 1 || n < min ? 1 : threads * CHUNKS_PER_THREAD;
+}
+
+void pool_for_chunks(size_t n, size_t min, int threads, pool_chunk_job *fn, void *ctx) {
+	int n_chunks = pool_chunk_count(n, min, threads);
+
+	struct pool pool;
+	struct chunk_task *tasks = NULL;
+	if (n_chunks > 1 && (tasks = calloc(n_chunks, sizeof(struct chunk_task))) != NULL
+			&& pool_init(&pool, n_chunks / CHUNKS_PER_THREAD) != CRACKING) {
+		free(tasks);
+		tasks = NULL;
+	}
+
+	for (int i = 0; i < n_chunks; i++) {
+		struct chunk_task t = {fn, ctx, i, n * i / n_chunks, n * (i + 1) / n_chunks};
+		if (tasks == NULL) {
+			run_chunk(&t);
+			continue;
+		}
+
+		tasks[i] = t;
+		if (pool_submit(&pool, run_chunk, &tasks[i]) != CRACKING)
+			run_chunk(&tasks[i]);
+	}
+
+	if (tasks != NULL) {
+		pool_free(&pool);
+		free(tasks);
+	}
+}
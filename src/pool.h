@@ -0,0 +1,55 @@
+#ifndef OSM_POOL
+#define OSM_POOL
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef void pool_job(void *arg);
+
+struct pool_task;
+
+// fixed size worker pool with a single FIFO job queue
+struct pool {
+	pthread_t *threads;
+	int n_threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t has_work;
+	pthread_cond_t idle;
+
+	struct pool_task *head;
+	struct pool_task *tail;
+	int pending;
+	bool stopping;
+};
+
+// number of online cpus, at least 1
+int pool_default_threads(void);
+
+// threads <= 0 uses pool_default_threads()
+int pool_init(struct pool *pool, int threads);
+
+int pool_submit(struct pool *pool, pool_job *fn, void *arg);
+
+// blocks until every submitted job has finished
+void pool_wait(struct pool *pool);
+
+// waits for outstanding jobs then joins all workers
+void pool_free(struct pool *pool);
+
+// items [from, to) of chunk number chunk
+typedef void pool_chunk_job(void *ctx, int chunk, size_t from, size_t to);
+
+// how many chunks pool_for_chunks splits n items into. one with a single
+// thread or under min items, which are quicker done inline than by waking
+// workers, otherwise a few a thread as items can vary a lot in cost
+int pool_chunk_count(size_t n, size_t min, int threads);
+
+// runs fn over [0, n) in pool_chunk_count chunks on a pool of threads
+// workers (<= 0 for one a cpu) and returns once they are all done. chunks
+// run inline if there is no pool to be had, so how the items are split
+// only ever depends on the arguments
+void pool_for_chunks(size_t n, size_t min, int threads, pool_chunk_job *fn, void *ctx);
+
+#endif
@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "project.h"
+#include "world.h"
+#include "osm/osm.h"
+#include "error.h"
+#include "simd.h"
+
+// the sphere of web mercator, also used for the local grid
+#define EARTH_RADIUS (6378137.0)
+#define DEG_TO_RAD (M_PI / 180.0)
+
+// where mercator reaches the same northing as it has easting at 180
+#define MERCATOR_MAX_LAT (85.051128779806604)
+
+#define SQRT2 (1.4142135623730951)
+#define LN2 (0.6931471805599453)
+#define MANTISSA_BITS (0x000fffffffffffffULL)
+#define EXPONENT_ONE (0x3ff0000000000000ULL)
+
+// avx2 has no sin or log, so the northing is these polynomials on both
+// paths and they agree exactly. sin is its taylor series in x^2 up to
+// x^21, under 1e-16 off up to the mercator limit
+static const double sin_terms[] = {
+	1.0 / 51090942171709440000.0,
+	-1.0 / 121645100408832000.0,
+	1.0 / 355687428096000.0,
+	-1.0 / 1307674368000.0,
+	1.0 / 6227020800.0,
+	-1.0 / 39916800.0,
+	1.0 / 362880.0,
+	-1.0 / 5040.0,
+	1.0 / 120.0,
+	-1.0 / 6.0,
+	1.0
+};
+#define SIN_TERMS (sizeof(sin_terms) / sizeof(*sin_terms))
+
+// ln m = 2 atanh(t), t = (m - 1) / (m + 1), whose series in t^2 up to
+// t^21 is exact to a double for m in [sqrt(1/2), sqrt(2))
+static const double log_terms[] = {
+	1.0 / 21, 1.0 / 19, 1.0 / 17, 1.0 / 15, 1.0 / 13, 1.0 / 11,
+	1.0 / 9, 1.0 / 7, 1.0 / 5, 1.0 / 3, 1.0
+};
+#define LOG_TERMS (sizeof(log_terms) / sizeof(*log_terms))
+
+void projector_init(struct projector *p, enum projection kind, point origin) {
+	p->kind = kind;
+	p->origin = origin;
+
+	switch (kind) {
+		case PROJECT_MERCATOR:
+			p->origin = (point) {0, 0};
+			p->scale_lat = EARTH_RADIUS * DEG_TO_RAD; // unused, the northing isn't linear
+			p->scale_lon = EARTH_RADIUS * DEG_TO_RAD;
+			break;
+		case PROJECT_LOCAL:
+			p->scale_lat = EARTH_RADIUS * DEG_TO_RAD;
+			p->scale_lon = EARTH_RADIUS * DEG_TO_RAD * cos(origin.lat * DEG_TO_RAD);
+			break;
+		case PROJECT_NONE:
+		default:
+			p->origin = (point) {0, 0};
+			p->scale_lat = p->scale_lon = 1;
+			break;
+	}
+}
+
+// out = (in - sub) * mul on both axes, the local grid and the mercator
+// easting are just this
+static void affine_scalar(const point *in, point *out, size_t n, point sub, point mul) {
+	for (size_t i = 0; i < n; i++) {
+		out[i].lat = (in[i].lat - sub.lat) * mul.lat;
+		out[i].lon = (in[i].lon - sub.lon) * mul.lon;
+	}
+}
+
+static void quantize_scalar(const point *in, fixed_point *out, size_t n, double scale) {
+	// lrint rounds half to even like cvtpd2dq, so both paths agree
+	for (size_t i = 0; i < n; i++) {
+		out[i].lat = (int32_t) lrint(in[i].lat * scale);
+		out[i].lon = (int32_t) lrint(in[i].lon * scale);
+	}
+}
+
+static double sin_poly(double x) {
+	double x2 = x * x, r = sin_terms[0];
+	for (size_t i = 1; i < SIN_TERMS; i++)
+		r = r * x2 + sin_terms[i];
+	return r * x;
+}
+
+// of a positive normal q, split as m 2^e by its bits like the avx2 path
+static double log_poly(double q) {
+	uint64_t bits;
+	memcpy(&bits, &q, sizeof(bits));
+	double e = (double) (bits >> 52) - 1023;
+	bits = (bits & MANTISSA_BITS) | EXPONENT_ONE;
+
+	double m;
+	memcpy(&m, &bits, sizeof(m));
+	if (m > SQRT2) {
+		m *= 0.5;
+		e += 1;
+	}
+
+	double t = (m - 1) / (m + 1), t2 = t * t, r = log_terms[0];
+	for (size_t i = 1; i < LOG_TERMS; i++)
+		r = r * t2 + log_terms[i];
+	return e * LN2 + 2 * t * r;
+}
+
+static double mercator_northing(double lat) {
+	lat = fmax(-MERCATOR_MAX_LAT, fmin(MERCATOR_MAX_LAT, lat));
+	// the same as ln(tan(pi/4 + lat/2)), one transcendental cheaper
+	double s = sin_poly(lat * DEG_TO_RAD);
+	return EARTH_RADIUS / 2 * log_poly((1 + s) / (1 - s));
+}
+
+static void northing_scalar(point *p, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		p[i].lat = mercator_northing(p[i].lat);
+}
+
+#ifdef HAVE_AVX2
+// two points per register, laid out lat lon lat lon
+__attribute__((target("avx2")))
+static void affine_avx2(const point *in, point *out, size_t n, point sub, point mul) {
+	__m256d vsub = _mm256_setr_pd(sub.lat, sub.lon, sub.lat, sub.lon);
+	__m256d vmul = _mm256_setr_pd(mul.lat, mul.lon, mul.lat, mul.lon);
+	const double *src = (const double *) in;
+	double *dst = (double *) out;
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d a = _mm256_loadu_pd(src + i * 2);
+		__m256d b = _mm256_loadu_pd(src + i * 2 + 4);
+		_mm256_storeu_pd(dst + i * 2, _mm256_mul_pd(_mm256_sub_pd(a, vsub), vmul));
+		_mm256_storeu_pd(dst + i * 2 + 4, _mm256_mul_pd(_mm256_sub_pd(b, vsub), vmul));
+	}
+
+	// the tail and whatever the caller does next are sse, which stalls on
+	// dirty upper halves and the compiler doesn't always clear them
+	_mm256_zeroupper();
+	affine_scalar(in + i, out + i, n - i, sub, mul);
+}
+
+__attribute__((target("avx2")))
+static void quantize_avx2(const point *in, fixed_point *out, size_t n, double scale) {
+	__m256d vscale = _mm256_set1_pd(scale);
+	const double *src = (const double *) in;
+	int32_t *dst = (int32_t *) out;
+
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m256d v = _mm256_mul_pd(_mm256_loadu_pd(src + i * 2), vscale);
+		_mm_storeu_si128((__m128i *) (dst + i * 2), _mm256_cvtpd_epi32(v));
+	}
+
+	_mm256_zeroupper();
+	quantize_scalar(in + i, out + i, n - i, scale);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256d sin_poly_avx2(__m256d x) {
+	__m256d x2 = _mm256_mul_pd(x, x), r = _mm256_set1_pd(sin_terms[0]);
+	for (size_t i = 1; i < SIN_TERMS; i++)
+		r = _mm256_add_pd(_mm256_mul_pd(r, x2), _mm256_set1_pd(sin_terms[i]));
+	return _mm256_mul_pd(r, x);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256d log_poly_avx2(__m256d q) {
+	__m256i bits = _mm256_castpd_si256(q);
+
+	// the biased exponent under the bits of 2^52, less 2^52, is it exactly
+	__m256i biased = _mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(0x4330000000000000LL));
+	__m256d e = _mm256_sub_pd(_mm256_castsi256_pd(biased), _mm256_set1_pd(4503599627370496.0));
+	e = _mm256_sub_pd(e, _mm256_set1_pd(1023));
+	__m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(MANTISSA_BITS)),
+			_mm256_set1_epi64x(EXPONENT_ONE)));
+
+	__m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(SQRT2), _CMP_GT_OQ);
+	m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+	e = _mm256_add_pd(e, _mm256_and_pd(big, _mm256_set1_pd(1)));
+
+	__m256d one = _mm256_set1_pd(1);
+	__m256d t = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+	__m256d t2 = _mm256_mul_pd(t, t), r = _mm256_set1_pd(log_terms[0]);
+	for (size_t i = 1; i < LOG_TERMS; i++)
+		r = _mm256_add_pd(_mm256_mul_pd(r, t2), _mm256_set1_pd(log_terms[i]));
+	return _mm256_add_pd(_mm256_mul_pd(e, _mm256_set1_pd(LN2)), _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(2), t), r));
+}
+
+// the lats of four points in place, their order in the register doesn't
+// matter as long as they go back where they came from
+__attribute__((target("avx2")))
+static void northing_avx2(point *p, size_t n) {
+	__m256d max = _mm256_set1_pd(MERCATOR_MAX_LAT), min = _mm256_set1_pd(-MERCATOR_MAX_LAT);
+	__m256d rad = _mm256_set1_pd(DEG_TO_RAD), one = _mm256_set1_pd(1);
+	__m256d half_radius = _mm256_set1_pd(EARTH_RADIUS / 2);
+	double *d = (double *) p;
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d a = _mm256_loadu_pd(d + i * 2), b = _mm256_loadu_pd(d + i * 2 + 4);
+		__m256d lat = _mm256_unpacklo_pd(a, b), lon = _mm256_unpackhi_pd(a, b);
+
+		lat = _mm256_max_pd(_mm256_min_pd(lat, max), min);
+		__m256d s = sin_poly_avx2(_mm256_mul_pd(lat, rad));
+		__m256d q = _mm256_div_pd(_mm256_add_pd(one, s), _mm256_sub_pd(one, s));
+		__m256d y = _mm256_mul_pd(half_radius, log_poly_avx2(q));
+
+		_mm256_storeu_pd(d + i * 2, _mm256_unpacklo_pd(y, lon));
+		_mm256_storeu_pd(d + i * 2 + 4, _mm256_unpackhi_pd(y, lon));
+	}
+
+	_mm256_zeroupper();
+	northing_scalar(p + i, n - i);
+}
+#endif
+
+static void affine(const point *in, point *out, size_t n, point sub, point mul) {
+#ifdef HAVE_AVX2
+	if (simd_avx2()) {
+		affine_avx2(in, out, n, sub, mul);
+		return;
+	}
+#endif
+	affine_scalar(in, out, n, sub, mul);
+}
+
+static void northing(point *p, size_t n) {
+#ifdef HAVE_AVX2
+	if (simd_avx2()) {
+		northing_avx2(p, n);
+		return;
+	}
+#endif
+	northing_scalar(p, n);
+}
+
+void quantize_points(const point *in, fixed_point *out, size_t n, double scale) {
+#ifdef HAVE_AVX2
+	if (simd_avx2()) {
+		quantize_avx2(in, out, n, scale);
+		return;
+	}
+#endif
+	quantize_scalar(in, out, n, scale);
+}
+
+void project_points(const struct projector *p, const point *in, point *out, size_t n) {
+	switch (p->kind) {
+		case PROJECT_LOCAL:
+			affine(in, out, n, p->origin, (point) {p->scale_lat, p->scale_lon});
+			break;
+
+		case PROJECT_MERCATOR:
+			// the easting is linear, the lat is only copied here
+			affine(in, out, n, p->origin, (point) {1, p->scale_lon});
+			northing(out, n);
+			break;
+
+		case PROJECT_NONE:
+		default:
+			if (out != in)
+				memmove(out, in, n * sizeof(point));
+			break;
+	}
+}
+
+struct extent {
+	point min, max;
+};
+
+static void grow(struct extent *e, const vec_point_t *points) {
+	for (int i = 0; i < points->length; i++) {
+		point pt = points->data[i];
+		e->min.lat = fmin(e->min.lat, pt.lat);
+		e->min.lon = fmin(e->min.lon, pt.lon);
+		e->max.lat = fmax(e->max.lat, pt.lat);
+		e->max.lon = fmax(e->max.lon, pt.lon);
+	}
+}
+
+static struct extent world_extent(const struct world *world) {
+	struct extent e = {{INFINITY, INFINITY}, {-INFINITY, -INFINITY}};
+	for (int i = 0; i < world->roads.length; i++)
+		grow(&e, &world->roads.data[i].segments);
+	for (int i = 0; i < world->land_uses.length; i++)
+		grow(&e, &world->land_uses.data[i].points);
+	return e;
+}
+
+// projects or shifts every feature's points in place
+static void map_world(struct world *world, const struct projector *p, point shift) {
+	for (int i = 0; i < world->roads.length; i++) {
+		vec_point_t *v = &world->roads.data[i].segments;
+		if (p != NULL)
+			project_points(p, v->data, v->data, v->length);
+		else
+			affine(v->data, v->data, v->length, shift, (point) {1, 1});
+	}
+
+	for (int i = 0; i < world->land_uses.length; i++) {
+		vec_point_t *v = &world->land_uses.data[i].points;
+		if (p != NULL)
+			project_points(p, v->data, v->data, v->length);
+		else
+			affine(v->data, v->data, v->length, shift, (point) {1, 1});
+	}
+}
+
+int project_world(struct world *world, enum projection kind, uint32_t fixed_scale) {
+	if (world->projection != PROJECT_NONE || kind == PROJECT_NONE)
+		return world->projection == kind ? CRACKING : ERR_UNSUPPORTED;
+
+	struct extent e = world_extent(world);
+	if (e.min.lat > e.max.lat) {
+		world->projection = kind;
+		world->fixed_scale = fixed_scale;
+		return CRACKING;
+	}
+
+	struct projector p;
+	projector_init(&p, kind, (point) {(e.min.lat + e.max.lat) / 2, (e.min.lon + e.max.lon) / 2});
+
+	// both projections are monotonic on each axis, so the corners give the
+	// projected extent before anything is touched
+	point corners[2] = {e.min, e.max};
+	project_points(&p, corners, corners, 2);
+
+	double width = ceil(corners[1].lon - corners[0].lon);
+	double height = ceil(corners[1].lat - corners[0].lat);
+	if (fixed_scale > 0 && fmax(width, height) * fixed_scale > INT32_MAX)
+		return ERR_RANGE;
+
+	map_world(world, &p, (point) {0, 0});
+	map_world(world, NULL, corners[0]);
+
+	world->projection = kind;
+	world->bounds_x = (uint32_t) width;
+	world->bounds_y = (uint32_t) height;
+	world->fixed_scale = fixed_scale;
+	world->origin = corners[0];
+	world->tangent = p.origin;
+	return CRACKING;
+}
+
+void unproject_points(const struct world *world, const point *in, point *out, size_t n) {
+	struct projector p;
+	projector_init(&p, world->projection, world->tangent);
+
+	for (size_t i = 0; i < n; i++) {
+		double y = in[i].lat + world->origin.lat;
+		double x = in[i].lon + world->origin.lon;
+		switch (p.kind) {
+			case PROJECT_MERCATOR:
+				out[i].lat = atan(sinh(y / EARTH_RADIUS)) / DEG_TO_RAD;
+				out[i].lon = x / p.scale_lon;
+				break;
+			case PROJECT_LOCAL:
+				out[i].lat = y / p.scale_lat + p.origin.lat;
+				out[i].lon = x / p.scale_lon + p.origin.lon;
+				break;
+			case PROJECT_NONE:
+			default:
+				out[i] = in[i];
+				break;
+		}
+	}
+}
+
+enum projection projection_from_string(const char *s) {
+	if (strcmp(s, "mercator") == 0)
+		return PROJECT_MERCATOR;
+	if (strcmp(s, "local") == 0)
+		return PROJECT_LOCAL;
+	return PROJECT_NONE;
+}
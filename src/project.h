@@ -0,0 +1,57 @@
+#ifndef OSM_PROJECT
+#define OSM_PROJECT
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osm/parser.h"
+
+struct world;
+
+enum projection {
+	PROJECT_NONE = 0,
+
+	// spherical web mercator (EPSG:3857)
+	PROJECT_MERCATOR,
+
+	// equirectangular about a tangent point, close to true metres near it
+	PROJECT_LOCAL
+};
+
+// a projected point keeps the layout of point, lat holding the northing
+// and lon the easting
+typedef struct {
+	int32_t lat, lon;
+} fixed_point;
+
+struct projector {
+	enum projection kind;
+	point origin; // tangent point of PROJECT_LOCAL
+
+	// metres per degree on each axis
+	double scale_lat, scale_lon;
+};
+
+void projector_init(struct projector *p, enum projection kind, point origin);
+
+// metres from the projection's origin, in and out may be the same array
+void project_points(const struct projector *p, const point *in, point *out, size_t n);
+
+// rounds to the nearest 1/scale of a unit, the caller keeps it in range
+void quantize_points(const point *in, fixed_point *out, size_t n, double scale);
+
+// reprojects every feature in place, shifted so the minimum corner is 0,0,
+// and sets the world bounds in whole metres and the origin and tangent
+// that undo it. a fixed_scale above 0 has
+// the dump write points on a grid of 1/fixed_scale metres instead of
+// doubles, ERR_RANGE if the world is too big for that in an int32
+int project_world(struct world *world, enum projection kind, uint32_t fixed_scale);
+
+// lat/lon degrees of points of a world from project_world, in and out may
+// be the same array. mercator clamped latitudes to +-85.05 on the way in
+void unproject_points(const struct world *world, const point *in, point *out, size_t n);
+
+// "mercator" or "local", PROJECT_NONE for anything else
+enum projection projection_from_string(const char *s);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef OSM_PROTOCOL
+#define OSM_PROTOCOL
+
+#include <stdint.h>
+
+// frames on the daemon socket. both ends are on one machine, so everything
+// is in host byte order. every request gets one reply with its tag, not
+// necessarily in the order they were sent
+
+// no request body is bigger, a longer frame closes the connection
+#define PROTOCOL_MAX_REQUEST (64)
+
+enum query_op {
+	QUERY_INFO = 1,
+	QUERY_BBOX,
+	QUERY_FEATURE,
+	QUERY_NEAREST
+};
+
+enum reply_status {
+	REPLY_OK = 0,
+	REPLY_NOT_FOUND,
+	REPLY_BAD_REQUEST,
+	REPLY_ERROR
+};
+
+enum feature_kind {
+	FEATURE_ROAD = 0,
+	FEATURE_LAND_USE
+};
+
+struct frame_header {
+	uint32_t length; // of the body that follows
+	uint32_t tag;    // chosen by the client, echoed in the reply
+	uint8_t op;      // query_op in a request, reply_status in a reply
+	uint8_t pad[3];
+};
+
+struct query_bbox {
+	double min_lat, min_lon, max_lat, max_lon;
+	uint32_t limit; // 0 for all
+	uint32_t pad;
+};
+
+struct query_feature {
+	int64_t id;
+};
+
+struct query_nearest {
+	double lat, lon;
+};
+
+struct reply_info {
+	uint64_t generation; // goes up each time the world is swapped
+	uint32_t roads, land_uses;
+	double min_lat, min_lon, max_lat, max_lon;
+};
+
+// a bbox reply is a uint32 count then this for each feature
+struct reply_feature_ref {
+	int64_t id;
+	uint8_t kind;
+	uint8_t type;
+	uint16_t pad;
+	uint32_t points;
+};
+
+// followed by name_len bytes of name and points lat/lon doubles
+struct reply_feature {
+	int64_t id;
+	uint8_t kind;
+	uint8_t type;
+	uint16_t name_len;
+	uint32_t points;
+};
+
+struct reply_nearest {
+	int64_t id;
+	double distance;
+	double lat, lon;
+};
+
+#endif
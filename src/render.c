@@ -0,0 +1,627 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "render.h"
+#include "world.h"
+#include "pool.h"
+#include "alloc.h"
+#include "error.h"
+#include "osm/osm.h"
+
+// the latitude where mercator tiles are square
+#define MAX_TILE_LAT (85.0511287798)
+
+#define DEG_TO_RAD (M_PI / 180.0)
+
+static const uint8_t background[3] = {242, 239, 233};
+
+static const uint8_t land_use_colours[LANDUSE_TYPE_COUNT][3] = {
+	[LANDUSE_UNKNOWN] = {226, 224, 220},
+	[LANDUSE_RESIDENTIAL] = {224, 223, 223},
+	[LANDUSE_COMMERCIAL] = {242, 218, 217},
+	[LANDUSE_AGRICULTURE] = {238, 240, 213},
+	[LANDUSE_INDUSTRIAL] = {235, 219, 232},
+	[LANDUSE_GREEN] = {205, 235, 176},
+	[LANDUSE_WATER] = {170, 211, 223},
+};
+
+static const uint8_t road_colours[ROAD_TYPE_COUNT][3] = {
+	[ROAD_UNKNOWN] = {190, 190, 190},
+	[ROAD_MOTORWAY] = {232, 146, 162},
+	[ROAD_PRIMARY] = {252, 214, 164},
+	[ROAD_SECONDARY] = {247, 250, 191},
+	[ROAD_MINOR] = {255, 255, 255},
+	[ROAD_RESIDENTIAL] = {255, 255, 255},
+	[ROAD_PEDESTRIAN] = {221, 221, 232},
+};
+
+// in pixels at zoom 16 and above
+static const float road_widths[ROAD_TYPE_COUNT] = {
+	[ROAD_UNKNOWN] = 1.5f,
+	[ROAD_MOTORWAY] = 7,
+	[ROAD_PRIMARY] = 6,
+	[ROAD_SECONDARY] = 5,
+	[ROAD_MINOR] = 4,
+	[ROAD_RESIDENTIAL] = 3,
+	[ROAD_PEDESTRIAN] = 1.5f,
+};
+#define MAX_ROAD_WIDTH (7)
+
+// bigger roads are drawn over smaller ones, land uses are layer 0
+static const uint8_t road_layers[ROAD_TYPE_COUNT] = {
+	[ROAD_UNKNOWN] = 1,
+	[ROAD_PEDESTRIAN] = 2,
+	[ROAD_RESIDENTIAL] = 3,
+	[ROAD_MINOR] = 4,
+	[ROAD_SECONDARY] = 5,
+	[ROAD_PRIMARY] = 6,
+	[ROAD_MOTORWAY] = 7,
+};
+
+static const vec_point_t *feature_points(const struct world *world, uint32_t n_roads, uint32_t feature) {
+	return feature < n_roads
+		? &world->roads.data[feature].segments
+		: &world->land_uses.data[feature - n_roads].points;
+}
+
+int renderer_init(struct renderer *r, const struct world *world, int tile_size, int threads) {
+	memset(r, 0, sizeof(*r));
+	if (world->projection != PROJECT_NONE)
+		return ERR_UNSUPPORTED;
+	if (tile_size <= 0)
+		return ERR_RANGE;
+
+	r->world = world;
+	r->tile_size = tile_size;
+
+	int ret = index_build(&r->index, world, threads);
+	if (ret != CRACKING)
+		return ret;
+
+	uint32_t n = r->index.n_features;
+	size_t total = 0;
+	for (uint32_t f = 0; f < n; f++)
+		total += feature_points(world, r->index.n_roads, f)->length;
+
+	r->offsets = alloc_malloc(ALLOC_GEOMETRY, (n + 1) * sizeof(uint32_t));
+	r->merc = alloc_malloc(ALLOC_GEOMETRY, (total ? total : 1) * sizeof(point));
+	if (r->offsets == NULL || r->merc == NULL || total > UINT32_MAX) {
+		renderer_free(r);
+		return ERR_MEM;
+	}
+
+	struct projector proj;
+	projector_init(&proj, PROJECT_MERCATOR, (point) {0, 0});
+
+	uint32_t at = 0;
+	for (uint32_t f = 0; f < n; f++) {
+		const vec_point_t *points = feature_points(world, r->index.n_roads, f);
+		r->offsets[f] = at;
+		project_points(&proj, points->data, r->merc + at, points->length);
+		at += points->length;
+	}
+	r->offsets[n] = at;
+	return CRACKING;
+}
+
+void renderer_free(struct renderer *r) {
+	index_free(&r->index);
+	alloc_free(ALLOC_GEOMETRY, r->merc);
+	alloc_free(ALLOC_GEOMETRY, r->offsets);
+	memset(r, 0, sizeof(*r));
+}
+
+int canvas_init(struct canvas *c, int size) {
+	memset(c, 0, sizeof(*c));
+	c->size = size;
+	c->rgb = alloc_malloc(ALLOC_ENCODER, (size_t) size * size * 3);
+	c->cover = alloc_calloc(ALLOC_OTHER, (size_t) size * size, sizeof(float));
+	if (c->rgb == NULL || c->cover == NULL) {
+		canvas_free(c);
+		return ERR_MEM;
+	}
+	return CRACKING;
+}
+
+void canvas_free(struct canvas *c) {
+	alloc_free(ALLOC_ENCODER, c->rgb);
+	alloc_free(ALLOC_OTHER, c->cover);
+	alloc_free(ALLOC_OTHER, c->xy);
+	alloc_free(ALLOC_OTHER, c->crossings);
+	alloc_free(ALLOC_OTHER, c->features);
+	memset(c, 0, sizeof(*c));
+}
+
+static bool reserve(void **buf, size_t *cap, size_t want, size_t size) {
+	if (want <= *cap)
+		return true;
+
+	size_t grown = *cap ? *cap * 2 : 64;
+	while (grown < want)
+		grown *= 2;
+	void *p = alloc_realloc(ALLOC_OTHER, *buf, grown * size);
+	if (p == NULL)
+		return false;
+	*buf = p;
+	*cap = grown;
+	return true;
+}
+
+double tile_lon(uint32_t x, int zoom) {
+	return x / (double) (1u << zoom) * 360.0 - 180.0;
+}
+
+double tile_lat(uint32_t y, int zoom) {
+	return atan(sinh(M_PI * (1 - 2.0 * y / (1u << zoom)))) / DEG_TO_RAD;
+}
+
+uint32_t lon_tile(double lon, int zoom) {
+	uint32_t n = 1u << zoom;
+	double t = floor((lon + 180.0) / 360.0 * n);
+	return t <= 0 ? 0 : t >= n - 1 ? n - 1 : (uint32_t) t;
+}
+
+uint32_t lat_tile(double lat, int zoom) {
+	uint32_t n = 1u << zoom;
+	lat = fmax(-MAX_TILE_LAT, fmin(MAX_TILE_LAT, lat)) * DEG_TO_RAD;
+	double t = floor((1 - asinh(tan(lat)) / M_PI) / 2 * n);
+	return t <= 0 ? 0 : t >= n - 1 ? n - 1 : (uint32_t) t;
+}
+
+struct collect {
+	struct canvas *c;
+	const struct renderer *r;
+	bool failed;
+};
+
+static bool collect_feature(uint32_t feature, void *arg) {
+	struct collect *col = arg;
+	struct canvas *c = col->c;
+	if (!reserve((void **) &c->features, &c->features_cap, c->features_len + 1, sizeof(uint64_t))) {
+		col->failed = true;
+		return false;
+	}
+
+	uint64_t layer = 0;
+	if (feature < col->r->index.n_roads) {
+		enum road_type type = col->r->world->roads.data[feature].type;
+		layer = type < ROAD_TYPE_COUNT ? road_layers[type] : 1;
+	}
+	c->features[c->features_len++] = layer << 32 | feature;
+	return true;
+}
+
+static int compare_keys(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+// even-odd scanline fill sampled at pixel centres, the ring is closed
+// implicitly
+static bool fill_polygon(struct canvas *c, size_t n, const uint8_t colour[3]) {
+	if (n < 3)
+		return true;
+	if (!reserve((void **) &c->crossings, &c->crossings_cap, n, sizeof(double)))
+		return false;
+
+	const double *xy = c->xy;
+	double ymin = INFINITY, ymax = -INFINITY;
+	for (size_t i = 0; i < n; i++) {
+		ymin = fmin(ymin, xy[i * 2 + 1]);
+		ymax = fmax(ymax, xy[i * 2 + 1]);
+	}
+
+	int row0 = (int) fmax(0, ceil(ymin - 0.5));
+	int row1 = (int) fmin(c->size - 1, floor(ymax - 0.5));
+	for (int row = row0; row <= row1; row++) {
+		double sy = row + 0.5;
+		size_t found = 0;
+		for (size_t i = 0, j = n - 1; i < n; j = i++) {
+			double x0 = xy[j * 2], y0 = xy[j * 2 + 1];
+			double x1 = xy[i * 2], y1 = xy[i * 2 + 1];
+			if ((y0 <= sy) == (y1 <= sy))
+				continue;
+
+			double x = x0 + (sy - y0) * (x1 - x0) / (y1 - y0);
+			// insertion sort, a row rarely crosses more than a few edges
+			size_t k = found++;
+			while (k > 0 && c->crossings[k - 1] > x) {
+				c->crossings[k] = c->crossings[k - 1];
+				k--;
+			}
+			c->crossings[k] = x;
+		}
+
+		uint8_t *line = c->rgb + (size_t) row * c->size * 3;
+		for (size_t k = 0; k + 1 < found; k += 2) {
+			int from = (int) fmax(0, ceil(c->crossings[k] - 0.5));
+			int to = (int) fmin(c->size, ceil(c->crossings[k + 1] - 0.5));
+			for (int px = from; px < to; px++)
+				memcpy(line + px * 3, colour, 3);
+		}
+	}
+	return true;
+}
+
+// coverage of each pixel by a line of the given width, taken as how far
+// its centre is inside the line's edge. the pixels of one road keep their
+// highest coverage so joints aren't blended twice
+static void stroke_line(struct canvas *c, size_t n, float width, const uint8_t colour[3]) {
+	const double *xy = c->xy;
+	double hw = width / 2.0;
+	int size = c->size;
+	int dx0 = size, dy0 = size, dx1 = -1, dy1 = -1;
+
+	for (size_t i = 0; i + 1 < n; i++) {
+		double ax = xy[i * 2], ay = xy[i * 2 + 1];
+		double bx = xy[i * 2 + 2], by = xy[i * 2 + 3];
+		double reach = hw + 1;
+
+		int x0 = (int) fmax(0, floor(fmin(ax, bx) - reach));
+		int x1 = (int) fmin(size - 1, ceil(fmax(ax, bx) + reach));
+		int y0 = (int) fmax(0, floor(fmin(ay, by) - reach));
+		int y1 = (int) fmin(size - 1, ceil(fmax(ay, by) + reach));
+		if (x0 > x1 || y0 > y1)
+			continue;
+
+		double ex = bx - ax, ey = by - ay;
+		double len2 = ex * ex + ey * ey;
+		for (int py = y0; py <= y1; py++) {
+			// the closest point of the segment to a covered pixel is within
+			// reach of its row, which bounds the columns worth visiting
+			double cy = py + 0.5, from = 0, to = 1;
+			if (ey != 0) {
+				double t0 = (cy - reach - ay) / ey, t1 = (cy + reach - ay) / ey;
+				from = fmax(0, fmin(t0, t1));
+				to = fmin(1, fmax(t0, t1));
+				if (from > to)
+					continue;
+			} else if (fabs(cy - ay) > reach) {
+				continue;
+			}
+
+			int row0 = (int) fmax(x0, floor(fmin(ax + from * ex, ax + to * ex) - reach));
+			int row1 = (int) fmin(x1, ceil(fmax(ax + from * ex, ax + to * ex) + reach));
+			for (int px = row0; px <= row1; px++) {
+				double qx = px + 0.5 - ax, qy = py + 0.5 - ay;
+				double t = len2 > 0 ? (qx * ex + qy * ey) / len2 : 0;
+				t = t < 0 ? 0 : t > 1 ? 1 : t;
+				double d = hypot(qx - t * ex, qy - t * ey);
+				float cov = (float) (hw + 0.5 - d);
+				if (cov <= 0)
+					continue;
+
+				float *cell = &c->cover[py * size + px];
+				if (cov > *cell)
+					*cell = cov > 1 ? 1 : cov;
+			}
+		}
+
+		dx0 = x0 < dx0 ? x0 : dx0;
+		dy0 = y0 < dy0 ? y0 : dy0;
+		dx1 = x1 > dx1 ? x1 : dx1;
+		dy1 = y1 > dy1 ? y1 : dy1;
+	}
+
+	for (int py = dy0; py <= dy1; py++) {
+		for (int px = dx0; px <= dx1; px++) {
+			float *cell = &c->cover[py * size + px];
+			if (*cell <= 0)
+				continue;
+
+			uint8_t *p = c->rgb + ((size_t) py * size + px) * 3;
+			for (int ch = 0; ch < 3; ch++)
+				p[ch] = (uint8_t) lrintf(p[ch] + (colour[ch] - p[ch]) * *cell);
+			*cell = 0;
+		}
+	}
+}
+
+int render_tile(const struct renderer *r, struct canvas *c, int zoom, uint32_t x, uint32_t y) {
+	if (zoom < 0 || zoom > RENDER_MAX_ZOOM || x >= 1u << zoom || y >= 1u << zoom || c->size != r->tile_size)
+		return ERR_RANGE;
+
+	for (size_t i = 0; i < (size_t) c->size * c->size; i++)
+		memcpy(c->rgb + i * 3, background, 3);
+
+	// thinner roads when zoomed out, never under a pixel
+	float road_scale = (float) fmin(1, pow(2, (zoom - 16) / 2.0));
+
+	// features whose bbox comes within a road's width of the tile. a pixel
+	// is less tall in latitude than wide in longitude, so the longitude
+	// margin covers both
+	uint32_t n = 1u << zoom;
+	double margin = (MAX_ROAD_WIDTH / 2.0 + 1) * 360.0 / ((double) n * c->size);
+	struct bbox box = {
+		{tile_lat(y + 1, zoom) - margin, tile_lon(x, zoom) - margin},
+		{tile_lat(y, zoom) + margin, tile_lon(x + 1, zoom) + margin}
+	};
+
+	struct collect col = {.c = c, .r = r};
+	c->features_len = 0;
+	index_query_bbox(&r->index, box, collect_feature, &col);
+	if (col.failed)
+		return ERR_MEM;
+	qsort(c->features, c->features_len, sizeof(uint64_t), compare_keys);
+
+	// mercator metres to tile pixels
+	struct projector proj;
+	projector_init(&proj, PROJECT_MERCATOR, (point) {0, 0});
+	double half = 180.0 * proj.scale_lon;
+	double per_pixel = 2 * half / ((double) n * c->size);
+	double left = -half + (double) x * c->size * per_pixel;
+	double top = half - (double) y * c->size * per_pixel;
+
+	for (size_t i = 0; i < c->features_len; i++) {
+		uint32_t f = (uint32_t) c->features[i];
+		const point *merc = r->merc + r->offsets[f];
+		size_t count = r->offsets[f + 1] - r->offsets[f];
+		if (!reserve((void **) &c->xy, &c->xy_cap, count * 2, sizeof(double)))
+			return ERR_MEM;
+
+		for (size_t k = 0; k < count; k++) {
+			c->xy[k * 2] = (merc[k].lon - left) / per_pixel;
+			c->xy[k * 2 + 1] = (top - merc[k].lat) / per_pixel;
+		}
+
+		if (f < r->index.n_roads) {
+			enum road_type type = r->world->roads.data[f].type;
+			if (type >= ROAD_TYPE_COUNT)
+				type = ROAD_UNKNOWN;
+			stroke_line(c, count, fmaxf(1, road_widths[type] * road_scale), road_colours[type]);
+		} else {
+			enum land_use_type type = r->world->land_uses.data[f - r->index.n_roads].type;
+			if (type >= LANDUSE_TYPE_COUNT)
+				type = LANDUSE_UNKNOWN;
+			if (!fill_polygon(c, count, land_use_colours[type]))
+				return ERR_MEM;
+		}
+	}
+	return CRACKING;
+}
+
+bool render_world_range(const struct renderer *r, int zoom, struct tile_range *out) {
+	const struct bbox *e = &r->index.extent;
+	if (r->index.n_features == 0 || e->min.lat > e->max.lat)
+		return false;
+
+	out->zoom = zoom;
+	out->x0 = lon_tile(e->min.lon, zoom);
+	out->x1 = lon_tile(e->max.lon, zoom);
+	out->y0 = lat_tile(e->max.lat, zoom);
+	out->y1 = lat_tile(e->min.lat, zoom);
+	return true;
+}
+
+bool tile_range_from_string(const char *s, struct tile_range *out) {
+	int zoom, used = 0;
+	unsigned x0, x1, y0, y1;
+
+	if (sscanf(s, "%d/%u-%u/%u-%u%n", &zoom, &x0, &x1, &y0, &y1, &used) == 5 && s[used] == '\0') {
+		// taken as is
+	} else if (sscanf(s, "%d/%u/%u%n", &zoom, &x0, &y0, &used) == 3 && s[used] == '\0') {
+		x1 = x0;
+		y1 = y0;
+	} else if (sscanf(s, "%d%n", &zoom, &used) == 1 && s[used] == '\0') {
+		if (zoom < 0 || zoom > RENDER_MAX_ZOOM)
+			return false;
+		*out = (struct tile_range) {zoom, 1, 0, 1, 0};
+		return true;
+	} else {
+		return false;
+	}
+
+	if (zoom < 0 || zoom > RENDER_MAX_ZOOM)
+		return false;
+	uint32_t n = 1u << zoom;
+	if (x0 > x1 || y0 > y1 || x1 >= n || y1 >= n)
+		return false;
+
+	*out = (struct tile_range) {zoom, x0, x1, y0, y1};
+	return true;
+}
+
+// each worker starts on its own run of tiles, column by column for
+// locality, and takes half of the fullest other run when it runs dry
+struct tile_queue {
+	pthread_mutex_t lock;
+	uint64_t next, end;
+};
+
+struct render_run {
+	const struct renderer *r;
+	struct tile_range range;
+	const char *dir;
+	enum image_format format;
+
+	struct tile_queue *queues;
+	int n_queues;
+	atomic_int error;
+};
+
+struct render_worker {
+	struct render_run *run;
+	int self;
+};
+
+static bool pop_tile(struct tile_queue *q, uint64_t *tile) {
+	pthread_mutex_lock(&q->lock);
+	bool found = q->next < q->end;
+	if (found)
+		*tile = q->next++;
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+static uint64_t queue_left(struct tile_queue *q) {
+	pthread_mutex_lock(&q->lock);
+	uint64_t left = q->end - q->next;
+	pthread_mutex_unlock(&q->lock);
+	return left;
+}
+
+static bool steal_tiles(struct render_run *run, int self, uint64_t *tile) {
+	for (;;) {
+		int victim = -1;
+		uint64_t most = 0;
+		for (int i = 0; i < run->n_queues; i++) {
+			uint64_t left = i == self ? 0 : queue_left(&run->queues[i]);
+			if (left > most) {
+				most = left;
+				victim = i;
+			}
+		}
+
+		// runs only ever shrink, so nothing left anywhere means done
+		if (victim < 0)
+			return false;
+
+		struct tile_queue *q = &run->queues[victim];
+		pthread_mutex_lock(&q->lock);
+		uint64_t left = q->end - q->next;
+		uint64_t end = q->end;
+		q->end -= (left + 1) / 2;
+		uint64_t start = q->end;
+		pthread_mutex_unlock(&q->lock);
+
+		if (left == 0)
+			continue;
+
+		struct tile_queue *own = &run->queues[self];
+		pthread_mutex_lock(&own->lock);
+		own->next = start + 1;
+		own->end = end;
+		pthread_mutex_unlock(&own->lock);
+		*tile = start;
+		return true;
+	}
+}
+
+static int write_tile(struct render_run *run, struct canvas *c, uint64_t tile) {
+	uint32_t height = run->range.y1 - run->range.y0 + 1;
+	uint32_t x = run->range.x0 + (uint32_t) (tile / height);
+	uint32_t y = run->range.y0 + (uint32_t) (tile % height);
+
+	int ret = render_tile(run->r, c, run->range.zoom, x, y);
+	if (ret != CRACKING)
+		return ret;
+
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/%d/%u/%u.%s", run->dir, run->range.zoom, x, y,
+				image_extension(run->format)) >= (int) sizeof(path))
+		return ERR_IO;
+	return write_image(path, run->format, c->rgb, c->size, c->size);
+}
+
+static void render_worker(void *arg) {
+	struct render_worker *w = arg;
+	struct render_run *run = w->run;
+
+	struct canvas c;
+	int ret = canvas_init(&c, run->r->tile_size);
+
+	uint64_t tile;
+	while (ret == CRACKING && atomic_load(&run->error) == CRACKING
+			&& (pop_tile(&run->queues[w->self], &tile) || steal_tiles(run, w->self, &tile)))
+		ret = write_tile(run, &c, tile);
+
+	if (ret != CRACKING) {
+		int expected = CRACKING;
+		atomic_compare_exchange_strong(&run->error, &expected, ret);
+	}
+	canvas_free(&c);
+}
+
+static int make_dir(const char *path) {
+	return mkdir(path, 0755) == 0 || errno == EEXIST ? CRACKING : ERR_IO;
+}
+
+// dir/z/x for every column up front, so workers only write files
+static int make_tile_dirs(const char *dir, const struct tile_range *range) {
+	char path[PATH_MAX];
+	int ret = make_dir(dir);
+	snprintf(path, sizeof(path), "%s/%d", dir, range->zoom);
+	if (ret == CRACKING)
+		ret = make_dir(path);
+
+	for (uint32_t x = range->x0; ret == CRACKING && x <= range->x1; x++) {
+		if (snprintf(path, sizeof(path), "%s/%d/%u", dir, range->zoom, x) >= (int) sizeof(path))
+			return ERR_IO;
+		ret = make_dir(path);
+	}
+	return ret;
+}
+
+static int render_range(const struct renderer *r, const struct tile_range *range, const char *dir,
+		enum image_format format, int threads) {
+	int ret = make_tile_dirs(dir, range);
+	if (ret != CRACKING)
+		return ret;
+
+	struct pool pool;
+	if ((ret = pool_init(&pool, threads)) != CRACKING)
+		return ret;
+
+	struct render_run run = {
+		.r = r,
+		.range = *range,
+		.dir = dir,
+		.format = format,
+		.n_queues = pool.n_threads
+	};
+	atomic_init(&run.error, CRACKING);
+
+	run.queues = alloc_calloc(ALLOC_OTHER, run.n_queues, sizeof(struct tile_queue));
+	struct render_worker *workers = alloc_calloc(ALLOC_OTHER, run.n_queues, sizeof(struct render_worker));
+	if (run.queues == NULL || workers == NULL) {
+		pool_free(&pool);
+		alloc_free(ALLOC_OTHER, run.queues);
+		alloc_free(ALLOC_OTHER, workers);
+		return ERR_MEM;
+	}
+
+	uint64_t total = (uint64_t) (range->x1 - range->x0 + 1) * (range->y1 - range->y0 + 1);
+	for (int i = 0; i < run.n_queues; i++) {
+		pthread_mutex_init(&run.queues[i].lock, NULL);
+		run.queues[i].next = total * i / run.n_queues;
+		run.queues[i].end = total * (i + 1) / run.n_queues;
+	}
+
+	for (int i = 0; i < run.n_queues; i++) {
+		workers[i] = (struct render_worker) {&run, i};
+		if (pool_submit(&pool, render_worker, &workers[i]) != CRACKING)
+			render_worker(&workers[i]);
+	}
+	pool_free(&pool);
+
+	for (int i = 0; i < run.n_queues; i++)
+		pthread_mutex_destroy(&run.queues[i].lock);
+	alloc_free(ALLOC_OTHER, run.queues);
+	alloc_free(ALLOC_OTHER, workers);
+	return atomic_load(&run.error);
+}
+
+int render_tiles(const struct world *world, const struct tile_range *range, const char *dir,
+		enum image_format format, int threads) {
+	struct renderer r;
+	int ret = renderer_init(&r, world, RENDER_TILE_SIZE, threads);
+	if (ret != CRACKING)
+		return ret;
+
+	struct tile_range tiles = *range;
+	if (tiles.x1 < tiles.x0 && !render_world_range(&r, tiles.zoom, &tiles)) {
+		renderer_free(&r);
+		return CRACKING;
+	}
+
+	ret = render_range(&r, &tiles, dir, format, threads);
+	renderer_free(&r);
+	return ret;
+}
@@ -0,0 +1,83 @@
+#ifndef OSM_RENDER
+#define OSM_RENDER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "index.h"
+#include "image.h"
+
+struct world;
+
+#define RENDER_TILE_SIZE (256)
+#define RENDER_MAX_ZOOM (24)
+
+// web mercator (slippy map) tiles, x grows east and y south
+struct tile_range {
+	int zoom;
+	uint32_t x0, x1, y0, y1; // inclusive
+};
+
+// everything tiles share, read only once built so any number of threads
+// can render from it
+struct renderer {
+	const struct world *world;
+	struct spatial_index index;
+
+	// every feature's points in mercator metres, numbered as in the index
+	point *merc;
+	uint32_t *offsets; // n_features + 1, into merc
+
+	int tile_size;
+};
+
+// per thread scratch, rgb holds the last tile rendered
+struct canvas {
+	int size;
+	uint8_t *rgb;
+	float *cover; // coverage of the road being drawn
+
+	// grown as features need them
+	double *xy; // a feature's points in tile pixels, x then y
+	double *crossings;
+	size_t xy_cap, crossings_cap;
+	uint64_t *features; // draw layer then feature number
+	size_t features_len, features_cap;
+};
+
+// the world must be unprojected, lat/lon, and outlive the renderer
+int renderer_init(struct renderer *r, const struct world *world, int tile_size, int threads);
+
+void renderer_free(struct renderer *r);
+
+int canvas_init(struct canvas *c, int size);
+
+void canvas_free(struct canvas *c);
+
+// draws land uses then roads into c->rgb, only the features near the tile
+int render_tile(const struct renderer *r, struct canvas *c, int zoom, uint32_t x, uint32_t y);
+
+// the tiles at zoom covering the world, false if it is empty
+bool render_world_range(const struct renderer *r, int zoom, struct tile_range *out);
+
+// west and north edges of a tile column or row, in degrees
+double tile_lon(uint32_t x, int zoom);
+
+double tile_lat(uint32_t y, int zoom);
+
+// the column or row holding a point, clamped to the map
+uint32_t lon_tile(double lon, int zoom);
+
+uint32_t lat_tile(double lat, int zoom);
+
+// "Z", "Z/X/Y" or "Z/X0-X1/Y0-Y1", a bare zoom has x1 < x0 to mean the
+// whole world
+bool tile_range_from_string(const char *s, struct tile_range *out);
+
+// writes dir/z/x/y.ext for every tile in range, in parallel. threads <= 0
+// uses one a cpu
+int render_tiles(const struct world *world, const struct tile_range *range, const char *dir,
+		enum image_format format, int threads);
+
+#endif
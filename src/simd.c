@@ -0,0 +1,17 @@
+#include "simd.h"
+
+static bool enabled = true;
+
+bool simd_avx2(void) {
+#ifdef HAVE_AVX2
+	return enabled && __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+bool simd_set(bool enable) {
+	bool was = simd_avx2();
+	enabled = enable;
+	return was;
+}
@@ -0,0 +1,19 @@
+#ifndef OSM_SIMD
+#define OSM_SIMD
+
+#include <stdbool.h>
+
+#if !defined(NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+// whether a kernel with an avx2 version should take it: built in, on this
+// cpu and not turned off by simd_set
+bool simd_avx2(void);
+
+// one switch for the projection and geodesic kernels alike, returning the
+// previous setting. never on without cpu support. for tests and benchmarks
+bool simd_set(bool enable);
+
+#endif
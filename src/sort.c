@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sort.h"
+#include "pool.h"
+#include "alloc.h"
+#include "error.h"
+
+// items before a pass is split across the threads
+#define PARALLEL_MIN (1 << 16)
+
+struct sort_chunk {
+	const struct sort_item *src;
+	struct sort_item *dst;
+	size_t from, to;
+	int shift;
+
+	// digit counts, then where each digit of this chunk starts in dst
+	size_t counts[256];
+};
+
+static void count_chunk(void *arg) {
+	struct sort_chunk *c = arg;
+	memset(c->counts, 0, sizeof(c->counts));
+	for (size_t i = c->from; i < c->to; i++)
+		c->counts[(c->src[i].key >> c->shift) & 0xff]++;
+}
+
+static void scatter_chunk(void *arg) {
+	struct sort_chunk *c = arg;
+	for (size_t i = c->from; i < c->to; i++)
+		c->dst[c->counts[(c->src[i].key >> c->shift) & 0xff]++] = c->src[i];
+}
+
+static void run_all(struct pool *pool, pool_job *fn, struct sort_chunk *chunks, int n) {
+	if (pool == NULL) {
+		for (int i = 0; i < n; i++)
+			fn(&chunks[i]);
+		return;
+	}
+
+	for (int i = 0; i < n; i++)
+		if (pool_submit(pool, fn, &chunks[i]) != CRACKING)
+			fn(&chunks[i]);
+	pool_wait(pool);
+}
+
+int radix_sort_items(struct sort_item *items, size_t n, int key_bits, int threads) {
+	if (n < 2)
+		return CRACKING;
+
+	if (threads <= 0)
+		threads = pool_default_threads();
+	if (n < PARALLEL_MIN)
+		threads = 1;
+
+	struct sort_item *tmp = alloc_malloc(ALLOC_OTHER, n * sizeof(struct sort_item));
+	struct sort_chunk *chunks = alloc_calloc(ALLOC_OTHER, threads, sizeof(struct sort_chunk));
+	if (tmp == NULL || chunks == NULL) {
+		alloc_free(ALLOC_OTHER, tmp);
+		alloc_free(ALLOC_OTHER, chunks);
+		return ERR_MEM;
+	}
+
+	struct pool pool;
+	struct pool *workers = NULL;
+	if (threads > 1 && pool_init(&pool, threads) == CRACKING)
+		workers = &pool;
+
+	struct sort_item *src = items;
+	struct sort_item *dst = tmp;
+	for (int shift = 0; shift < key_bits; shift += 8) {
+		for (int t = 0; t < threads; t++) {
+			chunks[t].src = src;
+			chunks[t].dst = dst;
+			chunks[t].from = n * t / threads;
+			chunks[t].to = n * (t + 1) / threads;
+			chunks[t].shift = shift;
+		}
+		run_all(workers, count_chunk, chunks, threads);
+
+		// every key has the same digit, nothing would move
+		size_t first = (src[0].key >> shift) & 0xff;
+		size_t same = 0;
+		for (int t = 0; t < threads; t++)
+			same += chunks[t].counts[first];
+		if (same == n)
+			continue;
+
+		// digit major, then chunk order, keeps it stable
+		size_t sum = 0;
+		for (int d = 0; d < 256; d++) {
+			for (int t = 0; t < threads; t++) {
+				size_t count = chunks[t].counts[d];
+				chunks[t].counts[d] = sum;
+				sum += count;
+			}
+		}
+		run_all(workers, scatter_chunk, chunks, threads);
+
+		struct sort_item *swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != items)
+		memcpy(items, src, n * sizeof(struct sort_item));
+
+	if (workers != NULL)
+		pool_free(workers);
+	alloc_free(ALLOC_OTHER, chunks);
+	alloc_free(ALLOC_OTHER, tmp);
+	return CRACKING;
+}
@@ -0,0 +1,17 @@
+#ifndef OSM_SORT
+#define OSM_SORT
+
+#include <stddef.h>
+#include <stdint.h>
+
+// something to be permuted by a key, the index says where it came from
+struct sort_item {
+	uint64_t key;
+	uint32_t index;
+};
+
+// stable lsd radix sort on the low key_bits of each key, split over
+// threads workers (<= 0 for one per cpu). small inputs stay on the caller
+int radix_sort_items(struct sort_item *items, size_t n, int key_bits, int threads);
+
+#endif
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stitch.h"
+#include "world.h"
+#include "osm/osm.h"
+#include "alloc.h"
+#include "error.h"
+
+// one end of a road, END_FIRST is segments[0]
+enum end {
+	END_FIRST = 0,
+	END_LAST = 1
+};
+
+struct endpoint {
+	id node;
+	int road; // -1 for an empty slot
+	enum end end;
+};
+
+// open addressed on the node id, a node has a slot per road end touching it
+struct endpoint_table {
+	struct endpoint *slots;
+	size_t mask;
+};
+
+// one road of a chain, flipped if its segments run backwards
+struct link {
+	int road;
+	bool reversed;
+};
+typedef vec_t(struct link) vec_link_t;
+
+static size_t hash_node(id node) {
+	return (size_t) (((uint64_t) node * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static id end_node(const struct road *r, enum end end) {
+	return end == END_FIRST ? r->first_node : r->last_node;
+}
+
+static bool same_street(const struct road *a, const struct road *b) {
+	if (a->type != b->type)
+		return false;
+	if (a->name == NULL || b->name == NULL)
+		return a->name == b->name;
+	return strcmp(a->name, b->name) == 0;
+}
+
+static int build_table(struct endpoint_table *t, const struct world *world) {
+	size_t cap = 16;
+	while (cap < (size_t) world->roads.length * 4)
+		cap *= 2;
+
+	t->slots = alloc_malloc(ALLOC_OTHER, cap * sizeof(struct endpoint));
+	if (t->slots == NULL)
+		return ERR_MEM;
+	t->mask = cap - 1;
+	for (size_t i = 0; i < cap; i++)
+		t->slots[i].road = -1;
+
+	for (int i = 0; i < world->roads.length; i++) {
+		const struct road *r = &world->roads.data[i];
+		if (r->segments.length < 2)
+			continue;
+
+		for (int end = END_FIRST; end <= END_LAST; end++) {
+			id node = end_node(r, end);
+			size_t slot = hash_node(node) & t->mask;
+			while (t->slots[slot].road >= 0)
+				slot = (slot + 1) & t->mask;
+			t->slots[slot] = (struct endpoint) {node, i, end};
+		}
+	}
+	return CRACKING;
+}
+
+// the only other end of the same street at node, if there is exactly one
+static bool next_link(const struct endpoint_table *t, const struct world *world,
+		const struct road *street, int road, enum end end, struct endpoint *out) {
+	id node = end_node(&world->roads.data[road], end);
+	int found = 0;
+
+	for (size_t slot = hash_node(node) & t->mask; t->slots[slot].road >= 0; slot = (slot + 1) & t->mask) {
+		const struct endpoint *e = &t->slots[slot];
+		if (e->node != node || (e->road == road && e->end == end))
+			continue;
+		if (!same_street(street, &world->roads.data[e->road]))
+			continue;
+
+		*out = *e;
+		found++;
+	}
+
+	// a way that loops back on itself would otherwise join to itself
+	return found == 1 && out->road != road;
+}
+
+// follows the street from one end of the seed until it forks or runs out
+static int walk(const struct endpoint_table *t, const struct world *world, bool *used,
+		int seed, enum end from, vec_link_t *out) {
+	const struct road *street = &world->roads.data[seed];
+	int road = seed;
+	enum end end = from;
+	struct endpoint next;
+
+	while (next_link(t, world, street, road, end, &next) && !used[next.road]) {
+		// flipped relative to the walk if it is entered from its last end
+		struct link link = {next.road, next.end == END_LAST};
+		alloc_set_vec_tag(ALLOC_OTHER);
+		if (vec_push(out, link) != 0)
+			return ERR_MEM;
+
+		used[next.road] = true;
+		road = next.road;
+		end = next.end == END_FIRST ? END_LAST : END_FIRST;
+	}
+	return CRACKING;
+}
+
+static void append_points(vec_point_t *to, const vec_point_t *from, bool reversed, bool skip_first) {
+	for (int i = skip_first ? 1 : 0; i < from->length; i++)
+		to->data[to->length++] = from->data[reversed ? from->length - 1 - i : i];
+}
+
+// a road stitched by an earlier call brings all of its ways along
+static void append_ids(vec_id_t *to, const struct road *r, bool reversed) {
+	if (r->way_ids.length == 0) {
+		to->data[to->length++] = r->id;
+		return;
+	}
+
+	for (int i = 0; i < r->way_ids.length; i++)
+		to->data[to->length++] = r->way_ids.data[reversed ? r->way_ids.length - 1 - i : i];
+}
+
+// replaces the seed's geometry with the whole chain, freeing the rest
+static int join_chain(struct world *world, const vec_link_t *chain, int seed) {
+	struct road *roads = world->roads.data;
+	int total = 0, n_ids = 0;
+	for (int i = 0; i < chain->length; i++) {
+		const struct road *r = &roads[chain->data[i].road];
+		total += r->segments.length;
+		n_ids += r->way_ids.length > 0 ? r->way_ids.length : 1;
+	}
+
+	vec_point_t points;
+	vec_id_t ids;
+	vec_init(&points);
+	vec_init(&ids);
+
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	if (vec_reserve(&points, total) != 0)
+		return ERR_MEM;
+	alloc_set_vec_tag(ALLOC_WAYS);
+	if (vec_reserve(&ids, n_ids) != 0) {
+		alloc_vec_deinit(ALLOC_GEOMETRY, &points);
+		return ERR_MEM;
+	}
+
+	// neighbours share their joining node, so it is only taken once
+	for (int i = 0; i < chain->length; i++) {
+		const struct link *l = &chain->data[i];
+		append_points(&points, &roads[l->road].segments, l->reversed, i > 0);
+		append_ids(&ids, &roads[l->road], l->reversed);
+	}
+
+	const struct link *head = &chain->data[0];
+	const struct link *tail = &chain->data[chain->length - 1];
+	id first = head->reversed ? roads[head->road].last_node : roads[head->road].first_node;
+	id last = tail->reversed ? roads[tail->road].first_node : roads[tail->road].last_node;
+
+	for (int i = 0; i < chain->length; i++) {
+		struct road *r = &roads[chain->data[i].road];
+		alloc_vec_deinit(ALLOC_GEOMETRY, &r->segments);
+		alloc_vec_deinit(ALLOC_WAYS, &r->way_ids);
+		if (r != &roads[seed]) {
+			alloc_free(ALLOC_TAGS, r->name);
+			r->name = NULL;
+		}
+	}
+
+	struct road *r = &roads[seed];
+	r->segments = points;
+	r->way_ids = ids;
+	r->first_node = first;
+	r->last_node = last;
+	return CRACKING;
+}
+
+int stitch_roads(struct world *world, int *joined) {
+	int n = world->roads.length;
+	if (joined != NULL)
+		*joined = 0;
+	if (n < 2)
+		return CRACKING;
+
+	struct endpoint_table table;
+	int ret = build_table(&table, world);
+	if (ret != CRACKING)
+		return ret;
+
+	bool *used = alloc_calloc(ALLOC_OTHER, n, sizeof(bool));
+	bool *dropped = alloc_calloc(ALLOC_OTHER, n, sizeof(bool));
+	vec_link_t before, after, chain;
+	vec_init(&before);
+	vec_init(&after);
+	vec_init(&chain);
+	if (used == NULL || dropped == NULL)
+		ret = ERR_MEM;
+
+	for (int i = 0; ret == CRACKING && i < n; i++) {
+		if (used[i] || world->roads.data[i].segments.length < 2)
+			continue;
+
+		used[i] = true;
+		before.length = after.length = chain.length = 0;
+		if ((ret = walk(&table, world, used, i, END_FIRST, &before)) != CRACKING)
+			break;
+		if ((ret = walk(&table, world, used, i, END_LAST, &after)) != CRACKING)
+			break;
+		if (before.length == 0 && after.length == 0)
+			continue;
+
+		// what was found off the first end runs backwards into the seed
+		alloc_set_vec_tag(ALLOC_OTHER);
+		if (vec_reserve(&chain, before.length + after.length + 1) != 0) {
+			ret = ERR_MEM;
+			break;
+		}
+		for (int b = before.length - 1; b >= 0; b--) {
+			struct link l = before.data[b];
+			l.reversed = !l.reversed;
+			chain.data[chain.length++] = l;
+		}
+		chain.data[chain.length++] = (struct link) {i, false};
+		for (int a = 0; a < after.length; a++)
+			chain.data[chain.length++] = after.data[a];
+
+		if ((ret = join_chain(world, &chain, i)) != CRACKING)
+			break;
+
+		// every road before i was a seed itself, so i is the lowest index
+		// of the chain and keeps its place
+		for (int c = 0; c < chain.length; c++)
+			if (chain.data[c].road != i)
+				dropped[chain.data[c].road] = true;
+	}
+
+	if (ret == CRACKING) {
+		int kept = 0;
+		for (int i = 0; i < n; i++)
+			if (!dropped[i])
+				world->roads.data[kept++] = world->roads.data[i];
+
+		if (joined != NULL)
+			*joined = n - kept;
+		world->roads.length = kept;
+	}
+
+	alloc_vec_deinit(ALLOC_OTHER, &before);
+	alloc_vec_deinit(ALLOC_OTHER, &after);
+	alloc_vec_deinit(ALLOC_OTHER, &chain);
+	alloc_free(ALLOC_OTHER, used);
+	alloc_free(ALLOC_OTHER, dropped);
+	alloc_free(ALLOC_OTHER, table.slots);
+	return ret;
+}
@@ -0,0 +1,13 @@
+#ifndef OSM_STITCH
+#define OSM_STITCH
+
+struct world;
+
+// joins roads with the same type and name that meet end to end into one
+// polyline, only where exactly two such roads share the node so junctions
+// are left alone. the joined road keeps the id of the first of its ways in
+// parse order and lists them all in way_ids. joined, if given, is the
+// number of roads that were folded into another
+int stitch_roads(struct world *world, int *joined);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef OSM_TIMING
+#define OSM_TIMING
+
+#include <time.h>
+
+// seconds on the monotonic clock, for measuring intervals
+static inline double monotonic_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif
@@ -1,16 +1,32 @@
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 #include "world.h"
 #include "error.h"
 #include "osm/osm.h"
+#include "alloc.h"
+#include "pool.h"
 
 #ifndef NO_PROTOBUF
 #include "pb_encode.h"
 #include "world.pb.h"
 #endif
 
+// parallel encoding, features per chunk by points and chunks in flight
+#define ENCODE_CHUNK_POINTS (1 << 16)
+#define ENCODE_WINDOW_PER_THREAD (4)
+#define ENCODE_IOV (64)
+
 int init_world(struct world *world) {
 	vec_init(&world->roads);
+	vec_init(&world->land_uses);
+	buildings_init(&world->buildings);
+	world->projection = PROJECT_NONE;
+	world->bounds_x = world->bounds_y = 0;
+	world->fixed_scale = 0;
+	world->origin = world->tangent = (point) {0, 0};
 	return CRACKING;
 }
 
@@ -19,21 +35,25 @@ void free_world(struct world *world) {
 	struct road r = {0};
 	vec_foreach(&world->roads, r, i) {
 		if (r.name != NULL)
-			free(r.name);
+			alloc_free(ALLOC_TAGS, r.name);
 		if (r.segments.data != NULL)
-			vec_deinit(&r.segments);
+			alloc_vec_deinit(ALLOC_GEOMETRY, &r.segments);
+		if (r.way_ids.data != NULL)
+			alloc_vec_deinit(ALLOC_WAYS, &r.way_ids);
 	}
 
 	if (world->roads.data != NULL)
-		vec_deinit(&world->roads);
+		alloc_vec_deinit(ALLOC_GEOMETRY, &world->roads);
 
 	struct land_use l = {0};
 	vec_foreach(&world->land_uses, l, i) {
 		if (l.points.data != NULL)
-			vec_deinit(&l.points);
+			alloc_vec_deinit(ALLOC_GEOMETRY, &l.points);
 	}
 	if (world->land_uses.data != NULL)
-		vec_deinit(&world->land_uses);
+		alloc_vec_deinit(ALLOC_GEOMETRY, &world->land_uses);
+
+	buildings_free(&world->buildings);
 }
 
 void debug_print(struct world *world) {
@@ -54,6 +74,9 @@ void debug_print(struct world *world) {
 	vec_foreach(&world->land_uses, l, i) {
 		printf("\t%ld - %d points\n", l.id, l.points.length);
 	}
+
+	// too many to list
+	printf("%d buildings with %u points\n", world->buildings.length, world->buildings.n_points);
 }
 
 #ifndef NO_PROTOBUF
@@ -72,9 +95,41 @@ static bool encode_string(pb_ostream_t *stream, const pb_field_t *field, void *
 	return pb_encode_string(stream, s, strlen(s));
 }
 
+// what encode_points needs of a feature
+struct points_arg {
+	vec_point_t *points;
+	uint32_t fixed_scale;
+};
+
+static bool encode_fixed_points(pb_ostream_t *stream, const pb_field_t *field, struct points_arg *arg) {
+	vec_point_t *vec = arg->points;
+	if (vec->length == 0)
+		return true;
+
+	fixed_point *fixed = alloc_malloc(ALLOC_ENCODER, vec->length * sizeof(fixed_point));
+	if (fixed == NULL)
+		return false;
+	quantize_points(vec->data, fixed, vec->length, arg->fixed_scale);
+
+	bool ok = true;
+	for (int i = 0; ok && i < vec->length; i++) {
+		Point p = Point_init_zero;
+		p.x = fixed[i].lon;
+		p.y = fixed[i].lat;
+
+		ok = pb_encode_tag_for_field(stream, field) && pb_encode_submessage(stream, Point_fields, &p);
+	}
+
+	alloc_free(ALLOC_ENCODER, fixed);
+	return ok;
+}
+
 static bool encode_points(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	struct points_arg *points = (struct points_arg *)*arg;
+	if (points->fixed_scale > 0)
+		return encode_fixed_points(stream, field, points);
 
-	vec_point_t *vec = (vec_point_t *)*arg;
+	vec_point_t *vec = points->points;
 	int i = 0;
 	point point = {0};
 	vec_foreach(vec, point, i) {
@@ -92,6 +147,19 @@ static bool encode_points(pb_ostream_t *stream, const pb_field_t *field, void *
 	return true;
 }
 
+static bool encode_ids(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	vec_id_t *vec = (vec_id_t *)*arg;
+	for (int i = 0; i < vec->length; i++) {
+		if (!pb_encode_tag_for_field(stream, field))
+			return false;
+
+		if (!pb_encode_varint(stream, (uint64_t) vec->data[i]))
+			return false;
+	}
+
+	return true;
+}
+
 static RoadType convert_road_type(enum road_type rt) {
 	switch (rt) {
 		case ROAD_MOTORWAY:
@@ -132,72 +200,348 @@ static LandUseType convert_land_use_type(enum land_use_type lu) {
 	}
 }
 
-static bool encode_roads(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
-	struct world *world = (struct world *)*arg;
+// one record of the repeated World field, the same bytes whether it goes
+// straight to the file or into a chunk buffer
+static bool encode_road(pb_ostream_t *stream, struct world *world, struct road *road) {
+	Road r = Road_init_zero;
+	r.id = road->id;
+	r.type = convert_road_type(road->type);
+	r.name.funcs.encode = encode_string;
+	r.name.arg = road->name;
+	struct points_arg segments = {&road->segments, world->fixed_scale};
+	r.segments.funcs.encode = encode_points;
+	r.segments.arg = &segments;
+	r.way_ids.funcs.encode = encode_ids;
+	r.way_ids.arg = &road->way_ids;
+
+	return pb_encode_tag(stream, PB_WT_STRING, World_roads_tag)
+		&& pb_encode_submessage(stream, Road_fields, &r);
+}
 
-	int i = 0;
-	struct road road = {0};
-	vec_foreach(&world->roads, road, i) {
-		Road r = Road_init_zero;
-		r.id = road.id;
-		r.type = convert_road_type(road.type);
-		r.name.funcs.encode = encode_string;
-		r.name.arg = road.name;
-		r.segments.funcs.encode = encode_points;
-		r.segments.arg = &road.segments;
+static bool encode_land_use(pb_ostream_t *stream, struct world *world, struct land_use *land_use) {
+	LandUse l = LandUse_init_zero;
+	l.id = land_use->id;
+	l.type = convert_land_use_type(land_use->type);
+	struct points_arg points = {&land_use->points, world->fixed_scale};
+	l.points.funcs.encode = encode_points;
+	l.points.arg = &points;
 
-		if (!pb_encode_tag_for_field(stream, field))
+	return pb_encode_tag(stream, PB_WT_STRING, World_land_uses_tag)
+		&& pb_encode_submessage(stream, LandUse_fields, &l);
+}
+
+static BuildingType convert_building_type(enum building_type bt) {
+	switch (bt) {
+		case BUILDING_ACCOMODATION:
+			return BuildingType_B_ACCOMODATION;
+		case BUILDING_COMMERCIAL:
+			return BuildingType_B_COMMERCIAL;
+		case BUILDING_CIVIC:
+			return BuildingType_B_CIVIC;
+		case BUILDING_OTHER:
+			return BuildingType_B_OTHER;
+		case BUILDING_UNKNOWN:
+		default:
+			return BuildingType_B_UNKNOWN;
+	}
+}
+
+// what encode_ring needs of a building
+struct ring_arg {
+	const fixed_point *points;
+	uint32_t n;
+	fixed_point from;
+};
+
+static bool encode_ring_deltas(pb_ostream_t *stream, const struct ring_arg *ring) {
+	fixed_point prev = ring->from;
+	for (uint32_t i = 0; i < ring->n; i++) {
+		fixed_point p = ring->points[i];
+		if (!pb_encode_svarint(stream, (int64_t) p.lat - prev.lat)
+				|| !pb_encode_svarint(stream, (int64_t) p.lon - prev.lon))
 			return false;
+		prev = p;
+	}
+	return true;
+}
+
+// packed, so sized first for the length prefix
+static bool encode_ring(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	const struct ring_arg *ring = (const struct ring_arg *)*arg;
+	if (ring->n == 0)
+		return true;
+
+	pb_ostream_t sizing = PB_OSTREAM_SIZING;
+	if (!encode_ring_deltas(&sizing, ring))
+		return false;
 
-		if (!pb_encode_submessage(stream, Road_fields, &r))
+	return pb_encode_tag(stream, PB_WT_STRING, field->tag)
+		&& pb_encode_varint(stream, sizing.bytes_written)
+		&& encode_ring_deltas(stream, ring);
+}
+
+static bool encode_building(pb_ostream_t *stream, struct world *world, int i) {
+	const struct buildings *b = &world->buildings;
+	Building m = Building_init_zero;
+	m.id = b->ids[i];
+	m.type = convert_building_type((enum building_type) b->types[i]);
+
+	struct ring_arg ring = {b->points + b->offsets[i], building_ring_length(b, i), {0, 0}};
+	if (b->measured) {
+		m.area = b->areas[i];
+		m.centroid_lat = b->centroids[i].lat;
+		m.centroid_lon = b->centroids[i].lon;
+		ring.from = b->centroids[i];
+	}
+	m.ring.funcs.encode = encode_ring;
+	m.ring.arg = &ring;
+
+	return pb_encode_tag(stream, PB_WT_STRING, World_buildings_tag)
+		&& pb_encode_submessage(stream, Building_fields, &m);
+}
+
+// feature i of the repeated World field with this tag
+static bool encode_feature(pb_ostream_t *stream, struct world *world, uint32_t tag, int i) {
+	switch (tag) {
+		case World_roads_tag:
+			return encode_road(stream, world, &world->roads.data[i]);
+		case World_land_uses_tag:
+			return encode_land_use(stream, world, &world->land_uses.data[i]);
+		default:
+			return encode_building(stream, world, i);
+	}
+}
+
+static int feature_count(const struct world *world, uint32_t tag) {
+	switch (tag) {
+		case World_roads_tag:
+			return world->roads.length;
+		case World_land_uses_tag:
+			return world->land_uses.length;
+		default:
+			return world->buildings.length;
+	}
+}
+
+// roughly how much a feature takes to encode
+static size_t feature_points(const struct world *world, uint32_t tag, int i) {
+	switch (tag) {
+		case World_roads_tag:
+			return 1 + world->roads.data[i].segments.length + world->roads.data[i].way_ids.length;
+		case World_land_uses_tag:
+			return 1 + world->land_uses.data[i].points.length;
+		default:
+			return 1 + building_ring_length(&world->buildings, i);
+	}
+}
+
+static bool encode_features(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	struct world *world = (struct world *)*arg;
+
+	int n = feature_count(world, field->tag);
+	for (int i = 0; i < n; i++) {
+		if (!encode_feature(stream, world, field->tag, i))
 			return false;
 	}
 
 	return true;
 }
 
-static bool encode_land_uses(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
-	struct world *world = (struct world *)*arg;
+// a run of consecutive features encoded by a worker into its own buffer
+struct encode_chunk {
+	struct world *world;
+	uint32_t tag;
+	int from, to;
+
+	uint8_t *buf;
+	size_t len, cap;
+	bool ok;
+};
+
+struct parallel_encode {
+	struct world *world;
+	struct pool pool;
+
+	// reused window by window, so only this many buffers are ever alive
+	struct encode_chunk *chunks;
+	size_t n_chunks;
+};
+
+static bool buffer_callback(pb_ostream_t *stream, const uint8_t *buf, size_t count) {
+	struct encode_chunk *c = stream->state;
+	if (c->len + count > c->cap) {
+		size_t cap = c->cap ? c->cap : 4096;
+		while (cap < c->len + count)
+			cap *= 2;
+		uint8_t *grown = alloc_realloc(ALLOC_ENCODER, c->buf, cap);
+		if (grown == NULL)
+			return false;
+		c->buf = grown;
+		c->cap = cap;
+	}
 
-	int i = 0;
-	struct land_use land_use = {0};
-	vec_foreach(&world->land_uses, land_use, i) {
-		LandUse l = LandUse_init_zero;
+	memcpy(c->buf + c->len, buf, count);
+	c->len += count;
+	return true;
+}
+
+static void encode_chunk_job(void *arg) {
+	struct encode_chunk *c = arg;
+	pb_ostream_t os = {0};
+	os.callback = buffer_callback;
+	os.state = c;
+	os.max_size = SIZE_MAX;
 
-		l.id = land_use.id;
-		l.type = convert_land_use_type(land_use.type);
-		l.points.funcs.encode = encode_points;
-		l.points.arg = &land_use.points;
+	c->len = 0;
+	c->ok = true;
+	for (int i = c->from; c->ok && i < c->to; i++)
+		c->ok = encode_feature(&os, c->world, c->tag, i);
+}
 
-		if (!pb_encode_tag_for_field(stream, field))
+// first feature after a chunk starting at from, by point count so a few
+// huge land uses don't end up in one chunk with thousands of roads
+static int chunk_end(const struct world *world, uint32_t tag, int from) {
+	int n = feature_count(world, tag);
+	size_t points = 0;
+	int i = from;
+	while (i < n && points < ENCODE_CHUNK_POINTS)
+		points += feature_points(world, tag, i++);
+	return i;
+}
+
+static bool writev_all(int fd, struct iovec *iov, int n) {
+	while (n > 0) {
+		ssize_t wrote = writev(fd, iov, n);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0)
+			return false;
+
+		for (; n > 0 && (size_t) wrote >= iov->iov_len; iov++, n--)
+			wrote -= iov->iov_len;
+		if (n > 0) {
+			iov->iov_base = (uint8_t *) iov->iov_base + wrote;
+			iov->iov_len -= wrote;
+		}
+	}
+	return true;
+}
+
+// the chunks in order, straight to the file's descriptor past stdio
+static bool write_chunks(pb_ostream_t *stream, struct encode_chunk *chunks, size_t n) {
+	FILE *file = stream->state;
+	if (fflush(file) != 0)
+		return false;
+
+	struct iovec iov[ENCODE_IOV];
+	for (size_t i = 0; i < n;) {
+		int batch = 0;
+		for (; i < n && batch < ENCODE_IOV; i++, batch++) {
+			iov[batch].iov_base = chunks[i].buf;
+			iov[batch].iov_len = chunks[i].len;
+			stream->bytes_written += chunks[i].len;
+		}
+		if (!writev_all(fileno(file), iov, batch))
 			return false;
+	}
+	return true;
+}
 
-		if (!pb_encode_submessage(stream, LandUse_fields, &l))
+// stands in for encode_features, a window of chunks is encoded across
+// the pool then written before the next is started
+static bool encode_features_parallel(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	struct parallel_encode *p = (struct parallel_encode *)*arg;
+	int n = feature_count(p->world, field->tag);
+
+	int next = 0;
+	while (next < n) {
+		size_t used = 0;
+		for (; used < p->n_chunks && next < n; used++) {
+			struct encode_chunk *c = &p->chunks[used];
+			c->world = p->world;
+			c->tag = field->tag;
+			c->from = next;
+			c->to = next = chunk_end(p->world, field->tag, next);
+			if (pool_submit(&p->pool, encode_chunk_job, c) != CRACKING)
+				encode_chunk_job(c);
+		}
+		pool_wait(&p->pool);
+
+		for (size_t i = 0; i < used; i++) {
+			if (!p->chunks[i].ok)
+				return false;
+		}
+		if (!write_chunks(stream, p->chunks, used))
 			return false;
 	}
 
 	return true;
 }
 
-static bool dump_to_file_safe(struct world *world, FILE *file) {
+static bool dump_to_file_safe(struct world *world, FILE *file, int threads) {
+	if (threads <= 0)
+		threads = pool_default_threads();
+
+	struct parallel_encode parallel = {0};
+	parallel.world = world;
+	if (threads > 1) {
+		parallel.n_chunks = (size_t) threads * ENCODE_WINDOW_PER_THREAD;
+		parallel.chunks = alloc_calloc(ALLOC_ENCODER, parallel.n_chunks, sizeof(struct encode_chunk));
+		if (parallel.chunks != NULL && pool_init(&parallel.pool, threads) != CRACKING) {
+			alloc_free(ALLOC_ENCODER, parallel.chunks);
+			parallel.chunks = NULL;
+		}
+	}
 
+	// the serial encoders if there is no pool, the bytes are the same
 	World msg = World_init_zero;
-	msg.roads.funcs.encode = encode_roads;
-	msg.roads.arg = world;
+	if (parallel.chunks != NULL) {
+		msg.roads.funcs.encode = encode_features_parallel;
+		msg.roads.arg = &parallel;
+		msg.land_uses.funcs.encode = encode_features_parallel;
+		msg.land_uses.arg = &parallel;
+		msg.buildings.funcs.encode = encode_features_parallel;
+		msg.buildings.arg = &parallel;
+	} else {
+		msg.roads.funcs.encode = encode_features;
+		msg.roads.arg = world;
+		msg.land_uses.funcs.encode = encode_features;
+		msg.land_uses.arg = world;
+		msg.buildings.funcs.encode = encode_features;
+		msg.buildings.arg = world;
+	}
 
-	msg.land_uses.funcs.encode = encode_land_uses;
-	msg.land_uses.arg = world;
+	msg.bounds_x = world->bounds_x;
+	msg.bounds_y = world->bounds_y;
+	msg.projection = (Projection) world->projection;
+	msg.fixed_scale = world->fixed_scale;
+	msg.origin_x = world->origin.lon;
+	msg.origin_y = world->origin.lat;
+	msg.tangent_lat = world->tangent.lat;
+	msg.tangent_lon = world->tangent.lon;
 
-	pb_ostream_t os;
+	pb_ostream_t os = {0};
 	os.callback = write_callback;
 	os.state = file;
 	os.max_size = SIZE_MAX;
 
-	return pb_encode(&os, World_fields, &msg);
+	bool ok = pb_encode(&os, World_fields, &msg);
+
+	if (parallel.chunks != NULL) {
+		pool_free(&parallel.pool);
+		for (size_t i = 0; i < parallel.n_chunks; i++)
+			alloc_free(ALLOC_ENCODER, parallel.chunks[i].buf);
+		alloc_free(ALLOC_ENCODER, parallel.chunks);
+	}
+	return ok;
 }
 #endif
 
 bool dump_to_file(struct world *world, char *path) {
+	return dump_to_file_threads(world, path, 1);
+}
+
+bool dump_to_file_threads(struct world *world, char *path, int threads) {
 
 #ifndef NO_PROTOBUF
 	FILE *file = fopen(path, "wb");
@@ -206,7 +550,7 @@ bool dump_to_file(struct world *world, char *path) {
 		return false;
 	}
 
-	bool ret = dump_to_file_safe(world, file);
+	bool ret = dump_to_file_safe(world, file, threads);
 	fflush(file);
 	fclose(file);
 
@@ -214,6 +558,7 @@ bool dump_to_file(struct world *world, char *path) {
 #else
 	(void)(world);
 	(void)(path);
+	(void)(threads);
     return false;
 #endif
 }
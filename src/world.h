@@ -2,12 +2,26 @@
 #define OSM_WORLD
 
 #include "osm/parser.h"
+#include "project.h"
+#include "building.h"
 
 typedef vec_t(struct road) vec_road_t;
 typedef vec_t(struct land_use) vec_land_use_t;
 struct world {
 	vec_road_t roads;
 	vec_land_use_t land_uses;
+	struct buildings buildings;
+
+	// set by project_world, points are then metres from the minimum corner
+	// with lat the northing and lon the easting
+	enum projection projection;
+	uint32_t bounds_x, bounds_y;
+	uint32_t fixed_scale;
+
+	// the projected minimum corner the points were shifted from, and the
+	// tangent point of PROJECT_LOCAL, see unproject_points
+	point origin;
+	point tangent;
 };
 
 int init_world(struct world *world);
@@ -18,6 +32,10 @@ void debug_print(struct world *world);
 
 bool dump_to_file(struct world *world, char *path);
 
+// encodes chunks of features on a pool of threads, <= 0 for one a cpu, the
+// file is byte for byte what dump_to_file writes
+bool dump_to_file_threads(struct world *world, char *path, int threads);
+
 
 #endif
 
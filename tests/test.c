@@ -4,6 +4,32 @@
 #include "world.h"
 #include "osm/parser.h"
 #include "osm/osm.h"
+#include "osm/number.h"
+#include "osm/filter.h"
+#include "osm/stats.h"
+#include "alloc.h"
+#include "hilbert.h"
+#include "sort.h"
+#include "stitch.h"
+#include "project.h"
+#include "daemon.h"
+#include "index.h"
+#include "render.h"
+#include "diff.h"
+#include "geodesic.h"
+#include "aggregate.h"
+#include "simd.h"
+
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sys/stat.h>
+#ifndef NO_COMPRESSION
+#include <zlib.h>
+#include <bzlib.h>
+#endif
 
 int create_test_world(struct world *out) {
 	err_stream = fopen("/dev/null", "w");
@@ -32,7 +58,1703 @@ void test_roads() {
 	free_world(&w);
 }
 
+// xorshift, so the corpus is the same every run
+static uint64_t test_rand(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+void test_numbers() {
+	uint64_t rng = 0x9e3779b97f4a7c15ULL;
+	char buf[64];
+
+	for (int i = 0; i < 2000000; i++) {
+		uint64_t r = test_rand(&rng);
+		int places = r % (COORD_DECIMAL + 1);
+		long whole = (r >> 8) % 181;
+		long frac = (r >> 16) % 10000000 / (long) pow(10, COORD_DECIMAL - places);
+		int len = places == 0
+			? sprintf(buf, "%s%ld", r & (1 << 4) ? "-" : "", whole)
+			: sprintf(buf, "%s%ld.%0*ld", r & (1 << 4) ? "-" : "", whole, places, frac);
+
+		double expected = strtod(buf, NULL);
+		double got = parse_coord(buf, len);
+		if (!TEST_CHECK_(memcmp(&expected, &got, sizeof(double)) == 0, "coordinate '%s'", buf))
+			break;
+
+		int32_t fixed;
+		TEST_CHECK(parse_coord_fixed(buf, len, &fixed));
+		TEST_CHECK(fixed == (int32_t) llround(expected * COORD_SCALE));
+
+		int64_t id_expected = (int64_t) (r >> (r % 64));
+		len = sprintf(buf, "%" PRId64, id_expected);
+		int64_t id_got = 0;
+		if (!TEST_CHECK_(parse_int64(buf, len, &id_got) && id_got == id_expected, "id '%s'", buf))
+			break;
+	}
+
+	// more precision than the fast path takes
+	const char *odd[] = {"54.09017461234", "1e-3", "-0.0000000", "-180.0000000", "+12.5"};
+	for (size_t i = 0; i < sizeof(odd) / sizeof(odd[0]); i++) {
+		double expected = strtod(odd[i], NULL);
+		double got = parse_coord(odd[i], strlen(odd[i]));
+		TEST_CHECK(memcmp(&expected, &got, sizeof(double)) == 0);
+	}
+
+	int64_t v;
+	TEST_CHECK(parse_int64("9223372036854775807", 19, &v) && v == INT64_MAX);
+	TEST_CHECK(parse_int64("-9223372036854775808", 20, &v) && v == INT64_MIN);
+	TEST_CHECK(!parse_int64("9223372036854775808", 19, &v));
+	TEST_CHECK(!parse_int64("12345678x", 9, &v));
+	TEST_CHECK(!parse_int64("", 0, &v));
+}
+
+static bool points_equal(vec_point_t *a, vec_point_t *b) {
+	if (a->length != b->length)
+		return false;
+	for (int i = 0; i < a->length; i++)
+		if (a->data[i].lat != b->data[i].lat || a->data[i].lon != b->data[i].lon)
+			return false;
+	return true;
+}
+
+static bool worlds_equal(struct world *a, struct world *b) {
+	if (a->roads.length != b->roads.length || a->land_uses.length != b->land_uses.length)
+		return false;
+
+	for (int i = 0; i < a->roads.length; i++) {
+		struct road *ra = &a->roads.data[i], *rb = &b->roads.data[i];
+		if (ra->id != rb->id || ra->type != rb->type || !points_equal(&ra->segments, &rb->segments))
+			return false;
+		if ((ra->name == NULL) != (rb->name == NULL) || (ra->name != NULL && strcmp(ra->name, rb->name) != 0))
+			return false;
+	}
+
+	for (int i = 0; i < a->land_uses.length; i++) {
+		struct land_use *la = &a->land_uses.data[i], *lb = &b->land_uses.data[i];
+		if (la->id != lb->id || la->type != lb->type || !points_equal(&la->points, &lb->points))
+			return false;
+	}
+
+	struct buildings *ba = &a->buildings, *bb = &b->buildings;
+	if (ba->length != bb->length || ba->n_points != bb->n_points || ba->measured != bb->measured)
+		return false;
+	if (ba->length == 0)
+		return true;
+	if (memcmp(ba->ids, bb->ids, ba->length * sizeof(id)) != 0
+			|| memcmp(ba->types, bb->types, ba->length) != 0
+			|| memcmp(ba->offsets, bb->offsets, (ba->length + 1) * sizeof(uint32_t)) != 0
+			|| memcmp(ba->points, bb->points, ba->n_points * sizeof(fixed_point)) != 0)
+		return false;
+	return !ba->measured || (memcmp(ba->areas, bb->areas, ba->length * sizeof(float)) == 0
+			&& memcmp(ba->centroids, bb->centroids, ba->length * sizeof(fixed_point)) == 0);
+}
+
+// nodes node_from..node_to in shuffled id order then ways way_from..way_to,
+// referencing random nodes of 1..n_nodes with some dangling. every element
+// only depends on its own id, so ranges of one region can be cut into files
+static char *generate_region(uint64_t seed, int n_nodes, int node_from, int node_to, int way_from, int way_to, size_t *len) {
+	int count = node_to - node_from + 1;
+	size_t cap = 256 + (size_t) count * 96 + (size_t) (way_to - way_from + 1) * 24 * 40;
+	char *buf = malloc(cap);
+	size_t off = sprintf(buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n");
+
+	for (int i = 0; i < count; i++) {
+		int nid = node_from + (int) ((i * 7919L) % count);
+		uint64_t rng = seed + nid * 0x9e3779b97f4a7c15ULL;
+		test_rand(&rng);
+		off += sprintf(buf + off, " <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n",
+				nid, (test_rand(&rng) % 1800000000) / 1e7 - 90, (test_rand(&rng) % 3600000000) / 1e7 - 180);
+	}
+
+	for (int w = way_from; w <= way_to; w++) {
+		uint64_t rng = ~seed + w * 0x9e3779b97f4a7c15ULL;
+		off += sprintf(buf + off, " <way id=\"%d\">\n", w);
+		int refs = 2 + test_rand(&rng) % 20;
+		for (int r = 0; r < refs; r++)
+			off += sprintf(buf + off, "  <nd ref=\"%d\"/>\n", (int) (test_rand(&rng) % (n_nodes + n_nodes / 500)) + 1);
+
+		if (w % 3 == 0)
+			off += sprintf(buf + off, "  <tag k=\"landuse\" v=\"forest\"/>\n");
+		else
+			off += sprintf(buf + off, "  <tag k=\"highway\" v=\"primary\"/>\n  <tag k=\"name\" v=\"road %d\"/>\n", w);
+		off += sprintf(buf + off, " </way>\n");
+	}
+
+	off += sprintf(buf + off, "</osm>\n");
+	*len = off;
+	return buf;
+}
+
+static char *generate_random_osm(uint64_t seed, int n_nodes, int n_ways, size_t *len) {
+	return generate_region(seed, n_nodes, 1, n_nodes, 1, n_ways, len);
+}
+
+static void write_file(const char *path, const char *buf, size_t len) {
+	FILE *f = fopen(path, "wb");
+	fwrite(buf, 1, len, f);
+	fclose(f);
+}
+
+void test_deferred_resolution() {
+	size_t len;
+	char *osm = generate_random_osm(42, 20000, 3000, &len);
+	char *copy = malloc(len);
+	memcpy(copy, osm, len);
+
+	struct world immediate, deferred;
+	struct parse_options opts = { .resolution = RESOLVE_DEFERRED };
+	TEST_CHECK(parse_osm_from_buffer(osm, len, &immediate) == CRACKING);
+	TEST_CHECK(parse_osm_from_buffer_opts(copy, len, &opts, &deferred) == CRACKING);
+
+	// some ways must have been dropped for dangling refs, and not all of them
+	TEST_CHECK(immediate.roads.length > 0 && immediate.roads.length < 2000);
+	TEST_CHECK(worlds_equal(&immediate, &deferred));
+
+	free_world(&immediate);
+	free_world(&deferred);
+	free(copy);
+	free(osm);
+}
+
+void test_parser_reuse() {
+	size_t lens[3];
+	char *inputs[3];
+	for (int i = 0; i < 3; i++)
+		inputs[i] = generate_random_osm(20 + i, 4000 + i * 1500, 600, &lens[i]);
+
+	for (int mode = 0; mode < 2; mode++) {
+		struct parse_options opts = { .resolution = mode == 0 ? RESOLVE_IMMEDIATE : RESOLVE_DEFERRED };
+		struct osm_parser *parser;
+		TEST_CHECK(osm_parser_new(&opts, &parser) == CRACKING);
+
+		// every parse matches a fresh one, whatever came before it
+		uint64_t node_allocs[4];
+		for (int round = 0; round < 4; round++) {
+			int i = round % 3;
+			struct alloc_stats before[ALLOC_TAG_COUNT], after[ALLOC_TAG_COUNT];
+			struct world reused, fresh;
+
+			alloc_get_stats(before);
+			TEST_CHECK(osm_parser_parse_buffer(parser, inputs[i], lens[i], &reused) == CRACKING);
+			alloc_get_stats(after);
+			node_allocs[round] = after[ALLOC_NODES].allocs - before[ALLOC_NODES].allocs;
+
+			TEST_CHECK(parse_osm_from_buffer_opts(inputs[i], lens[i], &opts, &fresh) == CRACKING);
+			TEST_CHECK_(worlds_equal(&reused, &fresh), "mode %d round %d", mode, round);
+			TEST_CHECK(reused.roads.length > 0);
+			free_world(&reused);
+			free_world(&fresh);
+		}
+
+		// the same input again finds its node storage already grown
+		TEST_CHECK_(node_allocs[3] < node_allocs[0], "%" PRIu64 " then %" PRIu64, node_allocs[0], node_allocs[3]);
+
+		// giving the memory back leaves it usable
+		struct alloc_stats kept[ALLOC_TAG_COUNT], reset[ALLOC_TAG_COUNT];
+		alloc_get_stats(kept);
+		osm_parser_reset(parser);
+		alloc_get_stats(reset);
+		TEST_CHECK(reset[ALLOC_NODES].live < kept[ALLOC_NODES].live);
+
+		struct world again;
+		TEST_CHECK(osm_parser_parse_buffer(parser, inputs[1], lens[1], &again) == CRACKING);
+		TEST_CHECK(again.roads.length > 0);
+		free_world(&again);
+		osm_parser_free(parser);
+	}
+
+	for (int i = 0; i < 3; i++)
+		free(inputs[i]);
+}
+
+void test_spill() {
+	// a second pass over some of the way ids, drawn differently, so the
+	// way map's first-one-wins has to be kept up while spilling
+	size_t len_a, len_b;
+	char *a = generate_region(11, 30000, 1, 30000, 1, 4000, &len_a);
+	char *b = generate_region(12, 30000, 29000, 30500, 3500, 4500, &len_b);
+	const char *body = strstr(b, "<osm");
+	body = strchr(body, '\n') + 1;
+	size_t head = len_a - strlen("</osm>\n");
+	size_t len = head + (b + len_b - body);
+	char *osm = malloc(len + 1);
+	memcpy(osm, a, head);
+	memcpy(osm + head, body, b + len_b - body);
+
+	// the second half's nodes come after ways using them, so this is the
+	// path to match rather than immediate resolution
+	struct world in_memory;
+	struct parse_options deferred = { .resolution = RESOLVE_DEFERRED };
+	TEST_CHECK(parse_osm_from_buffer_opts(osm, len, &deferred, &in_memory) == CRACKING);
+	TEST_CHECK(in_memory.roads.length > 0);
+
+	// from tiny budgets with hundreds of runs to one that never spills
+	size_t budgets[] = {16 << 10, 256 << 10, 64 << 20};
+	for (int i = 0; i < 3; i++) {
+		struct parse_stats stats = {0};
+		struct parse_options opts = { .max_memory = budgets[i], .stats = &stats };
+		struct world spilled;
+		TEST_CHECK(parse_osm_from_buffer_opts(osm, len, &opts, &spilled) == CRACKING);
+		TEST_CHECK_(worlds_equal(&in_memory, &spilled), "budget %zu", budgets[i]);
+		TEST_CHECK(stats.deferred_nodes == 30000 + 1501);
+		if (i < 2)
+			TEST_CHECK_(stats.spilled_runs > 3 && stats.spilled_bytes > 0, "%" PRIu64 " runs", stats.spilled_runs);
+		else
+			TEST_CHECK(stats.spilled_runs == 0);
+		free_world(&spilled);
+	}
+
+	// reused parsers spill too, and the join needs every file
+	struct parse_options opts = { .max_memory = 32 << 10 };
+	struct osm_parser *parser;
+	struct world reused;
+	TEST_CHECK(osm_parser_new(&opts, &parser) == CRACKING);
+	for (int i = 0; i < 2; i++) {
+		TEST_CHECK(osm_parser_parse_buffer(parser, osm, len, &reused) == CRACKING);
+		TEST_CHECK(worlds_equal(&in_memory, &reused));
+		free_world(&reused);
+	}
+	osm_parser_free(parser);
+
+	const char *paths[] = {"a.osm", "b.osm"};
+	TEST_CHECK(parse_osm_from_files(paths, 2, &opts, &reused) == ERR_UNSUPPORTED);
+	free_world(&reused);
+
+	free_world(&in_memory);
+	free(osm);
+	free(a);
+	free(b);
+}
+
+void test_parse_stats() {
+	size_t len;
+	char *osm = generate_random_osm(3, 20000, 3000, &len);
+
+	struct parse_stats stats[2] = {{0}};
+	struct world world;
+	for (int i = 0; i < 2; i++) {
+		struct parse_options opts = {
+			.resolution = i == 0 ? RESOLVE_IMMEDIATE : RESOLVE_DEFERRED,
+			.stats = &stats[i]
+		};
+		TEST_CHECK(parse_osm_from_buffer_opts(osm, len, &opts, &world) == CRACKING);
+
+		struct parse_stats *s = &stats[i];
+		uint64_t kept = world.roads.length + world.land_uses.length;
+		TEST_CHECK(s->bytes == len);
+		TEST_CHECK(s->elements[TAG_NODE] == 20000 && s->elements[TAG_WAY] == 3000);
+		TEST_CHECK(s->ways[WAY_ROAD] == 2000 && s->ways[WAY_LANDUSE] == 1000);
+		TEST_CHECK(s->roads[ROAD_PRIMARY] == 2000 && s->land_uses[LANDUSE_GREEN] == 1000);
+		TEST_CHECK(s->dropped_features > 0 && s->dropped_features == 3000 - kept);
+		TEST_CHECK(s->unresolved_refs >= s->dropped_features);
+
+		// phases add up to the total
+		struct parse_timings *t = &s->timings;
+		TEST_CHECK(t->total > 0 && t->node_store > 0 && t->way_resolve > 0 && t->tokenize > 0);
+		TEST_CHECK(fabs(t->tokenize + t->node_store + t->way_resolve - t->total) < 1e-6);
+		free_world(&world);
+	}
+
+	TEST_CHECK(stats[0].node_map_size == 20000 && stats[0].way_map_size == 3000);
+	TEST_CHECK(stats[1].deferred_nodes == 20000 && stats[1].node_map_probes == 0);
+	TEST_CHECK(stats[0].unresolved_refs == stats[1].unresolved_refs);
+	TEST_CHECK(stats[0].lines == stats[1].lines);
+
+	// added on top of what's there
+	struct parse_stats sum = stats[0];
+	add_parse_stats(&sum, &stats[1]);
+	TEST_CHECK(sum.elements[TAG_NODE_REF] == 2 * stats[0].elements[TAG_NODE_REF]);
+	free(osm);
+}
+
+// prefixes each block with its size, so anything freed around the backend
+// would be caught
+struct header_backend {
+	uint64_t allocs, frees;
+};
+
+static void *header_realloc(void *ctx, void *ptr, size_t size) {
+	struct header_backend *b = ctx;
+	size_t *block = ptr != NULL ? (size_t *) ptr - 2 : NULL;
+	if (block == NULL)
+		b->allocs++;
+
+	block = realloc(block, size + 2 * sizeof(size_t));
+	if (block == NULL)
+		return NULL;
+	block[0] = size;
+	return block + 2;
+}
+
+static void header_free(void *ctx, void *ptr) {
+	((struct header_backend *) ctx)->frees++;
+	free((size_t *) ptr - 2);
+}
+
+static size_t header_size(void *ctx, void *ptr) {
+	(void) ctx;
+	return ((size_t *) ptr)[-2];
+}
+
+void test_alloc_accounting() {
+	size_t len;
+	char *osm = generate_random_osm(5, 20000, 3000, &len);
+
+	// the default filter is compiled once and kept for the process
+	struct world world;
+	TEST_CHECK(parse_osm_from_buffer(osm, len, &world) == CRACKING);
+	free_world(&world);
+
+	struct header_backend counts = {0};
+	struct allocator backend = {
+		.realloc = header_realloc,
+		.free = header_free,
+		.size = header_size,
+		.ctx = &counts
+	};
+	alloc_set_backend(&backend);
+
+	struct alloc_stats before[ALLOC_TAG_COUNT], parsed[ALLOC_TAG_COUNT], after[ALLOC_TAG_COUNT];
+	alloc_get_stats(before);
+
+	for (int i = 0; i < 2; i++) {
+		struct parse_options opts = { .resolution = i == 0 ? RESOLVE_IMMEDIATE : RESOLVE_DEFERRED };
+		TEST_CHECK(parse_osm_from_buffer_opts(osm, len, &opts, &world) == CRACKING);
+
+		// only the world is still around, and it's the size of its points
+		alloc_get_stats(parsed);
+		int64_t points = 0;
+		for (int r = 0; r < world.roads.length; r++)
+			points += world.roads.data[r].segments.length * (int64_t) sizeof(point);
+		TEST_CHECK(parsed[ALLOC_GEOMETRY].live - before[ALLOC_GEOMETRY].live >= points);
+		TEST_CHECK(parsed[ALLOC_TAGS].live > before[ALLOC_TAGS].live);
+		TEST_CHECK(parsed[ALLOC_NODES].live == before[ALLOC_NODES].live);
+		TEST_CHECK(parsed[ALLOC_NODES].peak > before[ALLOC_NODES].live + 20000 * (int64_t) sizeof(struct node) / 2);
+		TEST_CHECK(parsed[ALLOC_WAYS].allocs > before[ALLOC_WAYS].allocs);
+
+		free_world(&world);
+	}
+
+	// everything given back, and all of it through the backend
+	alloc_get_stats(after);
+	for (int t = 0; t < ALLOC_TAG_COUNT; t++) {
+		TEST_CHECK_(after[t].live == before[t].live, "tag %d leaks %" PRId64 " bytes", t, after[t].live - before[t].live);
+		TEST_CHECK(after[t].allocs - before[t].allocs == after[t].frees - before[t].frees);
+	}
+	TEST_CHECK(counts.allocs > 0 && counts.allocs == counts.frees);
+
+	alloc_set_backend(NULL);
+	free(osm);
+}
+
+// fails every new block once its budget of them is spent
+struct failing_backend {
+	struct header_backend counts;
+	int budget;
+};
+
+static void *failing_realloc(void *ctx, void *ptr, size_t size) {
+	struct failing_backend *b = ctx;
+	if (ptr == NULL && b->budget-- <= 0)
+		return NULL;
+	return header_realloc(&b->counts, ptr, size);
+}
+
+static void failing_free(void *ctx, void *ptr) {
+	header_free(&((struct failing_backend *) ctx)->counts, ptr);
+}
+
+void test_tag_filter_oom() {
+	// running out at every allocation in turn, including while a second
+	// rule for a key grows the first, gives back all it took
+	bool compiled = false;
+	for (int budget = 0; !compiled && budget < 1000; budget++) {
+		struct failing_backend b = { .budget = budget };
+		struct allocator backend = {
+			.realloc = failing_realloc,
+			.free = failing_free,
+			.size = header_size,
+			.ctx = &b
+		};
+		alloc_set_backend(&backend);
+
+		struct tag_filter filter;
+		int ret = tag_filter_compile("highway=primary,lane;landuse;highway=track,path,trail", &filter);
+		TEST_CHECK(ret == CRACKING || ret == ERR_MEM);
+		if ((compiled = ret == CRACKING))
+			tag_filter_free(&filter);
+
+		alloc_set_backend(NULL);
+		TEST_CHECK_(b.counts.allocs == b.counts.frees, "budget %d: %" PRIu64 " of %" PRIu64 " blocks leaked",
+				budget, b.counts.allocs - b.counts.frees, b.counts.allocs);
+	}
+	TEST_CHECK(compiled);
+}
+
+void test_multi_file() {
+	const int n_nodes = 20000, n_ways = 3000;
+	size_t len_all, len_a, len_b;
+	char *all = generate_region(7, n_nodes, 1, n_nodes, 1, n_ways, &len_all);
+
+	// two extracts sharing a band of ways, each with half the nodes
+	char *a = generate_region(7, n_nodes, 1, n_nodes / 2, 1, n_ways * 2 / 3, &len_a);
+	char *b = generate_region(7, n_nodes, n_nodes / 2 + 1, n_nodes, n_ways / 3, n_ways, &len_b);
+
+	char path_a[] = "/tmp/osm_test_XXXXXX";
+	char path_b[] = "/tmp/osm_test_XXXXXX";
+	close(mkstemp(path_a));
+	close(mkstemp(path_b));
+	write_file(path_a, a, len_a);
+	write_file(path_b, b, len_b);
+
+	struct world expected, merged;
+	struct parse_options opts = { .resolution = RESOLVE_DEFERRED, .threads = 2 };
+	TEST_CHECK(parse_osm_from_buffer_opts(all, len_all, &opts, &expected) == CRACKING);
+
+	const char *paths[] = {path_a, path_b};
+	TEST_CHECK(parse_osm_from_files(paths, 2, &opts, &merged) == CRACKING);
+	TEST_CHECK(expected.roads.length > 0);
+	TEST_CHECK(worlds_equal(&expected, &merged));
+
+	free_world(&expected);
+	free_world(&merged);
+	unlink(path_a);
+	unlink(path_b);
+	free(all);
+	free(a);
+	free(b);
+}
+
+static const char filter_osm[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n"
+	" <node id=\"1\" lat=\"51.5\" lon=\"-0.1\"/>\n"
+	" <node id=\"2\" lat=\"51.6\" lon=\"-0.2\">\n  <tag k=\"highway\" v=\"primary\"/>\n </node>\n"
+	" <way id=\"10\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <tag k=\"name\" v=\"High Street\"/>\n  <tag k=\"highway\" v=\"primary\"/>\n </way>\n"
+	" <way id=\"11\">\n  <nd ref=\"2\"/>\n  <nd ref=\"1\"/>\n  <tag k=\"highway\" v=\"footway\"/>\n </way>\n"
+	" <way id=\"12\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <tag k=\"highway\" v=\"racetrack\"/>\n </way>\n"
+	" <way id=\"13\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <tag k=\"landuse\" v=\"forest\"/>\n </way>\n"
+	" <way id=\"14\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <tag k=\"landuse\" v=\"moon\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n </way>\n"
+	" <way id=\"15\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <tag k=\"building\" v=\"house\"/>\n </way>\n"
+	"</osm>\n";
+
+static struct road *find_road(struct world *w, id road_id) {
+	for (int i = 0; i < w->roads.length; i++)
+		if (w->roads.data[i].id == road_id)
+			return &w->roads.data[i];
+	return NULL;
+}
+
+void test_tag_filter() {
+	char buf[sizeof(filter_osm)];
+	struct world world;
+
+	// the default keeps any highway and only known land uses
+	memcpy(buf, filter_osm, sizeof(buf));
+	TEST_CHECK(parse_osm_from_buffer(buf, sizeof(buf) - 1, &world) == CRACKING);
+	TEST_CHECK(world.roads.length == 4);
+	TEST_CHECK(world.land_uses.length == 1 && world.land_uses.data[0].type == LANDUSE_GREEN);
+
+	struct road *r = find_road(&world, 10);
+	TEST_CHECK(r != NULL && r->type == ROAD_PRIMARY && r->name != NULL && strcmp(r->name, "High Street") == 0);
+	TEST_CHECK(r != NULL && r->segments.length == 2 && r->segments.data[1].lat == 51.6);
+	TEST_CHECK((r = find_road(&world, 11)) != NULL && r->type == ROAD_PEDESTRIAN && r->name == NULL);
+	TEST_CHECK((r = find_road(&world, 12)) != NULL && r->type == ROAD_UNKNOWN);
+	TEST_CHECK((r = find_road(&world, 14)) != NULL && r->type == ROAD_RESIDENTIAL);
+	free_world(&world);
+
+	// listed values only, including one with no known type
+	struct tag_filter filter;
+	struct parse_options opts = { .filter = &filter };
+	TEST_CHECK(tag_filter_compile(" highway = primary, racetrack ; building=* ", &filter) == CRACKING);
+
+	memcpy(buf, filter_osm, sizeof(buf));
+	TEST_CHECK(parse_osm_from_buffer_opts(buf, sizeof(buf) - 1, &opts, &world) == CRACKING);
+	TEST_CHECK(world.roads.length == 2 && world.land_uses.length == 0);
+	TEST_CHECK((r = find_road(&world, 10)) != NULL && r->type == ROAD_PRIMARY);
+	TEST_CHECK((r = find_road(&world, 12)) != NULL && r->type == ROAD_UNKNOWN);
+	free_world(&world);
+	tag_filter_free(&filter);
+
+	// rules for one key accumulate, here read from a file
+	char path[] = "/tmp/osm_filter_XXXXXX";
+	int fd = mkstemp(path);
+	const char *rules = "# comment\nlanduse=forest\nlanduse=moon # unknown\n\nhighway=footway\n";
+	TEST_CHECK(fd >= 0 && write(fd, rules, strlen(rules)) == (ssize_t) strlen(rules));
+	close(fd);
+
+	char spec[sizeof(path) + 1];
+	sprintf(spec, "@%s", path);
+	TEST_CHECK(tag_filter_compile(spec, &filter) == CRACKING);
+
+	memcpy(buf, filter_osm, sizeof(buf));
+	TEST_CHECK(parse_osm_from_buffer_opts(buf, sizeof(buf) - 1, &opts, &world) == CRACKING);
+	TEST_CHECK(world.roads.length == 1 && world.roads.data[0].id == 11);
+	TEST_CHECK(world.land_uses.length == 2 && world.land_uses.data[1].type == LANDUSE_UNKNOWN);
+	free_world(&world);
+	tag_filter_free(&filter);
+	unlink(path);
+
+	TEST_CHECK(tag_filter_compile("amenity=pub", &filter) == ERR_FILTER);
+	TEST_CHECK(tag_filter_compile("highway=primary,,trunk", &filter) == ERR_FILTER);
+	TEST_CHECK(tag_filter_compile("@/nonexistent/filter", &filter) == ERR_FILE_NOT_FOUND);
+}
+
+#ifndef NO_COMPRESSION
+// one long road over n nodes, big enough to span many bzip2 blocks
+static char *generate_osm(int n, size_t *len) {
+	size_t cap = 256 + (size_t) n * 160;
+	char *buf = malloc(cap);
+	size_t off = sprintf(buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n");
+
+	for (int i = 1; i <= n; i++)
+		off += sprintf(buf + off, " <node id=\"%d\" lat=\"%d.%07d\" lon=\"%d.%07d\" version=\"1\"/>\n",
+				i, i % 80, (i * 7919) % 10000000, i % 170, (i * 104729) % 10000000);
+
+	off += sprintf(buf + off, " <way id=\"1\">\n");
+	for (int i = 1; i <= n; i++)
+		off += sprintf(buf + off, "  <nd ref=\"%d\"/>\n", i);
+	off += sprintf(buf + off, "  <tag k=\"highway\" v=\"primary\"/>\n </way>\n</osm>\n");
+
+	*len = off;
+	return buf;
+}
+
+static void write_bzip2(FILE *f, const char *buf, size_t len, int streams) {
+	// concatenated streams, like pbzip2 output
+	size_t per = len / streams;
+	for (int s = 0; s < streams; s++) {
+		int err;
+		BZFILE *bz = BZ2_bzWriteOpen(&err, f, 1, 0, 0);
+		size_t n = s == streams - 1 ? len - per * s : per;
+		BZ2_bzWrite(&err, bz, (void *) (buf + per * s), n);
+		BZ2_bzWriteClose(&err, bz, 0, NULL, NULL);
+	}
+}
+
+static void check_compressed_world(const char *path, int n) {
+	struct world w;
+	TEST_CHECK(parse_osm_from_file(path, &w) == CRACKING);
+	TEST_CHECK(w.roads.length == 1);
+	if (w.roads.length == 1) {
+		struct road r = w.roads.data[0];
+		TEST_CHECK(r.segments.length == n);
+		char lat[32];
+		sprintf(lat, "%d.%07d", n % 80, (n * 7919) % 10000000);
+		TEST_CHECK(r.segments.data[n - 1].lat == strtod(lat, NULL));
+	}
+	free_world(&w);
+}
+
+void test_compressed() {
+	const int n = 20000;
+	size_t len;
+	char *osm = generate_osm(n, &len);
+
+	char gz_path[] = "/tmp/osm_test_XXXXXX";
+	close(mkstemp(gz_path));
+	gzFile gz = gzopen(gz_path, "wb");
+	gzwrite(gz, osm, len);
+	gzclose(gz);
+	check_compressed_world(gz_path, n);
+	unlink(gz_path);
+
+	for (int streams = 1; streams <= 3; streams += 2) {
+		char bz_path[] = "/tmp/osm_test_XXXXXX";
+		FILE *f = fdopen(mkstemp(bz_path), "wb");
+		write_bzip2(f, osm, len, streams);
+		fclose(f);
+		check_compressed_world(bz_path, n);
+		unlink(bz_path);
+	}
+
+	free(osm);
+}
+#endif
+
+static const char stitch_osm[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n"
+	" <node id=\"1\" lat=\"50.01\" lon=\"0\"/>\n <node id=\"2\" lat=\"50.02\" lon=\"0\"/>\n"
+	" <node id=\"3\" lat=\"50.03\" lon=\"0\"/>\n <node id=\"4\" lat=\"50.04\" lon=\"0\"/>\n"
+	" <node id=\"5\" lat=\"50.05\" lon=\"0\"/>\n <node id=\"6\" lat=\"50.06\" lon=\"0\"/>\n"
+	" <node id=\"7\" lat=\"50.07\" lon=\"0\"/>\n <node id=\"8\" lat=\"50.08\" lon=\"0\"/>\n"
+	" <node id=\"9\" lat=\"50.09\" lon=\"0\"/>\n <node id=\"11\" lat=\"51\" lon=\"0\"/>\n"
+	" <node id=\"12\" lat=\"51\" lon=\"1\"/>\n <node id=\"13\" lat=\"52\" lon=\"1\"/>\n"
+	// one street split four ways, one of them drawn backwards
+	" <way id=\"10\">\n  <nd ref=\"2\"/>\n  <nd ref=\"3\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"A\"/>\n </way>\n"
+	" <way id=\"11\">\n  <nd ref=\"4\"/>\n  <nd ref=\"3\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"A\"/>\n </way>\n"
+	" <way id=\"12\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"A\"/>\n </way>\n"
+	" <way id=\"13\">\n  <nd ref=\"4\"/>\n  <nd ref=\"5\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"A\"/>\n </way>\n"
+	// another name, another type
+	" <way id=\"14\">\n  <nd ref=\"5\"/>\n  <nd ref=\"6\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"B\"/>\n </way>\n"
+	" <way id=\"15\">\n  <nd ref=\"5\"/>\n  <nd ref=\"6\"/>\n  <tag k=\"highway\" v=\"primary\"/>\n  <tag k=\"name\" v=\"A\"/>\n </way>\n"
+	// a fork, nothing meeting at 7 is joined
+	" <way id=\"16\">\n  <nd ref=\"6\"/>\n  <nd ref=\"7\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"C\"/>\n </way>\n"
+	" <way id=\"17\">\n  <nd ref=\"7\"/>\n  <nd ref=\"8\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"C\"/>\n </way>\n"
+	" <way id=\"18\">\n  <nd ref=\"7\"/>\n  <nd ref=\"9\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"C\"/>\n </way>\n"
+	// a ring
+	" <way id=\"20\">\n  <nd ref=\"11\"/>\n  <nd ref=\"12\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"D\"/>\n </way>\n"
+	" <way id=\"21\">\n  <nd ref=\"12\"/>\n  <nd ref=\"13\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"D\"/>\n </way>\n"
+	" <way id=\"22\">\n  <nd ref=\"13\"/>\n  <nd ref=\"11\"/>\n  <tag k=\"highway\" v=\"residential\"/>\n  <tag k=\"name\" v=\"D\"/>\n </way>\n"
+	"</osm>\n";
+
+void test_stitch_roads() {
+	char buf[sizeof(stitch_osm)];
+	memcpy(buf, stitch_osm, sizeof(buf));
+
+	struct world world;
+	TEST_CHECK(parse_osm_from_buffer(buf, sizeof(buf) - 1, &world) == CRACKING);
+	TEST_CHECK(world.roads.length == 12);
+
+	int joined;
+	TEST_CHECK(stitch_roads(&world, &joined) == CRACKING);
+	TEST_CHECK_(joined == 5, "joined %d", joined);
+	TEST_CHECK(world.roads.length == 7);
+
+	// keeps the first way's id and place, in order from node 1 to 5
+	struct road *a = &world.roads.data[0];
+	TEST_CHECK(a->id == 10);
+	TEST_CHECK(a->segments.length == 5);
+	for (int i = 0; i < a->segments.length; i++)
+		TEST_CHECK(fabs(a->segments.data[i].lat - (50.01 + i * 0.01)) < 1e-9);
+	TEST_CHECK(a->first_node == 1 && a->last_node == 5);
+
+	id ids[] = {12, 10, 11, 13};
+	TEST_CHECK(a->way_ids.length == 4);
+	for (int i = 0; i < 4 && i < a->way_ids.length; i++)
+		TEST_CHECK(a->way_ids.data[i] == ids[i]);
+
+	for (id i = 14; i <= 18; i++) {
+		struct road *r = find_road(&world, i);
+		TEST_CHECK(r != NULL && r->way_ids.length == 0 && r->segments.length == 2);
+	}
+
+	struct road *ring = find_road(&world, 20);
+	TEST_CHECK(ring != NULL && ring->segments.length == 4 && ring->way_ids.length == 3);
+	TEST_CHECK(ring != NULL && ring->first_node == ring->last_node);
+
+	// nothing left to do a second time
+	TEST_CHECK(stitch_roads(&world, &joined) == CRACKING);
+	TEST_CHECK(joined == 0 && world.roads.length == 7);
+	free_world(&world);
+}
+
+static double centre_gap(vec_point_t *a, vec_point_t *b) {
+	if (a->length == 0 || b->length == 0)
+		return 0;
+	return fabs(a->data[0].lat - b->data[0].lat) + fabs(a->data[0].lon - b->data[0].lon);
+}
+
+static double road_walk(struct world *w) {
+	double total = 0;
+	for (int i = 1; i < w->roads.length; i++)
+		total += centre_gap(&w->roads.data[i - 1].segments, &w->roads.data[i].segments);
+	return total;
+}
+
+static int compare_ids(const void *a, const void *b) {
+	id x = *(const id *) a, y = *(const id *) b;
+	return (x > y) - (x < y);
+}
+
+void test_hilbert_order() {
+	// the first level visits the quadrants as (0,0) (0,1) (1,1) (1,0)
+	uint32_t h = HILBERT_SIDE / 2;
+	TEST_CHECK(hilbert_key(0, 0) == 0);
+	TEST_CHECK(hilbert_key(0, h) / (h * h) == 1);
+	TEST_CHECK(hilbert_key(h, h) / (h * h) == 2);
+	TEST_CHECK(hilbert_key(h, 0) / (h * h) == 3);
+
+	// the corner 16x16 cells take the first 256 keys, each a step from the last
+	uint32_t xs[256], ys[256];
+	bool seen[256] = {0};
+	for (uint32_t x = 0; x < 16; x++) {
+		for (uint32_t y = 0; y < 16; y++) {
+			uint32_t k = hilbert_key(x, y);
+			TEST_CHECK(k < 256 && !seen[k]);
+			if (k < 256) {
+				seen[k] = true;
+				xs[k] = x;
+				ys[k] = y;
+			}
+		}
+	}
+	for (int k = 1; k < 256; k++)
+		TEST_CHECK(abs((int) xs[k] - (int) xs[k - 1]) + abs((int) ys[k] - (int) ys[k - 1]) == 1);
+
+	// stable and the same split over any number of threads
+	const size_t n = 300000;
+	struct sort_item *one = malloc(n * sizeof(struct sort_item));
+	struct sort_item *many = malloc(n * sizeof(struct sort_item));
+	uint64_t rng = 42;
+	for (size_t i = 0; i < n; i++) {
+		one[i].key = test_rand(&rng) % 5000;
+		one[i].index = i;
+	}
+	memcpy(many, one, n * sizeof(struct sort_item));
+	TEST_CHECK(radix_sort_items(one, n, 32, 1) == CRACKING);
+	TEST_CHECK(radix_sort_items(many, n, 32, 4) == CRACKING);
+	TEST_CHECK(memcmp(one, many, n * sizeof(struct sort_item)) == 0);
+	for (size_t i = 1; i < n; i++) {
+		if (one[i - 1].key > one[i].key || (one[i - 1].key == one[i].key && one[i - 1].index > one[i].index)) {
+			TEST_CHECK_(false, "out of order at %zu", i);
+			break;
+		}
+	}
+	free(one);
+	free(many);
+
+	// roads scattered in random order are only moved, ending up by their neighbours
+	struct world world;
+	init_world(&world);
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	for (int i = 0; i < 4000; i++) {
+		struct road r = { .id = i + 1 };
+		vec_init(&r.segments);
+		point pt = {51 + (test_rand(&rng) % 100000) / 1e5, -1 + (test_rand(&rng) % 100000) / 1e5};
+		vec_push(&r.segments, pt);
+		pt.lat += 0.001;
+		vec_push(&r.segments, pt);
+		vec_push(&world.roads, r);
+	}
+
+	int n_roads = world.roads.length;
+	id *ids = malloc(n_roads * sizeof(id));
+
+	double walk = road_walk(&world);
+	TEST_CHECK(sort_world_hilbert(&world, 2) == CRACKING);
+	TEST_CHECK_(road_walk(&world) * 4 < walk, "walk %f before %f", road_walk(&world), walk);
+
+	for (int i = 0; i < n_roads; i++)
+		ids[i] = world.roads.data[i].id;
+	qsort(ids, n_roads, sizeof(id), compare_ids);
+	for (int i = 0; i < n_roads; i++)
+		TEST_CHECK(ids[i] == i + 1);
+
+	free(ids);
+	free_world(&world);
+}
+
+void test_projection() {
+	// reference values of EPSG:3857
+	struct projector mercator, local;
+	projector_init(&mercator, PROJECT_MERCATOR, (point) {0, 0});
+	point known[] = {{0, 0}, {45, 180}, {-45, -90}};
+	project_points(&mercator, known, known, 3);
+	TEST_CHECK(fabs(known[0].lat) < 1e-9 && fabs(known[0].lon) < 1e-9);
+	TEST_CHECK(fabs(known[1].lon - 20037508.342789244) < 1e-6);
+	TEST_CHECK(fabs(known[1].lat - 5621521.486192066) < 1e-6);
+	TEST_CHECK(fabs(known[2].lat + 5621521.486192066) < 1e-6);
+	TEST_CHECK(fabs(known[2].lon + 10018754.171394622) < 1e-6);
+
+	// a hundredth of a degree either way of the tangent point
+	projector_init(&local, PROJECT_LOCAL, (point) {60, 10});
+	point near[] = {{60.01, 10.01}};
+	project_points(&local, near, near, 1);
+	TEST_CHECK(fabs(near[0].lat - 1113.1949) < 1e-3);
+	TEST_CHECK(fabs(near[0].lon - 556.5975) < 1e-3);
+
+	// the vector kernels give the same bits as the scalar ones, tails included
+	const size_t n = 1001;
+	point *in = malloc(n * sizeof(point));
+	point *scalar = malloc(n * sizeof(point));
+	point *vector = malloc(n * sizeof(point));
+	fixed_point *fixed_scalar = malloc(n * sizeof(fixed_point));
+	fixed_point *fixed_vector = malloc(n * sizeof(fixed_point));
+	uint64_t rng = 5;
+	for (size_t i = 0; i < n; i++) {
+		in[i].lat = (test_rand(&rng) % 1700000000) / 1e7 - 85;
+		in[i].lon = (test_rand(&rng) % 3600000000) / 1e7 - 180;
+	}
+
+	bool simd = simd_set(false);
+	project_points(&local, in, scalar, n);
+	quantize_points(scalar, fixed_scalar, n, 100);
+	simd_set(true);
+	project_points(&local, in, vector, n);
+	quantize_points(vector, fixed_vector, n, 100);
+	simd_set(simd);
+
+	TEST_CHECK(memcmp(scalar, vector, n * sizeof(point)) == 0);
+	TEST_CHECK(memcmp(fixed_scalar, fixed_vector, n * sizeof(fixed_point)) == 0);
+	TEST_CHECK(fixed_scalar[7].lat == (int32_t) lrint(scalar[7].lat * 100));
+
+	// mercator too, and its polynomials stay close to libm
+	simd_set(false);
+	project_points(&mercator, in, scalar, n);
+	simd_set(true);
+	project_points(&mercator, in, vector, n);
+	simd_set(simd);
+
+	TEST_CHECK(memcmp(scalar, vector, n * sizeof(point)) == 0);
+	double worst = 0;
+	for (size_t i = 0; i < n; i++)
+		worst = fmax(worst, fabs(scalar[i].lat - 6378137.0 * log(tan(M_PI / 4 + in[i].lat * M_PI / 360))));
+	TEST_CHECK_(worst < 1e-6, "mercator northing within %g m of libm", worst);
+	free(in);
+	free(scalar);
+	free(vector);
+	free(fixed_scalar);
+	free(fixed_vector);
+
+	// a world ends up in metres from its corner, with its size as bounds
+	size_t len;
+	char *osm = generate_random_osm(3, 2000, 300, &len);
+	struct world world;
+	TEST_CHECK(parse_osm_from_buffer(osm, len, &world) == CRACKING);
+	TEST_CHECK(world.roads.length > 0);
+	TEST_CHECK(project_world(&world, PROJECT_LOCAL, UINT32_MAX) == ERR_RANGE);
+	TEST_CHECK(world.projection == PROJECT_NONE);
+	TEST_CHECK(project_world(&world, PROJECT_LOCAL, 10) == CRACKING);
+	TEST_CHECK(world.projection == PROJECT_LOCAL && world.bounds_x > 0 && world.bounds_y > 0);
+
+	double min_x = INFINITY, min_y = INFINITY;
+	bool inside = true;
+	for (int i = 0; i < world.roads.length; i++) {
+		vec_point_t *v = &world.roads.data[i].segments;
+		for (int j = 0; j < v->length; j++) {
+			min_x = fmin(min_x, v->data[j].lon);
+			min_y = fmin(min_y, v->data[j].lat);
+			inside &= v->data[j].lon <= world.bounds_x && v->data[j].lat <= world.bounds_y;
+		}
+	}
+	TEST_CHECK(inside);
+	TEST_CHECK(min_x >= 0 && min_y >= 0);
+	free_world(&world);
+
+	// and goes back to where it was from its origin and tangent, both ways,
+	// the random nodes reaching past where mercator clamps
+	enum projection kinds[] = {PROJECT_LOCAL, PROJECT_MERCATOR};
+	for (int k = 0; k < 2; k++) {
+		struct world before;
+		TEST_CHECK(parse_osm_from_buffer(osm, len, &world) == CRACKING);
+		TEST_CHECK(parse_osm_from_buffer(osm, len, &before) == CRACKING);
+		TEST_CHECK(project_world(&world, kinds[k], 0) == CRACKING);
+		TEST_CHECK(world.projection == PROJECT_LOCAL ? world.tangent.lat != 0 : world.origin.lat != 0);
+
+		double worst = 0;
+		for (int i = 0; i < world.roads.length; i++) {
+			vec_point_t *v = &world.roads.data[i].segments;
+			unproject_points(&world, v->data, v->data, v->length);
+			for (int j = 0; j < v->length; j++) {
+				point was = before.roads.data[i].segments.data[j];
+				if (kinds[k] == PROJECT_MERCATOR)
+					was.lat = fmax(-85.051128779806604, fmin(85.051128779806604, was.lat));
+				worst = fmax(worst, fmax(fabs(v->data[j].lat - was.lat), fabs(v->data[j].lon - was.lon)));
+			}
+		}
+		TEST_CHECK_(worst < 1e-9, "%s back to lat/lon within %g degrees", kinds[k] == PROJECT_LOCAL ? "local" : "mercator", worst);
+		free_world(&before);
+		free_world(&world);
+	}
+	free(osm);
+}
+
+static int daemon_world(int n_ways, struct world *out) {
+	size_t len;
+	char *osm = generate_random_osm(9, 5000, n_ways, &len);
+	struct parse_options opts = { .resolution = RESOLVE_DEFERRED };
+	int ret = parse_osm_from_buffer_opts(osm, len, &opts, out);
+	free(osm);
+	return ret;
+}
+
+// the first load serves fewer ways than every one after it
+static int load_test_world(void *ctx, struct world *out) {
+	int *loads = ctx;
+	return daemon_world((*loads)++ == 0 ? 400 : 600, out);
+}
+
+static void *run_test_daemon(void *arg) {
+	static int ret;
+	ret = daemon_run(arg);
+	return &ret;
+}
+
+static bool query(int fd, enum query_op op, uint32_t tag, const void *body, uint32_t len,
+		struct frame_header *reply, void **out, size_t *cap) {
+	return daemon_send(fd, op, tag, body, len) == CRACKING
+		&& daemon_receive(fd, reply, out, cap) == CRACKING
+		&& reply->tag == tag;
+}
+
+static struct reply_info daemon_info(int fd) {
+	struct reply_info info = {0};
+	struct frame_header h;
+	void *body = NULL;
+	size_t cap = 0;
+	if (query(fd, QUERY_INFO, 1, NULL, 0, &h, &body, &cap) && h.op == REPLY_OK)
+		memcpy(&info, body, sizeof(info));
+	free(body);
+	return info;
+}
+
+void test_daemon() {
+	char path[64];
+	sprintf(path, "/tmp/osm_test_%d.sock", (int) getpid());
+
+	// the daemon thread inherits the mask, nothing else may take the signals
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	int loads = 0;
+	struct daemon_config cfg = { .socket_path = path, .threads = 2, .load = load_test_world, .load_ctx = &loads };
+	pthread_t thread;
+	pthread_create(&thread, NULL, run_test_daemon, &cfg);
+
+	int fd = -1;
+	for (int tries = 0; tries < 500 && daemon_connect(path, &fd) != CRACKING; tries++)
+		usleep(10000);
+	TEST_CHECK(fd >= 0);
+
+	// the same world, for checking answers against
+	struct world world;
+	TEST_CHECK(daemon_world(400, &world) == CRACKING);
+	struct reply_info info = daemon_info(fd);
+	TEST_CHECK(info.generation == 1);
+	TEST_CHECK(info.roads == (uint32_t) world.roads.length && info.land_uses == (uint32_t) world.land_uses.length);
+
+	struct frame_header h;
+	void *body = NULL;
+	size_t cap = 0;
+
+	struct road *road = &world.roads.data[world.roads.length / 2];
+	struct query_feature feature = { road->id };
+	TEST_CHECK(query(fd, QUERY_FEATURE, 2, &feature, sizeof(feature), &h, &body, &cap));
+	TEST_CHECK(h.op == REPLY_OK);
+	struct reply_feature found;
+	memcpy(&found, body, sizeof(found));
+	TEST_CHECK(found.id == road->id && found.kind == FEATURE_ROAD && found.points == (uint32_t) road->segments.length);
+	TEST_CHECK(found.name_len == strlen(road->name) && memcmp((char *) body + sizeof(found), road->name, found.name_len) == 0);
+
+	feature.id = -5;
+	TEST_CHECK(query(fd, QUERY_FEATURE, 3, &feature, sizeof(feature), &h, &body, &cap) && h.op == REPLY_NOT_FOUND);
+
+	// a point of a road is no distance from some road
+	struct query_nearest nearest = { road->segments.data[1].lat, road->segments.data[1].lon };
+	TEST_CHECK(query(fd, QUERY_NEAREST, 4, &nearest, sizeof(nearest), &h, &body, &cap) && h.op == REPLY_OK);
+	struct reply_nearest closest;
+	memcpy(&closest, body, sizeof(closest));
+	TEST_CHECK(closest.distance < 1e-6);
+
+	struct query_bbox all = { info.min_lat, info.min_lon, info.max_lat, info.max_lon, 0, 0 };
+	TEST_CHECK(query(fd, QUERY_BBOX, 5, &all, sizeof(all), &h, &body, &cap) && h.op == REPLY_OK);
+	uint32_t count;
+	memcpy(&count, body, sizeof(count));
+	TEST_CHECK(count == info.roads + info.land_uses);
+
+	// a pipelined burst gets every tag back once
+	const int burst = 200;
+	bool seen[200] = {0};
+	for (int i = 0; i < burst; i++)
+		TEST_CHECK(daemon_send(fd, QUERY_NEAREST, 1000 + i, &nearest, sizeof(nearest)) == CRACKING);
+	for (int i = 0; i < burst; i++) {
+		TEST_CHECK(daemon_receive(fd, &h, &body, &cap) == CRACKING);
+		if (h.tag >= 1000 && h.tag < 1000 + (uint32_t) burst)
+			seen[h.tag - 1000] = true;
+	}
+	bool all_seen = true;
+	for (int i = 0; i < burst; i++)
+		all_seen &= seen[i];
+	TEST_CHECK(all_seen);
+
+	// a reload swaps the world under a connection that stays open
+	kill(getpid(), SIGHUP);
+	for (int tries = 0; tries < 500 && info.generation != 2; tries++) {
+		usleep(10000);
+		info = daemon_info(fd);
+	}
+	TEST_CHECK(info.generation == 2);
+	TEST_CHECK(info.roads + info.land_uses > (uint32_t) (world.roads.length + world.land_uses.length));
+
+	close(fd);
+	kill(getpid(), SIGTERM);
+	void *ret;
+	pthread_join(thread, &ret);
+	TEST_CHECK(*(int *) ret == CRACKING);
+	TEST_CHECK(access(path, F_OK) != 0);
+
+	free(body);
+	free_world(&world);
+}
+
+// all inside tile 16/32768/21794. the grass ring goes round its outer
+// square then an inner one, which even-odd leaves as a hole
+static const char render_osm[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n"
+	" <node id=\"1\" lat=\"51.4995\" lon=\"0.001\"/>\n <node id=\"2\" lat=\"51.4995\" lon=\"0.003\"/>\n"
+	" <node id=\"3\" lat=\"51.5012\" lon=\"0.003\"/>\n <node id=\"4\" lat=\"51.5012\" lon=\"0.001\"/>\n"
+	" <node id=\"5\" lat=\"51.5006\" lon=\"0.0017\"/>\n <node id=\"6\" lat=\"51.5006\" lon=\"0.0023\"/>\n"
+	" <node id=\"7\" lat=\"51.5009\" lon=\"0.0023\"/>\n <node id=\"8\" lat=\"51.5009\" lon=\"0.0017\"/>\n"
+	" <node id=\"9\" lat=\"51.5\" lon=\"0.0005\"/>\n <node id=\"10\" lat=\"51.5\" lon=\"0.005\"/>\n"
+	" <way id=\"1\">\n  <nd ref=\"1\"/>\n  <nd ref=\"2\"/>\n  <nd ref=\"3\"/>\n  <nd ref=\"4\"/>\n  <nd ref=\"1\"/>\n"
+	"  <nd ref=\"5\"/>\n  <nd ref=\"6\"/>\n  <nd ref=\"7\"/>\n  <nd ref=\"8\"/>\n  <nd ref=\"5\"/>\n  <nd ref=\"1\"/>\n"
+	"  <tag k=\"landuse\" v=\"grass\"/>\n </way>\n"
+	" <way id=\"2\">\n  <nd ref=\"9\"/>\n  <nd ref=\"10\"/>\n  <tag k=\"highway\" v=\"motorway\"/>\n </way>\n"
+	"</osm>\n";
+
+static const uint8_t *tile_pixel(struct canvas *c, double lat, double lon) {
+	struct projector p;
+	projector_init(&p, PROJECT_MERCATOR, (point) {0, 0});
+	point m = {lat, lon};
+	project_points(&p, &m, &m, 1);
+
+	double half = 180 * p.scale_lon, pixels = 65536.0 * c->size;
+	int x = (int) floor((m.lon + half) / (2 * half) * pixels - 32768.0 * c->size);
+	int y = (int) floor((half - m.lat) / (2 * half) * pixels - 21794.0 * c->size);
+	TEST_CHECK(x >= 0 && x < c->size && y >= 0 && y < c->size);
+	return c->rgb + ((size_t) y * c->size + x) * 3;
+}
+
+static bool same_colour(const uint8_t *p, uint8_t r, uint8_t g, uint8_t b) {
+	return p[0] == r && p[1] == g && p[2] == b;
+}
+
+static bool read_whole(const char *path, char **out, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*out = malloc(*len + 1);
+	bool ok = fread(*out, 1, *len, f) == *len;
+	fclose(f);
+	return ok;
+}
+
+void test_render() {
+	struct tile_range range;
+	TEST_CHECK(tile_range_from_string("16", &range) && range.zoom == 16 && range.x1 < range.x0);
+	TEST_CHECK(tile_range_from_string("3/0-7/2-3", &range) && range.x1 == 7 && range.y0 == 2);
+	TEST_CHECK(tile_range_from_string("16/4/5", &range) && range.x0 == 4 && range.x1 == 4 && range.y1 == 5);
+	TEST_CHECK(!tile_range_from_string("3/0-8/0-0", &range));
+	TEST_CHECK(!tile_range_from_string("3/4-2/0-0", &range));
+	TEST_CHECK(!tile_range_from_string("25", &range));
+	TEST_CHECK(!tile_range_from_string("3/x", &range));
+
+	char buf[sizeof(render_osm)];
+	memcpy(buf, render_osm, sizeof(buf));
+	struct world world;
+	TEST_CHECK(parse_osm_from_buffer(buf, sizeof(buf) - 1, &world) == CRACKING);
+	TEST_CHECK(world.roads.length == 1 && world.land_uses.length == 1);
+
+	struct renderer r;
+	struct canvas c;
+	TEST_CHECK(renderer_init(&r, &world, RENDER_TILE_SIZE, 1) == CRACKING);
+	TEST_CHECK(canvas_init(&c, RENDER_TILE_SIZE) == CRACKING);
+
+	TEST_CHECK(render_world_range(&r, 16, &range));
+	TEST_CHECK(range.x0 == 32768 && range.x1 == 32768 && range.y0 == 21794 && range.y1 == 21794);
+
+	TEST_CHECK(render_tile(&r, &c, 16, 32768, 21794) == CRACKING);
+	TEST_CHECK(same_colour(tile_pixel(&c, 51.5003, 0.0012), 205, 235, 176));
+	TEST_CHECK(same_colour(tile_pixel(&c, 51.50075, 0.002), 242, 239, 233));
+	TEST_CHECK(same_colour(tile_pixel(&c, 51.5015, 0.0045), 242, 239, 233));
+
+	// the road goes over the grass, with soft edges
+	TEST_CHECK(same_colour(tile_pixel(&c, 51.5, 0.004), 232, 146, 162));
+	TEST_CHECK(same_colour(tile_pixel(&c, 51.5, 0.0015), 232, 146, 162));
+	int blended = 0;
+	for (int y = 130; y < 156; y++) {
+		const uint8_t *p = c.rgb + ((size_t) y * c.size + 186) * 3;
+		blended += !same_colour(p, 242, 239, 233) && !same_colour(p, 232, 146, 162);
+	}
+	TEST_CHECK_(blended >= 2, "%d blended", blended);
+
+	// a tile away from everything is left blank
+	TEST_CHECK(render_tile(&r, &c, 16, 32760, 21794) == CRACKING);
+	bool blank = true;
+	for (int i = 0; i < c.size * c.size; i++)
+		blank &= same_colour(c.rgb + i * 3, 242, 239, 233);
+	TEST_CHECK(blank);
+	TEST_CHECK(render_tile(&r, &c, 16, 65536, 0) == ERR_RANGE);
+
+	canvas_free(&c);
+	renderer_free(&r);
+
+	// any number of threads draws the same tiles
+	char dir_a[] = "/tmp/osm_tiles_XXXXXX";
+	char dir_b[] = "/tmp/osm_tiles_XXXXXX";
+	TEST_CHECK(mkdtemp(dir_a) != NULL && mkdtemp(dir_b) != NULL);
+	TEST_CHECK(tile_range_from_string("17/65535-65537/43587-43589", &range));
+	TEST_CHECK(render_tiles(&world, &range, dir_a, IMAGE_PPM, 1) == CRACKING);
+	TEST_CHECK(render_tiles(&world, &range, dir_b, IMAGE_PPM, 3) == CRACKING);
+
+	char path[128];
+	int differing = 0, drawn = 0;
+	for (uint32_t x = 65535; x <= 65537; x++) {
+		for (uint32_t y = 43587; y <= 43589; y++) {
+			char *a = NULL, *b = NULL;
+			size_t len_a = 0, len_b = 0;
+			sprintf(path, "%s/17/%u/%u.ppm", dir_a, x, y);
+			TEST_CHECK(read_whole(path, &a, &len_a));
+			remove(path);
+			sprintf(path, "%s/17/%u/%u.ppm", dir_b, x, y);
+			TEST_CHECK(read_whole(path, &b, &len_b));
+			remove(path);
+
+			differing += len_a != len_b || (a && b && memcmp(a, b, len_a) != 0);
+			drawn += a != NULL && len_a > 15 && strchr(a + 15, 146) != NULL;
+			free(a);
+			free(b);
+		}
+		sprintf(path, "%s/17/%u", dir_a, x);
+		rmdir(path);
+		sprintf(path, "%s/17/%u", dir_b, x);
+		rmdir(path);
+	}
+	TEST_CHECK(differing == 0);
+	TEST_CHECK_(drawn >= 2, "%d tiles with road", drawn);
+
+#ifndef NO_COMPRESSION
+	TEST_CHECK(tile_range_from_string("16", &range));
+	TEST_CHECK(render_tiles(&world, &range, dir_a, IMAGE_PNG, 2) == CRACKING);
+	char *png = NULL;
+	size_t png_len = 0;
+	sprintf(path, "%s/16/32768/21794.png", dir_a);
+	TEST_CHECK(read_whole(path, &png, &png_len));
+	TEST_CHECK(png_len > 8 && memcmp(png, "\x89PNG\r\n\x1a\n", 8) == 0);
+	free(png);
+	remove(path);
+	sprintf(path, "%s/16/32768", dir_a);
+	rmdir(path);
+	sprintf(path, "%s/16", dir_a);
+	rmdir(path);
+#endif
+
+	sprintf(path, "%s/17", dir_a);
+	rmdir(path);
+	sprintf(path, "%s/17", dir_b);
+	rmdir(path);
+	rmdir(dir_a);
+	rmdir(dir_b);
+	free_world(&world);
+}
+
+// n small buildings on a grid, each four nodes closed by the first again.
+// every 7th is a triangle left open, every 50th refers to a node that
+// isn't there, and the odd ones go round clockwise
+static char *generate_buildings(int n, size_t *len) {
+	char *buf = malloc(256 + (size_t) n * (4 * 64 + 5 * 24 + 96));
+	size_t off = sprintf(buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\">\n");
+
+	const double corners[4][2] = {{0, 0}, {0, 3}, {2, 3}, {2, 0}};
+	for (int b = 0; b < n; b++) {
+		for (int c = 0; c < 4; c++) {
+			off += sprintf(buf + off, " <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\"/>\n", b * 4 + c + 1,
+					51 + (b / 100) * 0.001 + corners[c][0] * 1e-4, -0.1 + (b % 100) * 0.001 + corners[c][1] * 1e-4);
+		}
+	}
+
+	for (int b = 0; b < n; b++) {
+		off += sprintf(buf + off, " <way id=\"%d\">\n", b + 1);
+		int refs = b % 7 == 0 ? 3 : 5;
+		for (int r = 0; r < refs; r++) {
+			int c = b % 2 ? (4 - r) % 4 : r % 4;
+			off += sprintf(buf + off, "  <nd ref=\"%d\"/>\n", b % 50 == 0 && r == 1 ? 999999999 : b * 4 + c + 1);
+		}
+		off += sprintf(buf + off, "  <tag k=\"building\" v=\"%s\"/>\n </way>\n", b % 3 ? "house" : "yes");
+	}
+
+	off += sprintf(buf + off, "</osm>\n");
+	*len = off;
+	return buf;
+}
+
+void test_buildings() {
+	const int n = 6000;
+	size_t len;
+	char *osm = generate_buildings(n, &len);
+	char *copy = malloc(len);
+
+	struct tag_filter filter;
+	TEST_CHECK(tag_filter_compile("building", &filter) == CRACKING);
+	struct parse_stats stats = {0};
+	struct parse_options opts = { .filter = &filter, .stats = &stats };
+	struct world worlds[3];
+	for (int mode = 0; mode < 3; mode++) {
+		opts.resolution = mode == 0 ? RESOLVE_IMMEDIATE : RESOLVE_DEFERRED;
+		opts.max_memory = mode == 2 ? 64 * 1024 : 0;
+		memcpy(copy, osm, len);
+		TEST_CHECK(parse_osm_from_buffer_opts(copy, len, &opts, &worlds[mode]) == CRACKING);
+	}
+	TEST_CHECK(worlds_equal(&worlds[0], &worlds[1]));
+	TEST_CHECK(worlds_equal(&worlds[0], &worlds[2]));
+	TEST_CHECK(stats.buildings[BUILDING_ACCOMODATION] == 3 * (uint64_t) (n - n / 3));
+	TEST_CHECK(stats.spilled_runs > 0);
+
+	// dangling ones dropped, the closing node never stored
+	struct buildings *b = &worlds[0].buildings;
+	TEST_CHECK(worlds[0].roads.length == 0 && b->length == n - n / 50 && b->measured);
+	double side_lat = 2e-4 * 6378137.0 * M_PI / 180;
+	int bad_rings = 0, bad_areas = 0, bad_centroids = 0;
+	for (int i = 0; i < b->length; i++) {
+		int w = (int) b->ids[i] - 1;
+		uint32_t ring = building_ring_length(b, i);
+		bad_rings += ring != (w % 7 == 0 ? 3u : 4u);
+		TEST_CHECK(b->types[i] == (w % 3 ? BUILDING_ACCOMODATION : BUILDING_UNKNOWN));
+
+		// counter clockwise whichever way it was drawn
+		const fixed_point *p = b->points + b->offsets[i];
+		int64_t cross = 0;
+		for (uint32_t j = 0; j < ring; j++) {
+			const fixed_point *q = &p[(j + 1) % ring];
+			cross += (int64_t) p[j].lon * q->lat - (int64_t) q->lon * p[j].lat;
+		}
+		bad_rings += cross <= 0;
+
+		double lat = 51 + (w / 100) * 0.001 + 1e-4;
+		double square = side_lat * side_lat * 1.5 * cos(lat * M_PI / 180);
+		double expect = ring == 3 ? square / 2 : square;
+		bad_areas += fabs(b->areas[i] - expect) > expect * 1e-3;
+		if (ring == 4) {
+			int32_t clat = (int32_t) lround(lat * 1e7);
+			int32_t clon = (int32_t) lround((-0.1 + (w % 100) * 0.001 + 1.5e-4) * 1e7);
+			bad_centroids += abs(b->centroids[i].lat - clat) > 1 || abs(b->centroids[i].lon - clon) > 1;
+		}
+	}
+	TEST_CHECK_(bad_rings == 0, "%d bad rings", bad_rings);
+	TEST_CHECK_(bad_areas == 0, "%d bad areas", bad_areas);
+	TEST_CHECK_(bad_centroids == 0, "%d bad centroids", bad_centroids);
+
+	// the same measurements over any number of threads
+	struct buildings one, many;
+	buildings_init(&one);
+	buildings_init(&many);
+	for (int i = 0; i < b->length; i++) {
+		TEST_CHECK(buildings_copy(&one, b, i) == CRACKING);
+		TEST_CHECK(buildings_copy(&many, b, i) == CRACKING);
+	}
+	TEST_CHECK(buildings_measure(&one, 1) == CRACKING && buildings_measure(&many, 4) == CRACKING);
+	TEST_CHECK(memcmp(one.areas, many.areas, b->length * sizeof(float)) == 0);
+	TEST_CHECK(memcmp(one.centroids, many.centroids, b->length * sizeof(fixed_point)) == 0);
+	TEST_CHECK(memcmp(one.points, b->points, b->n_points * sizeof(fixed_point)) == 0);
+	buildings_free(&one);
+	buildings_free(&many);
+
+	for (int mode = 0; mode < 3; mode++)
+		free_world(&worlds[mode]);
+	tag_filter_free(&filter);
+	free(copy);
+	free(osm);
+}
+
+static bool delta_is_empty(struct world *a, struct world *b, const char *path) {
+	struct diff_counts counts;
+	return diff_write(a, b, path, 1, &counts) == CRACKING
+		&& counts.removed == 0 && counts.changed == 0 && counts.added == 0;
+}
+
+void test_diff() {
+	// ways 1..3000 then 1001..4000 over the same nodes, the ones in both
+	// come out alike
+	size_t len;
+	char *osm = generate_region(11, 20000, 1, 20000, 1, 3000, &len);
+	struct world old, new, orig;
+	TEST_CHECK(parse_osm_from_buffer(osm, len, &old) == CRACKING);
+	free(osm);
+	osm = generate_region(11, 20000, 1, 20000, 1, 3000, &len);
+	TEST_CHECK(parse_osm_from_buffer(osm, len, &orig) == CRACKING);
+	free(osm);
+	osm = generate_region(11, 20000, 1, 20000, 1001, 4000, &len);
+	TEST_CHECK(parse_osm_from_buffer(osm, len, &new) == CRACKING);
+	free(osm);
+
+	uint32_t removed = 0, changed = 0, added = 0;
+	for (int i = 0; i < old.roads.length; i++)
+		removed += old.roads.data[i].id <= 1000;
+	for (int i = 0; i < old.land_uses.length; i++)
+		removed += old.land_uses.data[i].id <= 1000;
+
+	for (int i = 0; i < new.roads.length; i++) {
+		struct road *r = &new.roads.data[i];
+		if (r->id > 3000) {
+			added++;
+		} else if (r->id % 50 == 0) {
+			alloc_free(ALLOC_TAGS, r->name);
+			r->name = alloc_strdup(ALLOC_TAGS, "renamed");
+			changed++;
+		} else if (r->id % 50 == 1) {
+			r->segments.data[0].lat += 1e-6;
+			changed++;
+		} else if (r->id % 50 == 2) {
+			// under the grid it is hashed on
+			r->segments.data[0].lon += 1e-10;
+		}
+	}
+	for (int i = 0; i < new.land_uses.length; i++) {
+		struct land_use *l = &new.land_uses.data[i];
+		if (l->id > 3000) {
+			added++;
+		} else if (l->id % 30 == 0) {
+			l->type = LANDUSE_WATER;
+			changed++;
+		}
+	}
+	TEST_CHECK(removed > 0 && changed > 0 && added > 0);
+
+	// hashes don't depend on how many threads made them
+	int n = new.roads.length + new.land_uses.length;
+	uint64_t *one = malloc(n * sizeof(uint64_t)), *four = malloc(n * sizeof(uint64_t));
+	TEST_CHECK(diff_hash_world(&new, 1, one) == CRACKING);
+	TEST_CHECK(diff_hash_world(&new, 4, four) == CRACKING);
+	TEST_CHECK(memcmp(one, four, n * sizeof(uint64_t)) == 0);
+	free(one);
+	free(four);
+
+	char path[] = "/tmp/osm_diff_XXXXXX";
+	char back[] = "/tmp/osm_diff_XXXXXX";
+	close(mkstemp(path));
+	close(mkstemp(back));
+
+	struct diff_counts counts;
+	TEST_CHECK(diff_write(&old, &new, path, 4, &counts) == CRACKING);
+	TEST_CHECK_(counts.removed == removed && counts.changed == changed && counts.added == added,
+			"%u %u %u against %u %u %u", counts.removed, counts.changed, counts.added, removed, changed, added);
+
+	// applying it leaves nothing between the old world and the new
+	struct diff_index idx, check;
+	struct diff_counts applied;
+	TEST_CHECK(diff_index_build(&idx, &old, 2) == CRACKING);
+	TEST_CHECK(diff_apply(&old, &idx, path, &applied) == CRACKING);
+	TEST_CHECK(memcmp(&applied, &counts, sizeof(counts)) == 0);
+	TEST_CHECK(old.roads.length == new.roads.length && old.land_uses.length == new.land_uses.length);
+	TEST_CHECK(delta_is_empty(&old, &new, back));
+	TEST_CHECK(diff_index_build(&check, &new, 1) == CRACKING);
+	TEST_CHECK(idx.digest == check.digest && idx.used == check.used);
+	diff_index_free(&check);
+
+	// a second time it was made against another world, and changes nothing
+	TEST_CHECK(diff_apply(&old, &idx, path, NULL) == ERR_DIFF);
+	TEST_CHECK(old.roads.length == new.roads.length && delta_is_empty(&old, &new, back));
+
+	// the index kept up with the moves, so the way back goes through it too
+	TEST_CHECK(diff_write(&new, &orig, back, 1, &counts) == CRACKING);
+	TEST_CHECK(counts.removed == added && counts.added == removed && counts.changed == changed);
+	TEST_CHECK(diff_apply(&old, &idx, back, NULL) == CRACKING);
+	TEST_CHECK(delta_is_empty(&old, &orig, path));
+
+	// a cut short delta is turned away before anything moves
+	TEST_CHECK(diff_write(&orig, &new, path, 1, NULL) == CRACKING);
+	struct stat st;
+	TEST_CHECK(stat(path, &st) == 0 && truncate(path, st.st_size - 8) == 0);
+	TEST_CHECK(diff_apply(&old, &idx, path, NULL) == ERR_DIFF);
+	TEST_CHECK(delta_is_empty(&old, &orig, back));
+
+	// as is one claiming more features than it could hold
+	TEST_CHECK(diff_write(&orig, &new, path, 1, NULL) == CRACKING);
+	FILE *f = fopen(path, "r+b");
+	uint32_t huge = UINT32_MAX / 2;
+	TEST_CHECK(f != NULL && fseek(f, offsetof(struct diff_header, added), SEEK_SET) == 0);
+	TEST_CHECK(fwrite(&huge, sizeof(huge), 1, f) == 1 && fclose(f) == 0);
+	TEST_CHECK(diff_apply(&old, &idx, path, NULL) == ERR_DIFF);
+	TEST_CHECK(delta_is_empty(&old, &orig, back));
+
+	diff_index_free(&idx);
+	remove(path);
+	remove(back);
+	free_world(&old);
+	free_world(&new);
+	free_world(&orig);
+}
+
+#define WGS84_A (6378137.0)
+#define WGS84_E2 (0.00669437999014)
+
+// exact area between two parallels over dlon radians, by the authalic latitude
+static double band_area(double lat0, double lat1, double dlon) {
+	double e = sqrt(WGS84_E2), q[2], lat[2] = {lat0, lat1};
+	for (int i = 0; i < 2; i++) {
+		double s = sin(lat[i] * M_PI / 180);
+		q[i] = (1 - WGS84_E2) * (s / (1 - WGS84_E2 * s * s) - log((1 - e * s) / (1 + e * s)) / (2 * e));
+	}
+	return WGS84_A * WGS84_A / 2 * dlon * (q[1] - q[0]);
+}
+
+static double sum(const double *v, size_t n) {
+	double total = 0;
+	for (size_t i = 0; i < n; i++)
+		total += v[i];
+	return total;
+}
+
+static bool close_to(double a, double b, double rel) {
+	return fabs(a - b) <= rel * fmax(fabs(a), fabs(b));
+}
+
+void test_aggregate() {
+	// a degree along the equator is exactly a * pi / 180
+	point line[201];
+	double lengths[200];
+	for (int i = 0; i <= 100; i++)
+		line[i] = (point) {0, 10 + i * 0.01};
+	geodesic_segments(line, 101, lengths);
+	TEST_CHECK(close_to(sum(lengths, 100), WGS84_A * M_PI / 180, 1e-12));
+
+	// up a meridian, against the meridian arc integrated finely
+	double arc = 0;
+	for (int i = 0; i < 100000; i++) {
+		double s = sin((51 + (i + 0.5) * 1e-5) * M_PI / 180);
+		arc += WGS84_A * (1 - WGS84_E2) / pow(1 - WGS84_E2 * s * s, 1.5) * 1e-5 * M_PI / 180;
+	}
+	for (int i = 0; i <= 200; i++)
+		line[i] = (point) {51 + i * 0.005, -1.5};
+	geodesic_segments(line, 201, lengths);
+	TEST_CHECK_(close_to(sum(lengths, 200), arc, 1e-9), "%.6f against %.6f", sum(lengths, 200), arc);
+
+	// a cell of a tenth of a degree either way round, closed or not
+	point ring[5] = {{51, 0}, {51, 0.1}, {51.1, 0.1}, {51.1, 0}, {51, 0}}, back[5], scratch[5];
+	for (int i = 0; i < 5; i++)
+		back[i] = ring[4 - i];
+	double exact = band_area(51, 51.1, 0.1 * M_PI / 180);
+	TEST_CHECK_(close_to(geodesic_area(ring, 4, scratch), exact, 1e-6), "%.3f against %.3f",
+			geodesic_area(ring, 4, scratch), exact);
+	TEST_CHECK(geodesic_area(ring, 5, scratch) == geodesic_area(ring, 4, scratch));
+	TEST_CHECK(close_to(geodesic_area(back, 5, scratch), exact, 1e-6));
+	// across the antimeridian
+	point wrapped[4] = {{-10, 179.95}, {-10, -179.95}, {-9.9, -179.95}, {-9.9, 179.95}};
+	TEST_CHECK(close_to(geodesic_area(wrapped, 4, scratch), band_area(-10, -9.9, 0.1 * M_PI / 180), 1e-6));
+
+	// the avx2 kernels do the same sums
+	uint64_t rng = 99;
+	point random[203];
+	point scratch_a[203], scratch_b[203];
+	double a[202], b[202];
+	for (int i = 0; i < 203; i++)
+		random[i] = (point) {(test_rand(&rng) % 1700000) / 1e4 - 85, (test_rand(&rng) % 3600000) / 1e4 - 180};
+	bool simd = simd_set(false);
+	geodesic_segments(random, 203, a);
+	double area_a = geodesic_area(random, 203, scratch_a);
+	simd_set(true);
+	geodesic_segments(random, 203, b);
+	double area_b = geodesic_area(random, 203, scratch_b);
+	simd_set(simd);
+	TEST_CHECK(memcmp(a, b, sizeof(a)) == 0 && area_a == area_b);
+
+	// nine segments either side of a cell edge
+	struct world world;
+	init_world(&world);
+	struct road r = { .id = 1, .type = ROAD_PRIMARY };
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	for (int i = 0; i <= 18; i++) {
+		point pt = {0.05, 0.01 + i * 0.01};
+		vec_push(&r.segments, pt);
+	}
+	vec_push(&world.roads, r);
+	struct land_use l = { .id = 2, .type = LANDUSE_WATER };
+	for (int i = 0; i < 5; i++)
+		vec_push(&l.points, ring[i]);
+	vec_push(&world.land_uses, l);
+
+	struct agg_grid grid;
+	struct aggregate agg;
+	TEST_CHECK(!agg_grid_from_string("z99", &grid) && !agg_grid_from_string("0", &grid));
+	TEST_CHECK(agg_grid_from_string("0.1", &grid) && grid.kind == GRID_DEGREES);
+	TEST_CHECK(aggregate_world(&world, &grid, 1, &agg) == CRACKING);
+	TEST_CHECK(agg.n_cells == 3);
+	double segment = WGS84_A * M_PI / 180 * 0.01 * cos(0.05 * M_PI / 180);
+	if (agg.n_cells == 3) {
+		// sorted by y then x
+		TEST_CHECK(agg.y[0] == 900 && agg.x[0] == 1800 && agg.x[1] == 1801);
+		TEST_CHECK(close_to(agg.columns[ROAD_PRIMARY][0], 9 * segment, 1e-4));
+		TEST_CHECK(close_to(agg.columns[ROAD_PRIMARY][0], agg.columns[ROAD_PRIMARY][1], 1e-9));
+		TEST_CHECK(agg.y[2] == 1410 && agg.x[2] == 1800);
+		TEST_CHECK(close_to(agg.columns[ROAD_TYPE_COUNT + LANDUSE_WATER][2], exact, 1e-6));
+	}
+
+	char path[] = "/tmp/osm_agg_XXXXXX";
+	close(mkstemp(path));
+	TEST_CHECK(aggregate_write(&agg, path) == CRACKING);
+	struct agg_header h;
+	struct stat st;
+	FILE *f = fopen(path, "rb");
+	TEST_CHECK(f != NULL && fread(&h, sizeof(h), 1, f) == 1);
+	fclose(f);
+	TEST_CHECK(h.magic == AGG_MAGIC && h.n_cells == 3);
+	TEST_CHECK(h.columns == (1u << ROAD_PRIMARY | 1u << (ROAD_TYPE_COUNT + LANDUSE_WATER)));
+	TEST_CHECK(stat(path, &st) == 0 && st.st_size == (off_t) (sizeof(h) + 3 * 4 * 4));
+	remove(path);
+	aggregate_free(&agg);
+	free_world(&world);
+
+	// a road and a ring over the antimeridian count just west of -180,
+	// not at the lon 0 their plain averages would give
+	init_world(&world);
+	struct road across = { .id = 3, .type = ROAD_MINOR };
+	alloc_set_vec_tag(ALLOC_GEOMETRY);
+	vec_push(&across.segments, ((point) {10.5, 179.9}));
+	vec_push(&across.segments, ((point) {10.5, -179.7}));
+	vec_push(&world.roads, across);
+	struct land_use straddle = { .id = 4, .type = LANDUSE_GREEN };
+	point corners[] = {{20.2, 179.9}, {20.2, -179.7}, {20.4, -179.7}, {20.4, 179.9}};
+	for (int i = 0; i < 4; i++)
+		vec_push(&straddle.points, corners[i]);
+	vec_push(&world.land_uses, straddle);
+
+	TEST_CHECK(agg_grid_from_string("1", &grid));
+	TEST_CHECK(aggregate_world(&world, &grid, 1, &agg) == CRACKING);
+	TEST_CHECK(agg.n_cells == 2);
+	if (agg.n_cells == 2) {
+		// along the parallel, of radius a cos(lat) / sqrt(1 - e^2 sin^2 lat)
+		double s = sin(10.5 * M_PI / 180);
+		double length = WGS84_A * cos(10.5 * M_PI / 180) / sqrt(1 - WGS84_E2 * s * s) * 0.4 * M_PI / 180;
+		TEST_CHECK(agg.x[0] == 0 && agg.y[0] == 100 && close_to(agg.columns[ROAD_MINOR][0], length, 1e-9));
+		TEST_CHECK(agg.x[1] == 0 && agg.y[1] == 110);
+		TEST_CHECK(close_to(agg.columns[ROAD_TYPE_COUNT + LANDUSE_GREEN][1], band_area(20.2, 20.4, 0.4 * M_PI / 180), 1e-5));
+	}
+	aggregate_free(&agg);
+	free_world(&world);
+
+	// the same totals however the world is cut up and however many threads
+	size_t len;
+	char *osm = generate_random_osm(5, 20000, 3000, &len);
+	TEST_CHECK(parse_osm_from_buffer(osm, len, &world) == CRACKING);
+	free(osm);
+
+	double totals[AGG_COLUMNS] = {0};
+	point *pts = malloc(4096 * sizeof(point));
+	double *segs = malloc(4096 * sizeof(double));
+	for (int i = 0; i < world.roads.length; i++) {
+		struct road *rd = &world.roads.data[i];
+		geodesic_segments(rd->segments.data, rd->segments.length, segs);
+		totals[rd->type] += sum(segs, rd->segments.length - 1);
+	}
+	for (int i = 0; i < world.land_uses.length; i++) {
+		struct land_use *lu = &world.land_uses.data[i];
+		totals[ROAD_TYPE_COUNT + lu->type] += geodesic_area(lu->points.data, lu->points.length, pts);
+	}
+	free(pts);
+	free(segs);
+	TEST_CHECK(totals[ROAD_PRIMARY] > 0 && totals[ROAD_TYPE_COUNT + LANDUSE_GREEN] > 0);
+
+	const char *grids[] = {"z0", "z9", "1", "0.01"};
+	struct aggregate one, four;
+	for (int g = 0; g < 4; g++) {
+		TEST_CHECK(agg_grid_from_string(grids[g], &grid));
+		TEST_CHECK(aggregate_world(&world, &grid, 1, &one) == CRACKING);
+		TEST_CHECK(aggregate_world(&world, &grid, 4, &four) == CRACKING);
+		TEST_CHECK_(one.n_cells == four.n_cells && one.n_cells > 0, "%s: %u cells", grids[g], one.n_cells);
+		TEST_CHECK(memcmp(one.x, four.x, one.n_cells * sizeof(uint32_t)) == 0);
+		TEST_CHECK(memcmp(one.y, four.y, one.n_cells * sizeof(uint32_t)) == 0);
+		for (int k = 0; k < AGG_COLUMNS; k++) {
+			double s1 = sum(one.columns[k], one.n_cells), s4 = sum(four.columns[k], four.n_cells);
+			TEST_CHECK_(close_to(s1, totals[k], 1e-9) || (s1 == 0 && totals[k] == 0), "%s column %d", grids[g], k);
+			TEST_CHECK(close_to(s1, s4, 1e-9) || (s1 == 0 && s4 == 0));
+		}
+		aggregate_free(&one);
+		aggregate_free(&four);
+	}
+
+	// lat/lon only
+	world.projection = PROJECT_LOCAL;
+	TEST_CHECK(aggregate_world(&world, &grid, 1, &one) == ERR_UNSUPPORTED);
+	world.projection = PROJECT_NONE;
+	free_world(&world);
+}
+
+#ifndef NO_PROTOBUF
+void test_parallel_encode() {
+	// enough points for several chunks of each kind
+	struct world world;
+	init_world(&world);
+	world.bounds_x = 1234;
+	world.bounds_y = 5678;
+	uint64_t rng = 7;
+	char name[32];
+	for (int i = 0; i < 6000; i++) {
+		struct road r = { .id = i + 1, .type = i % 7 };
+		if (i % 3 == 0) {
+			sprintf(name, "Street %d", i);
+			r.name = alloc_strdup(ALLOC_TAGS, name);
+		}
+		alloc_set_vec_tag(ALLOC_GEOMETRY);
+		vec_init(&r.segments);
+		for (int j = 0; j < 40; j++) {
+			point pt = {51 + (test_rand(&rng) % 100000) / 1e5, -1 + (test_rand(&rng) % 100000) / 1e5};
+			vec_push(&r.segments, pt);
+		}
+		alloc_set_vec_tag(ALLOC_WAYS);
+		vec_init(&r.way_ids);
+		for (int j = 0; i % 5 == 0 && j < 3; j++)
+			vec_push(&r.way_ids, (id) (i * 10 + j));
+		alloc_set_vec_tag(ALLOC_GEOMETRY);
+		vec_push(&world.roads, r);
+	}
+	for (int i = 0; i < 2000; i++) {
+		struct land_use l = { .id = i + 1, .type = i % 7 };
+		vec_init(&l.points);
+		for (int j = 0; j < 50; j++) {
+			point pt = {51 + (test_rand(&rng) % 100000) / 1e5, -1 + (test_rand(&rng) % 100000) / 1e5};
+			vec_push(&l.points, pt);
+		}
+		vec_push(&world.land_uses, l);
+	}
+	for (int i = 0; i < 3000; i++) {
+		point ring[5];
+		for (int j = 0; j < 5; j++)
+			ring[j] = (point) {51 + (test_rand(&rng) % 100000) / 1e5, -1 + (test_rand(&rng) % 100000) / 1e5};
+		TEST_CHECK(buildings_add(&world.buildings, i + 1, i % BUILDING_TYPE_COUNT, ring, 5) == CRACKING);
+	}
+	TEST_CHECK(buildings_measure(&world.buildings, 2) == CRACKING);
+
+	char serial[] = "/tmp/osm_world_XXXXXX";
+	char parallel[] = "/tmp/osm_world_XXXXXX";
+	close(mkstemp(serial));
+	close(mkstemp(parallel));
+
+	char *a = NULL, *b = NULL;
+	size_t len_a = 0, len_b = 0;
+	TEST_CHECK(dump_to_file(&world, serial));
+	TEST_CHECK(read_whole(serial, &a, &len_a));
+	const int threads[] = {2, 3, 0};
+	for (size_t t = 0; t < sizeof(threads) / sizeof(*threads); t++) {
+		TEST_CHECK(dump_to_file_threads(&world, parallel, threads[t]));
+		TEST_CHECK(read_whole(parallel, &b, &len_b));
+		TEST_CHECK_(len_a == len_b && memcmp(a, b, len_a) == 0, "%d threads, %zu bytes against %zu",
+				threads[t], len_b, len_a);
+		free(b);
+		b = NULL;
+	}
+	TEST_CHECK(len_a > 8000 * 40 * 18 + 3000 * 20);
+
+	free(a);
+	remove(serial);
+	remove(parallel);
+	free_world(&world);
+}
+#endif
+
 TEST_LIST = {
 	{ "road discovery", test_roads },
+	{ "number parsing", test_numbers },
+	{ "deferred resolution", test_deferred_resolution },
+	{ "parser reuse", test_parser_reuse },
+	{ "memory budget", test_spill },
+	{ "parse stats", test_parse_stats },
+	{ "allocation accounting", test_alloc_accounting },
+	{ "multi file ingest", test_multi_file },
+	{ "tag filter", test_tag_filter },
+	{ "tag filter out of memory", test_tag_filter_oom },
+	{ "hilbert order", test_hilbert_order },
+	{ "road stitching", test_stitch_roads },
+	{ "projection", test_projection },
+	{ "query daemon", test_daemon },
+	{ "tile rendering", test_render },
+	{ "building store", test_buildings },
+	{ "world diff", test_diff },
+	{ "tile aggregates", test_aggregate },
+#ifndef NO_PROTOBUF
+	{ "parallel encoding", test_parallel_encode },
+#endif
+#ifndef NO_COMPRESSION
+	{ "compressed input", test_compressed },
+#endif
 	{ NULL, NULL }
 };